@@ -0,0 +1,645 @@
+#include "commands.h"
+
+#include <time.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/socket.h>
+
+/* Each measurement runs at least this long, the best of MICRO_REPEATS counts */
+#define MICRO_MIN_SECONDS       0.2
+#define MICRO_REPEATS           3
+
+#define MICRO_MAX_RESULTS       64
+#define MICRO_DEFAULT_THRESHOLD 10.0    /* Percent worse than baseline */
+
+typedef enum _MICRO_UNIT
+{
+    MICRO_NS_PER_OP,                    /* Lower is better */
+    MICRO_MB_PER_SEC                    /* Higher is better */
+} MICRO_UNIT;
+
+static const char *unitNames[] = { "ns/op", "MB/s" };
+
+/* Run ulIterations of something, return the nanoseconds it took */
+typedef double(*MICRO_FN)(
+    void                *lpContext,
+    unsigned long       ulIterations
+);
+
+typedef struct _MICRO_RESULT
+{
+    char                cpName[64];
+    double              dValue;
+    MICRO_UNIT          eUnit;
+} MICRO_RESULT, * PMICRO_RESULT;
+
+typedef struct _MICRO_DISPATCH
+{
+    PCONNECTION         conn;
+    const char          *cpCommand;
+} MICRO_DISPATCH, * PMICRO_DISPATCH;
+
+typedef struct _MICRO_LIST
+{
+    PCONNECTION         conn;
+    const char          *cpDir;
+} MICRO_LIST, * PMICRO_LIST;
+
+typedef struct _MICRO_FILE
+{
+    PCONNECTION         conn;
+    const char          *cpPath;
+    size_t              stSize;
+    HYPERFILE           data;
+} MICRO_FILE, * PMICRO_FILE;
+
+static MICRO_RESULT results[MICRO_MAX_RESULTS];
+static unsigned int uiResults = 0;
+static const char *cpFilter = NULL;
+static WORKER worker;
+
+static double
+micro_now(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Double the count until one run is long enough to trust, then keep the best run
+static void
+micro_run(
+    const char          *cpName,
+    MICRO_FN            fnBench,
+    void                *lpContext,
+    MICRO_UNIT          eUnit,
+    double              dBytesPerOp)
+{
+    unsigned long ulIterations = 1;
+    double dElapsed = 0;
+    double dBest = 0;
+    PMICRO_RESULT result = NULL;
+
+    if ((cpFilter && strstr(cpName, cpFilter) == NULL) || uiResults == MICRO_MAX_RESULTS)
+        return;
+
+    while ((dElapsed = fnBench(lpContext, ulIterations)) < MICRO_MIN_SECONDS * 1e9)
+        ulIterations *= 2;
+
+    dBest = dElapsed;
+    for (unsigned int i = 1; i < MICRO_REPEATS; i++)
+    {
+        dElapsed = fnBench(lpContext, ulIterations);
+        if (dElapsed < dBest)
+            dBest = dElapsed;
+    }
+
+    result = &results[uiResults++];
+    snprintf(result->cpName, sizeof(result->cpName), "%s", cpName);
+    result->eUnit = eUnit;
+    if (eUnit == MICRO_MB_PER_SEC)
+        result->dValue = dBytesPerOp * ulIterations / (dBest / 1e9) / 1e6;
+    else
+        result->dValue = dBest / ulIterations;
+
+    printf("%s\t%.2f\t%s\n", result->cpName, result->dValue, unitNames[eUnit]);
+    fflush(stdout);
+}
+
+static double
+micro_getargs(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    char cpCommand[MAX_INPUT_BUFFER];
+    size_t stArgsSize = 0;
+    char **args = NULL;
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+    {
+        strcpy(cpCommand, (const char*)lpContext);
+        stArgsSize = 0;
+        args = GetArgs(cpCommand, ' ', &stArgsSize);
+
+        for (size_t j = 0; j < stArgsSize; j++)
+            free(args[j]);
+        free(args);
+    }
+
+    return micro_now() - dStart;
+}
+
+static double
+micro_parse_args(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    char cpCommand[MAX_INPUT_BUFFER];
+    char *args[MAX_COMMAND_ARGS + 1];
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+    {
+        strcpy(cpCommand, (const char*)lpContext);
+        parse_args(cpCommand, args, MAX_COMMAND_ARGS);
+    }
+
+    return micro_now() - dStart;
+}
+
+// Whole command_handler path: tokenize, look up, run, record stats
+static double
+micro_dispatch(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    PMICRO_DISPATCH dispatch = (PMICRO_DISPATCH)lpContext;
+    char cpCommand[MAX_INPUT_BUFFER];
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+    {
+        strcpy(cpCommand, dispatch->cpCommand);
+        command_handler(dispatch->conn, cpCommand);
+        dispatch->conn->bClosing = 0;
+    }
+
+    return micro_now() - dStart;
+}
+
+// Format a synthetic listing of lpContext entries, buffer by buffer like the producer
+static double
+micro_format(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    unsigned long ulEntries = (unsigned long)(uintptr_t)lpContext;
+    char cpBuffer[PRODUCER_BUFFER_SIZE];
+    char cpName[32];
+    size_t stUsed = 0;
+    size_t stLength = 0;
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+    {
+        for (unsigned long ulEntry = 0; ulEntry < ulEntries; ulEntry++)
+        {
+            snprintf(cpName, sizeof(cpName), "entry-%07lu.dat", ulEntry);
+
+            stLength = list_format_entry(cpBuffer + stUsed, sizeof(cpBuffer) - stUsed,
+                    cpName, S_IFREG | 0644, (off_t)ulEntry);
+            if (stLength == 0)
+            {
+                stUsed = 0;
+                stLength = list_format_entry(cpBuffer, sizeof(cpBuffer), cpName, S_IFREG | 0644, (off_t)ulEntry);
+            }
+            stUsed += stLength;
+        }
+    }
+
+    return micro_now() - dStart;
+}
+
+static HYPERSTATUS
+micro_drain_output(
+    PCONNECTION         conn)
+{
+    while (conn->psHead)
+    {
+        if (conn_flush(conn) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// list_dir on a real directory, streamed through the socket to the drain thread
+static double
+micro_list_dir(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    PMICRO_LIST list = (PMICRO_LIST)lpContext;
+    const char *argv[] = { "LIST", list->cpDir };
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+    {
+        list_dir(list->conn, argv, 2);
+        if (micro_drain_output(list->conn) != HYPER_SUCCESS)
+            break;
+    }
+
+    return micro_now() - dStart;
+}
+
+static double
+micro_read_file(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    PMICRO_FILE file = (PMICRO_FILE)lpContext;
+    HYPERFILE data = NULL;
+    size_t stSize = 0;
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+    {
+        if (HyperReadFile(file->cpPath, &data, &stSize) != HYPER_SUCCESS)
+            break;
+        HyperMemFree(data);
+        data = NULL;
+    }
+
+    return micro_now() - dStart;
+}
+
+static double
+micro_send_file(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    PMICRO_FILE file = (PMICRO_FILE)lpContext;
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+    {
+        if (HyperSendFile(file->conn->sock, &file->data, (unsigned long)file->stSize) != HYPER_SUCCESS)
+            break;
+    }
+
+    return micro_now() - dStart;
+}
+
+static double
+micro_crc32c(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    PMICRO_FILE file = (PMICRO_FILE)lpContext;
+    volatile uint32_t uiCrc = 0;
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+        uiCrc = checksum_crc32c(0, file->data, file->stSize);
+
+    (void)uiCrc;
+    return micro_now() - dStart;
+}
+
+// The library's table-driven CRC, what checksum_crc32c falls back to
+static double
+micro_crc32c_portable(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    PMICRO_FILE file = (PMICRO_FILE)lpContext;
+    volatile uint32_t uiCrc = 0;
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+        uiCrc = HyperCrc32c(0, file->data, file->stSize);
+
+    (void)uiCrc;
+    return micro_now() - dStart;
+}
+
+static double
+micro_sha256(
+    void                *lpContext,
+    unsigned long       ulIterations)
+{
+    PMICRO_FILE file = (PMICRO_FILE)lpContext;
+    SHA256_CONTEXT context;
+    unsigned char ucDigest[SHA256_DIGEST_SIZE];
+    double dStart = micro_now();
+
+    for (unsigned long i = 0; i < ulIterations; i++)
+    {
+        checksum_sha256_init(&context);
+        checksum_sha256_update(&context, file->data, file->stSize);
+        checksum_sha256_final(&context, ucDigest);
+    }
+
+    return micro_now() - dStart;
+}
+
+// Reads and throws away everything the benchmarks write to the socketpair
+static void*
+micro_drain_main(
+    void                *lpParam)
+{
+    int fd = (int)(intptr_t)lpParam;
+    char cpBuffer[65536];
+
+    while (read(fd, cpBuffer, sizeof(cpBuffer)) > 0)
+        ;
+
+    return NULL;
+}
+
+static HYPERSTATUS
+micro_make_dir(
+    const char          *cpDir,
+    unsigned long       ulEntries)
+{
+    char cpName[32];
+    int dirFd = -1;
+    int fd = -1;
+
+    if (mkdir(cpDir, 0755) == -1 && errno != EEXIST)
+        return HYPER_FAILED;
+
+    dirFd = open(cpDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1)
+        return HYPER_FAILED;
+
+    for (unsigned long i = 0; i < ulEntries; i++)
+    {
+        snprintf(cpName, sizeof(cpName), "entry-%07lu.dat", i);
+        fd = openat(dirFd, cpName, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd == -1)
+            break;
+        close(fd);
+    }
+
+    close(dirFd);
+    return fd == -1 && ulEntries ? HYPER_FAILED : HYPER_SUCCESS;
+}
+
+static void
+micro_remove_dir(
+    const char          *cpDir,
+    unsigned long       ulEntries)
+{
+    char cpName[32];
+    int dirFd = open(cpDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (dirFd == -1)
+        return;
+
+    for (unsigned long i = 0; i < ulEntries; i++)
+    {
+        snprintf(cpName, sizeof(cpName), "entry-%07lu.dat", i);
+        unlinkat(dirFd, cpName, 0);
+    }
+
+    close(dirFd);
+    rmdir(cpDir);
+}
+
+static HYPERSTATUS
+micro_make_file(
+    const char          *cpPath,
+    size_t              stSize)
+{
+    HYPERFILE data = NULL;
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+
+    if (HyperMemAlloc(&data, stSize) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    memset(data, 'h', stSize);
+    hsResult = HyperWriteFile(cpPath, data, stSize);
+    HyperMemFree(data);
+
+    return hsResult;
+}
+
+static void
+micro_save(
+    const char          *cpPath)
+{
+    FILE *file = fopen(cpPath, "w");
+
+    if (file == NULL)
+    {
+        printf("[-] Couldn't write baseline %s: %s\n", cpPath, strerror(errno));
+        return;
+    }
+
+    for (unsigned int i = 0; i < uiResults; i++)
+        fprintf(file, "%s\t%.2f\t%s\n", results[i].cpName, results[i].dValue, unitNames[results[i].eUnit]);
+
+    fclose(file);
+}
+
+// Returns the number of results more than dThreshold percent worse than the baseline
+static int
+micro_compare(
+    const char          *cpPath,
+    double              dThreshold)
+{
+    FILE *file = fopen(cpPath, "r");
+    char cpName[64];
+    char cpUnit[16];
+    double dBaseline = 0;
+    double dChange = 0;
+    int iRegressions = 0;
+
+    if (file == NULL)
+    {
+        printf("[-] Couldn't read baseline %s: %s\n", cpPath, strerror(errno));
+        return -1;
+    }
+
+    printf("\nname\tcurrent\tbaseline\tchange%%\tverdict\n");
+    while (fscanf(file, "%63s %lf %15s", cpName, &dBaseline, cpUnit) == 3)
+    {
+        for (unsigned int i = 0; i < uiResults; i++)
+        {
+            if (strcmp(results[i].cpName, cpName) != 0 || dBaseline <= 0)
+                continue;
+
+            // Positive change is always an improvement, whatever the unit
+            dChange = (results[i].dValue - dBaseline) / dBaseline * 100;
+            if (results[i].eUnit == MICRO_NS_PER_OP)
+                dChange = -dChange;
+
+            printf("%s\t%.2f\t%.2f\t%+.1f\t%s\n", cpName, results[i].dValue, dBaseline, dChange,
+                    dChange < -dThreshold ? "REGRESSION" : "ok");
+            if (dChange < -dThreshold)
+                iRegressions++;
+        }
+    }
+
+    fclose(file);
+    return iRegressions;
+}
+
+static void
+micro_usage(void)
+{
+    puts("Usage: bench-micro [OPTIONS]\n"
+         "\n"
+         "Prints one \"name<TAB>value<TAB>unit\" line per benchmark.\n"
+         "\n"
+         "  -s, --save FILE        Write the results to FILE as a baseline\n"
+         "  -c, --compare FILE     Compare against a saved baseline, exit 1 on a\n"
+         "                         regression\n"
+         "  -t, --threshold PCT    Regression threshold (default 10)\n"
+         "  -f, --filter TEXT      Only run benchmarks whose name contains TEXT\n"
+         "  -L, --large            Also LIST a real directory of 1M entries");
+}
+
+int main(int argc, char **argv)
+{
+    static const char *commands[] = {
+        "SEND hosted/artifacts/build-1234.tar.gz 1048576 65536",
+        "LIST some/nested/directory"
+    };
+    static const unsigned long formatSizes[] = { 10, 10000, 1000000 };
+    static const size_t fileSizes[] = { 64 * 1024, 1024 * 1024, 64 * 1024 * 1024 };
+
+    MICRO_DISPATCH dispatch = {0};
+    MICRO_LIST list = {0};
+    MICRO_FILE file = {0};
+    unsigned long dirSizes[] = { 10, 10000, 1000000 };
+    unsigned int uiDirs = 2;
+    char cpTemp[] = "/tmp/hyper-micro.XXXXXX";
+    char cpName[64];
+    char cpPath[SERVER_MAX_PATH];
+    const char *cpSave = NULL;
+    const char *cpCompare = NULL;
+    double dThreshold = MICRO_DEFAULT_THRESHOLD;
+    int sockPair[2] = { -1, -1 };
+    pthread_t drainThread;
+    int iRegressions = 0;
+    int iOption = 0;
+
+    static const struct option longOptions[] = {
+        {"save", required_argument, NULL, 's'},
+        {"compare", required_argument, NULL, 'c'},
+        {"threshold", required_argument, NULL, 't'},
+        {"filter", required_argument, NULL, 'f'},
+        {"large", no_argument, NULL, 'L'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((iOption = getopt_long(argc, argv, "s:c:t:f:Lh", longOptions, NULL)) != -1)
+    {
+        switch (iOption)
+        {
+        case 's': cpSave = optarg; break;
+        case 'c': cpCompare = optarg; break;
+        case 't': dThreshold = strtod(optarg, NULL); break;
+        case 'f': cpFilter = optarg; break;
+        case 'L': uiDirs = 3; break;
+        default:
+            micro_usage();
+            return HYPER_FAILED;
+        }
+    }
+
+    if (command_table_init() != HYPER_SUCCESS || mkdtemp(cpTemp) == NULL || chdir(cpTemp) == -1)
+    {
+        puts("[-] Couldn't set up the benchmark");
+        return HYPER_FAILED;
+    }
+    snprintf(serverConfig.cpRoot, SERVER_MAX_PATH, "%s", cpTemp);
+
+    checksum_init();
+
+    // No caches, every LIST and SEND takes the full path
+    file_cache_init(&worker.fileCache, 0);
+    list_cache_init(&worker.listCache, 0);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockPair) == -1 ||
+        pthread_create(&drainThread, NULL, micro_drain_main, (void*)(intptr_t)sockPair[1]) != 0)
+    {
+        puts("[-] Couldn't start the drain thread");
+        return HYPER_FAILED;
+    }
+
+    list.conn = conn_create(&worker, sockPair[0]);
+    dispatch.conn = list.conn;
+    file.conn = list.conn;
+    if (list.conn == NULL)
+        return HYPER_FAILED;
+
+    for (unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        snprintf(cpName, sizeof(cpName), "parse.getargs.%s", i ? "list" : "send");
+        micro_run(cpName, micro_getargs, (void*)commands[i], MICRO_NS_PER_OP, 0);
+        snprintf(cpName, sizeof(cpName), "parse.parse_args.%s", i ? "list" : "send");
+        micro_run(cpName, micro_parse_args, (void*)commands[i], MICRO_NS_PER_OP, 0);
+    }
+
+    dispatch.cpCommand = "QUIT";
+    micro_run("dispatch.hit", micro_dispatch, &dispatch, MICRO_NS_PER_OP, 0);
+    dispatch.cpCommand = "NOPE unknown command";
+    micro_run("dispatch.miss", micro_dispatch, &dispatch, MICRO_NS_PER_OP, 0);
+
+    for (unsigned int i = 0; i < sizeof(formatSizes) / sizeof(formatSizes[0]); i++)
+    {
+        snprintf(cpName, sizeof(cpName), "list.format.%lu", formatSizes[i]);
+        micro_run(cpName, micro_format, (void*)(uintptr_t)formatSizes[i], MICRO_NS_PER_OP, 0);
+    }
+
+    for (unsigned int i = 0; i < uiDirs; i++)
+    {
+        snprintf(cpName, sizeof(cpName), "list.dir.%lu", dirSizes[i]);
+        if (cpFilter && strstr(cpName, cpFilter) == NULL)
+            continue;
+
+        snprintf(cpPath, sizeof(cpPath), "d%lu", dirSizes[i]);
+        if (micro_make_dir(cpPath, dirSizes[i]) == HYPER_SUCCESS)
+        {
+            list.cpDir = cpPath;
+            micro_run(cpName, micro_list_dir, &list, MICRO_NS_PER_OP, 0);
+        }
+        else
+            printf("[-] Couldn't create %lu entries for %s\n", dirSizes[i], cpName);
+        micro_remove_dir(cpPath, dirSizes[i]);
+    }
+
+    for (unsigned int i = 0; i < sizeof(fileSizes) / sizeof(fileSizes[0]); i++)
+    {
+        snprintf(cpPath, sizeof(cpPath), "f%zu", fileSizes[i]);
+        if (micro_make_file(cpPath, fileSizes[i]) != HYPER_SUCCESS)
+            continue;
+
+        file.cpPath = cpPath;
+        file.stSize = fileSizes[i];
+        snprintf(cpName, sizeof(cpName), "file.read.%zuK", fileSizes[i] / 1024);
+        micro_run(cpName, micro_read_file, &file, MICRO_MB_PER_SEC, fileSizes[i]);
+
+        if (HyperReadFile(cpPath, &file.data, &file.stSize) == HYPER_SUCCESS)
+        {
+            snprintf(cpName, sizeof(cpName), "file.send.%zuK", fileSizes[i] / 1024);
+            micro_run(cpName, micro_send_file, &file, MICRO_MB_PER_SEC, fileSizes[i]);
+            snprintf(cpName, sizeof(cpName), "checksum.crc32c.%zuK", fileSizes[i] / 1024);
+            micro_run(cpName, micro_crc32c, &file, MICRO_MB_PER_SEC, fileSizes[i]);
+            snprintf(cpName, sizeof(cpName), "checksum.crc32c_portable.%zuK", fileSizes[i] / 1024);
+            micro_run(cpName, micro_crc32c_portable, &file, MICRO_MB_PER_SEC, fileSizes[i]);
+            snprintf(cpName, sizeof(cpName), "checksum.sha256.%zuK", fileSizes[i] / 1024);
+            micro_run(cpName, micro_sha256, &file, MICRO_MB_PER_SEC, fileSizes[i]);
+            HyperMemFree(file.data);
+            file.data = NULL;
+        }
+
+        unlink(cpPath);
+    }
+
+    // Closes our end, the drain thread sees EOF
+    conn_destroy(list.conn);
+    pthread_join(drainThread, NULL);
+    close(sockPair[1]);
+
+    if (chdir("/") == 0)
+        rmdir(cpTemp);
+
+    if (cpSave)
+        micro_save(cpSave);
+
+    if (cpCompare)
+    {
+        iRegressions = micro_compare(cpCompare, dThreshold);
+        if (iRegressions)
+            return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#include "commands.h"
+
+#include <time.h>
+
+#define BENCH_ITERATIONS 2000000
+
+static const char *benchCommands[] = {
+    "SEND hosted/artifacts/build-1234.tar.gz 1048576 65536",
+    "LIST",
+    "LIST some/nested/directory",
+    "QUIT",
+    "NOPE unknown command"
+};
+#define BENCH_COMMAND_COUNT (sizeof(benchCommands) / sizeof(benchCommands[0]))
+
+static double
+bench_now(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// What command_handler used to do: GetArgs, then strcmp down command_list
+static PCOMMAND
+bench_legacy(
+    char                *cpCommand)
+{
+    PCOMMAND pFound = NULL;
+    size_t stArgsSize = 0;
+    char **args = GetArgs(cpCommand, ' ', &stArgsSize);
+
+    for (unsigned int i = 0; i < numCommands; i++)
+    {
+        if (strcmp(command_list[i].command, cpCommand) == 0)
+        {
+            pFound = &command_list[i];
+            break;
+        }
+    }
+
+    // The server leaked the tokens, free them here so the run stays bounded
+    for (size_t i = 0; i < stArgsSize; i++)
+        free(args[i]);
+    free(args);
+
+    return pFound;
+}
+
+static PCOMMAND
+bench_current(
+    char                *cpCommand)
+{
+    char *args[MAX_COMMAND_ARGS + 1];
+
+    if (parse_args(cpCommand, args, MAX_COMMAND_ARGS) == 0)
+        return NULL;
+
+    return command_lookup(args[0]);
+}
+
+static double
+bench_run(
+    PCOMMAND            (*fnParse)(char*),
+    unsigned long       *ulFound)
+{
+    char cpCommand[MAX_INPUT_BUFFER];
+    size_t stLength = 0;
+    double dStart = bench_now();
+
+    *ulFound = 0;
+
+    // Both paths tokenize destructively, so each iteration gets a fresh copy
+    for (unsigned long i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        const char *cpSource = benchCommands[i % BENCH_COMMAND_COUNT];
+        stLength = strlen(cpSource);
+        memcpy(cpCommand, cpSource, stLength + 1);
+
+        if (fnParse(cpCommand))
+            (*ulFound)++;
+    }
+
+    return (bench_now() - dStart) / BENCH_ITERATIONS;
+}
+
+int main(void)
+{
+    unsigned long ulLegacyFound = 0;
+    unsigned long ulCurrentFound = 0;
+    double dLegacy = 0;
+    double dCurrent = 0;
+
+    if (command_table_init() != HYPER_SUCCESS)
+    {
+        puts("[-] Couldn't build the command table");
+        return HYPER_FAILED;
+    }
+
+    dLegacy = bench_run(bench_legacy, &ulLegacyFound);
+    dCurrent = bench_run(bench_current, &ulCurrentFound);
+
+    if (ulLegacyFound != ulCurrentFound)
+    {
+        printf("[-] Paths disagree: %lu vs %lu commands found\n", ulLegacyFound, ulCurrentFound);
+        return HYPER_FAILED;
+    }
+
+    printf("GetArgs + strcmp dispatch      %8.1f ns/command\n", dLegacy);
+    printf("parse_args + hashed dispatch   %8.1f ns/command\n", dCurrent);
+    printf("speedup                        %8.1fx\n", dLegacy / dCurrent);
+
+    return HYPER_SUCCESS;
+}
@@ -0,0 +1,619 @@
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+
+#include <time.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <signal.h>
+
+#define LOAD_MAX_SIZES          16
+#define LOAD_FILES_PER_SIZE     16      /* Distinct files per size class */
+#define LOAD_MAX_PATH           512
+
+/* Fixture layout, relative to the server's hosted directory */
+#define LOAD_FIXTURE_ROOT       "loadgen"
+#define LOAD_DEFAULT_SIZES      "1K:60,16K:25,256K:10,4M:5"
+
+static const unsigned int listDirEntries[] = { 10, 100, 1000 };
+#define LOAD_LIST_DIRS  (sizeof(listDirEntries) / sizeof(listDirEntries[0]))
+
+typedef enum _LOAD_OP
+{
+    LOAD_OP_SEND,
+    LOAD_OP_LIST,
+    LOAD_OP_COUNT
+} LOAD_OP;
+
+static const char *opNames[LOAD_OP_COUNT] = { "SEND", "LIST" };
+
+typedef struct _LOAD_SIZE
+{
+    unsigned long long  ullSize;
+    unsigned int        uiWeight;
+    char                cpName[32];     /* As given on the command line */
+} LOAD_SIZE, * PLOAD_SIZE;
+
+/* Every latency of one kind of request, in nanoseconds */
+typedef struct _LOAD_SAMPLES
+{
+    unsigned long long  *ullValues;
+    size_t              stCount;
+    size_t              stCapacity;
+} LOAD_SAMPLES, * PLOAD_SAMPLES;
+
+typedef struct _LOAD_THREAD
+{
+    pthread_t           thread;
+    unsigned int        uiId;
+    unsigned long long  ullRandom;      /* xorshift64 state */
+
+    LOAD_SAMPLES        samples[LOAD_OP_COUNT];
+    unsigned long long  ullBytes;
+    unsigned long long  ullErrors;
+} LOAD_THREAD, * PLOAD_THREAD;
+
+typedef struct _LOAD_CONFIG
+{
+    const char          *cpHost;
+    unsigned short      usPort;
+    unsigned int        uiConnections;
+    unsigned int        uiDuration;
+    unsigned int        uiListPercent;
+    unsigned long long  ullSeed;
+
+    LOAD_SIZE           sizes[LOAD_MAX_SIZES];
+    unsigned int        uiSizes;
+    unsigned int        uiTotalWeight;
+} LOAD_CONFIG, * PLOAD_CONFIG;
+
+static LOAD_CONFIG loadConfig = {
+    .cpHost = "127.0.0.1",
+    .usPort = 9100,
+    .uiConnections = 8,
+    .uiDuration = 10,
+    .uiListPercent = 10,
+    .ullSeed = 1
+};
+
+static volatile int bStop = 0;
+
+static unsigned long long
+load_now(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long
+load_random(
+    unsigned long long  *ullState)
+{
+    *ullState ^= *ullState << 13;
+    *ullState ^= *ullState >> 7;
+    *ullState ^= *ullState << 17;
+    return *ullState;
+}
+
+// "4M" -> 4194304, 0 if it isn't a size
+static unsigned long long
+load_parse_size(
+    const char          *cpSize,
+    char                **cpEnd)
+{
+    unsigned long long ullSize = strtoull(cpSize, cpEnd, 10);
+
+    switch (**cpEnd)
+    {
+    case 'G': case 'g': ullSize <<= 10; /* fallthrough */
+    case 'M': case 'm': ullSize <<= 10; /* fallthrough */
+    case 'K': case 'k': ullSize <<= 10; (*cpEnd)++; break;
+    default: break;
+    }
+
+    return ullSize;
+}
+
+// size:weight,size:weight,...
+static HYPERSTATUS
+load_parse_sizes(
+    const char          *cpSpec)
+{
+    const char *cpItem = cpSpec;
+    char *cpEnd = NULL;
+    PLOAD_SIZE size = NULL;
+
+    loadConfig.uiSizes = 0;
+    loadConfig.uiTotalWeight = 0;
+
+    while (*cpItem)
+    {
+        if (loadConfig.uiSizes == LOAD_MAX_SIZES)
+            return HYPER_FAILED;
+
+        size = &loadConfig.sizes[loadConfig.uiSizes];
+        size->ullSize = load_parse_size(cpItem, &cpEnd);
+        if (cpEnd == cpItem || *cpEnd != ':' || (size_t)(cpEnd - cpItem) >= sizeof(size->cpName))
+            return HYPER_FAILED;
+
+        memcpy(size->cpName, cpItem, cpEnd - cpItem);
+        size->cpName[cpEnd - cpItem] = 0;
+
+        cpItem = cpEnd + 1;
+        size->uiWeight = (unsigned int)strtoul(cpItem, &cpEnd, 10);
+        if (cpEnd == cpItem || (*cpEnd != ',' && *cpEnd != 0))
+            return HYPER_FAILED;
+
+        loadConfig.uiTotalWeight += size->uiWeight;
+        loadConfig.uiSizes++;
+
+        cpItem = *cpEnd ? cpEnd + 1 : cpEnd;
+    }
+
+    return loadConfig.uiSizes && loadConfig.uiTotalWeight ? HYPER_SUCCESS : HYPER_FAILED;
+}
+
+static HYPERSTATUS
+load_make_dir(
+    const char          *cpPath)
+{
+    if (mkdir(cpPath, 0755) == -1 && errno != EEXIST)
+    {
+        printf("[-] Couldn't create %s: %s\n", cpPath, strerror(errno));
+        return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// Same bytes on every machine, so runs compare
+static HYPERSTATUS
+load_write_file(
+    const char          *cpPath,
+    unsigned long long  ullSize,
+    unsigned long long  ullSeed)
+{
+    unsigned long long block[1024];
+    unsigned long long ullWritten = 0;
+    size_t stChunk = 0;
+    FILE *file = fopen(cpPath, "wb");
+
+    if (file == NULL)
+    {
+        printf("[-] Couldn't create %s: %s\n", cpPath, strerror(errno));
+        return HYPER_FAILED;
+    }
+
+    ullSeed |= 1;
+    while (ullWritten < ullSize)
+    {
+        for (size_t i = 0; i < sizeof(block) / sizeof(block[0]); i++)
+            block[i] = load_random(&ullSeed);
+
+        stChunk = ullSize - ullWritten < sizeof(block) ? (size_t)(ullSize - ullWritten) : sizeof(block);
+        if (fwrite(block, 1, stChunk, file) != stChunk)
+            break;
+
+        ullWritten += stChunk;
+    }
+
+    if (fclose(file) != 0 || ullWritten != ullSize)
+    {
+        printf("[-] Couldn't write %s\n", cpPath);
+        return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// <dir>/loadgen/<size>/<n> for every size class, plus directories to LIST
+static HYPERSTATUS
+load_fixture(
+    const char          *cpDir)
+{
+    char cpPath[LOAD_MAX_PATH];
+
+    snprintf(cpPath, sizeof(cpPath), "%s/%s", cpDir, LOAD_FIXTURE_ROOT);
+    if (load_make_dir(cpPath) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    for (unsigned int i = 0; i < loadConfig.uiSizes; i++)
+    {
+        snprintf(cpPath, sizeof(cpPath), "%s/%s/%s", cpDir, LOAD_FIXTURE_ROOT, loadConfig.sizes[i].cpName);
+        if (load_make_dir(cpPath) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+
+        for (unsigned int uiFile = 0; uiFile < LOAD_FILES_PER_SIZE; uiFile++)
+        {
+            snprintf(cpPath, sizeof(cpPath), "%s/%s/%s/%u", cpDir, LOAD_FIXTURE_ROOT,
+                    loadConfig.sizes[i].cpName, uiFile);
+            if (load_write_file(cpPath, loadConfig.sizes[i].ullSize, (i + 1) * 1000003ULL + uiFile) != HYPER_SUCCESS)
+                return HYPER_FAILED;
+        }
+    }
+
+    snprintf(cpPath, sizeof(cpPath), "%s/%s/dirs", cpDir, LOAD_FIXTURE_ROOT);
+    if (load_make_dir(cpPath) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    for (unsigned int i = 0; i < LOAD_LIST_DIRS; i++)
+    {
+        snprintf(cpPath, sizeof(cpPath), "%s/%s/dirs/%u", cpDir, LOAD_FIXTURE_ROOT, listDirEntries[i]);
+        if (load_make_dir(cpPath) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+
+        for (unsigned int uiEntry = 0; uiEntry < listDirEntries[i]; uiEntry++)
+        {
+            snprintf(cpPath, sizeof(cpPath), "%s/%s/dirs/%u/entry-%05u", cpDir, LOAD_FIXTURE_ROOT,
+                    listDirEntries[i], uiEntry);
+            if (load_write_file(cpPath, uiEntry % 64, uiEntry) != HYPER_SUCCESS)
+                return HYPER_FAILED;
+        }
+    }
+
+    printf("[+] Fixture ready under %s/%s\n", cpDir, LOAD_FIXTURE_ROOT);
+    return HYPER_SUCCESS;
+}
+
+static HYPERSTATUS
+load_record(
+    PLOAD_SAMPLES       samples,
+    unsigned long long  ullNanoseconds)
+{
+    size_t stCapacity = 0;
+
+    if (samples->stCount == samples->stCapacity)
+    {
+        stCapacity = samples->stCapacity ? samples->stCapacity * 2 : 4096;
+        if (HyperMemRealloc((void**)&samples->ullValues, stCapacity * sizeof(unsigned long long)) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+        samples->stCapacity = stCapacity;
+    }
+
+    samples->ullValues[samples->stCount++] = ullNanoseconds;
+    return HYPER_SUCCESS;
+}
+
+static HYPERSTATUS
+load_discard(
+    const void          *lpBlock,
+    size_t              stLength,
+    void                *lpContext)
+{
+    return HYPER_SUCCESS;
+}
+
+// SEND over the legacy protocol, the way existing clients fetch files
+static HYPERSTATUS
+load_send(
+    SOCKET              sock,
+    PLOAD_THREAD        thread,
+    unsigned long long  *ullBytes)
+{
+    unsigned long long ullPick = load_random(&thread->ullRandom) % loadConfig.uiTotalWeight;
+    unsigned int uiSize = 0;
+    unsigned short usStatus = 0;
+    unsigned long ulSize = 0;
+    HYPERFILE data = NULL;
+    char cpCommand[MAX_COMMAND_LENGTH];
+
+    while (ullPick >= loadConfig.sizes[uiSize].uiWeight)
+        ullPick -= loadConfig.sizes[uiSize++].uiWeight;
+
+    snprintf(cpCommand, sizeof(cpCommand), "SEND %s/%s/%u", LOAD_FIXTURE_ROOT, loadConfig.sizes[uiSize].cpName,
+            (unsigned int)(load_random(&thread->ullRandom) % LOAD_FILES_PER_SIZE));
+
+    if (HyperSendCommand(sock, cpCommand) != HYPER_SUCCESS ||
+        HyperReceiveStatus(sock, &usStatus) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (usStatus != 200)
+        return HYPER_BAD_PARAMETER;
+
+    if (HyperReceiveFile(sock, &data, &ulSize) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    HyperMemFree(data);
+    *ullBytes = ulSize;
+
+    return HYPER_SUCCESS;
+}
+
+// LIST needs framing, a text mode listing has no length to stop at
+static HYPERSTATUS
+load_list(
+    SOCKET              sock,
+    PLOAD_THREAD        thread,
+    unsigned long long  *ullBytes)
+{
+    HYPER_FRAME frame = {0};
+    char cpCommand[MAX_COMMAND_LENGTH];
+    int iLength = 0;
+
+    iLength = snprintf(cpCommand, sizeof(cpCommand), "LIST %s/dirs/%u", LOAD_FIXTURE_ROOT,
+            listDirEntries[load_random(&thread->ullRandom) % LOAD_LIST_DIRS]);
+
+    if (HyperSendFrame(sock, HYPER_FRAME_COMMAND, 0, 0, cpCommand, iLength) != HYPER_SUCCESS ||
+        HyperReceiveFrame(sock, &frame) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (frame.usStatus != 200)
+        return frame.ullLength == 0 ? HYPER_BAD_PARAMETER : HYPER_FAILED;
+
+    *ullBytes = 0;
+    while (1)
+    {
+        if (HyperReceiveStream(sock, frame.ullLength, load_discard, NULL, 0, NULL) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+        *ullBytes += frame.ullLength;
+
+        // Chunked bodies end with an empty DATA frame
+        if (!(frame.ucFlags & HYPER_FRAME_FLAG_CHUNKED) && frame.ucType == HYPER_FRAME_RESPONSE)
+            break;
+        if (frame.ucType == HYPER_FRAME_DATA && frame.ullLength == 0)
+            break;
+
+        if (HyperReceiveFrame(sock, &frame) != HYPER_SUCCESS || frame.ucType != HYPER_FRAME_DATA)
+            return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// One closed loop per thread: a request, its whole response, the next request
+static void*
+load_thread_main(
+    void                *lpParam)
+{
+    PLOAD_THREAD thread = (PLOAD_THREAD)lpParam;
+    SOCKET sockSend = INVALID_SOCKET;
+    SOCKET sockList = INVALID_SOCKET;
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    unsigned long long ullStart = 0;
+    unsigned long long ullBytes = 0;
+    LOAD_OP eOp = LOAD_OP_SEND;
+
+    if (HyperConnectServer(&sockSend, loadConfig.cpHost, loadConfig.usPort) != HYPER_SUCCESS)
+    {
+        printf("[-] Client %u couldn't connect\n", thread->uiId);
+        thread->ullErrors++;
+        return NULL;
+    }
+
+    if (loadConfig.uiListPercent &&
+        (HyperConnectServer(&sockList, loadConfig.cpHost, loadConfig.usPort) != HYPER_SUCCESS ||
+         HyperNegotiateFraming(sockList) != HYPER_SUCCESS))
+    {
+        printf("[-] Client %u couldn't open a framed connection for LIST\n", thread->uiId);
+        thread->ullErrors++;
+        HyperCloseSocket(sockSend);
+        return NULL;
+    }
+
+    while (!bStop)
+    {
+        eOp = load_random(&thread->ullRandom) % 100 < loadConfig.uiListPercent ? LOAD_OP_LIST : LOAD_OP_SEND;
+        ullBytes = 0;
+
+        ullStart = load_now();
+        if (eOp == LOAD_OP_LIST)
+            hsResult = load_list(sockList, thread, &ullBytes);
+        else
+            hsResult = load_send(sockSend, thread, &ullBytes);
+
+        // A failed request leaves the stream out of sync, stop this client
+        if (hsResult != HYPER_SUCCESS)
+        {
+            thread->ullErrors++;
+            if (hsResult == HYPER_FAILED)
+                break;
+            continue;
+        }
+
+        if (load_record(&thread->samples[eOp], load_now() - ullStart) != HYPER_SUCCESS)
+            break;
+        thread->ullBytes += ullBytes;
+    }
+
+    HyperCloseSocket(sockSend);
+    if (sockList != INVALID_SOCKET)
+        HyperCloseSocket(sockList);
+
+    return NULL;
+}
+
+static int
+load_compare(
+    const void          *lpLeft,
+    const void          *lpRight)
+{
+    unsigned long long ullLeft = *(const unsigned long long*)lpLeft;
+    unsigned long long ullRight = *(const unsigned long long*)lpRight;
+
+    return (ullLeft > ullRight) - (ullLeft < ullRight);
+}
+
+// Nearest rank on sorted samples, in microseconds
+static double
+load_percentile(
+    PLOAD_SAMPLES       samples,
+    double              dPercentile)
+{
+    size_t stRank = 0;
+
+    if (samples->stCount == 0)
+        return 0;
+
+    stRank = (size_t)(dPercentile / 100.0 * samples->stCount + 0.999999);
+    if (stRank == 0)
+        stRank = 1;
+    if (stRank > samples->stCount)
+        stRank = samples->stCount;
+
+    return samples->ullValues[stRank - 1] / 1e3;
+}
+
+static void
+load_report_line(
+    const char          *cpName,
+    PLOAD_SAMPLES       samples,
+    double              dSeconds)
+{
+    qsort(samples->ullValues, samples->stCount, sizeof(unsigned long long), load_compare);
+
+    printf("%-6s %10zu %12.1f %10.1f %10.1f %10.1f %10.1f\n", cpName, samples->stCount,
+            samples->stCount / dSeconds, load_percentile(samples, 50), load_percentile(samples, 99),
+            load_percentile(samples, 99.9), load_percentile(samples, 100));
+}
+
+static HYPERSTATUS
+load_merge(
+    PLOAD_SAMPLES       total,
+    PLOAD_SAMPLES       samples)
+{
+    for (size_t i = 0; i < samples->stCount; i++)
+    {
+        if (load_record(total, samples->ullValues[i]) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+static void
+usage(void)
+{
+    puts("Usage: loadgen [OPTIONS]\n"
+         "\n"
+         "  -H, --host ADDR        Server address (default 127.0.0.1)\n"
+         "  -p, --port N           Server port (default 9100)\n"
+         "  -c, --connections N    Concurrent clients, one thread each (default 8)\n"
+         "  -d, --duration S       Seconds to run for (default 10)\n"
+         "  -l, --list-percent N   Share of requests that are LIST (default 10)\n"
+         "  -s, --sizes SPEC       SEND size mix as size:weight,... with K/M/G\n"
+         "                         suffixes (default " LOAD_DEFAULT_SIZES ")\n"
+         "  -r, --seed N           Seed for the request sequence (default 1)\n"
+         "  -f, --fixture DIR      Create the files and directories the run asks\n"
+         "                         for under DIR, the server's hosted directory,\n"
+         "                         then exit; use the same --sizes as the run");
+}
+
+int main(int argc, char **argv)
+{
+    PLOAD_THREAD threads = NULL;
+    LOAD_SAMPLES total[LOAD_OP_COUNT];
+    LOAD_SAMPLES all = {0};
+    unsigned long long ullBytes = 0;
+    unsigned long long ullErrors = 0;
+    unsigned long long ullStart = 0;
+    const char *cpFixture = NULL;
+    double dSeconds = 0;
+    int iOption = 0;
+
+    static const struct option longOptions[] = {
+        {"host", required_argument, NULL, 'H'},
+        {"port", required_argument, NULL, 'p'},
+        {"connections", required_argument, NULL, 'c'},
+        {"duration", required_argument, NULL, 'd'},
+        {"list-percent", required_argument, NULL, 'l'},
+        {"sizes", required_argument, NULL, 's'},
+        {"seed", required_argument, NULL, 'r'},
+        {"fixture", required_argument, NULL, 'f'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    memset(total, 0, sizeof(total));
+    load_parse_sizes(LOAD_DEFAULT_SIZES);
+
+    while ((iOption = getopt_long(argc, argv, "H:p:c:d:l:s:r:f:h", longOptions, NULL)) != -1)
+    {
+        switch (iOption)
+        {
+        case 'H': loadConfig.cpHost = optarg; break;
+        case 'p': loadConfig.usPort = (unsigned short)strtoul(optarg, NULL, 0); break;
+        case 'c': loadConfig.uiConnections = (unsigned int)strtoul(optarg, NULL, 0); break;
+        case 'd': loadConfig.uiDuration = (unsigned int)strtoul(optarg, NULL, 0); break;
+        case 'l': loadConfig.uiListPercent = (unsigned int)strtoul(optarg, NULL, 0); break;
+        case 'r': loadConfig.ullSeed = strtoull(optarg, NULL, 0); break;
+        case 'f': cpFixture = optarg; break;
+        case 's':
+            if (load_parse_sizes(optarg) != HYPER_SUCCESS)
+            {
+                printf("[-] Bad size mix %s\n", optarg);
+                return HYPER_FAILED;
+            }
+            break;
+        default:
+            usage();
+            return HYPER_FAILED;
+        }
+    }
+
+    if (cpFixture)
+        return load_fixture(cpFixture);
+
+    if (loadConfig.uiConnections == 0 || loadConfig.uiDuration == 0 || loadConfig.uiListPercent > 100)
+    {
+        usage();
+        return HYPER_FAILED;
+    }
+
+    if (HyperNetworkInit() != HYPER_SUCCESS ||
+        HyperMemAlloc((void**)&threads, sizeof(LOAD_THREAD) * loadConfig.uiConnections) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    memset(threads, 0, sizeof(LOAD_THREAD) * loadConfig.uiConnections);
+
+    // Sudden disconnects show up as errors, not a dead benchmark
+    signal(SIGPIPE, SIG_IGN);
+
+    ullStart = load_now();
+    for (unsigned int i = 0; i < loadConfig.uiConnections; i++)
+    {
+        threads[i].uiId = i;
+        threads[i].ullRandom = (loadConfig.ullSeed + i + 1) * 0x9e3779b97f4a7c15ULL;
+        if (pthread_create(&threads[i].thread, NULL, load_thread_main, &threads[i]) != 0)
+        {
+            printf("[-] Couldn't start client %u\n", i);
+            return HYPER_FAILED;
+        }
+    }
+
+    sleep(loadConfig.uiDuration);
+    bStop = 1;
+
+    for (unsigned int i = 0; i < loadConfig.uiConnections; i++)
+        pthread_join(threads[i].thread, NULL);
+    dSeconds = (load_now() - ullStart) / 1e9;
+
+    for (unsigned int i = 0; i < loadConfig.uiConnections; i++)
+    {
+        ullBytes += threads[i].ullBytes;
+        ullErrors += threads[i].ullErrors;
+        for (unsigned int uiOp = 0; uiOp < LOAD_OP_COUNT; uiOp++)
+        {
+            load_merge(&total[uiOp], &threads[i].samples[uiOp]);
+            load_merge(&all, &threads[i].samples[uiOp]);
+            HyperMemFree(threads[i].samples[uiOp].ullValues);
+        }
+    }
+
+    printf("%u connections, %.2fs, %.1f%% LIST\n\n", loadConfig.uiConnections, dSeconds,
+            all.stCount ? 100.0 * total[LOAD_OP_LIST].stCount / all.stCount : 0.0);
+    printf("%-6s %10s %12s %10s %10s %10s %10s\n", "op", "requests", "req/s", "p50 us", "p99 us", "p99.9 us", "max us");
+    for (unsigned int uiOp = 0; uiOp < LOAD_OP_COUNT; uiOp++)
+    {
+        if (total[uiOp].stCount)
+            load_report_line(opNames[uiOp], &total[uiOp], dSeconds);
+        HyperMemFree(total[uiOp].ullValues);
+    }
+    load_report_line("all", &all, dSeconds);
+    HyperMemFree(all.ullValues);
+
+    printf("\n%.2f MB/s, %llu errors\n", ullBytes / dSeconds / 1e6, ullErrors);
+
+    HyperMemFree(threads);
+    HyperSocketCleanup();
+
+    return ullErrors ? HYPER_FAILED : HYPER_SUCCESS;
+}
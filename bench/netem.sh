@@ -0,0 +1,73 @@
+#!/bin/sh
+# Bulk SEND throughput over loopback, then across a veth pair whose server
+# end delays every packet with netem, once per server socket buffer setting.
+# Needs root, iproute2 and the sch_netem qdisc. Run through `make bench-netem`.
+
+ROOT=$(pwd)
+DIR=${NETEM_DIR:-/tmp/hyper-netem}
+PORT=${NETEM_PORT:-9191}
+DELAY=${NETEM_DELAY:-20ms}
+SIZES=${NETEM_SIZES:-64M:1}
+SNDBUFS=${NETEM_SNDBUFS:-0 16M}
+FLAGS=${NETEM_FLAGS:--c 1 -d 10 -l 0}
+
+NS=hyper-netem
+SERVER_ADDR=10.213.0.1
+CLIENT_ADDR=10.213.0.2
+
+cleanup() {
+    [ -f "$DIR/server.pid" ] && kill "$(cat "$DIR/server.pid")" 2>/dev/null
+    rm -f "$DIR/server.pid"
+    ip link del hn-client 2>/dev/null
+    ip netns del $NS 2>/dev/null
+}
+
+# $1 is a command prefix ("" or "ip netns exec NS"), $2 the --sndbuf value
+start_server() {
+    (cd "$DIR" && exec $1 "$ROOT/hyper-server" --sndbuf "$2" $PORT > server.log 2>&1) &
+    echo $! > "$DIR/server.pid"
+    sleep 1
+}
+
+stop_server() {
+    kill "$(cat "$DIR/server.pid")" 2>/dev/null
+    rm -f "$DIR/server.pid"
+    sleep 0.5
+}
+
+run() {
+    echo "== $1, server --sndbuf $3"
+    ./bench-loadgen -H "$2" -p $PORT -s "$SIZES" $FLAGS | tail -n 1
+}
+
+trap cleanup EXIT INT TERM
+
+rm -rf "$DIR" && mkdir -p "$DIR/hosted"
+./bench-loadgen -s "$SIZES" --fixture "$DIR/hosted" > /dev/null || exit 1
+
+for SNDBUF in $SNDBUFS; do
+    start_server "" "$SNDBUF"
+    run "loopback" 127.0.0.1 "$SNDBUF"
+    stop_server
+done
+
+ip netns add $NS &&
+ip link add hn-client type veth peer name hn-server &&
+ip link set hn-server netns $NS &&
+ip addr add $CLIENT_ADDR/24 dev hn-client &&
+ip link set hn-client up &&
+ip netns exec $NS ip addr add $SERVER_ADDR/24 dev hn-server &&
+ip netns exec $NS ip link set hn-server up &&
+ip netns exec $NS ip link set lo up || { echo "[-] Couldn't set up the veth pair"; exit 1; }
+
+# A deep queue, netem's default 1000 packets would cap the window by itself
+if ! ip netns exec $NS tc qdisc add dev hn-server root netem delay "$DELAY" limit 100000; then
+    echo "[-] netem is unavailable, load the sch_netem module"
+    exit 1
+fi
+
+for SNDBUF in $SNDBUFS; do
+    start_server "ip netns exec $NS" "$SNDBUF"
+    run "veth, $DELAY netem delay" $SERVER_ADDR "$SNDBUF"
+    stop_server
+done
@@ -0,0 +1,54 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+
+#include <string.h>
+#include <stddef.h>
+
+/* Size of each bump block, the first one is kept across resets */
+#define ARENA_BLOCK_SIZE    (64 * 1024)
+
+/* Requests above this get their own allocation instead of a block */
+#define ARENA_MAX_BUMP      (ARENA_BLOCK_SIZE / 4)
+
+#define ARENA_ALIGNMENT     16
+
+typedef struct _ARENA_BLOCK
+{
+    struct _ARENA_BLOCK *next;
+    size_t              stUsed;
+    size_t              stSize;
+    _Alignas(ARENA_ALIGNMENT) char data[];
+} ARENA_BLOCK, * PARENA_BLOCK;
+
+typedef struct _ARENA
+{
+    PARENA_BLOCK        blocks;         /* Current block first */
+    PARENA_BLOCK        oversized;      /* Fallback allocations */
+    size_t              stAllocated;    /* Bytes handed out since the last reset */
+} ARENA, * PARENA;
+
+void
+arena_init(
+    PARENA              arena
+);
+
+void*
+arena_alloc(
+    PARENA              arena,
+    size_t              stSize
+);
+
+void
+arena_reset(
+    PARENA              arena
+);
+
+void
+arena_destroy(
+    PARENA              arena
+);
+
+#endif
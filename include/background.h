@@ -0,0 +1,72 @@
+#ifndef _BACKGROUND_H
+#define _BACKGROUND_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+/* Threads that take whole-file work off the workers, hashing and chunking */
+#define BACKGROUND_THREADS      2
+
+typedef struct _BACKGROUND_JOB BACKGROUND_JOB, * PBACKGROUND_JOB;
+
+typedef void(*BACKGROUND_CALLBACK)(
+    PBACKGROUND_JOB     job
+);
+
+/* Leading member of whatever a job needs. run goes on a background thread,
+   complete back on the worker that submitted it, and only if the connection
+   is still there to answer. release frees it, on either thread */
+struct _BACKGROUND_JOB
+{
+    PBACKGROUND_JOB     next;
+    struct _JOB_INBOX   *inbox;         /* Where it goes once run, NULL for none */
+    struct _CONNECTION  *conn;          /* Waiting on it, NULL once it's gone */
+
+    BACKGROUND_CALLBACK run;
+    BACKGROUND_CALLBACK complete;
+    BACKGROUND_CALLBACK release;
+};
+
+/* Per worker, finished jobs wait here until the worker's loop sees fd */
+typedef struct _JOB_INBOX
+{
+    pthread_mutex_t     lock;
+    int                 fd;             /* eventfd, readable while jobs wait */
+    PBACKGROUND_JOB     head;
+} JOB_INBOX, * PJOB_INBOX;
+
+HYPERSTATUS
+background_start(void);
+
+void
+background_stop(void);
+
+HYPERSTATUS
+background_submit(
+    PBACKGROUND_JOB     job
+);
+
+HYPERSTATUS
+background_inbox_init(
+    PJOB_INBOX          inbox
+);
+
+void
+background_inbox_destroy(
+    PJOB_INBOX          inbox
+);
+
+void
+background_finish(
+    PJOB_INBOX          inbox,
+    void                (*resume)(void *lpContext)
+);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define SHA256_DIGEST_SIZE      32
+#define SHA256_BLOCK_SIZE       64
+
+/* Bytes read per pread while checksumming a file */
+#define CHECKSUM_READ_SIZE      (256 * 1024)
+
+/* CRC32C runs three interleaved streams over blocks of these sizes, then
+   stitches them together with a table lookup */
+#define CRC32C_LONG_BLOCK       8192
+#define CRC32C_SHORT_BLOCK      256
+
+typedef struct _SHA256_CONTEXT
+{
+    uint32_t            uiState[8];
+    unsigned long long  ullLength;      /* Bytes hashed so far */
+    unsigned char       ucBuffer[SHA256_BLOCK_SIZE];
+    size_t              stBuffered;
+} SHA256_CONTEXT, * PSHA256_CONTEXT;
+
+void
+checksum_init(void);
+
+const char*
+checksum_describe(void);
+
+uint32_t
+checksum_crc32c(
+    uint32_t            uiCrc,
+    const void          *lpData,
+    size_t              stLength
+);
+
+void
+checksum_sha256_init(
+    PSHA256_CONTEXT     context
+);
+
+void
+checksum_sha256_update(
+    PSHA256_CONTEXT     context,
+    const void          *lpData,
+    size_t              stLength
+);
+
+void
+checksum_sha256_final(
+    PSHA256_CONTEXT     context,
+    unsigned char       *ucDigest
+);
+
+void
+checksum_buffer(
+    const void          *lpData,
+    size_t              stLength,
+    unsigned char       *ucSha256,
+    uint32_t            *uiCrc
+);
+
+HYPERSTATUS
+checksum_file(
+    int                 fd,
+    off_t               offStart,
+    unsigned long long  ullLength,
+    unsigned char       *ucSha256,
+    uint32_t            *uiCrc
+);
+
+#endif
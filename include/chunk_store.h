@@ -0,0 +1,160 @@
+#ifndef _CHUNK_STORE_H
+#define _CHUNK_STORE_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "checksum.h"
+#include "server_config.h"
+#include "background.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* FastCDC boundaries, chunks average STORE_AVG_CHUNK bytes */
+#define STORE_MIN_CHUNK         2048
+#define STORE_AVG_CHUNK         8192
+#define STORE_MAX_CHUNK         65536
+#define STORE_MASK_SMALL        0x0003590703530000ULL   /* 15 bits, before the average */
+#define STORE_MASK_LARGE        0x0000d90003530000ULL   /* 11 bits, after it */
+
+/* Packs are append-only and mapped whole, so chunks are served in place */
+#define STORE_PACK_SIZE         (256ULL * 1024 * 1024)
+#define STORE_MAX_PACKS         4096
+
+#define STORE_INITIAL_CHUNKS    1024
+
+#define STORE_MANIFEST_MAGIC    0x315453464e4d5948ULL   /* "HYMNFST1" */
+
+/* Files are read this much at a time to be split, at least STORE_MAX_CHUNK */
+#define STORE_INGEST_BUFFER     (1024 * 1024)
+
+/* Files waiting for a background ingest, more than this are simply not queued */
+#define STORE_MAX_PENDING       64
+
+/* Where one unique chunk lives, also the on-disk index record */
+typedef struct _STORE_CHUNK
+{
+    unsigned char       ucId[SHA256_DIGEST_SIZE];
+    uint32_t            uiPack;
+    uint32_t            uiLength;
+    uint64_t            ullOffset;
+} STORE_CHUNK, * PSTORE_CHUNK;
+
+typedef struct _STORE_PACK
+{
+    int                 fd;
+    const char          *cpMap;         /* STORE_PACK_SIZE bytes, valid up to ullUsed */
+    uint64_t            ullUsed;
+} STORE_PACK, * PSTORE_PACK;
+
+/* Manifest file header, followed by uiChunks chunk ids in file order */
+typedef struct _STORE_MANIFEST
+{
+    uint64_t            ullMagic;
+
+    /* Validators, a manifest only describes this exact version of the file */
+    uint64_t            ullSize;
+    uint64_t            ullInode;
+    int64_t             llModifiedSec;
+    int64_t             llModifiedNsec;
+
+    uint32_t            uiChunks;
+    uint32_t            uiReserved;
+    unsigned char       ucIds[];
+} STORE_MANIFEST, * PSTORE_MANIFEST;
+
+/* A piece of pack memory, consecutive chunks are merged into one */
+typedef struct _STORE_EXTENT
+{
+    const char          *cpData;
+    size_t              stLength;
+} STORE_EXTENT, * PSTORE_EXTENT;
+
+typedef struct _CHUNK_STORE_STATS
+{
+    unsigned long long  ullChunks;
+    unsigned long long  ullStoredBytes;     /* Unique chunk bytes in the packs */
+    unsigned long long  ullIngestedBytes;   /* File bytes chunked, duplicates included */
+} CHUNK_STORE_STATS, * PCHUNK_STORE_STATS;
+
+/* A file SEND found without a manifest, chunked in the background */
+typedef struct _STORE_INGEST
+{
+    BACKGROUND_JOB      job;            /* Must stay first */
+    struct _STORE_INGEST *next;         /* Queued or running, see chunk_store_queue */
+    int                 fd;             /* Own descriptor, pins the version that was asked for */
+    struct stat         st;
+    char                cpPath[SERVER_MAX_PATH];
+    char                cpManifestPath[SERVER_MAX_PATH];
+} STORE_INGEST, * PSTORE_INGEST;
+
+/* Shared by every worker, lock held for any index or pack access */
+typedef struct _CHUNK_STORE
+{
+    pthread_mutex_t     lock;
+    int                 bEnabled;
+    char                cpDir[SERVER_MAX_PATH];
+    int                 indexFd;
+
+    PSTORE_CHUNK        chunks;
+    uint32_t            uiChunks;
+    uint32_t            uiCapacity;
+    uint32_t            *uiTable;       /* Open addressing, chunk index + 1 */
+    uint32_t            uiTableSize;    /* Power of two, at most half full */
+
+    STORE_PACK          packs[STORE_MAX_PACKS];
+    uint32_t            uiPacks;
+
+    CHUNK_STORE_STATS   stats;
+} CHUNK_STORE, * PCHUNK_STORE;
+
+extern CHUNK_STORE chunkStore;
+
+HYPERSTATUS
+chunk_store_open(
+    const char          *cpDir
+);
+
+HYPERSTATUS
+chunk_store_manifest(
+    int                 fd,
+    const char          *cpPath,
+    const struct stat   *st,
+    int                 bIngest,
+    PSTORE_MANIFEST     *manifest
+);
+
+HYPERSTATUS
+chunk_store_locate(
+    const unsigned char *ucId,
+    const char          **cpData,
+    uint32_t            *uiLength
+);
+
+HYPERSTATUS
+chunk_store_extents(
+    int                 fd,
+    const char          *cpPath,
+    const struct stat   *st,
+    unsigned long long  ullOffset,
+    unsigned long long  ullLength,
+    PSTORE_EXTENT       *extents,
+    size_t              *stExtents
+);
+
+void
+chunk_store_free(
+    void                *lpContext
+);
+
+void
+chunk_store_get_stats(
+    PCHUNK_STORE_STATS  stats
+);
+
+#endif
@@ -1,12 +1,16 @@
 #ifndef _COMMANDS_H
 #define _COMMANDS_H
 
-#define SERVER_MAX_PATH 4096 /* I have issues with limits.h so fml */
-
 /* File Perm Masks */
 #define S_DIR   01
 
 #include "hyper_server.h"
+#include "connection.h"
+#include "parser.h"
+#include "upload.h"
+#include "checksum.h"
+#include "delta.h"
+#include "chunk_store.h"
 
 #define HYPER_IMPLEMENTATION
 #include <hyper.h>
@@ -14,37 +18,145 @@
 #include <string.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <stdint.h>
+
+/* Bytes of directory entries fetched by each getdents64 call */
+#define LIST_DENTS_BUFFER_SIZE  (32 * 1024)
+
+/* Directory being streamed by a LIST command */
+typedef struct _LIST_STATE
+{
+    int                 dirFd;          /* Entries are stat'd relative to this */
+    char                *cpDents;       /* Raw getdents64 records */
+    size_t              stDentsLength;
+    size_t              stDentsOffset;  /* Next record not yet formatted */
+    int                 bEof;
+
+    PLIST_CACHE         cache;
+    PLIST_ENTRY         capture;        /* Cache entry being filled, or NULL */
+} LIST_STATE, * PLIST_STATE;
+
+/* SEND of an uncached range to a CRC32C client, summed as it is read out */
+typedef struct _SEND_STATE
+{
+    int                 fd;
+    unsigned long long  ullOffset;      /* Next byte to read */
+    unsigned long long  ullRemaining;
+    uint32_t            uiCrc;
+    int                 bWhole;         /* Goes into the digest cache once done */
+    struct stat         st;
+    PDIGEST_CACHE       cache;
+} SEND_STATE, * PSEND_STATE;
+
+/* HASH of a file the digest cache doesn't know, summed in the background */
+typedef struct _HASH_JOB
+{
+    BACKGROUND_JOB      job;            /* Must stay first */
+    int                 fd;
+    struct stat         st;
+    DIGEST              digest;
+    HYPERSTATUS         hsResult;
+} HASH_JOB, * PHASH_JOB;
+
+/* CHUNKS for a file the store has no manifest of yet, ingested in the background */
+typedef struct _CHUNKS_JOB
+{
+    BACKGROUND_JOB      job;            /* Must stay first */
+    int                 fd;
+    struct stat         st;
+    PSTORE_MANIFEST     manifest;       /* Set by the ingest, NULL if it failed */
+    char                cpPath[SERVER_MAX_PATH];
+} CHUNKS_JOB, * PCHUNKS_JOB;
+
+size_t
+list_format_entry(
+    char                *cpBuffer,
+    size_t              stCapacity,
+    const char          *cpName,
+    mode_t              perm,
+    off_t               offSize
+);
 
 int 
 command_handler(
-    SOCKET              sock,
+    PCONNECTION         conn,
     char                *command
 );
 
 void 
 send_file(
-    SOCKET              sock,
+    PCONNECTION         conn,
     const char          **argv,
     const size_t        argc
 );
 
 void 
 list_dir(
-    SOCKET              sock,
+    PCONNECTION         conn,
     const char          **argv,
     const size_t        argc
 );
 
 void
 client_quit(
-    SOCKET              sock,
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc
+);
+
+void
+negotiate_protocol(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc
+);
+
+void
+put_file(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc
+);
+
+void
+report_stats(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc
+);
+
+void
+hash_file(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc
+);
+
+void
+sync_file(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc
+);
+
+void
+list_chunks(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc
+);
+
+void
+fetch_chunks(
+    PCONNECTION         conn,
     const char          **argv,
     const size_t        argc
 );
 
 typedef void(*FUNCPTR)(
-    SOCKET,
+    PCONNECTION,
     const char**,
     const size_t
 );
@@ -55,6 +167,19 @@ typedef struct _COMMAND
     FUNCPTR             execute;
 } COMMAND, * PCOMMAND;
 
-extern COMMAND command_list[3];
+/* Dispatch table size, must stay comfortably above the number of commands */
+#define COMMAND_TABLE_BITS  5
+#define COMMAND_TABLE_SIZE  (1 << COMMAND_TABLE_BITS)
+
+HYPERSTATUS
+command_table_init(void);
+
+PCOMMAND
+command_lookup(
+    const char          *cpName
+);
+
+extern COMMAND command_list[];
+extern const unsigned int numCommands;
 
 #endif
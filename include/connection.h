@@ -0,0 +1,292 @@
+#ifndef _CONNECTION_H
+#define _CONNECTION_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "worker.h"
+#include "ring_buffer.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <time.h>
+
+#define MAX_INPUT_BUFFER 1024
+
+/* Stop reading new commands while this much output is still queued */
+#define OUTPUT_HIGH_WATERMARK   (1024 * 1024)
+
+/* Minimum capacity of a coalescing output buffer */
+#define OUTPUT_BUFFER_SIZE      16384
+
+/* Staging buffer a producer segment generates output into */
+#define PRODUCER_BUFFER_SIZE    16384
+
+/* A CHECKSUM frame, header and CRC32C */
+#define CHECKSUM_FRAME_SIZE     (HYPER_FRAME_HEADER_SIZE + HYPER_CHECKSUM_SIZE)
+
+/* Pipelined input waiting to be parsed, must be a power of two */
+#define INPUT_RING_SIZE         16384
+
+/* Most queued buffers gathered into one sendmsg */
+#define FLUSH_MAX_IOV           64
+
+/* Fewest bytes offered to one sendfile/splice call. The chunk grows with the
+   socket buffer and congestion window, see HyperTransferBlockSize */
+#define TRANSFER_MIN_CHUNK      (64 * 1024)
+
+/* Zerocopy completions read from the error queue per recvmsg */
+#define ZEROCOPY_MAX_NOTIFY     8
+
+typedef enum _SEGMENT_TYPE
+{
+    SEGMENT_BUFFER,                     /* Arena buffer, may be appended to */
+    SEGMENT_MAPPED,                     /* Borrowed memory, released when sent */
+    SEGMENT_FILE,                       /* Byte range of an open file */
+    SEGMENT_PRODUCER                    /* Generated on demand, one buffer at a time */
+} SEGMENT_TYPE;
+
+/* Fill cpBuffer with the next piece of output, set *bDone after the last one.
+   Returns the number of bytes written, or -1 to drop the connection. */
+typedef ssize_t(*PRODUCER)(
+    void                *lpContext,
+    char                *cpBuffer,
+    size_t              stCapacity,
+    int                 *bDone
+);
+
+typedef struct _SEGMENT
+{
+    struct _SEGMENT     *next;
+    SEGMENT_TYPE        eType;
+    size_t              stOffset;       /* Bytes already sent */
+    size_t              stLength;       /* Bytes to send in total */
+
+    /* SEGMENT_BUFFER, SEGMENT_MAPPED */
+    char                *cpData;
+    size_t              stCapacity;
+
+    /* SEGMENT_MAPPED, SEGMENT_PRODUCER */
+    void                (*release)(void *lpContext);
+    void                *lpContext;
+
+    /* SEGMENT_PRODUCER, cpData is the staging buffer */
+    PRODUCER            produce;
+    int                 bDone;
+    int                 bFramed;        /* Wrap every piece in a DATA frame */
+
+    /* SEGMENT_FILE */
+    int                 fd;
+    off_t               offStart;
+    struct timespec     tsStart;
+    size_t              stChunk;        /* Per call, 0 to size it again */
+    int                 bSplice;        /* sendfile() refused the file, use the pipe */
+
+    /* SEGMENT_MAPPED, sent with MSG_ZEROCOPY so the kernel may still read it */
+    int                 bZerocopy;
+    uint32_t            uiZerocopyId;   /* Last send that used the memory */
+} SEGMENT, * PSEGMENT;
+
+/* Release of a sent segment held back until its zerocopy sends complete */
+typedef struct _ZEROCOPY_PENDING
+{
+    struct _ZEROCOPY_PENDING *next;
+    uint32_t            uiId;
+    void                (*release)(void *lpContext);
+    void                *lpContext;
+} ZEROCOPY_PENDING, * PZEROCOPY_PENDING;
+
+/* What a connection was waiting on when its deadline passed */
+typedef enum _CONN_TIMEOUT
+{
+    TIMEOUT_NONE,
+    TIMEOUT_IDLE,                       /* Nothing in flight between requests */
+    TIMEOUT_READ,                       /* Partial command or upload body stalled */
+    TIMEOUT_WRITE                       /* Client stopped reading its responses */
+} CONN_TIMEOUT;
+
+typedef struct _CONNECTION
+{
+    EVENT_TYPE          eType;          /* Must stay first, see event_loop.c */
+    PWORKER             worker;
+    SOCKET              sock;
+    int                 bClosing;       /* Close once the output queue drains */
+    int                 bInputPending;  /* Input left unread due to backpressure */
+    int                 bFramed;        /* Binary framing negotiated via HELLO */
+    int                 bLineMode;      /* Client terminates commands with '\n' */
+    int                 bChecksums;     /* Follow SEND bodies with a CHECKSUM frame */
+
+    RING_BUFFER         input;
+    ARENA               arena;          /* Reset whenever the output queue drains */
+    char                cpCommand[MAX_INPUT_BUFFER];
+
+    PSEGMENT            psHead;
+    PSEGMENT            psTail;
+    size_t              stQueued;
+
+    /* splice() fallback when sendfile() refuses the file */
+    int                 pipeFds[2];
+    size_t              stPipeBytes;
+
+    /* PUT body still being received, commands wait until it's done */
+    struct _UPLOAD      *upload;
+
+    /* Background work the next response waits for, commands wait as well */
+    PBACKGROUND_JOB     job;
+
+    /* MSG_ZEROCOPY, see --zerocopy. The kernel numbers every such send and
+       reports finished ranges on the socket error queue */
+    int                 bZerocopy;      /* SO_ZEROCOPY set on the socket */
+    int                 bZerocopyOff;   /* Refused, or the kernel copied anyway */
+    uint32_t            uiZerocopyNext; /* Id of the next zerocopy send */
+    uint32_t            uiZerocopyDone; /* Every id below this one has completed */
+    PZEROCOPY_PENDING   psZerocopyHead;
+    PZEROCOPY_PENDING   psZerocopyTail;
+
+    /* Deadline, in the worker's timer wheel. Only pulled in as activity
+       comes, a timer that fires early is just re-armed, see conn_check_deadline */
+    TIMER               timer;
+    unsigned long long  ullLastRead;    /* Ticks of the last progress each way */
+    unsigned long long  ullLastWrite;
+
+    /* Turn taking and rate limits, conn_flush sends no more than it's given */
+    SCHED_ENTRY         sched;
+
+    /* io_uring backend, the kernel holds readMsg while a read is in flight */
+    struct msghdr       readMsg;
+    struct iovec        readIov[2];
+    int                 iFixedSlot;     /* Registered file index, -1 if none */
+    unsigned int        uiInflight;     /* SQEs not yet completed */
+    int                 bReadArmed;
+    int                 bWriteArmed;
+    int                 bDead;          /* Shut down, freed once uiInflight hits 0 */
+} CONNECTION, * PCONNECTION;
+
+PCONNECTION
+conn_create(
+    PWORKER             worker,
+    SOCKET              sock
+);
+
+void
+conn_destroy(
+    PCONNECTION         conn
+);
+
+HYPERSTATUS
+conn_write(
+    PCONNECTION         conn,
+    const void          *data,
+    size_t              stLength
+);
+
+HYPERSTATUS
+conn_write_producer(
+    PCONNECTION         conn,
+    PRODUCER            produce,
+    void                (*release)(void *lpContext),
+    void                *lpContext
+);
+
+HYPERSTATUS
+conn_write_body_producer(
+    PCONNECTION         conn,
+    PRODUCER            produce,
+    void                (*release)(void *lpContext),
+    void                *lpContext
+);
+
+void*
+conn_alloc(
+    PCONNECTION         conn,
+    size_t              stSize
+);
+
+HYPERSTATUS
+conn_write_mapped(
+    PCONNECTION         conn,
+    const void          *data,
+    size_t              stLength,
+    void                (*release)(void *lpContext),
+    void                *lpContext
+);
+
+HYPERSTATUS
+conn_send_fd(
+    PCONNECTION         conn,
+    int                 fd,
+    off_t               offStart,
+    size_t              stLength
+);
+
+HYPERSTATUS
+conn_send_status(
+    PCONNECTION         conn,
+    const unsigned short status
+);
+
+HYPERSTATUS
+conn_begin_response(
+    PCONNECTION         conn,
+    const unsigned short status,
+    const unsigned long long ullLength
+);
+
+HYPERSTATUS
+conn_begin_text(
+    PCONNECTION         conn,
+    const unsigned short status,
+    const unsigned long long ullLength
+);
+
+HYPERSTATUS
+conn_begin_stream(
+    PCONNECTION         conn,
+    const unsigned short status
+);
+
+size_t
+conn_format_checksum(
+    const uint32_t      uiCrc,
+    unsigned char       *ucFrame
+);
+
+HYPERSTATUS
+conn_write_checksum(
+    PCONNECTION         conn,
+    const uint32_t      uiCrc
+);
+
+HYPERSTATUS
+conn_flush(
+    PCONNECTION         conn
+);
+
+HYPERSTATUS
+conn_reap_zerocopy(
+    PCONNECTION         conn
+);
+
+int
+conn_drained(
+    PCONNECTION         conn
+);
+
+void
+conn_update_timer(
+    PCONNECTION         conn
+);
+
+CONN_TIMEOUT
+conn_check_deadline(
+    PCONNECTION         conn
+);
+
+#endif
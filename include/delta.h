@@ -0,0 +1,87 @@
+#ifndef _DELTA_H
+#define _DELTA_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "connection.h"
+#include "upload.h"
+#include "checksum.h"
+#include "server_config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+/* Longest HYPER_SYNC_LITERAL, unmatched bytes are sent in pieces this size */
+#define DELTA_MAX_LITERAL       (64 * 1024)
+
+/* Bytes read per pread while scanning the file */
+#define DELTA_READ_SIZE         (256 * 1024)
+
+/* Matched bytes covered by one HYPER_SYNC_COPY. Each instruction hands the
+   socket back to the event loop, so this bounds the work per produce call */
+#define DELTA_MAX_COPY_BYTES    (4 * 1024 * 1024)
+
+/* Blocks with the same rolling checksum tried at one offset */
+#define DELTA_MAX_CANDIDATES    64
+
+/* Worst single step, a literal followed by a copy */
+#define DELTA_OUTPUT_SIZE       (DELTA_MAX_LITERAL + 64)
+
+/* What SYNC asked for, carried until its signatures have arrived */
+typedef struct _DELTA_REQUEST
+{
+    char                cpPath[SERVER_MAX_PATH];
+    size_t              stBlockSize;
+} DELTA_REQUEST, * PDELTA_REQUEST;
+
+/* A delta being generated against the client's signatures */
+typedef struct _DELTA_STATE
+{
+    int                 fd;
+    unsigned long long  ullFileSize;
+    size_t              stBlockSize;
+
+    /* Client signatures in host byte order, weak then CRC32C for each block */
+    uint32_t            *uiSignatures;
+    uint32_t            uiBlocks;
+    uint32_t            *uiBuckets;     /* Rolling checksum -> first block + 1 */
+    uint32_t            *uiChain;       /* Next block + 1 with the same bucket */
+    unsigned int        uiBucketShift;
+
+    /* File bytes from the start of the pending literal onward */
+    unsigned char       *ucWindow;
+    size_t              stWindowSize;
+    size_t              stWindowLength;
+    unsigned long long  ullWindowStart; /* File offset of ucWindow[0] */
+
+    unsigned long long  ullPosition;    /* Start of the block being tried */
+    unsigned long long  ullLiteral;     /* Start of the unmatched bytes */
+    uint32_t            uiRollA;
+    uint32_t            uiRollB;
+    int                 bRolling;       /* uiRollA/B describe ullPosition */
+
+    uint32_t            uiCopyFirst;
+    uint32_t            uiCopyCount;    /* Matched run not yet emitted */
+
+    /* Encoded instructions waiting for the producer buffer */
+    unsigned char       ucOutput[DELTA_OUTPUT_SIZE];
+    size_t              stOutputLength;
+    size_t              stOutputOffset;
+
+    uint32_t            uiCrc;          /* Of the file up to ullLiteral */
+    unsigned long long  ullCopied;
+    unsigned long long  ullLiteralBytes;
+    int                 bFinished;
+} DELTA_STATE, * PDELTA_STATE;
+
+void
+delta_complete(
+    PCONNECTION         conn,
+    PUPLOAD             upload
+);
+
+#endif
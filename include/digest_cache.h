@@ -0,0 +1,74 @@
+#ifndef _DIGEST_CACHE_H
+#define _DIGEST_CACHE_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "stats.h"
+#include "checksum.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* Direct-mapped, a file that collides simply replaces the previous one */
+#define DIGEST_CACHE_BITS       10
+#define DIGEST_CACHE_ENTRIES    (1 << DIGEST_CACHE_BITS)
+
+typedef struct _DIGEST
+{
+    uint32_t            uiCrc32c;
+    int                 bSha256;        /* SEND only ever needs the CRC */
+    unsigned char       ucSha256[SHA256_DIGEST_SIZE];
+} DIGEST, * PDIGEST;
+
+typedef struct _DIGEST_ENTRY
+{
+    /* Validators, the digest is only good for this exact version of the file */
+    dev_t               device;
+    ino_t               inode;
+    off_t               offSize;
+    struct timespec     tsModified;
+    int                 bValid;
+
+    DIGEST              digest;
+} DIGEST_ENTRY, * PDIGEST_ENTRY;
+
+typedef struct _DIGEST_CACHE_STATS
+{
+    unsigned long long  ullHits;
+    unsigned long long  ullMisses;
+} DIGEST_CACHE_STATS, * PDIGEST_CACHE_STATS;
+
+typedef struct _DIGEST_CACHE
+{
+    DIGEST_ENTRY        entries[DIGEST_CACHE_ENTRIES];
+    DIGEST_CACHE_STATS  stats;
+} DIGEST_CACHE, * PDIGEST_CACHE;
+
+void
+digest_cache_init(
+    PDIGEST_CACHE       cache
+);
+
+PDIGEST
+digest_cache_lookup(
+    PDIGEST_CACHE       cache,
+    const struct stat   *st,
+    int                 bSha256
+);
+
+void
+digest_cache_store(
+    PDIGEST_CACHE       cache,
+    const struct stat   *st,
+    const DIGEST        *digest
+);
+
+void
+digest_cache_get_stats(
+    PDIGEST_CACHE       cache,
+    PDIGEST_CACHE_STATS stats
+);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include "connection.h"
+#include "commands.h"
+#include "worker.h"
+#include "upload.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+#define MAX_EVENTS 256
+
+HYPERSTATUS
+event_loop_run(
+    PWORKER             worker
+);
+
+void
+event_loop_dispatch(
+    PCONNECTION         conn,
+    size_t              stLength,
+    size_t              stConsumed
+);
+
+int
+event_loop_next_command(
+    PCONNECTION         conn
+);
+
+int
+event_loop_process_input(
+    PCONNECTION         conn,
+    int                 bDrained
+);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _EVENT_LOOP_URING_H
+#define _EVENT_LOOP_URING_H
+
+#include "connection.h"
+#include "event_loop.h"
+#include "worker.h"
+#include "uring.h"
+
+#include <poll.h>
+
+/* Low bits of a connection's user_data say which operation completed */
+#define URING_OP_READ           1
+#define URING_OP_POLLIN         2
+#define URING_OP_POLLOUT        3
+#define URING_OP_MASK           3
+
+/* Timeouts carry the wheel tick they are for, user pointers never have the top bit set */
+#define URING_TIMEOUT_TAG       (1ULL << 63)
+
+HYPERSTATUS
+event_loop_uring_init(
+    PWORKER             worker
+);
+
+void
+event_loop_uring_destroy(
+    PWORKER             worker
+);
+
+HYPERSTATUS
+event_loop_uring_run(
+    PWORKER             worker
+);
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef _FILE_CACHE_H
+#define _FILE_CACHE_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "stats.h"
+#include "lru.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* Legacy SEND response header: status buffer followed by the size buffer */
+#define CACHE_HEADER_SIZE       (STATUS_BUFFER_SIZE + FILESIZE_BUFFER_SIZE)
+
+/* Files bigger than budget / CACHE_MAX_ENTRY_SHARE are never cached */
+#define CACHE_MAX_ENTRY_SHARE   8
+
+#define CACHE_INITIAL_BUCKETS   256
+
+typedef struct _CACHE_ENTRY
+{
+    LRU_NODE            lru;            /* Must stay first */
+    struct _CACHE_ENTRY *hashNext;
+
+    char                *cpPath;
+    uint64_t            ullHash;
+
+    /* Validators, compared against a fresh stat() on every hit */
+    dev_t               device;
+    ino_t               inode;
+    off_t               offSize;
+    struct timespec     tsModified;
+
+    /* CACHE_HEADER_SIZE bytes of pre-formatted header, then the file */
+    char                *cpData;
+    size_t              stDataLength;
+
+    unsigned int        uiRefs;         /* Queued segments still sending it */
+    int                 bLinked;        /* Still reachable from the cache */
+} CACHE_ENTRY, * PCACHE_ENTRY;
+
+typedef struct _FILE_CACHE_STATS
+{
+    unsigned long long  ullHits;
+    unsigned long long  ullMisses;
+    unsigned long long  ullEvictions;
+    size_t              stEntries;
+    size_t              stBytes;
+} FILE_CACHE_STATS, * PFILE_CACHE_STATS;
+
+typedef struct _FILE_CACHE
+{
+    PCACHE_ENTRY        *buckets;
+    size_t              stBuckets;
+
+    LRU_LIST            lru;
+
+    size_t              stBudget;
+    FILE_CACHE_STATS    stats;
+} FILE_CACHE, * PFILE_CACHE;
+
+HYPERSTATUS
+file_cache_init(
+    PFILE_CACHE         cache,
+    size_t              stBudget
+);
+
+void
+file_cache_destroy(
+    PFILE_CACHE         cache
+);
+
+PCACHE_ENTRY
+file_cache_lookup(
+    PFILE_CACHE         cache,
+    const char          *cpPath,
+    const struct stat   *st
+);
+
+PCACHE_ENTRY
+file_cache_insert(
+    PFILE_CACHE         cache,
+    const char          *cpPath,
+    int                 fd,
+    const struct stat   *st
+);
+
+void
+file_cache_retain(
+    PCACHE_ENTRY        entry
+);
+
+void
+file_cache_release(
+    void                *lpEntry
+);
+
+void
+file_cache_get_stats(
+    PFILE_CACHE         cache,
+    PFILE_CACHE_STATS   stats
+);
+
+#endif
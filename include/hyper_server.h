@@ -1,9 +1,9 @@
 #ifndef _HYPER_SERVER_H
 #define _HYPER_SERVER_H
 
-#define MAX_INPUT_BUFFER 1024
-
 #include "commands.h"
+#include "server_config.h"
+#include "worker.h"
 
 #define HYPER_IMPLEMENTATION
 #include <hyper.h>
@@ -13,16 +13,33 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+
+/* Long options without a short form */
+#define OPTION_SNDBUF           256
+#define OPTION_RCVBUF           257
+#define OPTION_READ_TIMEOUT     258
+#define OPTION_WRITE_TIMEOUT    259
+#define OPTION_QUANTUM          260
+#define OPTION_RATE             261
+#define OPTION_CLIENT_RATE      262
 
 void usage(void);
 
-char** 
-GetArgs(
-    char                *a_str, 
-    char                a_delim, 
-    size_t              *count
+HYPERSTATUS
+parse_count(
+    const char          *cpValue,
+    unsigned long long  ullMax,
+    unsigned long long  *ullValue
 );
 
-extern int isConnected;
+HYPERSTATUS
+parse_size(
+    const char          *cpSize,
+    unsigned long long  *ullSize
+);
 
 #endif
@@ -0,0 +1,128 @@
+#ifndef _LIST_CACHE_H
+#define _LIST_CACHE_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "stats.h"
+#include "lru.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+
+/* Listings bigger than budget / LIST_CACHE_MAX_ENTRY_SHARE aren't cached */
+#define LIST_CACHE_MAX_ENTRY_SHARE  4
+
+#define LIST_CACHE_BUCKETS          1024    /* Power of two */
+
+/* Anything that changes a name, size or mode shown by LIST */
+#define LIST_CACHE_WATCH_MASK   (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+                                 IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+                                 IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct _LIST_ENTRY
+{
+    LRU_NODE            lru;            /* Must stay first */
+    struct _LIST_ENTRY  *pathNext;
+    struct _LIST_ENTRY  *watchNext;
+
+    char                *cpPath;
+    uint64_t            ullHash;
+    int                 wd;
+
+    /* Formatted LIST body, only served once bComplete is set */
+    char                *cpData;
+    size_t              stLength;
+    size_t              stCapacity;
+
+    int                 bComplete;
+    int                 bStale;         /* Changed while the listing was captured */
+    int                 bLinked;
+    unsigned int        uiRefs;
+} LIST_ENTRY, * PLIST_ENTRY;
+
+typedef struct _LIST_CACHE_STATS
+{
+    unsigned long long  ullHits;
+    unsigned long long  ullMisses;
+    unsigned long long  ullInvalidations;
+    unsigned long long  ullEvictions;
+    size_t              stEntries;
+    size_t              stBytes;
+} LIST_CACHE_STATS, * PLIST_CACHE_STATS;
+
+typedef struct _LIST_CACHE
+{
+    int                 inotifyFd;      /* -1 when the cache is disabled */
+
+    PLIST_ENTRY         pathBuckets[LIST_CACHE_BUCKETS];
+    PLIST_ENTRY         watchBuckets[LIST_CACHE_BUCKETS];
+
+    LRU_LIST            lru;
+
+    size_t              stBudget;
+    LIST_CACHE_STATS    stats;
+} LIST_CACHE, * PLIST_CACHE;
+
+HYPERSTATUS
+list_cache_init(
+    PLIST_CACHE         cache,
+    size_t              stBudget
+);
+
+void
+list_cache_destroy(
+    PLIST_CACHE         cache
+);
+
+PLIST_ENTRY
+list_cache_lookup(
+    PLIST_CACHE         cache,
+    const char          *cpPath
+);
+
+PLIST_ENTRY
+list_cache_begin(
+    PLIST_CACHE         cache,
+    const char          *cpPath
+);
+
+void
+list_cache_append(
+    PLIST_CACHE         cache,
+    PLIST_ENTRY         entry,
+    const char          *cpData,
+    size_t              stLength
+);
+
+void
+list_cache_finish(
+    PLIST_CACHE         cache,
+    PLIST_ENTRY         entry,
+    int                 bComplete
+);
+
+void
+list_cache_handle_events(
+    PLIST_CACHE         cache
+);
+
+void
+list_cache_retain(
+    PLIST_ENTRY         entry
+);
+
+void
+list_cache_release(
+    void                *lpEntry
+);
+
+void
+list_cache_get_stats(
+    PLIST_CACHE         cache,
+    PLIST_CACHE_STATS   stats
+);
+
+#endif
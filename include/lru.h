@@ -0,0 +1,38 @@
+#ifndef _LRU_H
+#define _LRU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Intrusive recency list shared by the file and listing caches. The node
+   is the first member of an entry, so the two cast freely */
+typedef struct _LRU_NODE
+{
+    struct _LRU_NODE    *prev;
+    struct _LRU_NODE    *next;
+} LRU_NODE, * PLRU_NODE;
+
+typedef struct _LRU_LIST
+{
+    PLRU_NODE           head;           /* Most recently used */
+    PLRU_NODE           tail;           /* Next to be evicted */
+} LRU_LIST, * PLRU_LIST;
+
+uint64_t
+lru_key_hash(
+    const char          *cpKey
+);
+
+void
+lru_unlink(
+    PLRU_LIST           list,
+    PLRU_NODE           node
+);
+
+void
+lru_push(
+    PLRU_LIST           list,
+    PLRU_NODE           node
+);
+
+#endif
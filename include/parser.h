@@ -0,0 +1,26 @@
+#ifndef _PARSER_H
+#define _PARSER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* Arguments past this many are dropped, including the command name */
+#define MAX_COMMAND_ARGS 16
+
+size_t
+parse_args(
+    char                *cpInput,
+    char                **argv,
+    size_t              stMaxArgs
+);
+
+/* Original heap-allocating tokenizer, kept as the microbenchmark baseline */
+char** 
+GetArgs(
+    char                *a_str, 
+    char                a_delim, 
+    size_t              *count
+);
+
+#endif
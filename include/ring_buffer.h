@@ -0,0 +1,78 @@
+#ifndef _RING_BUFFER_H
+#define _RING_BUFFER_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+
+#include <string.h>
+#include <sys/uio.h>
+
+typedef struct _RING_BUFFER
+{
+    char                *cpData;
+    size_t              stCapacity;     /* Always a power of two */
+    size_t              stHead;         /* Read position, only ever grows */
+    size_t              stTail;         /* Write position, only ever grows */
+} RING_BUFFER, * PRING_BUFFER;
+
+HYPERSTATUS
+ring_init(
+    PRING_BUFFER        ring,
+    size_t              stCapacity
+);
+
+void
+ring_free(
+    PRING_BUFFER        ring
+);
+
+size_t
+ring_used(
+    const RING_BUFFER   *ring
+);
+
+size_t
+ring_space(
+    const RING_BUFFER   *ring
+);
+
+int
+ring_write_vectors(
+    PRING_BUFFER        ring,
+    struct iovec        *iov
+);
+
+int
+ring_read_vectors(
+    const RING_BUFFER   *ring,
+    struct iovec        *iov,
+    size_t              stLength
+);
+
+void
+ring_commit(
+    PRING_BUFFER        ring,
+    size_t              stLength
+);
+
+void
+ring_peek(
+    const RING_BUFFER   *ring,
+    void                *lpBuffer,
+    size_t              stLength
+);
+
+void
+ring_consume(
+    PRING_BUFFER        ring,
+    size_t              stLength
+);
+
+int
+ring_find(
+    const RING_BUFFER   *ring,
+    char                cDelimiter,
+    size_t              *stIndex
+);
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "timer_wheel.h"
+
+#include <stdint.h>
+
+/* A bucket holds an eighth of a second of its rate, and never less than this */
+#define SCHED_MIN_BURST         (64 * 1024)
+
+/* Throttled senders sleep until at least this much can go out at once */
+#define SCHED_MIN_SEND          (16 * 1024)
+
+#define SCHED_TICKS_PER_SECOND  (1000 / TIMER_TICK_MS)
+
+/* Refilled lazily from the wheel clock, may go into debt by one send */
+typedef struct _TOKEN_BUCKET
+{
+    unsigned long long  ullRate;        /* Bytes per second, 0 is unlimited */
+    unsigned long long  ullBurst;
+    long long           llTokens;
+    unsigned long long  ullUpdated;     /* Tick of the last refill */
+} TOKEN_BUCKET, * PTOKEN_BUCKET;
+
+/* Per connection. Either running, waiting its turn on the ready queue or
+   waiting for tokens on the throttle timer, never more than one of those */
+typedef struct _SCHED_ENTRY
+{
+    struct _SCHED_ENTRY *next;
+    struct _SCHED_ENTRY *prev;
+    int                 bQueued;
+    size_t              stDeficit;      /* Bytes left of the current turn */
+    TOKEN_BUCKET        bucket;
+    TIMER               throttle;
+    void                (*resume)(void *lpContext);
+    void                *lpContext;
+} SCHED_ENTRY, * PSCHED_ENTRY;
+
+/* Per worker, deficit round robin over connections with output to send */
+typedef struct _SCHEDULER
+{
+    PTIMER_WHEEL        wheel;
+    SCHED_ENTRY         ready;          /* List head */
+    size_t              stReady;
+    size_t              stQuantum;      /* 0 lets a connection send until EAGAIN */
+    TOKEN_BUCKET        bucket;         /* This worker's share of --rate */
+} SCHEDULER, * PSCHEDULER;
+
+void
+scheduler_init(
+    PSCHEDULER          sched,
+    PTIMER_WHEEL        wheel,
+    size_t              stQuantum,
+    unsigned long long  ullRate
+);
+
+void
+scheduler_entry_init(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry,
+    unsigned long long  ullRate,
+    void                (*resume)(void *lpContext),
+    void                *lpContext
+);
+
+int
+scheduler_waiting(
+    const SCHED_ENTRY   *entry
+);
+
+size_t
+scheduler_budget(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry
+);
+
+void
+scheduler_charge(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry,
+    size_t              stBytes
+);
+
+int
+scheduler_yield(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry
+);
+
+void
+scheduler_idle(
+    PSCHED_ENTRY        entry
+);
+
+void
+scheduler_remove(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry
+);
+
+void
+scheduler_run(
+    PSCHEDULER          sched
+);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _SERVER_CONFIG_H
+#define _SERVER_CONFIG_H
+
+#include <stddef.h>
+
+#define SERVER_MAX_PATH 4096 /* I have issues with limits.h so fml */
+
+#define DEFAULT_CACHE_SIZE      (64 * 1024 * 1024)
+#define DEFAULT_LIST_CACHE_SIZE (16 * 1024 * 1024)
+
+/* Seconds a connection may sit idle, stall a request or not read its response */
+#define DEFAULT_IDLE_TIMEOUT    120
+#define DEFAULT_READ_TIMEOUT    30
+#define DEFAULT_WRITE_TIMEOUT   60
+
+/* Bytes a connection may send per turn before the next one goes */
+#define DEFAULT_SCHED_QUANTUM   (256 * 1024)
+
+typedef enum _IO_BACKEND
+{
+    BACKEND_EPOLL,
+    BACKEND_URING                       /* Falls back to epoll if unsupported */
+} IO_BACKEND;
+
+typedef struct _SERVER_CONFIG
+{
+    unsigned short      usPort;
+    unsigned int        uiWorkers;
+    size_t              stCacheSize;    /* Hot-file cache budget, 0 disables */
+    size_t              stListCacheSize; /* Directory listing cache budget, 0 disables */
+    IO_BACKEND          eBackend;
+    size_t              stZerocopyMin;  /* Smallest MSG_ZEROCOPY payload, 0 disables */
+    size_t              stSendBuffer;   /* SO_SNDBUF for clients, 0 autotunes */
+    size_t              stReceiveBuffer; /* SO_RCVBUF for clients, 0 autotunes */
+    unsigned int        uiIdleTimeout;  /* Seconds, 0 disables each of these */
+    unsigned int        uiReadTimeout;
+    unsigned int        uiWriteTimeout;
+    size_t              stQuantum;      /* Bytes per scheduler turn, 0 disables it */
+    unsigned long long  ullRate;        /* Bytes per second for the whole server, 0 is unlimited */
+    unsigned long long  ullClientRate;  /* Bytes per second for each connection */
+    char                cpRoot[SERVER_MAX_PATH]; /* Resolved hosted directory */
+    char                cpStatsFile[SERVER_MAX_PATH]; /* Prometheus dump, empty if off */
+    char                cpStoreDir[SERVER_MAX_PATH]; /* Chunk store, empty if off */
+} SERVER_CONFIG, * PSERVER_CONFIG;
+
+/* Filled in by main() before any worker starts, read-only afterwards */
+extern SERVER_CONFIG serverConfig;
+
+#endif
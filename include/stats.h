@@ -0,0 +1,94 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+
+/* Counters have a single writer, their worker, and are read from any thread.
+   Relaxed atomics keep that well defined without a locked instruction. */
+#define STAT_READ(counter)      __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define STAT_ADD(counter, n)    __atomic_store_n(&(counter), STAT_READ(counter) + (n), __ATOMIC_RELAXED)
+#define STAT_SUB(counter, n)    __atomic_store_n(&(counter), STAT_READ(counter) - (n), __ATOMIC_RELAXED)
+
+/* Room for every entry of command_list */
+#define STATS_MAX_COMMANDS      16
+
+/* Status codes are counted individually up to this one */
+#define STATS_MAX_STATUS        600
+
+/* Latency bucket i holds commands that took at most 2^i microseconds, the
+   last one everything slower (about 8s and up) */
+#define STATS_LATENCY_BUCKETS   24
+
+/* Seconds between rewrites of the --stats-file dump */
+#define STATS_DUMP_INTERVAL     10
+
+typedef struct _COMMAND_STATS
+{
+    unsigned long long  ullCount;
+    unsigned long long  ullNanoseconds; /* Total time spent in the handler */
+    unsigned long long  ullBuckets[STATS_LATENCY_BUCKETS + 1];
+} COMMAND_STATS, * PCOMMAND_STATS;
+
+typedef struct _WORKER_STATS
+{
+    unsigned long long  ullAccepted;
+    unsigned long long  ullClosed;
+    unsigned long long  ullBytesReceived;
+    unsigned long long  ullBytesSent;
+    unsigned long long  ullSendCalls;       /* sendmsg, sendfile and splice to a socket */
+    unsigned long long  ullZerocopySends;
+    unsigned long long  ullZerocopyCopied;  /* Completions the kernel had to copy */
+    unsigned long long  ullIdleTimeouts;
+    unsigned long long  ullReadTimeouts;
+    unsigned long long  ullWriteTimeouts;
+    unsigned long long  ullSchedYields;     /* Turns handed to other connections */
+    unsigned long long  ullThrottled;       /* Waits for rate limit tokens */
+    unsigned long long  ullUnknownCommands;
+    unsigned long long  ullStatus[STATS_MAX_STATUS];
+
+    COMMAND_STATS       commands[STATS_MAX_COMMANDS];
+} WORKER_STATS, * PWORKER_STATS;
+
+unsigned long long
+stats_now(void);
+
+void
+stats_record_command(
+    PWORKER_STATS       stats,
+    unsigned int        uiCommand,
+    unsigned long long  ullNanoseconds
+);
+
+void
+stats_record_status(
+    PWORKER_STATS       stats,
+    unsigned short      usStatus
+);
+
+HYPERSTATUS
+stats_format(
+    char                **cpText,
+    size_t              *stLength
+);
+
+void
+stats_free(
+    void                *lpText
+);
+
+HYPERSTATUS
+stats_dump_start(
+    const char          *cpPath
+);
+
+void
+stats_dump_stop(void);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+
+#include <string.h>
+#include <time.h>
+
+/* Resolution of every timer */
+#define TIMER_TICK_MS           10
+
+/* Four levels of 64 slots, level n slots are 64^n ticks wide */
+#define TIMER_LEVEL_BITS        6
+#define TIMER_LEVEL_SLOTS       (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS            4
+
+/* Furthest a timer can be set, about 46 hours, later ones are clamped */
+#define TIMER_MAX_TICKS         ((1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+#define TIMER_MS_TO_TICKS(ms)   (((ms) + TIMER_TICK_MS - 1) / TIMER_TICK_MS)
+
+/* Embedded in whatever it times, nothing is allocated per timer */
+typedef struct _TIMER
+{
+    struct _TIMER       *next;          /* NULL while not scheduled */
+    struct _TIMER       *prev;
+    unsigned long long  ullExpires;     /* Tick it fires on */
+    void                (*expire)(struct _TIMER *timer);
+    void                *lpContext;
+} TIMER, * PTIMER;
+
+/* One per worker, only touched from its thread */
+typedef struct _TIMER_WHEEL
+{
+    unsigned long long  ullNow;         /* Current tick, everything due before it has fired */
+    unsigned long long  ullClock;       /* Tick read after the last wait, what activity is stamped with */
+    unsigned long long  ullStartMs;     /* Monotonic time of tick 0 */
+    size_t              stTimers;
+    TIMER               slots[TIMER_LEVELS][TIMER_LEVEL_SLOTS];     /* List heads */
+} TIMER_WHEEL, * PTIMER_WHEEL;
+
+void
+timer_wheel_init(
+    PTIMER_WHEEL        wheel
+);
+
+void
+timer_init(
+    PTIMER              timer,
+    void                (*expire)(PTIMER timer),
+    void                *lpContext
+);
+
+int
+timer_pending(
+    const TIMER         *timer
+);
+
+void
+timer_wheel_add(
+    PTIMER_WHEEL        wheel,
+    PTIMER              timer,
+    unsigned long long  ullExpires
+);
+
+void
+timer_wheel_remove(
+    PTIMER_WHEEL        wheel,
+    PTIMER              timer
+);
+
+void
+timer_wheel_update(
+    PTIMER_WHEEL        wheel
+);
+
+void
+timer_wheel_advance(
+    PTIMER_WHEEL        wheel
+);
+
+unsigned long long
+timer_wheel_next(
+    const TIMER_WHEEL   *wheel
+);
+
+int
+timer_wheel_timeout(
+    const TIMER_WHEEL   *wheel
+);
+
+#endif
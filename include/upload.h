@@ -0,0 +1,84 @@
+#ifndef _UPLOAD_H
+#define _UPLOAD_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "connection.h"
+#include "server_config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/uio.h>
+
+/* Kernel pipe capacity asked for when splicing an upload to disk */
+#define UPLOAD_PIPE_SIZE        (256 * 1024)
+
+/* Stack buffer for uploads that can't be spliced or are being discarded */
+#define UPLOAD_BOUNCE_SIZE      16384
+
+typedef struct _UPLOAD UPLOAD, * PUPLOAD;
+
+/* Answers a request whose body was collected in memory, see upload_start_buffer */
+typedef void(*UPLOAD_COMPLETE)(
+    PCONNECTION         conn,
+    PUPLOAD             upload
+);
+
+/* A request body being streamed off the socket, owned by its connection */
+struct _UPLOAD
+{
+    int                 fd;             /* Temp file, -1 once we only discard */
+    int                 pipeFds[2];     /* socket -> pipe -> file, -1 until used */
+    int                 bNoSplice;      /* Socket or file refused splice() */
+
+    unsigned long long  ullSize;        /* Declared body length */
+    unsigned long long  ullReceived;
+    unsigned short      usStatus;       /* Sent once the whole body is drained */
+
+    char                cpTempPath[SERVER_MAX_PATH];
+    char                cpFinalPath[SERVER_MAX_PATH];
+    struct timespec     tsStart;
+
+    /* Bodies kept in memory instead, NULL when going to a file */
+    char                *cpBuffer;      /* ullSize bytes */
+    UPLOAD_COMPLETE     complete;
+    void                *lpContext;     /* Freed with the upload */
+};
+
+HYPERSTATUS
+upload_start(
+    PCONNECTION         conn,
+    int                 fd,
+    const char          *cpTempPath,
+    const char          *cpFinalPath,
+    unsigned long long  ullSize,
+    unsigned short      usStatus
+);
+
+HYPERSTATUS
+upload_start_buffer(
+    PCONNECTION         conn,
+    unsigned long long  ullSize,
+    unsigned short      usStatus,
+    UPLOAD_COMPLETE     complete,
+    void                *lpContext
+);
+
+HYPERSTATUS
+upload_drain_ring(
+    PCONNECTION         conn
+);
+
+ssize_t
+upload_receive(
+    PCONNECTION         conn
+);
+
+void
+upload_abort(
+    PUPLOAD             upload
+);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _URING_H
+#define _URING_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Submission queue size of a worker's event ring, completions get twice that */
+#define URING_ENTRIES           1024
+
+/* Socket slots registered with each event ring, later connections go unregistered */
+#define URING_FIXED_FILES       4096
+
+/* Minimal io_uring, raw syscalls only since liburing isn't a dependency */
+typedef struct _URING
+{
+    int                 fd;             /* -1 when not set up */
+    unsigned int        uiFeatures;
+
+    unsigned int        *sqHead;
+    unsigned int        *sqTail;
+    unsigned int        *sqMask;
+    unsigned int        *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned int        uiSqEntries;
+    unsigned int        uiSqTail;       /* Local tail, published by uring_submit */
+
+    unsigned int        *cqHead;
+    unsigned int        *cqTail;
+    unsigned int        *cqMask;
+    struct io_uring_cqe *cqes;
+
+    void                *lpRing;
+    size_t              stRingSize;
+    size_t              stSqesSize;
+
+    /* Registered file table, slot -> fd, -1 when free */
+    int                 *fixedFiles;
+    unsigned int        uiFixedFiles;
+    unsigned int        uiFixedNext;    /* Search hint for a free slot */
+} URING, * PURING;
+
+HYPERSTATUS
+uring_init(
+    PURING              ring,
+    unsigned int        uiEntries
+);
+
+void
+uring_destroy(
+    PURING              ring
+);
+
+int
+uring_supports(
+    PURING              ring,
+    const int           *ops,
+    size_t              stOps
+);
+
+struct io_uring_sqe*
+uring_get_sqe(
+    PURING              ring
+);
+
+int
+uring_submit(
+    PURING              ring,
+    unsigned int        uiWait
+);
+
+struct io_uring_cqe*
+uring_peek_cqe(
+    PURING              ring
+);
+
+void
+uring_cqe_seen(
+    PURING              ring
+);
+
+HYPERSTATUS
+uring_register_files(
+    PURING              ring,
+    unsigned int        uiFiles
+);
+
+int
+uring_fixed_add(
+    PURING              ring,
+    int                 fd
+);
+
+void
+uring_fixed_remove(
+    PURING              ring,
+    int                 iSlot
+);
+
+#endif
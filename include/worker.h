@@ -0,0 +1,78 @@
+#ifndef _WORKER_H
+#define _WORKER_H
+
+#define HYPER_IMPLEMENTATION
+#include <hyper.h>
+#include "server_config.h"
+#include "file_cache.h"
+#include "list_cache.h"
+#include "digest_cache.h"
+#include "uring.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "scheduler.h"
+#include "background.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define MAX_WORKERS 1024
+
+/* Leading member of everything registered in a worker's epoll set */
+typedef enum _EVENT_TYPE
+{
+    EVENT_LISTENER,
+    EVENT_CONNECTION,
+    EVENT_INOTIFY,
+    EVENT_TIMER,
+    EVENT_JOBS
+} EVENT_TYPE;
+
+typedef struct _WORKER
+{
+    unsigned int        uiId;
+    int                 iCpu;           /* -1 if the worker is not pinned */
+    SOCKET              sockServer;
+    int                 epfd;
+    pthread_t           thread;
+    HYPERSTATUS         hsResult;
+
+    FILE_CACHE          fileCache;
+    LIST_CACHE          listCache;
+    DIGEST_CACHE        digestCache;    /* HASH and SEND checksums */
+    EVENT_TYPE          eInotify;       /* epoll tag for listCache.inotifyFd */
+
+    IO_BACKEND          eBackend;       /* What this worker actually runs */
+    URING               ring;           /* Event ring, BACKEND_URING only */
+    int                 bAcceptMultishot;
+
+    /* Connection deadlines. io_uring wakes up for them with a timeout SQE */
+    TIMER_WHEEL         timers;
+    EVENT_TYPE          eTimer;         /* Tag of IORING_OP_TIMEOUT_REMOVE completions */
+    struct __kernel_timespec tsTimeout; /* Read by the kernel at submission */
+    unsigned long long  ullTimeoutTick; /* Tick the armed timeout is for, 0 if none */
+
+    /* Takes turns between connections with output, see --quantum and --rate */
+    SCHEDULER           sched;
+
+    /* Background jobs done for this worker's connections */
+    JOB_INBOX           jobs;
+    EVENT_TYPE          eJobs;          /* Tag for jobs.fd */
+
+    WORKER_STATS        stats;          /* Written only by this worker */
+} WORKER, * PWORKER;
+
+HYPERSTATUS
+worker_pool_run(
+    const unsigned short usPort,
+    const unsigned int  uiWorkers
+);
+
+PWORKER
+worker_pool_get(
+    unsigned int        *uiCount
+);
+
+#endif
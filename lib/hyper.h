@@ -32,7 +32,14 @@ typedef int     HYPERSTATUS;
 /* Set block sizes. 4096 is a nice number lol */
 #define  SEND_BLOCK_SIZE    4096
 #define  RECV_BLOCK_SIZE    4096
+#define  RECV_STREAM_BLOCK_SIZE 65536   /* When the socket can't be asked */
+
+/* Bounds for HyperTransferBlockSize */
+#define  HYPER_TRANSFER_MIN_BLOCK   (16 * 1024)
+#define  HYPER_TRANSFER_MAX_BLOCK   (4 * 1024 * 1024)
+#define  HYPER_TRANSFER_RESIZE_CALLS 64     /* Receives between two sizings */
 #define  FILESIZE_BUFFER_SIZE   1024
+#define  STATUS_BUFFER_SIZE     255
 #define  MAX_COMMAND_LENGTH     1024
 
 /* Platform Specifics */
@@ -42,12 +49,17 @@ typedef int     HYPERSTATUS;
     #pragma comment (lib, "Ws2_32.lib") // Link to WinSock
     
     typedef int SOCKLEN;
+    typedef HANDLE HYPERFD;
+
+    #define HYPER_FSEEK(fp, offset) _fseeki64(fp, (__int64)(offset), SEEK_SET)
 #else
     #include <sys/types.h>
     #include <sys/stat.h>
     #include <fcntl.h>
     #include <unistd.h>
     #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
     #include <netdb.h>
     #include <errno.h>
@@ -58,6 +70,9 @@ typedef int     HYPERSTATUS;
     typedef struct sockaddr_in SOCKADDR_IN;
     typedef struct sockaddr SOCKADDR;
     typedef socklen_t SOCKLEN;
+    typedef int HYPERFD;
+
+    #define HYPER_FSEEK(fp, offset) fseeko(fp, (off_t)(offset), SEEK_SET)
 
     #define INVALID_SOCKET  -1
     #define SOCKET_ERROR    -1
@@ -65,6 +80,74 @@ typedef int     HYPERSTATUS;
 
 #define CONNECTION_CLOSED   0
 
+/* Binary framing, negotiated per connection with "HELLO <version>" */
+#define HYPER_FRAME_MAGIC           0x48    /* 'H' */
+#define HYPER_FRAME_VERSION         1
+#define HYPER_FRAME_HEADER_SIZE     16
+
+/* Frame Types */
+#define HYPER_FRAME_COMMAND         1   /* Client command, payload is the text */
+#define HYPER_FRAME_RESPONSE        2   /* Status plus the whole response body */
+#define HYPER_FRAME_DATA            3   /* Piece of a chunked response body */
+#define HYPER_FRAME_CHECKSUM        4   /* CRC32C of the preceding SEND body, sent
+                                           only after "HELLO 1 CRC32C" */
+
+/* Payload of a HYPER_FRAME_CHECKSUM frame, the CRC in network byte order */
+#define HYPER_CHECKSUM_SIZE         4
+
+/* Delta transfer with SYNC, see HyperSyncFile */
+#define HYPER_SYNC_BLOCK_SIZE       4096            /* Default block size */
+#define HYPER_SYNC_MIN_BLOCK_SIZE   512
+#define HYPER_SYNC_MAX_BLOCK_SIZE   (1024 * 1024)
+#define HYPER_SYNC_MAX_BLOCKS       (1 << 20)       /* Signatures the server accepts */
+#define HYPER_SYNC_SIGNATURE_SIZE   8               /* Rolling checksum, then CRC32C */
+
+/* Delta instructions, an opcode byte followed by big-endian fields */
+#define HYPER_SYNC_END              0   /* Size (64) and CRC32C (32) of the whole file */
+#define HYPER_SYNC_COPY             1   /* First block (32) and block count (32) */
+#define HYPER_SYNC_LITERAL          2   /* Length (32), then that many bytes */
+
+/* Chunk store, "CHUNKS <path>" lists a file as "<id> <length>" lines and
+   "FETCH <count>" followed by raw ids returns those chunks back to back */
+#define HYPER_CHUNK_ID_SIZE         32      /* SHA-256 of the chunk */
+#define HYPER_FETCH_MAX_CHUNKS      4096
+
+/* Frame Flags */
+#define HYPER_FRAME_FLAG_CHUNKED    0x01    /* Body follows as DATA frames, ended
+                                               by an empty DATA frame */
+
+/*!
+ * \brief Decoded binary frame header
+ *
+ * On the wire a header is HYPER_FRAME_HEADER_SIZE bytes in network byte
+ * order: magic (8), version (8), type (8), flags (8), status (16), 
+ * reserved (16) and payload length (64).
+ */
+typedef struct _HYPER_FRAME
+{
+    unsigned char       ucVersion;
+    unsigned char       ucType;
+    unsigned char       ucFlags;
+    unsigned short      usStatus;
+    unsigned long long  ullLength;
+} HYPER_FRAME, * PHYPER_FRAME;
+
+/*!
+ * \brief Sink for HyperReceiveStream
+ *
+ * Called with each block as it comes off the socket. Blocks can be shorter
+ * than the buffer size, since TCP hands data over in whatever pieces it has.
+ * Return HYPER_SUCCESS to keep receiving, anything else aborts the transfer.
+ */
+typedef HYPERSTATUS (*HYPER_RECEIVE_CALLBACK)(
+    const void          *lpBlock,
+    size_t              stLength,
+    void                *lpContext
+);
+
+/* HyperStartServerEx Flags */
+#define HYPER_SERVER_REUSEPORT  0x01  /* Let several sockets share one port */
+
 #define HYPERLIB static
 
 /* Libc Includes */
@@ -258,6 +341,9 @@ HyperWriteFile(
  * \result Returns HYPER_SUCCESS if successful. If something fails, returns 
  *      HYPER_FAILED.
  *
+ * \remarks The whole file is held in memory, use HyperReceiveToFile or
+ *      HyperReceiveStream for files that may not fit.
+ *
  * \see HyperSendFile
  */
 HYPERLIB
@@ -268,6 +354,201 @@ HyperReceiveFile(
     unsigned long       *ulSize
 );
 
+/*!
+ * \brief Receive an exact number of bytes from a connection
+ *
+ * Keeps calling recv until stLength bytes have arrived, since TCP is free to
+ * split a message across several reads.
+ *
+ * \param[in]  sock         Open, connected socket to receive from
+ * \param[out] lpBuffer     Buffer of at least stLength bytes
+ * \param[in]  stLength     Number of bytes to receive
+ *
+ * \result Returns HYPER_SUCCESS if successful. If the connection fails or is
+ *      closed early, returns HYPER_FAILED.
+ */
+HYPERLIB
+HYPERSTATUS
+HyperReceiveAll(
+    const SOCKET        sock,
+    void                *lpBuffer,
+    size_t              stLength
+);
+
+/*!
+ * \brief Receive a known number of bytes, handing each block to a callback
+ *
+ * Receives ullLength bytes from a connected socket through a single buffer
+ * of stBlockSize bytes, so memory use does not grow with the transfer size.
+ *
+ * \param[in]  sock         Open, connected socket to receive from
+ * \param[in]  ullLength    Number of bytes to receive
+ * \param[in]  callback     Called with every block received
+ * \param[in]  lpContext    Passed through to callback
+ * \param[in]  stBlockSize  Buffer size, 0 to size it from the socket
+ * \param[out] ullReceived  Optional, number of bytes handed to callback
+ *
+ * \result Returns HYPER_SUCCESS if successful. If the connection fails or is
+ *      closed early, or callback refuses a block, returns HYPER_FAILED.
+ *
+ * \remarks With stBlockSize 0 the buffer starts at HyperTransferBlockSize and
+ *      is resized every HYPER_TRANSFER_RESIZE_CALLS receives, following the
+ *      kernel as it grows the receive window.
+ *
+ * \see HyperReceiveToFile
+ * \see HyperTransferBlockSize
+ */
+HYPERLIB
+HYPERSTATUS
+HyperReceiveStream(
+    const SOCKET        sock,
+    const unsigned long long ullLength,
+    HYPER_RECEIVE_CALLBACK callback,
+    void                *lpContext,
+    size_t              stBlockSize,
+    unsigned long long  *ullReceived
+);
+
+/*!
+ * \brief Pick a buffer size for moving bulk data through a socket
+ *
+ * Sizes one send or receive call so it covers what the connection can carry
+ * at once: the larger of the kernel socket buffer and one round trip of
+ * data, which is cwnd * mss on the way out and the receiver's own estimate
+ * (TCP_INFO) on the way in. The result is a power of two between
+ * HYPER_TRANSFER_MIN_BLOCK and HYPER_TRANSFER_MAX_BLOCK, and no larger than
+ * ullRemaining.
+ *
+ * \param[in]  sock         Open, connected socket
+ * \param[in]  ullRemaining Bytes still to move, 0 if unknown
+ * \param[in]  bReceive     Nonzero to size a receive, zero for a send
+ *
+ * \result Returns the block size in bytes.
+ *
+ * \remarks TCP_INFO is only read on Linux, elsewhere the socket buffer alone
+ *      decides.
+ *
+ * \see HyperSetSocketBuffers
+ */
+HYPERLIB
+size_t
+HyperTransferBlockSize(
+    const SOCKET        sock,
+    const unsigned long long ullRemaining,
+    const int           bReceive
+);
+
+/*!
+ * \brief Set the kernel send and receive buffer sizes of a socket
+ *
+ * Raises SO_SNDBUF and SO_RCVBUF so a single connection can keep a link with
+ * a large bandwidth-delay product busy. Privileged processes on Linux go
+ * past net.core.wmem_max/rmem_max with SO_SNDBUFFORCE/SO_RCVBUFFORCE.
+ *
+ * \param[in]  sock             Socket to configure
+ * \param[in]  stSendBuffer     Send buffer in bytes, 0 leaves it alone
+ * \param[in]  stReceiveBuffer  Receive buffer in bytes, 0 leaves it alone
+ *
+ * \result Returns HYPER_SUCCESS if successful, else returns HYPER_FAILED
+ *
+ * \remarks A fixed size turns off the kernel's buffer autotuning. Call it
+ *      before connect() or listen(): the window scale is agreed on in the
+ *      handshake, and accepted sockets inherit the listener's buffers.
+ *
+ * \see HyperTransferBlockSize
+ */
+HYPERLIB
+HYPERSTATUS
+HyperSetSocketBuffers(
+    const SOCKET        sock,
+    const size_t        stSendBuffer,
+    const size_t        stReceiveBuffer
+);
+
+/*!
+ * \brief Receive a known number of bytes straight into an open file
+ *
+ * Writes ullLength bytes from a connected socket into fd starting at
+ * ullOffset. On Linux the data is spliced from the socket to the file
+ * through a pipe and never copied into user space; other platforms, and
+ * files that refuse splice, go through a buffer of stBlockSize bytes.
+ *
+ * \param[in]  sock         Open, connected socket to receive from
+ * \param[in]  fd           File opened for writing
+ * \param[in]  ullOffset    Offset in the file to write the first byte at
+ * \param[in]  ullLength    Number of bytes to receive
+ * \param[in]  stBlockSize  Buffer size, 0 to size it from the socket
+ * \param[out] ullReceived  Optional, number of bytes written to the file
+ *
+ * \result Returns HYPER_SUCCESS if successful. If something fails, returns 
+ *      HYPER_FAILED. ullReceived is set either way.
+ *
+ * \see HyperReceiveStream
+ */
+HYPERLIB
+HYPERSTATUS
+HyperReceiveToFile(
+    const SOCKET        sock,
+    HYPERFD             fd,
+    const unsigned long long ullOffset,
+    const unsigned long long ullLength,
+    size_t              stBlockSize,
+    unsigned long long  *ullReceived
+);
+
+/*!
+ * \brief Receive file from network into a file on disk at an offset
+ *
+ * Receives a file (or a byte range of one, see the SEND offset and length
+ * arguments) from a connected socket and writes it into cpFilePath starting
+ * at ullOffset. The file is created if needed but never truncated, so an
+ * interrupted download can be continued in place.
+ *
+ * \param[in]  sockServer   Open, connected socket to receive from
+ * \param[in]  cpFilePath   File path to write the data to
+ * \param[in]  ullOffset    Offset in the file to write the first byte at
+ * \param[out] ullReceived  Optional, number of bytes written to the file
+ *
+ * \result Returns HYPER_SUCCESS if successful. If something fails, returns 
+ *      HYPER_FAILED. ullReceived is set either way.
+ *
+ * \see HyperResumeDownload
+ * \see HyperReceiveFile
+ */
+HYPERLIB
+HYPERSTATUS
+HyperReceiveFileAt(
+    const SOCKET        sockServer,
+    const char          *cpFilePath,
+    const unsigned long long ullOffset,
+    unsigned long long  *ullReceived
+);
+
+/*!
+ * \brief Download a file, continuing a partial local copy if one exists
+ *
+ * Sends "SEND <cpRemotePath> <offset>" where offset is the current size of
+ * cpLocalPath, and appends the rest of the remote file to it.
+ *
+ * \param[in]  sockServer   Open, connected socket to a Hyper Server
+ * \param[in]  cpRemotePath Path of the file on the server
+ * \param[in]  cpLocalPath  Local file to create or continue
+ * \param[out] status       Optional, status code returned by the server
+ *
+ * \result Returns HYPER_SUCCESS if successful. If something fails, returns 
+ *      HYPER_FAILED.
+ *
+ * \see HyperReceiveFileAt
+ */
+HYPERLIB
+HYPERSTATUS
+HyperResumeDownload(
+    const SOCKET        sockServer,
+    const char          *cpRemotePath,
+    const char          *cpLocalPath,
+    unsigned short      *status
+);
+
 /*!
  * \brief Send file from HYPERFILE buffer over network
  *
@@ -281,7 +562,8 @@ HyperReceiveFile(
  * \result Returns HYPER_SUCCESS if successful. If something fails, returns 
  *      HYPER_FAILED.
  *
- * \remarks lpBuffer is reallocated to (ulSize + SEND_BLOCK_SIZE)
+ * \remarks The size header and the file go out in a single gathered send,
+ *      looping only when the socket accepts part of it.
  *
  * \see HyperReceiveFile
  */
@@ -395,6 +677,7 @@ HyperConnectServer(
  * 
  * \see HyperConnectServer
  * \see HyperServerListen
+ * \see HyperStartServerEx
  */
 HYPERLIB
 HYPERSTATUS
@@ -403,6 +686,31 @@ HyperStartServer(
     const unsigned short usPort
 );
 
+/*!
+ * \brief Starts a Hyper Server at specified port with extra socket options
+ *
+ * Starts and initializes a Hyper Server at the specified port. With
+ * HYPER_SERVER_REUSEPORT, several sockets (one per worker) may bind the 
+ * same port and the kernel load-balances incoming connections between them.
+ *
+ * \param[out]  sock            Pointer to SOCKET object to use for connections
+ * \param[in]   usPort          Unsigned port number to bind to
+ * \param[in]   iFlags          Bitmask of HYPER_SERVER_* flags
+ *
+ * \result Returns HYPER_SUCCESS if successful, else returns HYPER_FAILED
+ *
+ * \remarks HYPER_SERVER_REUSEPORT is ignored on platforms without SO_REUSEPORT.
+ * 
+ * \see HyperStartServer
+ */
+HYPERLIB
+HYPERSTATUS
+HyperStartServerEx(
+    SOCKET              *sock, 
+    const unsigned short usPort,
+    const int           iFlags
+);
+
 /*!
  * \brief Listens for connections to the server
  *
@@ -449,7 +757,12 @@ HyperReceiveCommand(
 /*!
  * \brief Send command to connection
  *
- * Sends a command to connected peer.
+ * Sends a command to connected peer, terminated with a newline. Every
+ * command the library sends goes through here, so a connection never mixes
+ * delimited commands with the legacy undelimited ones: the server stops
+ * accepting the latter once it has seen a delimiter.
+ *
+ * \remark cpCommand must not carry its own terminator
  *
  * \param[in]   sock                    SOCKET object to send to
  * \param[in]   cpCommand               Char pointer buffer storing command to send
@@ -509,6 +822,219 @@ HyperReceiveStatus(
     unsigned short      *status
 );
 
+/*!
+ * \brief Encode a frame header for the wire
+ *
+ * \param[in]   frame           Frame header to encode
+ * \param[out]  lpHeader        Buffer of HYPER_FRAME_HEADER_SIZE bytes
+ *
+ * \see HyperDecodeFrame
+ */
+HYPERLIB
+void
+HyperEncodeFrame(
+    const HYPER_FRAME   *frame,
+    unsigned char       *lpHeader
+);
+
+/*!
+ * \brief Decode a frame header received from the wire
+ *
+ * \param[in]   lpHeader        Buffer of HYPER_FRAME_HEADER_SIZE bytes
+ * \param[out]  frame           Decoded frame header
+ *
+ * \result Returns HYPER_SUCCESS if successful. If the magic or version don't
+ *      match, returns HYPER_BAD_PARAMETER.
+ *
+ * \see HyperEncodeFrame
+ */
+HYPERLIB
+HYPERSTATUS
+HyperDecodeFrame(
+    const unsigned char *lpHeader,
+    PHYPER_FRAME        frame
+);
+
+/*!
+ * \brief Switch a connection to binary framing
+ *
+ * Sends "HELLO <HYPER_FRAME_VERSION>" and waits for the server to accept.
+ * From then on every command must be sent with HyperSendFrame and every
+ * response starts with a frame header read by HyperReceiveFrame.
+ *
+ * \param[in]   sock            SOCKET object connected to a Hyper Server
+ *
+ * \result Returns HYPER_SUCCESS if the server accepted, else returns HYPER_FAILED.
+ *      Older servers refuse, and the connection stays in text mode.
+ *
+ * \see HyperSendFrame
+ * \see HyperReceiveFrame
+ */
+HYPERLIB
+HYPERSTATUS
+HyperNegotiateFraming(
+    const SOCKET        sock
+);
+
+/*!
+ * \brief Send a frame to connection
+ *
+ * Sends a frame header followed by its payload. Small frames go out with a
+ * single send.
+ *
+ * \param[in]   sock            SOCKET object to send to
+ * \param[in]   ucType          One of the HYPER_FRAME_* types
+ * \param[in]   ucFlags         HYPER_FRAME_FLAG_* bitmask
+ * \param[in]   usStatus        Status code, 0 for commands
+ * \param[in]   lpPayload       Payload, may be NULL if ullLength is 0
+ * \param[in]   ullLength       Payload length in bytes
+ *
+ * \result Returns HYPER_SUCCESS if successful, else returns HYPER_FAILED
+ *
+ * \see HyperReceiveFrame
+ */
+HYPERLIB
+HYPERSTATUS
+HyperSendFrame(
+    const SOCKET        sock,
+    const unsigned char ucType,
+    const unsigned char ucFlags,
+    const unsigned short usStatus,
+    const void          *lpPayload,
+    const unsigned long long ullLength
+);
+
+/*!
+ * \brief Receive a frame header from connection
+ *
+ * Receives and decodes the next frame header. The ullLength payload bytes 
+ * that follow are left in the socket for the caller.
+ *
+ * \param[in]   sock            SOCKET object to receive from
+ * \param[out]  frame           Decoded frame header
+ *
+ * \result Returns HYPER_SUCCESS if successful, else returns HYPER_FAILED
+ *
+ * \see HyperSendFrame
+ */
+HYPERLIB
+HYPERSTATUS
+HyperReceiveFrame(
+    const SOCKET        sock,
+    PHYPER_FRAME        frame
+);
+
+/*!
+ * \brief Update a CRC32C (Castagnoli) checksum
+ *
+ * Portable table-driven CRC32C, the checksum the server sends in
+ * HYPER_FRAME_CHECKSUM frames and with HASH. Start from 0 and feed the data
+ * in as many pieces as convenient.
+ *
+ * \param[in]   uiCrc           CRC of the data so far, 0 to start
+ * \param[in]   lpData          Next piece of data
+ * \param[in]   stLength        Length of lpData in bytes
+ *
+ * \result Returns the CRC of everything fed in so far
+ */
+HYPERLIB
+unsigned int
+HyperCrc32c(
+    unsigned int        uiCrc,
+    const void          *lpData,
+    size_t              stLength
+);
+
+/*!
+ * \brief Rolling checksum of one block, as used in SYNC signatures
+ *
+ * Adler-style sums a (of every byte) and b (of every running a), packed as
+ * (a & 0xffff) | (b << 16). Sliding the block one byte along only takes a
+ * couple of additions, which is what lets the server search for blocks at
+ * every offset.
+ *
+ * \param[in]   lpData          Block to checksum
+ * \param[in]   stLength        Block size in bytes
+ *
+ * \result Returns the packed checksum
+ */
+HYPERLIB
+unsigned int
+HyperRollingChecksum(
+    const void          *lpData,
+    size_t              stLength
+);
+
+/*!
+ * \brief Bring a local file up to date with a remote one, sending only changes
+ *
+ * Sends "SYNC <cpRemotePath> <block size> <blocks>" followed by a signature
+ * of every full block of cpLocalPath, a rolling checksum and a CRC32C each.
+ * The server answers with a delta of HYPER_SYNC_COPY instructions for blocks
+ * the local file already has and HYPER_SYNC_LITERAL bytes for everything else.
+ * The result is built in "<cpLocalPath>.sync", checked against the size and
+ * CRC32C in HYPER_SYNC_END and then renamed over cpLocalPath. A missing local
+ * file simply downloads the whole thing.
+ *
+ * \param[in]  sockServer   Open, connected socket to a Hyper Server
+ * \param[in]  cpRemotePath Path of the file on the server
+ * \param[in]  cpLocalPath  Local file to update or create
+ * \param[in]  stBlockSize  Block size, 0 for HYPER_SYNC_BLOCK_SIZE. Doubled as
+ *                          needed to stay within HYPER_SYNC_MAX_BLOCKS.
+ * \param[out] status       Optional, status code returned by the server
+ * \param[out] ullLiteral   Optional, bytes that had to come over the network
+ *
+ * \result Returns HYPER_SUCCESS if successful. If something fails, returns
+ *      HYPER_FAILED and cpLocalPath is left untouched.
+ *
+ * \remarks Text mode only. If the delta fails after a 200 status the
+ *      connection is out of step and should be closed.
+ *
+ * \see HyperResumeDownload
+ */
+HYPERLIB
+HYPERSTATUS
+HyperSyncFile(
+    const SOCKET        sockServer,
+    const char          *cpRemotePath,
+    const char          *cpLocalPath,
+    size_t              stBlockSize,
+    unsigned short      *status,
+    unsigned long long  *ullLiteral
+);
+
+/*!
+ * \brief Fetch chunks from a server's chunk store by id
+ *
+ * Sends "FETCH <uiCount>" followed by the ids, typically the ones from a
+ * CHUNKS listing that a client doesn't already have, and streams the chunks
+ * to callback in the order asked for. The lengths from the listing tell
+ * where one chunk ends and the next begins.
+ *
+ * \param[in]  sockServer   Open, connected socket to a Hyper Server
+ * \param[in]  ucIds        uiCount ids of HYPER_CHUNK_ID_SIZE bytes each
+ * \param[in]  uiCount      Number of ids, at most HYPER_FETCH_MAX_CHUNKS
+ * \param[in]  callback     Called with every block received
+ * \param[in]  lpContext    Passed through to callback
+ * \param[out] status       Optional, status code returned by the server. 404
+ *                          if any id is unknown, 501 without a chunk store.
+ *
+ * \result Returns HYPER_SUCCESS if successful. If something fails, returns
+ *      HYPER_FAILED.
+ *
+ * \see HyperReceiveStream
+ */
+HYPERLIB
+HYPERSTATUS
+HyperFetchChunks(
+    const SOCKET        sockServer,
+    const unsigned char *ucIds,
+    unsigned int        uiCount,
+    HYPER_RECEIVE_CALLBACK callback,
+    void                *lpContext,
+    unsigned short      *status
+);
+
 #ifdef HYPER_IMPLEMENTATION
 
 HYPERLIB
@@ -658,104 +1184,558 @@ HyperReceiveFile(
     void                **lpBuffer, 
     unsigned long       *ulSize)
 {
-    HYPERSTATUS iResult = 0;
-
     unsigned long ulFileSize = 0;
-	unsigned long ulWrittenSize = 0;
-	unsigned long ulBytesWritten = 0;
     void *data = NULL;
 
-    char cpSizeBuf[1024];
+    char cpSizeBuf[FILESIZE_BUFFER_SIZE];
     memset(cpSizeBuf, 0, sizeof(cpSizeBuf));
 
-	// Recieve file size from server
-	recv(sockServer, cpSizeBuf, sizeof(cpSizeBuf), 0);
-	ulFileSize = strtoull(cpSizeBuf, 0, 10);
-
-    // If data is less than a block size long, lets not bloat the size lol
-    if (ulFileSize < RECV_BLOCK_SIZE)
-    {
-        HyperMemAlloc(&data, ulFileSize);
-        
-        recv(sockServer, (char*)data, ulFileSize, 0);
-        
-        *lpBuffer = data;
-        *ulSize = ulFileSize;
-        return HYPER_SUCCESS;
-    }
+    // Recieve file size from server
+    if (HyperReceiveAll(sockServer, cpSizeBuf, sizeof(cpSizeBuf)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    cpSizeBuf[sizeof(cpSizeBuf) - 1] = 0;
+    ulFileSize = strtoul(cpSizeBuf, 0, 10);
 
     // Prevent integer overflow leading to heap overflow, thx zenpai *_*
-    if (ulFileSize >= ULONG_MAX-RECV_BLOCK_SIZE)
+    if (ulFileSize == ULONG_MAX)
         return HYPER_FAILED;
 
-    // Allocate data buffer
-    iResult = HyperMemAlloc(&data, ulFileSize + RECV_BLOCK_SIZE);
-    if (iResult == HYPER_FAILED)
+    // Exactly the file, one spare byte so an empty file still allocates
+    if (HyperMemAlloc(&data, ulFileSize + 1) != HYPER_SUCCESS)
         return HYPER_FAILED;
 
-	// Recieve binary data from server, and write to buffer.
-	while (ulWrittenSize < ulFileSize)
-	{
-        ulBytesWritten = recv(sockServer, (char*)(data) + ulWrittenSize, RECV_BLOCK_SIZE, 0);
-
-		// If we have recieved final bit of data, finish writing and break.
-		if (ulWrittenSize > ulFileSize)
-            break;
-		else
-		    ulWrittenSize += ulBytesWritten;
-	}
+    // Straight into place, each recv takes whatever the socket has buffered
+    if (HyperReceiveAll(sockServer, data, ulFileSize) != HYPER_SUCCESS)
+    {
+        HyperMemFree(data);
+        return HYPER_FAILED;
+    }
 
-    // Set input buffer to recieved data.
     *lpBuffer = data;
-    
-    // Set ulSize to ulFileSize.
-	*ulSize = ulFileSize;
+    *ulSize = ulFileSize;
 
-    return 0;
+    return HYPER_SUCCESS;
 }
 
 HYPERLIB
 HYPERSTATUS
-HyperReadFile(
-    const char          *cpFilePath,
-    HYPERFILE           *lpBuffer,
-    size_t              *lpFileSize)
+HyperReceiveAll(
+    const SOCKET        sock,
+    void                *lpBuffer,
+    size_t              stLength)
 {
-    HYPERSTATUS iResult = 0;
-    HYPERFILE data = NULL;
-    size_t stBytesRead = 0;
-    
-#ifdef _WIN32
-    HANDLE hFile = 0;
-    LARGE_INTEGER liFileSize = {0};
-    DWORD dwLength = 0;
-
-    hFile = CreateFileA(
-            cpFilePath,     /* lpFileName */ 
-            GENERIC_READ,   /* dwDesiredAccess */
-            0,              /* dwShareMode */
-            0,              /* lpSecurityAttributes */
-            OPEN_EXISTING,  /* dwCreationDisposition */
-            FILE_ATTRIBUTE_READONLY,    /* dwFlagsAndAttributes */
-            0               /* hTemplateFile */
-    );
-    if (hFile == NULL)
-        return HYPER_FAILED;
+    size_t stReceived = 0;
+    int iResult = 0;
 
-    /* Get file size */
-    iResult = GetFileSizeEx(hFile, &liFileSize);
-    if (iResult == NULL)
+    while (stReceived < stLength)
     {
-        CloseHandle(hFile);
-        return HYPER_FAILED;
+        // recv() reports its length as an int
+        iResult = recv(sock, (char*)lpBuffer + stReceived,
+                stLength - stReceived > INT_MAX ? INT_MAX : stLength - stReceived, 0);
+        if (iResult == SOCKET_ERROR || iResult == CONNECTION_CLOSED)
+        {
+#ifndef _WIN32
+            if (iResult == SOCKET_ERROR && errno == EINTR)
+                continue;
+#endif
+            return HYPER_FAILED;
+        }
+
+        stReceived += iResult;
     }
 
-    dwLength = liFileSize.QuadPart;
+    return HYPER_SUCCESS;
+}
 
-    /* Allocate Memory */
-    iResult = HyperMemAlloc(&data, dwLength);
-    if (iResult == HYPER_FAILED)
-    {
+HYPERLIB
+HYPERSTATUS
+HyperReceiveStream(
+    const SOCKET        sock,
+    const unsigned long long ullLength,
+    HYPER_RECEIVE_CALLBACK callback,
+    void                *lpContext,
+    size_t              stBlockSize,
+    unsigned long long  *ullReceived)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    unsigned long long ullDone = 0;
+    void *lpBlock = NULL;
+    int iBytesReceived = 0;
+    int bAdaptive = (stBlockSize == 0);
+    unsigned int uiCalls = 0;
+    size_t stResize = 0;
+
+    if (ullReceived)
+        *ullReceived = 0;
+
+    if (callback == NULL)
+        return HYPER_BAD_PARAMETER;
+
+    if (ullLength == 0)
+        return HYPER_SUCCESS;
+
+    if (bAdaptive)
+        stBlockSize = HyperTransferBlockSize(sock, ullLength, 1);
+
+    // recv() reports its length as an int
+    if (stBlockSize > INT_MAX)
+        stBlockSize = INT_MAX;
+
+    if (HyperMemAlloc(&lpBlock, stBlockSize) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    while (ullDone < ullLength)
+    {
+        // The window grows as the transfer goes, let the buffer follow it
+        if (bAdaptive && ++uiCalls % HYPER_TRANSFER_RESIZE_CALLS == 0)
+        {
+            stResize = HyperTransferBlockSize(sock, ullLength - ullDone, 1);
+            if (stResize > stBlockSize && HyperMemRealloc(&lpBlock, stResize) == HYPER_SUCCESS)
+                stBlockSize = stResize;
+        }
+
+        // Never ask for more than is left, the next message follows right after
+        iBytesReceived = recv(sock, (char*)lpBlock,
+                ullLength - ullDone < stBlockSize ? (size_t)(ullLength - ullDone) : stBlockSize, 0);
+        if (iBytesReceived == SOCKET_ERROR || iBytesReceived == CONNECTION_CLOSED)
+        {
+#ifndef _WIN32
+            if (iBytesReceived == SOCKET_ERROR && errno == EINTR)
+                continue;
+#endif
+            hsResult = HYPER_FAILED;
+            break;
+        }
+
+        if (callback(lpBlock, (size_t)iBytesReceived, lpContext) != HYPER_SUCCESS)
+        {
+            hsResult = HYPER_FAILED;
+            break;
+        }
+
+        ullDone += iBytesReceived;
+    }
+
+    HyperMemFree(lpBlock);
+
+    if (ullReceived)
+        *ullReceived = ullDone;
+
+    return hsResult;
+}
+
+HYPERLIB
+size_t
+HyperTransferBlockSize(
+    const SOCKET        sock,
+    const unsigned long long ullRemaining,
+    const int           bReceive)
+{
+    size_t stTarget = 0;
+    size_t stBlock = HYPER_TRANSFER_MIN_BLOCK;
+    int iBuffer = 0;
+    SOCKLEN slLength = sizeof(iBuffer);
+#if defined(__linux__) && defined(TCP_INFO)
+    struct tcp_info info;
+    SOCKLEN slInfo = sizeof(info);
+    size_t stFlight = 0;
+#endif
+
+    if (getsockopt(sock, SOL_SOCKET, bReceive ? SO_RCVBUF : SO_SNDBUF,
+                (char*)&iBuffer, &slLength) == 0 && iBuffer > 0)
+    {
+        stTarget = (size_t)iBuffer;
+#ifdef __linux__
+        // Linux reports twice the payload it will hold, the rest is overhead
+        stTarget /= 2;
+#endif
+    }
+
+#if defined(__linux__) && defined(TCP_INFO)
+    // One round trip of data, only meaningful once an RTT has been measured
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &slInfo) == 0 && info.tcpi_rtt)
+    {
+        stFlight = bReceive ? info.tcpi_rcv_space : (size_t)info.tcpi_snd_cwnd * info.tcpi_snd_mss;
+        if (stFlight > stTarget)
+            stTarget = stFlight;
+    }
+#endif
+
+    if (stTarget == 0)
+        stTarget = RECV_STREAM_BLOCK_SIZE;
+
+    while (stBlock < stTarget && stBlock < HYPER_TRANSFER_MAX_BLOCK)
+        stBlock <<= 1;
+
+    // Small transfers don't need a big buffer
+    if (ullRemaining && ullRemaining < stBlock)
+        stBlock = (size_t)ullRemaining;
+
+    return stBlock;
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperSetSocketBuffers(
+    const SOCKET        sock,
+    const size_t        stSendBuffer,
+    const size_t        stReceiveBuffer)
+{
+    int iSize = 0;
+
+    if (stSendBuffer)
+    {
+        iSize = stSendBuffer > INT_MAX ? INT_MAX : (int)stSendBuffer;
+#ifdef SO_SNDBUFFORCE
+        if (setsockopt(sock, SOL_SOCKET, SO_SNDBUFFORCE, (char*)&iSize, sizeof(iSize)) == SOCKET_ERROR)
+#endif
+        if (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char*)&iSize, sizeof(iSize)) == SOCKET_ERROR)
+            return HYPER_FAILED;
+    }
+
+    if (stReceiveBuffer)
+    {
+        iSize = stReceiveBuffer > INT_MAX ? INT_MAX : (int)stReceiveBuffer;
+#ifdef SO_RCVBUFFORCE
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, (char*)&iSize, sizeof(iSize)) == SOCKET_ERROR)
+#endif
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char*)&iSize, sizeof(iSize)) == SOCKET_ERROR)
+            return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+/* Where the next block of a HyperReceiveToFile goes */
+typedef struct _HYPER_FILE_SINK
+{
+    HYPERFD             fd;
+    unsigned long long  ullPosition;
+} HYPER_FILE_SINK, * PHYPER_FILE_SINK;
+
+HYPERLIB
+HYPERSTATUS
+HyperWriteBlock(
+    const void          *lpBlock,
+    size_t              stLength,
+    void                *lpContext)
+{
+    PHYPER_FILE_SINK sink = (PHYPER_FILE_SINK)lpContext;
+#ifdef _WIN32
+    LARGE_INTEGER liOffset = {0};
+    DWORD dwBytesWritten = 0;
+
+    liOffset.QuadPart = sink->ullPosition;
+    if (!SetFilePointerEx(sink->fd, liOffset, NULL, FILE_BEGIN) ||
+        !WriteFile(sink->fd, lpBlock, (DWORD)stLength, &dwBytesWritten, NULL) ||
+        dwBytesWritten != (DWORD)stLength)
+        return HYPER_FAILED;
+
+    sink->ullPosition += stLength;
+#else
+    ssize_t sWritten = 0;
+
+    // Disks can take less than they were given too
+    while (stLength)
+    {
+        sWritten = pwrite(sink->fd, lpBlock, stLength, (off_t)sink->ullPosition);
+        if (sWritten == -1 && errno == EINTR)
+            continue;
+        if (sWritten <= 0)
+            return HYPER_FAILED;
+
+        lpBlock = (const char*)lpBlock + sWritten;
+        stLength -= sWritten;
+        sink->ullPosition += sWritten;
+    }
+#endif
+
+    return HYPER_SUCCESS;
+}
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+/* Splice a socket into a file through a pipe. Returns HYPER_SUCCESS when
+   ullLength bytes are in, HYPER_FAILED on a broken connection or file, and
+   HYPER_BAD_PARAMETER when splice isn't usable and the rest should be copied */
+HYPERLIB
+HYPERSTATUS
+HyperSpliceToFile(
+    const SOCKET        sock,
+    PHYPER_FILE_SINK    sink,
+    const unsigned long long ullLength,
+    size_t              stBlockSize,
+    unsigned long long  *ullDone)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    int pipeFds[2] = { -1, -1 };
+    ssize_t sIn = 0;
+    ssize_t sOut = 0;
+    size_t stPiped = 0;
+    loff_t offPosition = 0;
+    int bCopyOut = 0;
+    char cpDrain[RECV_BLOCK_SIZE];
+
+    if (pipe2(pipeFds, O_CLOEXEC) == -1)
+        return HYPER_BAD_PARAMETER;
+
+    // Bigger pipe, fewer round trips; the kernel rounds up or refuses
+    fcntl(pipeFds[1], F_SETPIPE_SZ, (int)stBlockSize);
+
+    while (*ullDone < ullLength)
+    {
+        sIn = splice(sock, NULL, pipeFds[1], NULL,
+                ullLength - *ullDone < stBlockSize ? (size_t)(ullLength - *ullDone) : stBlockSize,
+                SPLICE_F_MOVE);
+        if (sIn == -1 && errno == EINTR)
+            continue;
+
+        // Nothing was taken off the socket, so the caller can just recv() instead
+        if (sIn == -1 && (errno == EINVAL || errno == ENOSYS))
+        {
+            hsResult = HYPER_BAD_PARAMETER;
+            break;
+        }
+
+        if (sIn <= 0)
+        {
+            hsResult = HYPER_FAILED;
+            break;
+        }
+
+        // A short splice is fine, move along whatever arrived
+        stPiped = (size_t)sIn;
+        while (stPiped)
+        {
+            offPosition = (loff_t)sink->ullPosition;
+            sOut = splice(pipeFds[0], NULL, sink->fd, &offPosition, stPiped, SPLICE_F_MOVE);
+            if (sOut == -1 && errno == EINTR)
+                continue;
+
+            // The file won't take a splice, copy out what's already in the pipe
+            if ((sOut == -1 && errno == EINVAL) || bCopyOut)
+            {
+                bCopyOut = 1;
+                sOut = read(pipeFds[0], cpDrain, stPiped < sizeof(cpDrain) ? stPiped : sizeof(cpDrain));
+                if (sOut <= 0 || HyperWriteBlock(cpDrain, (size_t)sOut, sink) != HYPER_SUCCESS)
+                {
+                    hsResult = HYPER_FAILED;
+                    break;
+                }
+
+                *ullDone += sOut;
+                stPiped -= sOut;
+                continue;
+            }
+
+            if (sOut <= 0)
+            {
+                hsResult = HYPER_FAILED;
+                break;
+            }
+
+            sink->ullPosition += sOut;
+            *ullDone += sOut;
+            stPiped -= sOut;
+        }
+
+        if (hsResult != HYPER_SUCCESS)
+            break;
+
+        // Pipe is empty again, let the caller copy the rest
+        if (bCopyOut)
+        {
+            hsResult = HYPER_BAD_PARAMETER;
+            break;
+        }
+    }
+
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+
+    return hsResult;
+}
+#endif
+
+HYPERLIB
+HYPERSTATUS
+HyperReceiveToFile(
+    const SOCKET        sock,
+    HYPERFD             fd,
+    const unsigned long long ullOffset,
+    const unsigned long long ullLength,
+    size_t              stBlockSize,
+    unsigned long long  *ullReceived)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    HYPER_FILE_SINK sink = { fd, ullOffset };
+    unsigned long long ullDone = 0;
+    unsigned long long ullRest = 0;
+
+    if (ullReceived)
+        *ullReceived = 0;
+
+    // The splice pipe is sized once, so pick it up front
+    if (stBlockSize == 0)
+        stBlockSize = HyperTransferBlockSize(sock, ullLength, 1);
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+    hsResult = HyperSpliceToFile(sock, &sink, ullLength, stBlockSize, &ullDone);
+    if (hsResult != HYPER_BAD_PARAMETER)
+    {
+        if (ullReceived)
+            *ullReceived = ullDone;
+        return hsResult;
+    }
+#endif
+
+    // Plain copy through one block
+    hsResult = HyperReceiveStream(sock, ullLength - ullDone, HyperWriteBlock, &sink,
+            stBlockSize, &ullRest);
+
+    if (ullReceived)
+        *ullReceived = ullDone + ullRest;
+
+    return hsResult;
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperReceiveFileAt(
+    const SOCKET        sockServer,
+    const char          *cpFilePath,
+    const unsigned long long ullOffset,
+    unsigned long long  *ullReceived)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    unsigned long long ullFileSize = 0;
+
+    char cpSizeBuf[FILESIZE_BUFFER_SIZE];
+    memset(cpSizeBuf, 0, sizeof(cpSizeBuf));
+
+    if (ullReceived)
+        *ullReceived = 0;
+
+    if (cpFilePath == NULL)
+        return HYPER_BAD_PARAMETER;
+
+    // Receive range size from server
+    if (HyperReceiveAll(sockServer, cpSizeBuf, sizeof(cpSizeBuf)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    cpSizeBuf[sizeof(cpSizeBuf) - 1] = 0;
+    ullFileSize = strtoull(cpSizeBuf, 0, 10);
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(
+            cpFilePath,     /* lpFileName */ 
+            GENERIC_WRITE,  /* dwDesiredAccess */
+            0,              /* dwShareMode */
+            0,              /* lpSecurityAttributes */
+            OPEN_ALWAYS,    /* dwCreationDisposition */
+            FILE_ATTRIBUTE_NORMAL,    /* dwFlagsAndAttributes */
+            0               /* hTemplateFile */
+    );
+    if (hFile == INVALID_HANDLE_VALUE)
+        return HYPER_FAILED;
+
+    hsResult = HyperReceiveToFile(sockServer, hFile, ullOffset, ullFileSize, 0, ullReceived);
+
+    CloseHandle(hFile);
+#else
+    int fd = open(cpFilePath, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        return HYPER_FAILED;
+
+    hsResult = HyperReceiveToFile(sockServer, fd, ullOffset, ullFileSize, 0, ullReceived);
+
+    close(fd);
+#endif
+
+    return hsResult;
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperResumeDownload(
+    const SOCKET        sockServer,
+    const char          *cpRemotePath,
+    const char          *cpLocalPath,
+    unsigned short      *status)
+{
+    unsigned long long ullOffset = 0;
+    unsigned short usStatus = 0;
+    char cpCommand[MAX_COMMAND_LENGTH];
+
+#ifdef _WIN32
+    struct _stat64 st = {0};
+    if (_stat64(cpLocalPath, &st) == 0)
+        ullOffset = st.st_size;
+#else
+    struct stat st = {0};
+    if (stat(cpLocalPath, &st) == 0)
+        ullOffset = st.st_size;
+#endif
+
+    if (snprintf(cpCommand, sizeof(cpCommand), "SEND %s %llu", cpRemotePath, ullOffset) >= (int)sizeof(cpCommand))
+        return HYPER_BAD_PARAMETER;
+
+    if (HyperSendCommand(sockServer, cpCommand) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (HyperReceiveStatus(sockServer, &usStatus) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (status)
+        *status = usStatus;
+
+    if (usStatus != 200)
+        return HYPER_FAILED;
+
+    return HyperReceiveFileAt(sockServer, cpLocalPath, ullOffset, NULL);
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperReadFile(
+    const char          *cpFilePath,
+    HYPERFILE           *lpBuffer,
+    size_t              *lpFileSize)
+{
+    HYPERSTATUS iResult = 0;
+    HYPERFILE data = NULL;
+    size_t stBytesRead = 0;
+    
+#ifdef _WIN32
+    HANDLE hFile = 0;
+    LARGE_INTEGER liFileSize = {0};
+    DWORD dwLength = 0;
+
+    hFile = CreateFileA(
+            cpFilePath,     /* lpFileName */ 
+            GENERIC_READ,   /* dwDesiredAccess */
+            0,              /* dwShareMode */
+            0,              /* lpSecurityAttributes */
+            OPEN_EXISTING,  /* dwCreationDisposition */
+            FILE_ATTRIBUTE_READONLY,    /* dwFlagsAndAttributes */
+            0               /* hTemplateFile */
+    );
+    if (hFile == NULL)
+        return HYPER_FAILED;
+
+    /* Get file size */
+    iResult = GetFileSizeEx(hFile, &liFileSize);
+    if (iResult == NULL)
+    {
+        CloseHandle(hFile);
+        return HYPER_FAILED;
+    }
+
+    dwLength = liFileSize.QuadPart;
+
+    /* Allocate Memory */
+    iResult = HyperMemAlloc(&data, dwLength);
+    if (iResult == HYPER_FAILED)
+    {
         CloseHandle(hFile);
         return HYPER_FAILED;
     }
@@ -897,6 +1877,93 @@ HyperWriteFile(
     return HYPER_SUCCESS;
 }
 
+/* Send a header and the body behind it, both in the same call where possible */
+HYPERLIB
+HYPERSTATUS
+HyperSendGather(
+    const SOCKET        sock,
+    const void          *lpHead,
+    size_t              stHead,
+    const void          *lpBody,
+    unsigned long long  ullBody)
+{
+    const char *cpHead = (const char*)lpHead;
+    const char *cpBody = (const char*)lpBody;
+    size_t stPiece = 0;
+    long long llSent = 0;
+#ifdef _WIN32
+    WSABUF buffers[2];
+    DWORD dwCount = 0;
+    DWORD dwSent = 0;
+#else
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    int iCount = 0;
+#endif
+
+    while (stHead || ullBody)
+    {
+        stPiece = ullBody > INT_MAX ? INT_MAX : (size_t)ullBody;
+
+#ifdef _WIN32
+        dwCount = 0;
+        if (stHead)
+        {
+            buffers[dwCount].buf = (char*)cpHead;
+            buffers[dwCount++].len = (ULONG)stHead;
+        }
+        if (stPiece)
+        {
+            buffers[dwCount].buf = (char*)cpBody;
+            buffers[dwCount++].len = (ULONG)stPiece;
+        }
+
+        if (WSASend(sock, buffers, dwCount, &dwSent, 0, NULL, NULL) == SOCKET_ERROR)
+            return HYPER_FAILED;
+        llSent = dwSent;
+#else
+        iCount = 0;
+        if (stHead)
+        {
+            iov[iCount].iov_base = (void*)cpHead;
+            iov[iCount++].iov_len = stHead;
+        }
+        if (stPiece)
+        {
+            iov[iCount].iov_base = (void*)cpBody;
+            iov[iCount++].iov_len = stPiece;
+        }
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iCount;
+
+        llSent = sendmsg(sock, &msg, 0);
+        if (llSent == SOCKET_ERROR)
+        {
+            if (errno == EINTR)
+                continue;
+            return HYPER_FAILED;
+        }
+#endif
+        if (llSent == 0)
+            return HYPER_FAILED;
+
+        // Partial sends can end anywhere, even inside the header
+        if ((size_t)llSent < stHead)
+        {
+            cpHead += llSent;
+            stHead -= (size_t)llSent;
+            continue;
+        }
+
+        llSent -= stHead;
+        stHead = 0;
+        cpBody += llSent;
+        ullBody -= llSent;
+    }
+
+    return HYPER_SUCCESS;
+}
+
 HYPERLIB
 HYPERSTATUS 
 HyperSendFile(
@@ -904,43 +1971,15 @@ HyperSendFile(
     HYPERFILE           *lpBuffer, 
     const unsigned long ulSize)
 {
-    HYPERSTATUS iResult = 0;
-    unsigned long ulSentSize = 0;
-    unsigned long ulBytesSent = 0;
-    
     char fileSizeBuffer[FILESIZE_BUFFER_SIZE];
     memset(fileSizeBuffer, 0, FILESIZE_BUFFER_SIZE);
 
-    // Add extra block due to memcpy scaring me
-    iResult = HyperMemRealloc(lpBuffer, ulSize + SEND_BLOCK_SIZE);
-    if (iResult == HYPER_FAILED)
-        return HYPER_FAILED;
-
-    // Send File Size to Peer
     snprintf(fileSizeBuffer, FILESIZE_BUFFER_SIZE, "%lu", ulSize);
-    ulBytesSent = send(sockServer, fileSizeBuffer, FILESIZE_BUFFER_SIZE, 0);
-    if ((int)ulBytesSent == SOCKET_ERROR)
-        return SOCKET_ERROR;
-  
-    // If data is less than a block size long, lets not bloat the size lol
-    if (ulSize < SEND_BLOCK_SIZE)
-    {
-        send(sockServer, (char*)(*lpBuffer), ulSize, 0);
-        return HYPER_SUCCESS;
-    }
 
-    // Begin Sending file
-    while(ulSentSize < ulSize)
-    {
-        // Copy data from buffer into block
-        ulBytesSent = send(sockServer, (char*)(*lpBuffer)+ulSentSize, SEND_BLOCK_SIZE, 0);
-        
-        if ((int)ulBytesSent == SOCKET_ERROR)
-            return SOCKET_ERROR;
-        else
-            ulSentSize += ulBytesSent;
-    }
-    
+    // Size and contents leave together, no small write waits on Nagle
+    if (HyperSendGather(sockServer, fileSizeBuffer, FILESIZE_BUFFER_SIZE, *lpBuffer, ulSize) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
     return HYPER_SUCCESS;
 }
 
@@ -1049,6 +2088,16 @@ HYPERSTATUS
 HyperStartServer(
     SOCKET              *sock, 
     const unsigned short usPort)
+{
+    return HyperStartServerEx(sock, usPort, 0);
+}
+
+HYPERLIB
+HYPERSTATUS 
+HyperStartServerEx(
+    SOCKET              *sock, 
+    const unsigned short usPort,
+    const int           iFlags)
 {
     SOCKADDR_IN sin = {0};
     SOCKET temp = 0;
@@ -1070,6 +2119,20 @@ HyperStartServer(
         return SOCKET_ERROR;
     }
 
+#ifdef SO_REUSEPORT
+    // Every worker binds its own socket to the same port
+    if (iFlags & HYPER_SERVER_REUSEPORT)
+    {
+        iResult = setsockopt(temp, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+        if (iResult == SOCKET_ERROR)
+        {
+            HyperCloseSocket(temp);
+            HyperSocketCleanup();
+            return SOCKET_ERROR;
+        }
+    }
+#endif
+
     // Set Server IP and Port
     // 0.0.0.0 == Bind to both local and public IPs
     sin.sin_family = AF_INET;
@@ -1137,13 +2200,11 @@ HyperSendCommand(
     const SOCKET        sock, 
     const char          *szCommand)
 {
-    HYPERSTATUS iResult = 0;
-
     if (!szCommand)
         return HYPER_BAD_PARAMETER;
 
-    iResult = send(sock, szCommand, strlen(szCommand), 0);
-    if (iResult == SOCKET_ERROR || iResult == CONNECTION_CLOSED)
+    // One send for both, a lone newline segment would cost the server a wakeup
+    if (HyperSendGather(sock, szCommand, strlen(szCommand), "\n", 1) != HYPER_SUCCESS)
         return SOCKET_ERROR;
 
     return HYPER_SUCCESS;
@@ -1156,7 +2217,7 @@ HyperSendStatus(
     const unsigned short status)
 {
     HYPERSTATUS hsResult = 0;
-    char buffer[255];
+    char buffer[STATUS_BUFFER_SIZE];
     memset(buffer, 0, sizeof(buffer));
 
     if (!sock)
@@ -1179,15 +2240,16 @@ HyperReceiveStatus(
 {
     HYPERSTATUS hsResult = 0;
     unsigned short temp = 0;
-    char buffer[255];
+    char buffer[STATUS_BUFFER_SIZE];
     memset(buffer, 0, sizeof(buffer));
 
     if (!sock || !status)
         return HYPER_BAD_PARAMETER;
 
-    hsResult = recv(sock, buffer, sizeof(buffer), 0);
-    if (hsResult == SOCKET_ERROR || hsResult == CONNECTION_CLOSED)
+    hsResult = HyperReceiveAll(sock, buffer, sizeof(buffer));
+    if (hsResult != HYPER_SUCCESS)
         return HYPER_FAILED;
+    buffer[sizeof(buffer) - 1] = 0;
 
     temp = (unsigned short)strtoul(buffer, NULL, 10);
 
@@ -1196,6 +2258,533 @@ HyperReceiveStatus(
     return HYPER_SUCCESS;
 }
 
+HYPERLIB
+void
+HyperEncodeFrame(
+    const HYPER_FRAME   *frame,
+    unsigned char       *lpHeader)
+{
+    lpHeader[0] = HYPER_FRAME_MAGIC;
+    lpHeader[1] = frame->ucVersion;
+    lpHeader[2] = frame->ucType;
+    lpHeader[3] = frame->ucFlags;
+    lpHeader[4] = (unsigned char)(frame->usStatus >> 8);
+    lpHeader[5] = (unsigned char)(frame->usStatus);
+    lpHeader[6] = 0;
+    lpHeader[7] = 0;
+
+    for (int i = 0; i < 8; i++)
+        lpHeader[8 + i] = (unsigned char)(frame->ullLength >> (56 - 8 * i));
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperDecodeFrame(
+    const unsigned char *lpHeader,
+    PHYPER_FRAME        frame)
+{
+    if (lpHeader[0] != HYPER_FRAME_MAGIC || lpHeader[1] != HYPER_FRAME_VERSION)
+        return HYPER_BAD_PARAMETER;
+
+    frame->ucVersion = lpHeader[1];
+    frame->ucType = lpHeader[2];
+    frame->ucFlags = lpHeader[3];
+    frame->usStatus = (unsigned short)((lpHeader[4] << 8) | lpHeader[5]);
+    frame->ullLength = 0;
+
+    for (int i = 0; i < 8; i++)
+        frame->ullLength = (frame->ullLength << 8) | lpHeader[8 + i];
+
+    return HYPER_SUCCESS;
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperNegotiateFraming(
+    const SOCKET        sock)
+{
+    unsigned short usStatus = 0;
+    char cpHello[32];
+
+    snprintf(cpHello, sizeof(cpHello), "HELLO %d", HYPER_FRAME_VERSION);
+
+    if (HyperSendCommand(sock, cpHello) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (HyperReceiveStatus(sock, &usStatus) != HYPER_SUCCESS || usStatus != 200)
+        return HYPER_FAILED;
+
+    return HYPER_SUCCESS;
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperSendFrame(
+    const SOCKET        sock,
+    const unsigned char ucType,
+    const unsigned char ucFlags,
+    const unsigned short usStatus,
+    const void          *lpPayload,
+    const unsigned long long ullLength)
+{
+    HYPER_FRAME frame = {0};
+    unsigned char buffer[HYPER_FRAME_HEADER_SIZE];
+
+    frame.ucVersion = HYPER_FRAME_VERSION;
+    frame.ucType = ucType;
+    frame.ucFlags = ucFlags;
+    frame.usStatus = usStatus;
+    frame.ullLength = ullLength;
+    HyperEncodeFrame(&frame, buffer);
+
+    if (HyperSendGather(sock, buffer, HYPER_FRAME_HEADER_SIZE, lpPayload, ullLength) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    return HYPER_SUCCESS;
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperReceiveFrame(
+    const SOCKET        sock,
+    PHYPER_FRAME        frame)
+{
+    unsigned char buffer[HYPER_FRAME_HEADER_SIZE];
+
+    if (!frame)
+        return HYPER_BAD_PARAMETER;
+
+    if (HyperReceiveAll(sock, buffer, sizeof(buffer)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (HyperDecodeFrame(buffer, frame) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    return HYPER_SUCCESS;
+}
+
+HYPERLIB
+unsigned int
+HyperCrc32c(
+    unsigned int        uiCrc,
+    const void          *lpData,
+    size_t              stLength)
+{
+    // Reflected polynomial 0x82F63B78
+    static const unsigned int crcTable[256] = {
+        0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+        0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+        0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+        0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+        0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+        0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+        0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+        0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+        0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+        0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+        0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+        0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+        0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+        0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+        0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+        0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+        0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+        0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+        0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+        0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+        0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+        0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+        0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+        0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+        0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+        0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+        0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+        0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+        0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+        0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+        0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+        0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+        0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+        0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+        0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+        0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+        0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+        0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+        0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+        0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+        0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+        0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+        0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+    };
+    const unsigned char *lpBytes = (const unsigned char*)lpData;
+
+    uiCrc = ~uiCrc;
+    while (stLength--)
+        uiCrc = crcTable[(uiCrc ^ *lpBytes++) & 0xff] ^ (uiCrc >> 8);
+
+    return ~uiCrc & 0xffffffff;
+}
+
+HYPERLIB
+unsigned int
+HyperRollingChecksum(
+    const void          *lpData,
+    size_t              stLength)
+{
+    const unsigned char *lpBytes = (const unsigned char*)lpData;
+    unsigned int a = 0;
+    unsigned int b = 0;
+
+    while (stLength--)
+    {
+        a += *lpBytes++;
+        b += a;
+    }
+
+    return (a & 0xffff) | (b << 16);
+}
+
+/* Output file of a HyperSyncFile and the CRC32C of what went into it */
+typedef struct _HYPER_SYNC_SINK
+{
+    FILE                *fp;
+    unsigned int        uiCrc;
+    unsigned long long  ullWritten;
+} HYPER_SYNC_SINK, * PHYPER_SYNC_SINK;
+
+HYPERLIB
+HYPERSTATUS
+HyperSyncWrite(
+    const void          *lpBlock,
+    size_t              stLength,
+    void                *lpContext)
+{
+    PHYPER_SYNC_SINK sink = (PHYPER_SYNC_SINK)lpContext;
+
+    if (fwrite(lpBlock, 1, stLength, sink->fp) != stLength)
+        return HYPER_FAILED;
+
+    sink->uiCrc = HyperCrc32c(sink->uiCrc, lpBlock, stLength);
+    sink->ullWritten += stLength;
+
+    return HYPER_SUCCESS;
+}
+
+HYPERLIB
+unsigned long long
+HyperSyncDecode(
+    const unsigned char *lpBytes,
+    size_t              stLength)
+{
+    unsigned long long ullValue = 0;
+
+    while (stLength--)
+        ullValue = (ullValue << 8) | *lpBytes++;
+
+    return ullValue;
+}
+
+HYPERLIB
+void
+HyperSyncEncode(
+    unsigned char       *lpBytes,
+    unsigned int        uiValue)
+{
+    lpBytes[0] = (unsigned char)(uiValue >> 24);
+    lpBytes[1] = (unsigned char)(uiValue >> 16);
+    lpBytes[2] = (unsigned char)(uiValue >> 8);
+    lpBytes[3] = (unsigned char)uiValue;
+}
+
+// Apply the delta that follows a 200 status, returns HYPER_SUCCESS once END checks out
+HYPERLIB
+HYPERSTATUS
+HyperSyncApply(
+    const SOCKET        sockServer,
+    FILE                *fpBasis,
+    unsigned long long  ullBlocks,
+    size_t              stBlockSize,
+    PHYPER_SYNC_SINK    sink,
+    unsigned char       *lpBlock,
+    unsigned long long  *ullLiteral)
+{
+    unsigned char ucInstruction[13];
+    unsigned long long ullFirst = 0;
+    unsigned long long ullCount = 0;
+    unsigned long long ullLength = 0;
+
+    while (1)
+    {
+        if (HyperReceiveAll(sockServer, ucInstruction, 1) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+
+        switch (ucInstruction[0])
+        {
+        case HYPER_SYNC_COPY:
+            if (HyperReceiveAll(sockServer, ucInstruction + 1, 8) != HYPER_SUCCESS)
+                return HYPER_FAILED;
+
+            ullFirst = HyperSyncDecode(ucInstruction + 1, 4);
+            ullCount = HyperSyncDecode(ucInstruction + 5, 4);
+            if (fpBasis == NULL || ullFirst + ullCount > ullBlocks)
+                return HYPER_FAILED;
+
+            if (HYPER_FSEEK(fpBasis, ullFirst * stBlockSize) != 0)
+                return HYPER_FAILED;
+
+            while (ullCount--)
+            {
+                if (fread(lpBlock, 1, stBlockSize, fpBasis) != stBlockSize ||
+                    HyperSyncWrite(lpBlock, stBlockSize, sink) != HYPER_SUCCESS)
+                    return HYPER_FAILED;
+            }
+            break;
+
+        case HYPER_SYNC_LITERAL:
+            if (HyperReceiveAll(sockServer, ucInstruction + 1, 4) != HYPER_SUCCESS)
+                return HYPER_FAILED;
+
+            ullLength = HyperSyncDecode(ucInstruction + 1, 4);
+            if (HyperReceiveStream(sockServer, ullLength, HyperSyncWrite, sink, 0, NULL) != HYPER_SUCCESS)
+                return HYPER_FAILED;
+
+            if (ullLiteral)
+                *ullLiteral += ullLength;
+            break;
+
+        case HYPER_SYNC_END:
+            if (HyperReceiveAll(sockServer, ucInstruction + 1, 12) != HYPER_SUCCESS)
+                return HYPER_FAILED;
+
+            if (HyperSyncDecode(ucInstruction + 1, 8) != sink->ullWritten ||
+                HyperSyncDecode(ucInstruction + 9, 4) != sink->uiCrc)
+                return HYPER_FAILED;
+
+            return HYPER_SUCCESS;
+
+        default:
+            return HYPER_FAILED;
+        }
+    }
+}
+
+// Signature of each of the first ullBlocks blocks of fpBasis
+HYPERLIB
+HYPERSTATUS
+HyperSyncSignatures(
+    FILE                *fpBasis,
+    unsigned long long  ullBlocks,
+    size_t              stBlockSize,
+    unsigned char       *lpBlock,
+    unsigned char       *lpSignatures)
+{
+    for (unsigned long long i = 0; i < ullBlocks; i++)
+    {
+        if (fread(lpBlock, 1, stBlockSize, fpBasis) != stBlockSize)
+            return HYPER_FAILED;
+
+        HyperSyncEncode(lpSignatures, HyperRollingChecksum(lpBlock, stBlockSize));
+        HyperSyncEncode(lpSignatures + 4, HyperCrc32c(0, lpBlock, stBlockSize));
+        lpSignatures += HYPER_SYNC_SIGNATURE_SIZE;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// SYNC command followed by the signatures, then the status of the reply
+HYPERLIB
+HYPERSTATUS
+HyperSyncRequest(
+    const SOCKET        sockServer,
+    const char          *cpRemotePath,
+    size_t              stBlockSize,
+    unsigned long long  ullBlocks,
+    const unsigned char *lpSignatures,
+    unsigned short      *usStatus)
+{
+    unsigned long long ullLength = ullBlocks * HYPER_SYNC_SIGNATURE_SIZE;
+    unsigned long long ullSent = 0;
+    int iResult = 0;
+    char cpCommand[MAX_COMMAND_LENGTH];
+
+    if (snprintf(cpCommand, sizeof(cpCommand), "SYNC %s %zu %llu",
+            cpRemotePath, stBlockSize, ullBlocks) >= (int)sizeof(cpCommand))
+        return HYPER_BAD_PARAMETER;
+
+    if (HyperSendCommand(sockServer, cpCommand) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    while (ullSent < ullLength)
+    {
+        iResult = send(sockServer, (const char*)lpSignatures + ullSent,
+                ullLength - ullSent > INT_MAX ? INT_MAX : (size_t)(ullLength - ullSent), 0);
+        if (iResult == SOCKET_ERROR)
+            return HYPER_FAILED;
+
+        ullSent += iResult;
+    }
+
+    return HyperReceiveStatus(sockServer, usStatus);
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperSyncFile(
+    const SOCKET        sockServer,
+    const char          *cpRemotePath,
+    const char          *cpLocalPath,
+    size_t              stBlockSize,
+    unsigned short      *status,
+    unsigned long long  *ullLiteral)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    HYPER_SYNC_SINK sink = {0};
+    FILE *fpBasis = NULL;
+    unsigned char *lpSignatures = NULL;
+    unsigned char *lpBlock = NULL;
+    unsigned long long ullBasisSize = 0;
+    unsigned long long ullBlocks = 0;
+    unsigned short usStatus = 0;
+    char cpTempPath[FILENAME_MAX];
+
+    if (ullLiteral)
+        *ullLiteral = 0;
+
+    if (stBlockSize == 0)
+        stBlockSize = HYPER_SYNC_BLOCK_SIZE;
+
+    if (stBlockSize < HYPER_SYNC_MIN_BLOCK_SIZE || stBlockSize > HYPER_SYNC_MAX_BLOCK_SIZE ||
+        snprintf(cpTempPath, sizeof(cpTempPath), "%s.sync", cpLocalPath) >= (int)sizeof(cpTempPath))
+        return HYPER_BAD_PARAMETER;
+
+#ifdef _WIN32
+    struct _stat64 st = {0};
+    if (_stat64(cpLocalPath, &st) == 0)
+        ullBasisSize = st.st_size;
+#else
+    struct stat st = {0};
+    if (stat(cpLocalPath, &st) == 0)
+        ullBasisSize = st.st_size;
+#endif
+
+    // Bigger blocks for bigger files, anything past the last signature is just resent
+    while (ullBasisSize / stBlockSize > HYPER_SYNC_MAX_BLOCKS && stBlockSize * 2 <= HYPER_SYNC_MAX_BLOCK_SIZE)
+        stBlockSize *= 2;
+
+    ullBlocks = ullBasisSize / stBlockSize;
+    if (ullBlocks > HYPER_SYNC_MAX_BLOCKS)
+        ullBlocks = HYPER_SYNC_MAX_BLOCKS;
+
+    if (HyperMemAlloc((void**)&lpBlock, stBlockSize) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (ullBlocks)
+    {
+        fpBasis = fopen(cpLocalPath, "rb");
+        if (fpBasis == NULL ||
+            HyperMemAlloc((void**)&lpSignatures, (size_t)ullBlocks * HYPER_SYNC_SIGNATURE_SIZE) != HYPER_SUCCESS ||
+            HyperSyncSignatures(fpBasis, ullBlocks, stBlockSize, lpBlock, lpSignatures) != HYPER_SUCCESS)
+            hsResult = HYPER_FAILED;
+    }
+
+    if (hsResult == HYPER_SUCCESS)
+        hsResult = HyperSyncRequest(sockServer, cpRemotePath, stBlockSize, ullBlocks, lpSignatures, &usStatus);
+
+    if (status)
+        *status = usStatus;
+
+    if (hsResult == HYPER_SUCCESS && usStatus != 200)
+        hsResult = HYPER_FAILED;
+
+    // Built next to the original, which stays as it was until the delta checks out
+    if (hsResult == HYPER_SUCCESS)
+    {
+        sink.fp = fopen(cpTempPath, "wb");
+        if (sink.fp == NULL)
+            hsResult = HYPER_FAILED;
+    }
+
+    if (sink.fp)
+    {
+        hsResult = HyperSyncApply(sockServer, fpBasis, ullBlocks, stBlockSize, &sink, lpBlock, ullLiteral);
+        if (fclose(sink.fp) != 0)
+            hsResult = HYPER_FAILED;
+    }
+
+    if (fpBasis)
+        fclose(fpBasis);
+
+    if (lpSignatures)
+        HyperMemFree(lpSignatures);
+    HyperMemFree(lpBlock);
+
+    if (sink.fp == NULL)
+        return hsResult;
+
+#ifdef _WIN32
+    // rename() won't replace an existing file here
+    if (hsResult == HYPER_SUCCESS)
+        remove(cpLocalPath);
+#endif
+
+    if (hsResult != HYPER_SUCCESS || rename(cpTempPath, cpLocalPath) != 0)
+    {
+        remove(cpTempPath);
+        return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+HYPERLIB
+HYPERSTATUS
+HyperFetchChunks(
+    const SOCKET        sockServer,
+    const unsigned char *ucIds,
+    unsigned int        uiCount,
+    HYPER_RECEIVE_CALLBACK callback,
+    void                *lpContext,
+    unsigned short      *status)
+{
+    unsigned long long ullLength = (unsigned long long)uiCount * HYPER_CHUNK_ID_SIZE;
+    unsigned long long ullSent = 0;
+    unsigned short usStatus = 0;
+    int iResult = 0;
+    char cpCommand[32];
+    char cpSizeBuf[FILESIZE_BUFFER_SIZE];
+
+    if (uiCount > HYPER_FETCH_MAX_CHUNKS || callback == NULL)
+        return HYPER_BAD_PARAMETER;
+
+    snprintf(cpCommand, sizeof(cpCommand), "FETCH %u", uiCount);
+    if (HyperSendCommand(sockServer, cpCommand) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    while (ullSent < ullLength)
+    {
+        iResult = send(sockServer, (const char*)ucIds + ullSent, (size_t)(ullLength - ullSent), 0);
+        if (iResult == SOCKET_ERROR)
+            return HYPER_FAILED;
+
+        ullSent += iResult;
+    }
+
+    if (HyperReceiveStatus(sockServer, &usStatus) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (status)
+        *status = usStatus;
+
+    if (usStatus != 200)
+        return HYPER_FAILED;
+
+    if (HyperReceiveAll(sockServer, cpSizeBuf, sizeof(cpSizeBuf)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    cpSizeBuf[sizeof(cpSizeBuf) - 1] = 0;
+
+    return HyperReceiveStream(sockServer, strtoull(cpSizeBuf, NULL, 10), callback, lpContext, 0, NULL);
+}
+
 #endif
 
 #endif
@@ -0,0 +1,110 @@
+#include "arena.h"
+
+void
+arena_init(
+    PARENA              arena)
+{
+    // Blocks are allocated on first use, idle connections cost nothing
+    memset(arena, 0, sizeof(ARENA));
+}
+
+static PARENA_BLOCK
+arena_new_block(
+    size_t              stSize)
+{
+    PARENA_BLOCK block = NULL;
+
+    if (HyperMemAlloc((void**)&block, sizeof(ARENA_BLOCK) + stSize) != HYPER_SUCCESS)
+        return NULL;
+
+    block->next = NULL;
+    block->stUsed = 0;
+    block->stSize = stSize;
+
+    return block;
+}
+
+void*
+arena_alloc(
+    PARENA              arena,
+    size_t              stSize)
+{
+    PARENA_BLOCK block = arena->blocks;
+    size_t stAligned = (stSize + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if (stSize == 0 || stAligned < stSize)
+        return NULL;
+
+    // Big requests would waste most of a block, give them their own
+    if (stAligned > ARENA_MAX_BUMP)
+    {
+        block = arena_new_block(stAligned);
+        if (block == NULL)
+            return NULL;
+
+        block->stUsed = stAligned;
+        block->next = arena->oversized;
+        arena->oversized = block;
+        arena->stAllocated += stAligned;
+
+        return block->data;
+    }
+
+    if (block == NULL || block->stSize - block->stUsed < stAligned)
+    {
+        block = arena_new_block(ARENA_BLOCK_SIZE);
+        if (block == NULL)
+            return NULL;
+
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    block->stUsed += stAligned;
+    arena->stAllocated += stAligned;
+
+    return block->data + block->stUsed - stAligned;
+}
+
+// Free everything at once, keeping a single block so the next request doesn't malloc
+void
+arena_reset(
+    PARENA              arena)
+{
+    PARENA_BLOCK block = NULL;
+    PARENA_BLOCK next = NULL;
+
+    if (arena->stAllocated == 0)
+        return;
+
+    for (block = arena->oversized; block; block = next)
+    {
+        next = block->next;
+        HyperMemFree(block);
+    }
+    arena->oversized = NULL;
+
+    if (arena->blocks)
+    {
+        for (block = arena->blocks->next; block; block = next)
+        {
+            next = block->next;
+            HyperMemFree(block);
+        }
+
+        arena->blocks->next = NULL;
+        arena->blocks->stUsed = 0;
+    }
+
+    arena->stAllocated = 0;
+}
+
+void
+arena_destroy(
+    PARENA              arena)
+{
+    arena_reset(arena);
+
+    HyperMemFree(arena->blocks);
+    arena->blocks = NULL;
+}
@@ -0,0 +1,212 @@
+#include "background.h"
+#include "connection.h"
+
+/* Jobs waiting for a thread, oldest first */
+static pthread_t threads[BACKGROUND_THREADS];
+static unsigned int uiThreads = 0;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueWake = PTHREAD_COND_INITIALIZER;
+static PBACKGROUND_JOB queueHead = NULL;
+static PBACKGROUND_JOB queueTail = NULL;
+static int bStop = 0;
+
+// Hand a job that has run back to its worker, the eventfd wakes the worker's loop
+static void
+background_post(
+    PBACKGROUND_JOB     job)
+{
+    PJOB_INBOX inbox = job->inbox;
+    uint64_t ullOne = 1;
+
+    if (inbox == NULL)
+    {
+        job->release(job);
+        return;
+    }
+
+    pthread_mutex_lock(&inbox->lock);
+    job->next = inbox->head;
+    inbox->head = job;
+    pthread_mutex_unlock(&inbox->lock);
+
+    // Only fails once the counter would overflow, and then the worker is awake anyway
+    while (write(inbox->fd, &ullOne, sizeof(ullOne)) == -1 && errno == EINTR)
+        ;
+}
+
+static void*
+background_main(
+    void                *lpParam)
+{
+    PBACKGROUND_JOB job = NULL;
+
+    pthread_mutex_lock(&queueLock);
+    while (!bStop)
+    {
+        if (queueHead == NULL)
+        {
+            pthread_cond_wait(&queueWake, &queueLock);
+            continue;
+        }
+
+        job = queueHead;
+        queueHead = job->next;
+        if (queueHead == NULL)
+            queueTail = NULL;
+        pthread_mutex_unlock(&queueLock);
+
+        job->run(job);
+        background_post(job);
+
+        pthread_mutex_lock(&queueLock);
+    }
+    pthread_mutex_unlock(&queueLock);
+
+    return NULL;
+}
+
+HYPERSTATUS
+background_start(void)
+{
+    bStop = 0;
+
+    for (uiThreads = 0; uiThreads < BACKGROUND_THREADS; uiThreads++)
+    {
+        if (pthread_create(&threads[uiThreads], NULL, background_main, NULL) != 0)
+            break;
+    }
+
+    return uiThreads ? HYPER_SUCCESS : HYPER_FAILED;
+}
+
+// Let the running jobs finish, the ones still queued are dropped
+void
+background_stop(void)
+{
+    PBACKGROUND_JOB job = NULL;
+
+    pthread_mutex_lock(&queueLock);
+    bStop = 1;
+    pthread_cond_broadcast(&queueWake);
+    pthread_mutex_unlock(&queueLock);
+
+    for (unsigned int i = 0; i < uiThreads; i++)
+        pthread_join(threads[i], NULL);
+    uiThreads = 0;
+
+    while (queueHead)
+    {
+        job = queueHead;
+        queueHead = job->next;
+        job->release(job);
+    }
+    queueTail = NULL;
+}
+
+/* Queue a job. With job->conn set that connection's next response waits for
+   it, event_loop_process_input reads no further commands until it completes */
+HYPERSTATUS
+background_submit(
+    PBACKGROUND_JOB     job)
+{
+    pthread_mutex_lock(&queueLock);
+
+    if (uiThreads == 0 || bStop)
+    {
+        pthread_mutex_unlock(&queueLock);
+        return HYPER_FAILED;
+    }
+
+    // Before a thread can take it, one without an inbox is gone once it has run
+    if (job->conn)
+        job->conn->job = job;
+
+    job->next = NULL;
+    if (queueTail)
+        queueTail->next = job;
+    else
+        queueHead = job;
+    queueTail = job;
+
+    pthread_cond_signal(&queueWake);
+    pthread_mutex_unlock(&queueLock);
+
+    return HYPER_SUCCESS;
+}
+
+HYPERSTATUS
+background_inbox_init(
+    PJOB_INBOX          inbox)
+{
+    inbox->head = NULL;
+    inbox->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inbox->fd == -1)
+        return HYPER_FAILED;
+
+    pthread_mutex_init(&inbox->lock, NULL);
+
+    return HYPER_SUCCESS;
+}
+
+// Only once background_stop made sure nothing can be posted to it any more
+void
+background_inbox_destroy(
+    PJOB_INBOX          inbox)
+{
+    PBACKGROUND_JOB job = NULL;
+
+    while (inbox->head)
+    {
+        job = inbox->head;
+        inbox->head = job->next;
+        job->release(job);
+    }
+
+    close(inbox->fd);
+    inbox->fd = -1;
+    pthread_mutex_destroy(&inbox->lock);
+}
+
+// Answer the connections whose jobs are done, then carry on with their input
+void
+background_finish(
+    PJOB_INBOX          inbox,
+    void                (*resume)(void *lpContext))
+{
+    PBACKGROUND_JOB job = NULL;
+    PBACKGROUND_JOB next = NULL;
+    PCONNECTION conn = NULL;
+    uint64_t ullCount = 0;
+
+    // Reset before taking the list, whatever is posted after this wakes us again
+    while (read(inbox->fd, &ullCount, sizeof(ullCount)) == -1 && errno == EINTR)
+        ;
+
+    pthread_mutex_lock(&inbox->lock);
+    job = inbox->head;
+    inbox->head = NULL;
+    pthread_mutex_unlock(&inbox->lock);
+
+    for (; job; job = next)
+    {
+        next = job->next;
+        conn = job->conn;
+
+        // Shut down but not freed yet, see uring_close
+        if (conn && conn->bDead)
+        {
+            conn->job = NULL;
+            conn = NULL;
+        }
+
+        if (conn)
+        {
+            conn->job = NULL;
+            job->complete(job);
+        }
+        job->release(job);
+
+        if (conn)
+            resume(conn);
+    }
+}
@@ -0,0 +1,452 @@
+#include "checksum.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t sha256Constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+checksum_sha256_blocks_portable(
+    uint32_t            *uiState,
+    const unsigned char *lpData,
+    size_t              stBlocks)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+
+    while (stBlocks--)
+    {
+        for (unsigned int i = 0; i < 16; i++)
+            w[i] = (uint32_t)lpData[i * 4] << 24 | (uint32_t)lpData[i * 4 + 1] << 16 |
+                   (uint32_t)lpData[i * 4 + 2] << 8 | lpData[i * 4 + 3];
+
+        for (unsigned int i = 16; i < 64; i++)
+            w[i] = w[i - 16] + w[i - 7] +
+                   (SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+                   (SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+        a = uiState[0]; b = uiState[1]; c = uiState[2]; d = uiState[3];
+        e = uiState[4]; f = uiState[5]; g = uiState[6]; h = uiState[7];
+
+        for (unsigned int i = 0; i < 64; i++)
+        {
+            t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) +
+                 ((e & f) ^ (~e & g)) + sha256Constants[i] + w[i];
+            t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) +
+                 ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        uiState[0] += a; uiState[1] += b; uiState[2] += c; uiState[3] += d;
+        uiState[4] += e; uiState[5] += f; uiState[6] += g; uiState[7] += h;
+
+        lpData += SHA256_BLOCK_SIZE;
+    }
+}
+
+static uint32_t
+checksum_crc32c_portable(
+    uint32_t            uiCrc,
+    const void          *lpData,
+    size_t              stLength)
+{
+    return HyperCrc32c(uiCrc, lpData, stLength);
+}
+
+/* Picked once by checksum_init, portable until then */
+static void (*sha256Blocks)(uint32_t*, const unsigned char*, size_t) = checksum_sha256_blocks_portable;
+static uint32_t (*crc32cUpdate)(uint32_t, const void*, size_t) = checksum_crc32c_portable;
+static char cpImplementation[64] = "portable sha256, portable crc32c";
+
+#if defined(__x86_64__)
+
+/* CRC register after CRC32C_*_BLOCK zero bytes, a byte of the register at a time */
+static uint32_t crc32cLongShift[4][256];
+static uint32_t crc32cShortShift[4][256];
+
+// The register is linear, so shifting a value is the XOR of shifting its bits
+__attribute__((target("sse4.2")))
+static void
+checksum_crc32c_build_shift(
+    uint32_t            shift[4][256],
+    size_t              stZeros)
+{
+    uint32_t uiBits[32];
+    uint64_t ullCrc = 0;
+
+    for (unsigned int uiBit = 0; uiBit < 32; uiBit++)
+    {
+        ullCrc = 1U << uiBit;
+        for (size_t i = 0; i < stZeros / 8; i++)
+            ullCrc = _mm_crc32_u64(ullCrc, 0);
+        uiBits[uiBit] = (uint32_t)ullCrc;
+    }
+
+    for (unsigned int uiByte = 0; uiByte < 4; uiByte++)
+    {
+        for (unsigned int uiValue = 0; uiValue < 256; uiValue++)
+        {
+            shift[uiByte][uiValue] = 0;
+            for (unsigned int uiBit = 0; uiBit < 8; uiBit++)
+            {
+                if (uiValue & (1U << uiBit))
+                    shift[uiByte][uiValue] ^= uiBits[uiByte * 8 + uiBit];
+            }
+        }
+    }
+}
+
+static uint32_t
+checksum_crc32c_shift(
+    uint32_t            shift[4][256],
+    uint32_t            uiCrc)
+{
+    return shift[0][uiCrc & 0xff] ^ shift[1][(uiCrc >> 8) & 0xff] ^
+           shift[2][(uiCrc >> 16) & 0xff] ^ shift[3][uiCrc >> 24];
+}
+
+// One crc32 instruction has a latency of three cycles but a throughput of
+// one, so three independent streams keep the unit busy
+__attribute__((target("sse4.2")))
+static uint32_t
+checksum_crc32c_sse42(
+    uint32_t            uiCrc,
+    const void          *lpData,
+    size_t              stLength)
+{
+    const unsigned char *lpBytes = (const unsigned char*)lpData;
+    const unsigned char *lpEnd = NULL;
+    uint64_t ullCrc0 = ~uiCrc & 0xffffffff;
+    uint64_t ullCrc1 = 0;
+    uint64_t ullCrc2 = 0;
+    uint64_t ullWords[3];
+
+    while (stLength && ((uintptr_t)lpBytes & 7))
+    {
+        ullCrc0 = _mm_crc32_u8((uint32_t)ullCrc0, *lpBytes++);
+        stLength--;
+    }
+
+    while (stLength >= CRC32C_LONG_BLOCK * 3)
+    {
+        ullCrc1 = ullCrc2 = 0;
+        for (lpEnd = lpBytes + CRC32C_LONG_BLOCK; lpBytes < lpEnd; lpBytes += 8)
+        {
+            memcpy(&ullWords[0], lpBytes, 8);
+            memcpy(&ullWords[1], lpBytes + CRC32C_LONG_BLOCK, 8);
+            memcpy(&ullWords[2], lpBytes + CRC32C_LONG_BLOCK * 2, 8);
+            ullCrc0 = _mm_crc32_u64(ullCrc0, ullWords[0]);
+            ullCrc1 = _mm_crc32_u64(ullCrc1, ullWords[1]);
+            ullCrc2 = _mm_crc32_u64(ullCrc2, ullWords[2]);
+        }
+
+        ullCrc0 = checksum_crc32c_shift(crc32cLongShift, (uint32_t)ullCrc0) ^ ullCrc1;
+        ullCrc0 = checksum_crc32c_shift(crc32cLongShift, (uint32_t)ullCrc0) ^ ullCrc2;
+        lpBytes += CRC32C_LONG_BLOCK * 2;
+        stLength -= CRC32C_LONG_BLOCK * 3;
+    }
+
+    while (stLength >= CRC32C_SHORT_BLOCK * 3)
+    {
+        ullCrc1 = ullCrc2 = 0;
+        for (lpEnd = lpBytes + CRC32C_SHORT_BLOCK; lpBytes < lpEnd; lpBytes += 8)
+        {
+            memcpy(&ullWords[0], lpBytes, 8);
+            memcpy(&ullWords[1], lpBytes + CRC32C_SHORT_BLOCK, 8);
+            memcpy(&ullWords[2], lpBytes + CRC32C_SHORT_BLOCK * 2, 8);
+            ullCrc0 = _mm_crc32_u64(ullCrc0, ullWords[0]);
+            ullCrc1 = _mm_crc32_u64(ullCrc1, ullWords[1]);
+            ullCrc2 = _mm_crc32_u64(ullCrc2, ullWords[2]);
+        }
+
+        ullCrc0 = checksum_crc32c_shift(crc32cShortShift, (uint32_t)ullCrc0) ^ ullCrc1;
+        ullCrc0 = checksum_crc32c_shift(crc32cShortShift, (uint32_t)ullCrc0) ^ ullCrc2;
+        lpBytes += CRC32C_SHORT_BLOCK * 2;
+        stLength -= CRC32C_SHORT_BLOCK * 3;
+    }
+
+    while (stLength >= 8)
+    {
+        memcpy(&ullWords[0], lpBytes, 8);
+        ullCrc0 = _mm_crc32_u64(ullCrc0, ullWords[0]);
+        lpBytes += 8;
+        stLength -= 8;
+    }
+
+    while (stLength--)
+        ullCrc0 = _mm_crc32_u8((uint32_t)ullCrc0, *lpBytes++);
+
+    return ~(uint32_t)ullCrc0;
+}
+
+// Four rounds per sha256rnds2 pair, the schedule comes from sha256msg1/msg2
+__attribute__((target("sha,sse4.1")))
+static void
+checksum_sha256_blocks_shani(
+    uint32_t            *uiState,
+    const unsigned char *lpData,
+    size_t              stBlocks)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, savedAbef, savedCdgh, temp, message;
+    __m128i schedule[4];
+
+    // Hardware wants the state as ABEF and CDGH
+    temp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&uiState[0]), 0xb1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&uiState[4]), 0x1b);
+    state0 = _mm_alignr_epi8(temp, state1, 8);
+    state1 = _mm_blend_epi16(state1, temp, 0xf0);
+
+    while (stBlocks--)
+    {
+        savedAbef = state0;
+        savedCdgh = state1;
+
+        // Unrolled, schedule[] then lives in registers instead of on the stack
+#pragma GCC unroll 16
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            if (i < 4)
+                schedule[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(lpData + i * 16)), byteSwap);
+            else
+            {
+                temp = _mm_sha256msg1_epu32(schedule[i & 3], schedule[(i + 1) & 3]);
+                temp = _mm_add_epi32(temp, _mm_alignr_epi8(schedule[(i + 3) & 3], schedule[(i + 2) & 3], 4));
+                schedule[i & 3] = _mm_sha256msg2_epu32(temp, schedule[(i + 3) & 3]);
+            }
+
+            message = _mm_add_epi32(schedule[i & 3], _mm_loadu_si128((const __m128i*)&sha256Constants[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            message = _mm_shuffle_epi32(message, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, message);
+        }
+
+        state0 = _mm_add_epi32(state0, savedAbef);
+        state1 = _mm_add_epi32(state1, savedCdgh);
+        lpData += SHA256_BLOCK_SIZE;
+    }
+
+    temp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    _mm_storeu_si128((__m128i*)&uiState[0], _mm_blend_epi16(temp, state1, 0xf0));
+    _mm_storeu_si128((__m128i*)&uiState[4], _mm_alignr_epi8(state1, temp, 8));
+}
+
+#endif
+
+// Pick the fastest implementations this CPU runs, call before any worker starts
+void
+checksum_init(void)
+{
+#if defined(__x86_64__)
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+    int bSse42 = 0;
+    int bSha = 0;
+
+    if (__get_cpuid(1, &a, &b, &c, &d))
+    {
+        bSse42 = (c & bit_SSE4_2) != 0;
+        bSha = (c & bit_SSE4_1) && (c & bit_SSSE3);
+    }
+    if (!(__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA)))
+        bSha = 0;
+
+    if (bSse42)
+    {
+        checksum_crc32c_build_shift(crc32cLongShift, CRC32C_LONG_BLOCK);
+        checksum_crc32c_build_shift(crc32cShortShift, CRC32C_SHORT_BLOCK);
+        crc32cUpdate = checksum_crc32c_sse42;
+    }
+    if (bSha)
+        sha256Blocks = checksum_sha256_blocks_shani;
+
+    snprintf(cpImplementation, sizeof(cpImplementation), "%s sha256, %s crc32c",
+            bSha ? "sha-ni" : "portable", bSse42 ? "sse4.2" : "portable");
+#endif
+}
+
+const char*
+checksum_describe(void)
+{
+    return cpImplementation;
+}
+
+uint32_t
+checksum_crc32c(
+    uint32_t            uiCrc,
+    const void          *lpData,
+    size_t              stLength)
+{
+    return crc32cUpdate(uiCrc, lpData, stLength);
+}
+
+void
+checksum_sha256_init(
+    PSHA256_CONTEXT     context)
+{
+    static const uint32_t initialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(context->uiState, initialState, sizeof(initialState));
+    context->ullLength = 0;
+    context->stBuffered = 0;
+}
+
+void
+checksum_sha256_update(
+    PSHA256_CONTEXT     context,
+    const void          *lpData,
+    size_t              stLength)
+{
+    const unsigned char *lpBytes = (const unsigned char*)lpData;
+    size_t stCopy = 0;
+
+    context->ullLength += stLength;
+
+    if (context->stBuffered)
+    {
+        stCopy = SHA256_BLOCK_SIZE - context->stBuffered;
+        if (stCopy > stLength)
+            stCopy = stLength;
+
+        memcpy(context->ucBuffer + context->stBuffered, lpBytes, stCopy);
+        context->stBuffered += stCopy;
+        lpBytes += stCopy;
+        stLength -= stCopy;
+
+        if (context->stBuffered < SHA256_BLOCK_SIZE)
+            return;
+
+        sha256Blocks(context->uiState, context->ucBuffer, 1);
+        context->stBuffered = 0;
+    }
+
+    // Whole blocks straight from the caller's memory
+    if (stLength >= SHA256_BLOCK_SIZE)
+    {
+        sha256Blocks(context->uiState, lpBytes, stLength / SHA256_BLOCK_SIZE);
+        lpBytes += stLength & ~(size_t)(SHA256_BLOCK_SIZE - 1);
+        stLength &= SHA256_BLOCK_SIZE - 1;
+    }
+
+    memcpy(context->ucBuffer, lpBytes, stLength);
+    context->stBuffered = stLength;
+}
+
+void
+checksum_sha256_final(
+    PSHA256_CONTEXT     context,
+    unsigned char       *ucDigest)
+{
+    unsigned long long ullBits = context->ullLength * 8;
+    size_t stPadding = 0;
+
+    context->ucBuffer[context->stBuffered++] = 0x80;
+
+    // The length goes in the last 8 bytes, which may need another block
+    if (context->stBuffered > SHA256_BLOCK_SIZE - 8)
+    {
+        memset(context->ucBuffer + context->stBuffered, 0, SHA256_BLOCK_SIZE - context->stBuffered);
+        sha256Blocks(context->uiState, context->ucBuffer, 1);
+        context->stBuffered = 0;
+    }
+
+    stPadding = SHA256_BLOCK_SIZE - 8 - context->stBuffered;
+    memset(context->ucBuffer + context->stBuffered, 0, stPadding);
+    for (unsigned int i = 0; i < 8; i++)
+        context->ucBuffer[SHA256_BLOCK_SIZE - 1 - i] = (unsigned char)(ullBits >> (8 * i));
+    sha256Blocks(context->uiState, context->ucBuffer, 1);
+
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        ucDigest[i * 4] = (unsigned char)(context->uiState[i] >> 24);
+        ucDigest[i * 4 + 1] = (unsigned char)(context->uiState[i] >> 16);
+        ucDigest[i * 4 + 2] = (unsigned char)(context->uiState[i] >> 8);
+        ucDigest[i * 4 + 3] = (unsigned char)context->uiState[i];
+    }
+}
+
+// CRC32C and, unless ucSha256 is NULL, SHA-256 of a buffer
+void
+checksum_buffer(
+    const void          *lpData,
+    size_t              stLength,
+    unsigned char       *ucSha256,
+    uint32_t            *uiCrc)
+{
+    SHA256_CONTEXT context;
+
+    *uiCrc = checksum_crc32c(0, lpData, stLength);
+
+    if (ucSha256)
+    {
+        checksum_sha256_init(&context);
+        checksum_sha256_update(&context, lpData, stLength);
+        checksum_sha256_final(&context, ucSha256);
+    }
+}
+
+// Same over a byte range of a file, in one read pass
+HYPERSTATUS
+checksum_file(
+    int                 fd,
+    off_t               offStart,
+    unsigned long long  ullLength,
+    unsigned char       *ucSha256,
+    uint32_t            *uiCrc)
+{
+    SHA256_CONTEXT context;
+    char *cpBuffer = NULL;
+    ssize_t sBytesRead = 0;
+    size_t stWant = 0;
+
+    if (HyperMemAlloc((void**)&cpBuffer, CHECKSUM_READ_SIZE) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    *uiCrc = 0;
+    checksum_sha256_init(&context);
+
+    while (ullLength)
+    {
+        stWant = ullLength < CHECKSUM_READ_SIZE ? (size_t)ullLength : CHECKSUM_READ_SIZE;
+        sBytesRead = pread(fd, cpBuffer, stWant, offStart);
+        if (sBytesRead == -1 && errno == EINTR)
+            continue;
+
+        // Shrunk underneath us, the digest would describe the wrong bytes
+        if (sBytesRead <= 0)
+        {
+            HyperMemFree(cpBuffer);
+            return HYPER_FAILED;
+        }
+
+        *uiCrc = checksum_crc32c(*uiCrc, cpBuffer, sBytesRead);
+        if (ucSha256)
+            checksum_sha256_update(&context, cpBuffer, sBytesRead);
+
+        offStart += sBytesRead;
+        ullLength -= sBytesRead;
+    }
+
+    if (ucSha256)
+        checksum_sha256_final(&context, ucSha256);
+
+    HyperMemFree(cpBuffer);
+    return HYPER_SUCCESS;
+}
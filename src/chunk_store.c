@@ -0,0 +1,848 @@
+#include "chunk_store.h"
+
+CHUNK_STORE chunkStore = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .bEnabled = 0
+};
+
+/* Index records written so far, the next one goes here */
+static unsigned long long ullIndexSize = 0;
+
+/* Gear hash values. These decide where chunks split, so changing them
+   orphans every chunk already in the store */
+static uint64_t gearTable[256];
+
+static void
+chunk_store_init_gear(void)
+{
+    uint64_t ullSeed = 0x4859504552435443ULL;
+    uint64_t ullValue = 0;
+
+    // splitmix64, the same table on every machine and every run
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        ullSeed += 0x9e3779b97f4a7c15ULL;
+        ullValue = ullSeed;
+        ullValue = (ullValue ^ (ullValue >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        ullValue = (ullValue ^ (ullValue >> 27)) * 0x94d049bb133111ebULL;
+        gearTable[i] = ullValue ^ (ullValue >> 31);
+    }
+}
+
+// FastCDC, length of the chunk that starts at ucData
+static size_t
+chunk_store_cut(
+    const unsigned char *ucData,
+    size_t              stLength)
+{
+    uint64_t ullHash = 0;
+    size_t stNormal = STORE_AVG_CHUNK;
+    size_t i = STORE_MIN_CHUNK;
+
+    if (stLength <= STORE_MIN_CHUNK)
+        return stLength;
+
+    if (stLength > STORE_MAX_CHUNK)
+        stLength = STORE_MAX_CHUNK;
+    if (stLength < stNormal)
+        stNormal = stLength;
+
+    // Harder to cut before the average and easier after, so sizes bunch around it
+    for (; i < stNormal; i++)
+    {
+        ullHash = (ullHash << 1) + gearTable[ucData[i]];
+        if (!(ullHash & STORE_MASK_SMALL))
+            return i;
+    }
+
+    for (; i < stLength; i++)
+    {
+        ullHash = (ullHash << 1) + gearTable[ucData[i]];
+        if (!(ullHash & STORE_MASK_LARGE))
+            return i;
+    }
+
+    return stLength;
+}
+
+// Index of the chunk with this id, UINT32_MAX if the store doesn't have it
+static uint32_t
+chunk_store_find(
+    const unsigned char *ucId)
+{
+    uint32_t uiMask = chunkStore.uiTableSize - 1;
+    uint32_t uiSlot = 0;
+
+    // Ids are SHA-256, any four bytes are as good a hash as any
+    memcpy(&uiSlot, ucId, sizeof(uiSlot));
+    uiSlot &= uiMask;
+
+    while (chunkStore.uiTable[uiSlot])
+    {
+        if (memcmp(chunkStore.chunks[chunkStore.uiTable[uiSlot] - 1].ucId, ucId, SHA256_DIGEST_SIZE) == 0)
+            return chunkStore.uiTable[uiSlot] - 1;
+
+        uiSlot = (uiSlot + 1) & uiMask;
+    }
+
+    return UINT32_MAX;
+}
+
+static void
+chunk_store_link(
+    uint32_t            uiChunk)
+{
+    uint32_t uiMask = chunkStore.uiTableSize - 1;
+    uint32_t uiSlot = 0;
+
+    memcpy(&uiSlot, chunkStore.chunks[uiChunk].ucId, sizeof(uiSlot));
+    uiSlot &= uiMask;
+
+    while (chunkStore.uiTable[uiSlot])
+        uiSlot = (uiSlot + 1) & uiMask;
+
+    chunkStore.uiTable[uiSlot] = uiChunk + 1;
+}
+
+// Room for one more chunk, the table never gets more than half full
+static HYPERSTATUS
+chunk_store_grow(void)
+{
+    uint32_t *uiTable = NULL;
+    uint32_t uiTableSize = chunkStore.uiTableSize;
+
+    if (chunkStore.uiChunks == UINT32_MAX - 1)
+        return HYPER_FAILED;
+
+    if (chunkStore.uiChunks == chunkStore.uiCapacity)
+    {
+        if (HyperMemRealloc((void**)&chunkStore.chunks,
+                sizeof(STORE_CHUNK) * chunkStore.uiCapacity * 2) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+        chunkStore.uiCapacity *= 2;
+    }
+
+    if ((unsigned long long)(chunkStore.uiChunks + 1) * 2 <= uiTableSize)
+        return HYPER_SUCCESS;
+
+    if (HyperMemAlloc((void**)&uiTable, sizeof(uint32_t) * uiTableSize * 2) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    memset(uiTable, 0, sizeof(uint32_t) * uiTableSize * 2);
+
+    HyperMemFree(chunkStore.uiTable);
+    chunkStore.uiTable = uiTable;
+    chunkStore.uiTableSize = uiTableSize * 2;
+
+    for (uint32_t i = 0; i < chunkStore.uiChunks; i++)
+        chunk_store_link(i);
+
+    return HYPER_SUCCESS;
+}
+
+static HYPERSTATUS
+chunk_store_insert(
+    const STORE_CHUNK   *chunk)
+{
+    if (chunk_store_grow() != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    chunkStore.chunks[chunkStore.uiChunks] = *chunk;
+    chunk_store_link(chunkStore.uiChunks);
+    chunkStore.uiChunks++;
+
+    chunkStore.stats.ullChunks++;
+    chunkStore.stats.ullStoredBytes += chunk->uiLength;
+
+    return HYPER_SUCCESS;
+}
+
+// Open or create pack uiPack and map all of it, pages past the end are never touched
+static HYPERSTATUS
+chunk_store_open_pack(
+    uint32_t            uiPack,
+    int                 bCreate)
+{
+    PSTORE_PACK pack = &chunkStore.packs[uiPack];
+    struct stat st = {0};
+    void *lpMap = NULL;
+    char cpPath[SERVER_MAX_PATH];
+
+    if (uiPack >= STORE_MAX_PACKS ||
+        snprintf(cpPath, sizeof(cpPath), "%s/packs/pack-%06u", chunkStore.cpDir, uiPack) >= (int)sizeof(cpPath))
+        return HYPER_FAILED;
+
+    pack->fd = open(cpPath, O_RDWR | O_CLOEXEC | (bCreate ? O_CREAT : 0), 0644);
+    if (pack->fd == -1)
+        return HYPER_FAILED;
+
+    lpMap = mmap(NULL, STORE_PACK_SIZE, PROT_READ, MAP_SHARED, pack->fd, 0);
+    if (fstat(pack->fd, &st) == -1 || lpMap == MAP_FAILED)
+    {
+        if (lpMap != MAP_FAILED)
+            munmap(lpMap, STORE_PACK_SIZE);
+        close(pack->fd);
+        return HYPER_FAILED;
+    }
+
+    pack->cpMap = (const char*)lpMap;
+    pack->ullUsed = st.st_size;
+    chunkStore.uiPacks = uiPack + 1;
+
+    return HYPER_SUCCESS;
+}
+
+// Replay the index, records past what their pack holds were never finished
+static HYPERSTATUS
+chunk_store_load_index(void)
+{
+    STORE_CHUNK records[256];
+    struct stat st = {0};
+    ssize_t sBytesRead = 0;
+    unsigned long long ullRecords = 0;
+    PSTORE_CHUNK record = NULL;
+    char cpPath[SERVER_MAX_PATH];
+
+    if (snprintf(cpPath, sizeof(cpPath), "%s/index", chunkStore.cpDir) >= (int)sizeof(cpPath))
+        return HYPER_FAILED;
+
+    chunkStore.indexFd = open(cpPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (chunkStore.indexFd == -1 || fstat(chunkStore.indexFd, &st) == -1)
+        return HYPER_FAILED;
+
+    // A torn last record is simply written over
+    ullRecords = st.st_size / sizeof(STORE_CHUNK);
+    ullIndexSize = 0;
+
+    while (ullIndexSize < ullRecords * sizeof(STORE_CHUNK))
+    {
+        sBytesRead = pread(chunkStore.indexFd, records, sizeof(records), (off_t)ullIndexSize);
+        if (sBytesRead == -1 && errno == EINTR)
+            continue;
+        if (sBytesRead < (ssize_t)sizeof(STORE_CHUNK))
+            return HYPER_FAILED;
+
+        for (size_t i = 0; i < (size_t)sBytesRead / sizeof(STORE_CHUNK); i++)
+        {
+            record = &records[i];
+            if (record->uiPack < chunkStore.uiPacks &&
+                record->ullOffset + record->uiLength <= chunkStore.packs[record->uiPack].ullUsed &&
+                chunk_store_find(record->ucId) == UINT32_MAX &&
+                chunk_store_insert(record) != HYPER_SUCCESS)
+                return HYPER_FAILED;
+        }
+
+        ullIndexSize += (sBytesRead / sizeof(STORE_CHUNK)) * sizeof(STORE_CHUNK);
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// Create the store in cpDir or pick up the one already there
+HYPERSTATUS
+chunk_store_open(
+    const char          *cpDir)
+{
+    char cpPath[SERVER_MAX_PATH];
+
+    if (strlen(cpDir) >= sizeof(chunkStore.cpDir))
+        return HYPER_FAILED;
+    strcpy(chunkStore.cpDir, cpDir);
+
+    if ((mkdir(cpDir, 0755) == -1 && errno != EEXIST) ||
+        snprintf(cpPath, sizeof(cpPath), "%s/packs", cpDir) >= (int)sizeof(cpPath) ||
+        (mkdir(cpPath, 0755) == -1 && errno != EEXIST) ||
+        snprintf(cpPath, sizeof(cpPath), "%s/manifests", cpDir) >= (int)sizeof(cpPath) ||
+        (mkdir(cpPath, 0755) == -1 && errno != EEXIST))
+        return HYPER_FAILED;
+
+    chunk_store_init_gear();
+
+    chunkStore.uiCapacity = STORE_INITIAL_CHUNKS;
+    chunkStore.uiTableSize = STORE_INITIAL_CHUNKS * 2;
+    if (HyperMemAlloc((void**)&chunkStore.chunks, sizeof(STORE_CHUNK) * chunkStore.uiCapacity) != HYPER_SUCCESS ||
+        HyperMemAlloc((void**)&chunkStore.uiTable, sizeof(uint32_t) * chunkStore.uiTableSize) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    memset(chunkStore.uiTable, 0, sizeof(uint32_t) * chunkStore.uiTableSize);
+
+    // Packs are numbered from 0 without gaps, new chunks go into the last one
+    while (chunkStore.uiPacks < STORE_MAX_PACKS)
+    {
+        if (chunk_store_open_pack(chunkStore.uiPacks, 0) != HYPER_SUCCESS)
+            break;
+    }
+
+    if (chunkStore.uiPacks == 0 && chunk_store_open_pack(0, 1) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (chunk_store_load_index() != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    chunkStore.bEnabled = 1;
+
+    return HYPER_SUCCESS;
+}
+
+static HYPERSTATUS
+chunk_store_write(
+    int                 fd,
+    const void          *lpData,
+    size_t              stLength,
+    off_t               offPosition)
+{
+    ssize_t sWritten = 0;
+
+    while (stLength)
+    {
+        sWritten = pwrite(fd, lpData, stLength, offPosition);
+        if (sWritten == -1 && errno == EINTR)
+            continue;
+        if (sWritten <= 0)
+            return HYPER_FAILED;
+
+        lpData = (const char*)lpData + sWritten;
+        stLength -= sWritten;
+        offPosition += sWritten;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// Add a chunk the store hasn't seen, data first so the index never points at nothing
+static HYPERSTATUS
+chunk_store_append(
+    const unsigned char *ucId,
+    const unsigned char *ucData,
+    uint32_t            uiLength)
+{
+    PSTORE_PACK pack = &chunkStore.packs[chunkStore.uiPacks - 1];
+    STORE_CHUNK chunk = {0};
+
+    if (pack->ullUsed + uiLength > STORE_PACK_SIZE)
+    {
+        if (chunk_store_open_pack(chunkStore.uiPacks, 1) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+        pack = &chunkStore.packs[chunkStore.uiPacks - 1];
+    }
+
+    memcpy(chunk.ucId, ucId, SHA256_DIGEST_SIZE);
+    chunk.uiPack = chunkStore.uiPacks - 1;
+    chunk.uiLength = uiLength;
+    chunk.ullOffset = pack->ullUsed;
+
+    if (chunk_store_write(pack->fd, ucData, uiLength, (off_t)pack->ullUsed) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    pack->ullUsed += uiLength;
+
+    if (chunk_store_write(chunkStore.indexFd, &chunk, sizeof(chunk), (off_t)ullIndexSize) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    ullIndexSize += sizeof(chunk);
+
+    return chunk_store_insert(&chunk);
+}
+
+// Manifests are named after the SHA-256 of the resolved path
+static HYPERSTATUS
+chunk_store_manifest_path(
+    const char          *cpPath,
+    char                *cpManifestPath,
+    size_t              stSize)
+{
+    SHA256_CONTEXT context;
+    unsigned char ucDigest[SHA256_DIGEST_SIZE];
+    char cpHex[SHA256_DIGEST_SIZE * 2 + 1];
+
+    checksum_sha256_init(&context);
+    checksum_sha256_update(&context, cpPath, strlen(cpPath));
+    checksum_sha256_final(&context, ucDigest);
+
+    for (unsigned int i = 0; i < SHA256_DIGEST_SIZE; i++)
+        snprintf(cpHex + i * 2, 3, "%02x", ucDigest[i]);
+
+    if (snprintf(cpManifestPath, stSize, "%s/manifests/%s", chunkStore.cpDir, cpHex) >= (int)stSize)
+        return HYPER_FAILED;
+
+    return HYPER_SUCCESS;
+}
+
+static int
+chunk_store_manifest_valid(
+    PSTORE_MANIFEST     manifest,
+    const struct stat   *st)
+{
+    return manifest->ullMagic == STORE_MANIFEST_MAGIC &&
+           manifest->ullSize == (uint64_t)st->st_size &&
+           manifest->ullInode == (uint64_t)st->st_ino &&
+           manifest->llModifiedSec == (int64_t)st->st_mtim.tv_sec &&
+           manifest->llModifiedNsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+// Manifest from an earlier ingest, NULL if there is none for this version of the file
+static PSTORE_MANIFEST
+chunk_store_read_manifest(
+    const char          *cpManifestPath,
+    const struct stat   *st)
+{
+    PSTORE_MANIFEST manifest = NULL;
+    STORE_MANIFEST header = {0};
+    size_t stLength = 0;
+    int fd = open(cpManifestPath, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return NULL;
+
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        !chunk_store_manifest_valid(&header, st))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    stLength = sizeof(STORE_MANIFEST) + (size_t)header.uiChunks * SHA256_DIGEST_SIZE;
+    if (HyperMemAlloc((void**)&manifest, stLength) != HYPER_SUCCESS)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if (pread(fd, manifest, stLength, 0) != (ssize_t)stLength)
+    {
+        HyperMemFree(manifest);
+        manifest = NULL;
+    }
+
+    close(fd);
+    return manifest;
+}
+
+// Fill lpData from offPosition on, fewer bytes only if the file ends first
+static ssize_t
+chunk_store_read(
+    int                 fd,
+    void                *lpData,
+    size_t              stLength,
+    off_t               offPosition)
+{
+    ssize_t sBytesRead = 0;
+    size_t stDone = 0;
+
+    while (stDone < stLength)
+    {
+        sBytesRead = pread(fd, (char*)lpData + stDone, stLength - stDone, offPosition + (off_t)stDone);
+        if (sBytesRead == -1 && errno == EINTR)
+            continue;
+        if (sBytesRead == -1)
+            return -1;
+        if (sBytesRead == 0)
+            break;
+
+        stDone += sBytesRead;
+    }
+
+    return (ssize_t)stDone;
+}
+
+// Store the chunks of one buffer the store doesn't have yet, the lock is held for this buffer only
+static HYPERSTATUS
+chunk_store_add(
+    const unsigned char *ucIds,
+    const unsigned char *ucData,
+    const uint32_t      *uiLengths,
+    uint32_t            uiChunks,
+    unsigned long long  *ullNew)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    size_t stOffset = 0;
+
+    pthread_mutex_lock(&chunkStore.lock);
+    for (uint32_t i = 0; i < uiChunks && hsResult == HYPER_SUCCESS; i++)
+    {
+        if (chunk_store_find(ucIds + (size_t)i * SHA256_DIGEST_SIZE) == UINT32_MAX)
+        {
+            hsResult = chunk_store_append(ucIds + (size_t)i * SHA256_DIGEST_SIZE, ucData + stOffset, uiLengths[i]);
+            *ullNew += uiLengths[i];
+        }
+        chunkStore.stats.ullIngestedBytes += uiLengths[i];
+        stOffset += uiLengths[i];
+    }
+    pthread_mutex_unlock(&chunkStore.lock);
+
+    return hsResult;
+}
+
+static HYPERSTATUS
+chunk_store_save_manifest(
+    PSTORE_MANIFEST     manifest,
+    const char          *cpManifestPath)
+{
+    char cpTempPath[SERVER_MAX_PATH];
+    int fd = -1;
+
+    if (snprintf(cpTempPath, sizeof(cpTempPath), "%s.XXXXXX", cpManifestPath) >= (int)sizeof(cpTempPath))
+        return HYPER_FAILED;
+
+    fd = mkostemp(cpTempPath, O_CLOEXEC);
+    if (fd == -1)
+        return HYPER_FAILED;
+
+    // Written aside and renamed, a reader never sees half a manifest
+    if (chunk_store_write(fd, manifest, sizeof(STORE_MANIFEST) + (size_t)manifest->uiChunks * SHA256_DIGEST_SIZE, 0) != HYPER_SUCCESS ||
+        close(fd) == -1 || rename(cpTempPath, cpManifestPath) == -1)
+    {
+        unlink(cpTempPath);
+        return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+/* Split the file into chunks, store the ones the store doesn't have and record
+   the manifest. Read with pread a buffer at a time rather than mapped, a hosted
+   file truncated meanwhile then fails the ingest instead of raising SIGBUS */
+static PSTORE_MANIFEST
+chunk_store_ingest(
+    int                 fd,
+    const char          *cpManifestPath,
+    const struct stat   *st)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    PSTORE_MANIFEST manifest = NULL;
+    SHA256_CONTEXT context;
+    struct stat stAfter = {0};
+    unsigned char *ucBuffer = NULL;
+    uint32_t uiLengths[STORE_INGEST_BUFFER / STORE_MIN_CHUNK + 1];
+    uint32_t uiBatch = 0;
+    size_t stMaxChunks = (size_t)st->st_size / STORE_MIN_CHUNK + 1;
+    size_t stFilled = 0;
+    size_t stOffset = 0;
+    size_t stChunk = 0;
+    size_t stWant = 0;
+    unsigned long long ullRead = 0;
+    unsigned long long ullNew = 0;
+
+    if (HyperMemAlloc((void**)&manifest, sizeof(STORE_MANIFEST) + stMaxChunks * SHA256_DIGEST_SIZE) != HYPER_SUCCESS)
+        return NULL;
+
+    if (HyperMemAlloc((void**)&ucBuffer, STORE_INGEST_BUFFER) != HYPER_SUCCESS)
+    {
+        HyperMemFree(manifest);
+        return NULL;
+    }
+
+    memset(manifest, 0, sizeof(STORE_MANIFEST));
+    manifest->ullMagic = STORE_MANIFEST_MAGIC;
+    manifest->ullSize = st->st_size;
+    manifest->ullInode = st->st_ino;
+    manifest->llModifiedSec = st->st_mtim.tv_sec;
+    manifest->llModifiedNsec = st->st_mtim.tv_nsec;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while (hsResult == HYPER_SUCCESS && (stFilled || ullRead < (unsigned long long)st->st_size))
+    {
+        // Top the buffer up, coming up short means the file shrank under us
+        stWant = STORE_INGEST_BUFFER - stFilled;
+        if (stWant > (unsigned long long)st->st_size - ullRead)
+            stWant = (size_t)((unsigned long long)st->st_size - ullRead);
+        if (stWant && chunk_store_read(fd, ucBuffer + stFilled, stWant, (off_t)ullRead) != (ssize_t)stWant)
+        {
+            hsResult = HYPER_FAILED;
+            break;
+        }
+        stFilled += stWant;
+        ullRead += stWant;
+
+        // A cut looks at most STORE_MAX_CHUNK ahead, so with that much left it
+        // lands where it would on the whole file. The rest waits for more data
+        stOffset = 0;
+        uiBatch = 0;
+        while (stOffset < stFilled &&
+               (ullRead == (unsigned long long)st->st_size || stFilled - stOffset >= STORE_MAX_CHUNK))
+        {
+            stChunk = chunk_store_cut(ucBuffer + stOffset, stFilled - stOffset);
+
+            checksum_sha256_init(&context);
+            checksum_sha256_update(&context, ucBuffer + stOffset, stChunk);
+            checksum_sha256_final(&context, manifest->ucIds + (size_t)(manifest->uiChunks + uiBatch) * SHA256_DIGEST_SIZE);
+
+            uiLengths[uiBatch++] = (uint32_t)stChunk;
+            stOffset += stChunk;
+        }
+
+        hsResult = chunk_store_add(manifest->ucIds + (size_t)manifest->uiChunks * SHA256_DIGEST_SIZE,
+                ucBuffer, uiLengths, uiBatch, &ullNew);
+        manifest->uiChunks += uiBatch;
+
+        memmove(ucBuffer, ucBuffer + stOffset, stFilled - stOffset);
+        stFilled -= stOffset;
+    }
+
+    HyperMemFree(ucBuffer);
+
+    // Rewritten in place while we read, the chunks are fine but this manifest isn't
+    if (hsResult == HYPER_SUCCESS &&
+        (fstat(fd, &stAfter) == -1 || stAfter.st_size != st->st_size ||
+         stAfter.st_mtim.tv_sec != st->st_mtim.tv_sec || stAfter.st_mtim.tv_nsec != st->st_mtim.tv_nsec))
+        hsResult = HYPER_FAILED;
+
+    if (hsResult != HYPER_SUCCESS || chunk_store_save_manifest(manifest, cpManifestPath) != HYPER_SUCCESS)
+    {
+        HyperMemFree(manifest);
+        return NULL;
+    }
+
+    printf("[+] Stored %lld bytes as %u chunks, %llu bytes new\n", (long long)st->st_size, manifest->uiChunks, ullNew);
+
+    return manifest;
+}
+
+/* Files queued or being ingested for SEND, so a popular one only goes once */
+static pthread_mutex_t ingestLock = PTHREAD_MUTEX_INITIALIZER;
+static PSTORE_INGEST ingestHead = NULL;
+static uint32_t uiPending = 0;
+
+static void
+chunk_store_ingest_run(
+    PBACKGROUND_JOB     job)
+{
+    PSTORE_INGEST ingest = (PSTORE_INGEST)job;
+    PSTORE_MANIFEST manifest = NULL;
+
+    // A CHUNKS request may have ingested it while it waited
+    manifest = chunk_store_read_manifest(ingest->cpManifestPath, &ingest->st);
+    if (manifest == NULL)
+        manifest = chunk_store_ingest(ingest->fd, ingest->cpManifestPath, &ingest->st);
+
+    if (manifest)
+        HyperMemFree(manifest);
+    else
+        printf("[-] Couldn't add %s to the chunk store\n", ingest->cpPath);
+}
+
+static void
+chunk_store_ingest_release(
+    PBACKGROUND_JOB     job)
+{
+    PSTORE_INGEST ingest = (PSTORE_INGEST)job;
+    PSTORE_INGEST *next = &ingestHead;
+
+    pthread_mutex_lock(&ingestLock);
+    while (*next != ingest)
+        next = &(*next)->next;
+    *next = ingest->next;
+    uiPending--;
+    pthread_mutex_unlock(&ingestLock);
+
+    close(ingest->fd);
+    HyperMemFree(ingest);
+}
+
+// Hand the file to a background thread, unless it is already on its way there
+static void
+chunk_store_queue(
+    int                 fd,
+    const char          *cpPath,
+    const char          *cpManifestPath,
+    const struct stat   *st)
+{
+    PSTORE_INGEST ingest = NULL;
+    PSTORE_INGEST *next = &ingestHead;
+
+    if (strlen(cpPath) >= sizeof(ingest->cpPath))
+        return;
+
+    pthread_mutex_lock(&ingestLock);
+
+    for (; *next; next = &(*next)->next)
+    {
+        if (strcmp((*next)->cpManifestPath, cpManifestPath) == 0)
+            break;
+    }
+
+    if (*next || uiPending >= STORE_MAX_PENDING ||
+        HyperMemAlloc((void**)&ingest, sizeof(STORE_INGEST)) != HYPER_SUCCESS)
+    {
+        pthread_mutex_unlock(&ingestLock);
+        return;
+    }
+
+    memset(ingest, 0, sizeof(STORE_INGEST));
+    ingest->job.run = chunk_store_ingest_run;
+    ingest->job.release = chunk_store_ingest_release;
+    ingest->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    ingest->st = *st;
+    strcpy(ingest->cpPath, cpPath);
+    strcpy(ingest->cpManifestPath, cpManifestPath);
+
+    if (ingest->fd == -1)
+    {
+        pthread_mutex_unlock(&ingestLock);
+        HyperMemFree(ingest);
+        return;
+    }
+
+    *next = ingest;
+    uiPending++;
+    pthread_mutex_unlock(&ingestLock);
+
+    // Nothing to answer, so no inbox or connection. Release also unlinks it
+    if (background_submit(&ingest->job) != HYPER_SUCCESS)
+        chunk_store_ingest_release(&ingest->job);
+}
+
+/* Chunk list of the file behind fd. With bIngest the file is ingested first
+   if it changed since last time, which reads all of it: background threads only */
+HYPERSTATUS
+chunk_store_manifest(
+    int                 fd,
+    const char          *cpPath,
+    const struct stat   *st,
+    int                 bIngest,
+    PSTORE_MANIFEST     *manifest)
+{
+    char cpManifestPath[SERVER_MAX_PATH];
+
+    if (!chunkStore.bEnabled ||
+        chunk_store_manifest_path(cpPath, cpManifestPath, sizeof(cpManifestPath)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    *manifest = chunk_store_read_manifest(cpManifestPath, st);
+    if (*manifest == NULL && bIngest)
+        *manifest = chunk_store_ingest(fd, cpManifestPath, st);
+
+    return *manifest ? HYPER_SUCCESS : HYPER_FAILED;
+}
+
+// Pack memory of one chunk, valid for as long as the server runs
+HYPERSTATUS
+chunk_store_locate(
+    const unsigned char *ucId,
+    const char          **cpData,
+    uint32_t            *uiLength)
+{
+    PSTORE_CHUNK chunk = NULL;
+    uint32_t uiChunk = 0;
+
+    pthread_mutex_lock(&chunkStore.lock);
+
+    uiChunk = chunk_store_find(ucId);
+    if (uiChunk != UINT32_MAX)
+    {
+        chunk = &chunkStore.chunks[uiChunk];
+        *cpData = chunkStore.packs[chunk->uiPack].cpMap + chunk->ullOffset;
+        *uiLength = chunk->uiLength;
+    }
+
+    pthread_mutex_unlock(&chunkStore.lock);
+
+    return uiChunk != UINT32_MAX ? HYPER_SUCCESS : HYPER_FAILED;
+}
+
+/* Pack memory that makes up a byte range of the file, for SEND to queue as is.
+   Fails for a file without a manifest yet and queues it to be ingested */
+HYPERSTATUS
+chunk_store_extents(
+    int                 fd,
+    const char          *cpPath,
+    const struct stat   *st,
+    unsigned long long  ullOffset,
+    unsigned long long  ullLength,
+    PSTORE_EXTENT       *extents,
+    size_t              *stExtents)
+{
+    PSTORE_MANIFEST manifest = NULL;
+    PSTORE_EXTENT extent = NULL;
+    PSTORE_CHUNK chunk = NULL;
+    const char *cpData = NULL;
+    unsigned long long ullPosition = 0;
+    unsigned long long ullEnd = ullOffset + ullLength;
+    size_t stSkip = 0;
+    size_t stTake = 0;
+    uint32_t uiChunk = 0;
+    char cpManifestPath[SERVER_MAX_PATH];
+
+    *extents = NULL;
+    *stExtents = 0;
+
+    if (!chunkStore.bEnabled ||
+        chunk_store_manifest_path(cpPath, cpManifestPath, sizeof(cpManifestPath)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    // Never chunked, or changed since. This SEND is served from the file itself
+    manifest = chunk_store_read_manifest(cpManifestPath, st);
+    if (manifest == NULL)
+    {
+        chunk_store_queue(fd, cpPath, cpManifestPath, st);
+        return HYPER_FAILED;
+    }
+
+    if (HyperMemAlloc((void**)extents, sizeof(STORE_EXTENT) * (manifest->uiChunks + 1)) != HYPER_SUCCESS)
+    {
+        HyperMemFree(manifest);
+        return HYPER_FAILED;
+    }
+
+    pthread_mutex_lock(&chunkStore.lock);
+
+    for (uint32_t i = 0; i < manifest->uiChunks && ullPosition < ullEnd; i++)
+    {
+        uiChunk = chunk_store_find(manifest->ucIds + (size_t)i * SHA256_DIGEST_SIZE);
+        if (uiChunk == UINT32_MAX)
+            break;
+
+        chunk = &chunkStore.chunks[uiChunk];
+        if (ullPosition + chunk->uiLength <= ullOffset)
+        {
+            ullPosition += chunk->uiLength;
+            continue;
+        }
+
+        // Only the first and last chunk of a range are ever clipped
+        stSkip = ullPosition < ullOffset ? (size_t)(ullOffset - ullPosition) : 0;
+        stTake = chunk->uiLength - stSkip;
+        if (ullPosition + chunk->uiLength > ullEnd)
+            stTake -= (size_t)(ullPosition + chunk->uiLength - ullEnd);
+
+        cpData = chunkStore.packs[chunk->uiPack].cpMap + chunk->ullOffset + stSkip;
+        if (extent && extent->cpData + extent->stLength == cpData)
+            extent->stLength += stTake;
+        else
+        {
+            extent = &(*extents)[(*stExtents)++];
+            extent->cpData = cpData;
+            extent->stLength = stTake;
+        }
+
+        ullPosition += chunk->uiLength;
+    }
+
+    pthread_mutex_unlock(&chunkStore.lock);
+    HyperMemFree(manifest);
+
+    // A chunk went missing from the packs, the file itself has to do
+    if (ullPosition < ullEnd)
+    {
+        HyperMemFree(*extents);
+        *extents = NULL;
+        *stExtents = 0;
+        return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// Release for manifest text and other store buffers handed to conn_write_mapped
+void
+chunk_store_free(
+    void                *lpContext)
+{
+    HyperMemFree(lpContext);
+}
+
+void
+chunk_store_get_stats(
+    PCHUNK_STORE_STATS  stats)
+{
+    pthread_mutex_lock(&chunkStore.lock);
+    *stats = chunkStore.stats;
+    pthread_mutex_unlock(&chunkStore.lock);
+}
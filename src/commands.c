@@ -1,165 +1,1204 @@
 #include "commands.h"
 
-COMMAND command_list[3] = {
+COMMAND command_list[] = {
     {"SEND", &send_file},
     {"LIST", &list_dir},
-    {"QUIT", &client_quit}
+    {"QUIT", &client_quit},
+    {"HELLO", &negotiate_protocol},
+    {"PUT", &put_file},
+    {"STATS", &report_stats},
+    {"HASH", &hash_file},
+    {"SYNC", &sync_file},
+    {"CHUNKS", &list_chunks},
+    {"FETCH", &fetch_chunks}
 };
-unsigned int numCommands = 3;
+const unsigned int numCommands = sizeof(command_list) / sizeof(command_list[0]);
+
+/* Perfect hash over command_list, built once by command_table_init */
+static PCOMMAND commandTable[COMMAND_TABLE_SIZE];
+static uint64_t commandKeys[COMMAND_TABLE_SIZE];
+static uint64_t ullCommandMultiplier = 0;
+
+// Pack a command name of up to 8 bytes into an integer, 0 if it can't be one
+static uint64_t
+command_key(
+    const char          *cpName)
+{
+    uint64_t ullKey = 0;
+    unsigned int i = 0;
+
+    for (i = 0; cpName[i]; i++)
+    {
+        if (i == sizeof(ullKey))
+            return 0;
+
+        ullKey |= (uint64_t)(unsigned char)cpName[i] << (8 * i);
+    }
+
+    return ullKey;
+}
+
+static unsigned int
+command_slot(
+    uint64_t            ullKey)
+{
+    return (unsigned int)((ullKey * ullCommandMultiplier) >> (64 - COMMAND_TABLE_BITS));
+}
+
+// Search for a multiplier that gives every command its own slot
+HYPERSTATUS
+command_table_init(void)
+{
+    uint64_t ullSeed = 0x9e3779b97f4a7c15ULL;
+    unsigned int uiSlot = 0;
+    unsigned int i = 0;
+
+    // Per-command counters are sized at compile time
+    if (numCommands > STATS_MAX_COMMANDS)
+        return HYPER_FAILED;
+
+    for (unsigned int uiTry = 0; uiTry < 100000; uiTry++)
+    {
+        // splitmix64, only odd multipliers spread bits into the top
+        ullSeed += 0x9e3779b97f4a7c15ULL;
+        ullCommandMultiplier = ullSeed;
+        ullCommandMultiplier = (ullCommandMultiplier ^ (ullCommandMultiplier >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        ullCommandMultiplier = (ullCommandMultiplier ^ (ullCommandMultiplier >> 27)) * 0x94d049bb133111ebULL;
+        ullCommandMultiplier = (ullCommandMultiplier ^ (ullCommandMultiplier >> 31)) | 1;
+
+        memset(commandTable, 0, sizeof(commandTable));
+        memset(commandKeys, 0, sizeof(commandKeys));
+
+        for (i = 0; i < numCommands; i++)
+        {
+            uiSlot = command_slot(command_key(command_list[i].command));
+            if (commandTable[uiSlot])
+                break;
+
+            commandTable[uiSlot] = &command_list[i];
+            commandKeys[uiSlot] = command_key(command_list[i].command);
+        }
+
+        if (i == numCommands)
+            return HYPER_SUCCESS;
+    }
+
+    return HYPER_FAILED;
+}
+
+PCOMMAND
+command_lookup(
+    const char          *cpName)
+{
+    uint64_t ullKey = command_key(cpName);
+    unsigned int uiSlot = command_slot(ullKey);
+
+    if (ullKey == 0 || commandKeys[uiSlot] != ullKey)
+        return NULL;
+
+    return commandTable[uiSlot];
+}
 
 int command_handler(
-    SOCKET              sock,
+    PCONNECTION         conn,
     char                *command
 )
 {
+    char *args[MAX_COMMAND_ARGS + 1];
+    size_t stArgsSize = 0;
+    PCOMMAND pCommand = NULL;
+    PWORKER_STATS stats = &conn->worker->stats;
+    unsigned long long ullStart = 0;
+
     if (command == NULL)
         return HYPER_FAILED;
 
-    size_t stArgsSize = 0;
-    char** args = GetArgs(command, ' ', &stArgsSize);
-    if (args == NULL)
+    // Every command gets exactly one response, or a pipelining client loses count
+    stArgsSize = parse_args(command, args, MAX_COMMAND_ARGS);
+    if (stArgsSize == 0)
+    {
+        conn_send_status(conn, 400);
         return HYPER_FAILED;
+    }
 
-    for(unsigned int i = 0; i < numCommands; i++)
+    pCommand = command_lookup(args[0]);
+    if (pCommand == NULL)
     {
-        if (strcmp(command_list[i].command, command) == 0)
+        STAT_ADD(stats->ullUnknownCommands, 1);
+        conn_send_status(conn, 501);
+        return HYPER_FAILED;
+    }
+
+    ullStart = stats_now();
+    pCommand->execute(conn, (const char**)args, stArgsSize);
+    stats_record_command(stats, (unsigned int)(pCommand - command_list), stats_now() - ullStart);
+
+    return HYPER_SUCCESS;
+}
+
+// Resolved paths must stay inside the hosted directory
+static int
+path_in_root(
+    const char          *cpPath)
+{
+    size_t stRootLength = strlen(serverConfig.cpRoot);
+
+    if (strncmp(cpPath, serverConfig.cpRoot, stRootLength) != 0)
+        return 0;
+
+    return cpPath[stRootLength] == '/' || cpPath[stRootLength] == 0;
+}
+
+// Strictly parse an unsigned decimal, a byte offset or length or a HELLO version
+static int
+parse_offset(
+    const char          *cpValue,
+    unsigned long long  *ullValue)
+{
+    char *cpEnd = NULL;
+
+    if (*cpValue < '0' || *cpValue > '9')
+        return 0;
+
+    errno = 0;
+    *ullValue = strtoull(cpValue, &cpEnd, 10);
+
+    return errno == 0 && *cpEnd == 0;
+}
+
+/* CRC32C of the range SEND is about to queue, whole files come from the digest cache.
+   Without cpData only the cache can answer, see send_produce */
+static HYPERSTATUS
+send_checksum(
+    PCONNECTION         conn,
+    const struct stat   *st,
+    const char          *cpData,
+    unsigned long long  ullOffset,
+    unsigned long long  ullLength,
+    uint32_t            *uiCrc)
+{
+    PDIGEST_CACHE cache = &conn->worker->digestCache;
+    PDIGEST digest = NULL;
+    DIGEST computed = {0};
+    int bWhole = ullOffset == 0 && ullLength == (unsigned long long)st->st_size;
+
+    if (bWhole)
+    {
+        digest = digest_cache_lookup(cache, st, 0);
+        if (digest)
         {
-            command_list[i].execute(sock, (const char**)args, stArgsSize);
-            free(args);
+            *uiCrc = digest->uiCrc32c;
             return HYPER_SUCCESS;
         }
     }
 
-    free(args);
-    return HYPER_FAILED;
+    if (cpData == NULL)
+        return HYPER_FAILED;
+
+    *uiCrc = checksum_crc32c(0, cpData + ullOffset, ullLength);
+
+    if (bWhole)
+    {
+        computed.uiCrc32c = *uiCrc;
+        digest_cache_store(cache, st, &computed);
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// Queue the status, size and a byte range of a cached file
+static void
+send_cached_range(
+    PCONNECTION         conn,
+    PCACHE_ENTRY        entry,
+    const struct stat   *st,
+    unsigned long long  ullOffset,
+    unsigned long long  ullLength,
+    int                 bRanged)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    uint32_t uiCrc = 0;
+
+    // Straight from memory, this can't fail
+    if (conn->bChecksums)
+        send_checksum(conn, st, entry->cpData + CACHE_HEADER_SIZE, ullOffset, ullLength, &uiCrc);
+
+    file_cache_retain(entry);
+
+    // The pre-formatted header only fits whole files in text mode
+    if (bRanged || conn->bFramed)
+    {
+        conn_begin_response(conn, 200, ullLength);
+        hsResult = conn_write_mapped(conn, entry->cpData + CACHE_HEADER_SIZE + ullOffset,
+                ullLength, file_cache_release, entry);
+    }
+    else
+    {
+        // Status is already baked into the cached header
+        stats_record_status(&conn->worker->stats, 200);
+        hsResult = conn_write_mapped(conn, entry->cpData, entry->stDataLength, file_cache_release, entry);
+    }
+
+    if (hsResult != HYPER_SUCCESS)
+    {
+        file_cache_release(entry);
+        conn->bClosing = 1;
+        return;
+    }
+
+    if (conn->bChecksums && conn_write_checksum(conn, uiCrc) != HYPER_SUCCESS)
+        conn->bClosing = 1;
+}
+
+// Read the next piece of the range and sum it, the CHECKSUM frame follows the last one
+static ssize_t
+send_produce(
+    void                *lpContext,
+    char                *cpBuffer,
+    size_t              stCapacity,
+    int                 *bDone)
+{
+    PSEND_STATE state = (PSEND_STATE)lpContext;
+    DIGEST computed = {0};
+    ssize_t sBytesRead = 0;
+    size_t stWanted = stCapacity;
+
+    if (stWanted > state->ullRemaining)
+        stWanted = state->ullRemaining;
+
+    while (stWanted)
+    {
+        sBytesRead = pread(state->fd, cpBuffer, stWanted, state->ullOffset);
+        if (sBytesRead == -1 && errno == EINTR)
+            continue;
+
+        // Truncated since the size went out, the body can't be completed
+        if (sBytesRead <= 0)
+            return -1;
+
+        state->uiCrc = checksum_crc32c(state->uiCrc, cpBuffer, sBytesRead);
+        state->ullOffset += sBytesRead;
+        state->ullRemaining -= sBytesRead;
+        break;
+    }
+
+    // The frame goes out whole, so it may have to wait for the next call
+    if (state->ullRemaining || stCapacity - sBytesRead < CHECKSUM_FRAME_SIZE)
+        return sBytesRead;
+
+    if (state->bWhole)
+    {
+        computed.uiCrc32c = state->uiCrc;
+        digest_cache_store(state->cache, &state->st, &computed);
+    }
+
+    *bDone = 1;
+    return sBytesRead + conn_format_checksum(state->uiCrc, (unsigned char*)cpBuffer + sBytesRead);
+}
+
+static void
+send_release(
+    void                *lpContext)
+{
+    PSEND_STATE state = (PSEND_STATE)lpContext;
+
+    close(state->fd);
+}
+
+// Uncached range with no CRC on record, summed on the way out instead of read twice
+static void
+send_summed_range(
+    PCONNECTION         conn,
+    int                 fd,
+    const struct stat   *st,
+    unsigned long long  ullOffset,
+    unsigned long long  ullLength)
+{
+    PSEND_STATE state = NULL;
+
+    state = conn_alloc(conn, sizeof(SEND_STATE));
+    if (state == NULL)
+    {
+        close(fd);
+        conn_send_status(conn, 500);
+        return;
+    }
+
+    memset(state, 0, sizeof(SEND_STATE));
+    state->fd = fd;
+    state->ullOffset = ullOffset;
+    state->ullRemaining = ullLength;
+    state->bWhole = ullOffset == 0 && ullLength == (unsigned long long)st->st_size;
+    state->st = *st;
+    state->cache = &conn->worker->digestCache;
+
+    conn_begin_response(conn, 200, ullLength);
+    if (conn_write_body_producer(conn, send_produce, send_release, state) != HYPER_SUCCESS)
+    {
+        send_release(state);
+        conn->bClosing = 1;
+    }
 }
 
+// SEND <path> [offset] [length]
 void send_file(
-    SOCKET sock,
+    PCONNECTION         conn,
     const char          **argv,
     const size_t        argc
 )
 {
-    HYPERSTATUS hsResult = 0;
-    HYPERFILE hfFile = NULL;
-    unsigned long ulSize = 0;
+    PFILE_CACHE cache = &conn->worker->fileCache;
+    PCACHE_ENTRY entry = NULL;
+    PSTORE_EXTENT extents = NULL;
+    size_t stExtents = 0;
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    struct stat st = {0};
+    int fd = -1;
+    unsigned long long ullOffset = 0;
+    unsigned long long ullLength = 0;
+    uint32_t uiCrc = 0;
+    int bRanged = argc > 2;
     
     char cpFilePath[SERVER_MAX_PATH];
-    char cpCWD[SERVER_MAX_PATH];
     memset(cpFilePath, 0, SERVER_MAX_PATH);
-    memset(cpCWD, 0, SERVER_MAX_PATH);
-
-    getcwd(cpCWD, SERVER_MAX_PATH);
 
     if (argc < 2)
+    {
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    if ((argc > 2 && !parse_offset(argv[2], &ullOffset)) ||
+        (argc > 3 && !parse_offset(argv[3], &ullLength)))
+    {
+        conn_send_status(conn, 400);
         return;
+    }
     
-    /* TODO: This is very bad and *will* lead to a directory traversal vuln */ 
     if (realpath(argv[1], cpFilePath) == NULL)
     {
-        HyperSendStatus(sock, 404);
+        conn_send_status(conn, 404);
         return;
     }
-    if (strstr(cpFilePath, cpCWD) == NULL)
+    if (!path_in_root(cpFilePath))
     {
-        HyperSendStatus(sock, 404);
+        conn_send_status(conn, 404);
         return;
     }
 
+    if (stat(cpFilePath, &st) == -1)
+    {
+        conn_send_status(conn, 400);
+        return;
+    }
 
-    hsResult = HyperReadFile(cpFilePath, &hfFile, &ulSize);
-    if (hsResult == HYPER_FAILED)
+    if (!S_ISREG(st.st_mode))
     {
-        HyperSendStatus(sock, 400);
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    // The range has to lie inside the file, an empty range at EOF is fine
+    if (ullOffset > (unsigned long long)st.st_size)
+    {
+        conn_send_status(conn, 416);
+        return;
+    }
+    if (argc < 4)
+        ullLength = st.st_size - ullOffset;
+    else if (ullLength > st.st_size - ullOffset)
+    {
+        conn_send_status(conn, 416);
+        return;
+    }
+
+    // Hot files go out as one pre-formatted buffer
+    entry = file_cache_lookup(cache, cpFilePath, &st);
+    if (entry)
+    {
+        send_cached_range(conn, entry, &st, ullOffset, ullLength, bRanged);
         return;
     }
-    
-    HyperSendStatus(sock, 200);
 
-    HyperSendFile(sock, &hfFile, ulSize);
+    // Stream straight from the page cache instead of reading into the heap
+    fd = open(cpFilePath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    // Whatever we send has to match what we validated the range against
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        ullOffset + ullLength > (unsigned long long)st.st_size)
+    {
+        close(fd);
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    entry = file_cache_insert(cache, cpFilePath, fd, &st);
+    if (entry)
+    {
+        close(fd);
+        send_cached_range(conn, entry, &st, ullOffset, ullLength, bRanged);
+        return;
+    }
     
-    HyperMemFree(hfFile);
+    if (conn->bChecksums && send_checksum(conn, &st, NULL, ullOffset, ullLength, &uiCrc) != HYPER_SUCCESS)
+    {
+        send_summed_range(conn, fd, &st, ullOffset, ullLength);
+        return;
+    }
+
+    // Deduplicated copies go out straight from the packs, the file is the fallback
+    if (chunkStore.bEnabled && ullLength &&
+        chunk_store_extents(fd, cpFilePath, &st, ullOffset, ullLength, &extents, &stExtents) == HYPER_SUCCESS)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    conn_begin_response(conn, 200, ullLength);
+
+    if (extents)
+    {
+        for (size_t i = 0; i < stExtents && hsResult == HYPER_SUCCESS; i++)
+            hsResult = conn_write_mapped(conn, extents[i].cpData, extents[i].stLength, NULL, NULL);
+        HyperMemFree(extents);
+    }
+    else
+        hsResult = conn_send_fd(conn, fd, ullOffset, ullLength);
+
+    if (hsResult != HYPER_SUCCESS)
+    {
+        if (fd != -1)
+            close(fd);
+        conn->bClosing = 1;
+        return;
+    }
+
+    if (conn->bChecksums && conn_write_checksum(conn, uiCrc) != HYPER_SUCCESS)
+        conn->bClosing = 1;
+}
+
+// Format one LIST line, returns 0 if it doesn't fit in stCapacity bytes
+size_t
+list_format_entry(
+    char                *cpBuffer,
+    size_t              stCapacity,
+    const char          *cpName,
+    mode_t              perm,
+    off_t               offSize)
+{
+    char filePerms[11];
+    int iLength = 0;
+
+    filePerms[0] = S_ISDIR(perm)    ? 'd' : '-';
+    filePerms[1] = (perm & S_IRUSR) ? 'r' : '-';
+    filePerms[2] = (perm & S_IWUSR) ? 'w' : '-';
+    filePerms[3] = (perm & S_IXUSR) ? 'x' : '-';
+    filePerms[4] = (perm & S_IRGRP) ? 'r' : '-';
+    filePerms[5] = (perm & S_IWGRP) ? 'w' : '-';
+    filePerms[6] = (perm & S_IXGRP) ? 'x' : '-';
+    filePerms[7] = (perm & S_IROTH) ? 'r' : '-';
+    filePerms[8] = (perm & S_IWOTH) ? 'w' : '-';
+    filePerms[9] = (perm & S_IXOTH) ? 'x' : '-';
+    filePerms[10] = 0;
+
+    iLength = snprintf(cpBuffer, stCapacity, "%s %ld %s\n", filePerms, (long)offSize, cpName);
+    if (iLength < 0 || (size_t)iLength >= stCapacity)
+        return 0;
+
+    return iLength;
+}
+
+// Fill the next LIST buffer, an entry that doesn't fit waits for the next call
+static ssize_t
+list_produce(
+    void                *lpContext,
+    char                *cpBuffer,
+    size_t              stCapacity,
+    int                 *bDone)
+{
+    PLIST_STATE state = (PLIST_STATE)lpContext;
+    struct dirent64 *entry = NULL;
+    struct statx stx;
+    ssize_t sBytesRead = 0;
+    size_t stUsed = 0;
+    size_t stLength = 0;
+
+    while (1)
+    {
+        if (state->stDentsOffset >= state->stDentsLength)
+        {
+            if (state->bEof)
+            {
+                *bDone = 1;
+                break;
+            }
+
+            sBytesRead = getdents64(state->dirFd, state->cpDents, LIST_DENTS_BUFFER_SIZE);
+            if (sBytesRead == -1 && errno == EINTR)
+                continue;
+
+            // A truncated listing must not look complete, drop the connection
+            if (sBytesRead == -1)
+                return -1;
+
+            state->bEof = sBytesRead == 0;
+            state->stDentsLength = sBytesRead;
+            state->stDentsOffset = 0;
+            continue;
+        }
+
+        entry = (struct dirent64*)(state->cpDents + state->stDentsOffset);
+
+        // Only the two fields LIST prints, and no revalidation on network mounts
+        memset(&stx, 0, sizeof(stx));
+        if (statx(state->dirFd, entry->d_name, AT_STATX_DONT_SYNC, STATX_MODE | STATX_SIZE, &stx) == -1 &&
+            entry->d_type != DT_UNKNOWN)
+            stx.stx_mode = DTTOIF(entry->d_type);
+
+        stLength = list_format_entry(cpBuffer + stUsed, stCapacity - stUsed,
+                entry->d_name, stx.stx_mode, stx.stx_size);
+        if (stLength == 0)
+            break;
+
+        stUsed += stLength;
+        state->stDentsOffset += entry->d_reclen;
+    }
+
+    if (state->capture)
+    {
+        list_cache_append(state->cache, state->capture, cpBuffer, stUsed);
+        if (*bDone)
+        {
+            list_cache_finish(state->cache, state->capture, 1);
+            state->capture = NULL;
+        }
+    }
+
+    return stUsed;
 }
 
+static void
+list_release(
+    void                *lpContext)
+{
+    PLIST_STATE state = (PLIST_STATE)lpContext;
+
+    // The client went away before the listing was complete
+    if (state->capture)
+        list_cache_finish(state->cache, state->capture, 0);
+
+    close(state->dirFd);
+}
+
+// LIST [directory], streamed a buffer at a time as the socket drains
 void 
 list_dir(
-    SOCKET              sock,
+    PCONNECTION         conn,
     const char          **argv,
     const size_t        argc)
 {
-    DIR *dpDir = NULL;
-    struct dirent *entry = {0};
-    struct stat st = {0};
-    char *cpDirToList = NULL;
-    
-    char *entryBuffer = NULL;
-    char *listBuffer = NULL;
-    size_t stListBufferSize = 0;
-    size_t stLength = 0;
-    
-    char filePerms[11];
-    memset(filePerms, 0, sizeof(filePerms));
+    PLIST_CACHE cache = &conn->worker->listCache;
+    PLIST_STATE state = NULL;
+    PLIST_ENTRY entry = NULL;
+    int dirFd = -1;
+    const char *cpDirToList = NULL;
+    char resolvedPath[SERVER_MAX_PATH];
 
     if (argc > 1)
-        cpDirToList = (char*)argv[1];
+        cpDirToList = argv[1];
     else
         cpDirToList = ".";
 
-    dpDir = opendir(cpDirToList);
-
-    if (dpDir)
+    if (realpath(cpDirToList, resolvedPath) == NULL || !path_in_root(resolvedPath))
     {
-        HyperSendStatus(sock, 200);
+        conn_send_status(conn, 404);
+        return;
+    }
 
-        entry = readdir(dpDir);
-        while (entry)
+    // Unchanged since the last LIST, so the whole reply is one mapped send
+    entry = list_cache_lookup(cache, resolvedPath);
+    if (entry)
+    {
+        list_cache_retain(entry);
+        conn_begin_text(conn, 200, entry->stLength);
+        if (conn_write_mapped(conn, entry->cpData, entry->stLength, list_cache_release, entry) != HYPER_SUCCESS)
         {
-            memset(filePerms, 0, sizeof(filePerms));
-
-            stat(entry->d_name, &st);
-            mode_t perm = st.st_mode;
-
-            filePerms[0] = S_ISDIR(perm)    ? 'd' : '-';
-            filePerms[1] = (perm & S_IRUSR) ? 'r' : '-';
-            filePerms[2] = (perm & S_IWUSR) ? 'w' : '-';
-            filePerms[3] = (perm & S_IXUSR) ? 'x' : '-';
-            filePerms[4] = (perm & S_IRGRP) ? 'r' : '-';
-            filePerms[5] = (perm & S_IWGRP) ? 'w' : '-';
-            filePerms[6] = (perm & S_IXGRP) ? 'x' : '-';
-            filePerms[7] = (perm & S_IROTH) ? 'r' : '-';
-            filePerms[8] = (perm & S_IWOTH) ? 'w' : '-';
-            filePerms[9] = (perm & S_IXOTH) ? 'x' : '-';
-        
-            stLength = snprintf(NULL, 0, "%s %ld %s\n", filePerms, st.st_size, entry->d_name);
-            HyperMemRealloc((void**)&entryBuffer, stLength+1);
-            stLength = snprintf(entryBuffer, stLength+1, "%s %ld %s\n", filePerms, st.st_size, entry->d_name);
-
-            stListBufferSize += stLength + 1;
-            HyperMemRealloc((void**)&listBuffer, stListBufferSize);
-            strncat(listBuffer, entryBuffer, stListBufferSize);
-
-            entry = readdir(dpDir);
+            list_cache_release(entry);
+            conn->bClosing = 1;
         }
-        
-        listBuffer[stListBufferSize] = 0;
-        HyperSendCommand(sock, listBuffer);
+        return;
     }
-    else
+
+    state = conn_alloc(conn, sizeof(LIST_STATE));
+    if (state == NULL)
     {
-        HyperSendStatus(sock, 404);
+        conn_send_status(conn, 500);
         return;
     }
+    memset(state, 0, sizeof(LIST_STATE));
+
+    state->cpDents = conn_alloc(conn, LIST_DENTS_BUFFER_SIZE);
+    if (state->cpDents == NULL)
+    {
+        conn_send_status(conn, 500);
+        return;
+    }
+
+    // Watch before reading so nothing that changes mid-listing gets cached
+    state->cache = cache;
+    state->capture = list_cache_begin(cache, resolvedPath);
+
+    dirFd = open(resolvedPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1)
+    {
+        if (state->capture)
+            list_cache_finish(cache, state->capture, 0);
+        conn_send_status(conn, 404);
+        return;
+    }
+    state->dirFd = dirFd;
+
+    conn_begin_stream(conn, 200);
+    if (conn_write_producer(conn, list_produce, list_release, state) != HYPER_SUCCESS)
+    {
+        list_release(state);
+        conn->bClosing = 1;
+    }
 }
 
 void 
 client_quit(
-    SOCKET              sock,
+    PCONNECTION         conn,
     const char          **argv,
     const size_t        argc)
 {
-    puts("[!] Client disconnected");
-    isConnected = 0; 
+    conn->bClosing = 1;
     return;
 }
 
+// HELLO <version> [CRC32C]
+void
+negotiate_protocol(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc)
+{
+    unsigned long long ullVersion = 0;
+    size_t i = 0;
+
+    // Only the version we speak, a client that wants another one stays in text mode
+    if (argc < 2 || !parse_offset(argv[1], &ullVersion) || ullVersion != HYPER_FRAME_VERSION)
+    {
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    // Acknowledge in the mode the client asked from, then switch
+    conn_send_status(conn, 200);
+    conn->bFramed = 1;
+
+    // Optional features follow the version, unknown ones are ignored
+    for (i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "CRC32C") == 0)
+            conn->bChecksums = 1;
+    }
+}
+
+// PUT <path> <size>, followed by exactly <size> raw bytes of file
+void
+put_file(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc)
+{
+    unsigned long long ullSize = 0;
+    unsigned short usStatus = 200;
+    char dirPath[SERVER_MAX_PATH];
+    char resolvedDir[SERVER_MAX_PATH];
+    char tempPath[SERVER_MAX_PATH] = {0};
+    char finalPath[SERVER_MAX_PATH] = {0};
+    const char *cpName = NULL;
+    struct stat st = {0};
+    int fd = -1;
+
+    // Without a size there's no telling where the body ends, so give up on the stream
+    if (argc < 3 || !parse_offset(argv[2], &ullSize))
+    {
+        conn_send_status(conn, 400);
+        conn->bClosing = 1;
+        return;
+    }
+
+    cpName = strrchr(argv[1], '/');
+    if (cpName == NULL)
+    {
+        strcpy(dirPath, ".");
+        cpName = argv[1];
+    }
+    else if ((size_t)(cpName - argv[1]) < SERVER_MAX_PATH)
+    {
+        memcpy(dirPath, argv[1], cpName - argv[1]);
+        dirPath[cpName - argv[1]] = 0;
+        cpName++;
+    }
+    else
+        usStatus = 400;
+
+    // Any error is only reported after the body has been drained
+    if (usStatus != 200 || *cpName == 0 || strcmp(cpName, ".") == 0 || strcmp(cpName, "..") == 0)
+        usStatus = 400;
+    else if (realpath(dirPath[0] ? dirPath : "/", resolvedDir) == NULL || !path_in_root(resolvedDir))
+        usStatus = 404;
+    else if (snprintf(finalPath, SERVER_MAX_PATH, "%s/%s", resolvedDir, cpName) >= SERVER_MAX_PATH ||
+             snprintf(tempPath, SERVER_MAX_PATH, "%s/.upload.XXXXXX", resolvedDir) >= SERVER_MAX_PATH)
+        usStatus = 400;
+    else if (lstat(finalPath, &st) == 0 && S_ISDIR(st.st_mode))
+        usStatus = 400;
+    else
+    {
+        fd = mkostemp(tempPath, O_CLOEXEC);
+        if (fd == -1)
+            usStatus = 500;
+        else
+            fchmod(fd, 0644);
+    }
+
+    if (upload_start(conn, fd, tempPath, finalPath, ullSize, usStatus) != HYPER_SUCCESS)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(tempPath);
+        }
+
+        conn_send_status(conn, 500);
+        conn->bClosing = 1;
+    }
+}
+
+// STATS, every worker's counters in Prometheus text format
+void
+report_stats(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc)
+{
+    char *cpText = NULL;
+    size_t stLength = 0;
+
+    if (stats_format(&cpText, &stLength) != HYPER_SUCCESS)
+    {
+        conn_send_status(conn, 500);
+        return;
+    }
+
+    conn_begin_text(conn, 200, stLength);
+    if (conn_write_mapped(conn, cpText, stLength, stats_free, cpText) != HYPER_SUCCESS)
+    {
+        stats_free(cpText);
+        conn->bClosing = 1;
+    }
+}
+
+static void
+hash_reply(
+    PCONNECTION         conn,
+    const struct stat   *st,
+    const DIGEST        *digest)
+{
+    int iLength = 0;
+    char cpHex[SHA256_DIGEST_SIZE * 2 + 1];
+    char cpReply[160];
+
+    for (unsigned int i = 0; i < SHA256_DIGEST_SIZE; i++)
+        snprintf(cpHex + i * 2, 3, "%02x", digest->ucSha256[i]);
+
+    iLength = snprintf(cpReply, sizeof(cpReply), "size %lld\nsha256 %s\ncrc32c %08x\n",
+            (long long)st->st_size, cpHex, digest->uiCrc32c);
+
+    conn_begin_response(conn, 200, iLength);
+    if (conn_write(conn, cpReply, iLength) != HYPER_SUCCESS)
+        conn->bClosing = 1;
+}
+
+// Background thread, reads the whole file
+static void
+hash_job_run(
+    PBACKGROUND_JOB     job)
+{
+    PHASH_JOB hash = (PHASH_JOB)job;
+
+    hash->hsResult = checksum_file(hash->fd, 0, hash->st.st_size,
+            hash->digest.ucSha256, &hash->digest.uiCrc32c);
+    hash->digest.bSha256 = 1;
+}
+
+// Back on the worker, which alone may touch its digest cache
+static void
+hash_job_complete(
+    PBACKGROUND_JOB     job)
+{
+    PHASH_JOB hash = (PHASH_JOB)job;
+
+    if (hash->hsResult != HYPER_SUCCESS)
+    {
+        conn_send_status(job->conn, 500);
+        return;
+    }
+
+    digest_cache_store(&job->conn->worker->digestCache, &hash->st, &hash->digest);
+    hash_reply(job->conn, &hash->st, &hash->digest);
+}
+
+static void
+hash_job_release(
+    PBACKGROUND_JOB     job)
+{
+    PHASH_JOB hash = (PHASH_JOB)job;
+
+    close(hash->fd);
+    HyperMemFree(hash);
+}
+
+// HASH <path>, the size, SHA-256 and CRC32C of a whole file
+void
+hash_file(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc)
+{
+    PDIGEST_CACHE cache = &conn->worker->digestCache;
+    PDIGEST digest = NULL;
+    PHASH_JOB hash = NULL;
+    struct stat st = {0};
+    int fd = -1;
+    char cpFilePath[SERVER_MAX_PATH];
+
+    if (argc < 2)
+    {
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    if (realpath(argv[1], cpFilePath) == NULL || !path_in_root(cpFilePath))
+    {
+        conn_send_status(conn, 404);
+        return;
+    }
+
+    if (stat(cpFilePath, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    // Unchanged since it was last hashed, nothing to read
+    digest = digest_cache_lookup(cache, &st, 1);
+    if (digest)
+    {
+        hash_reply(conn, &st, digest);
+        return;
+    }
+
+    fd = open(cpFilePath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    // Key the digest on the file we actually read
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        HyperMemAlloc((void**)&hash, sizeof(HASH_JOB)) != HYPER_SUCCESS)
+    {
+        close(fd);
+        conn_send_status(conn, 500);
+        return;
+    }
+
+    // The answer waits for the read, and so do the commands after it
+    memset(hash, 0, sizeof(HASH_JOB));
+    hash->job.inbox = &conn->worker->jobs;
+    hash->job.conn = conn;
+    hash->job.run = hash_job_run;
+    hash->job.complete = hash_job_complete;
+    hash->job.release = hash_job_release;
+    hash->fd = fd;
+    hash->st = st;
+
+    if (background_submit(&hash->job) != HYPER_SUCCESS)
+    {
+        hash_job_release(&hash->job);
+        conn_send_status(conn, 500);
+    }
+}
+
+// SYNC <path> <block size> <blocks>, followed by a signature for every block
+void
+sync_file(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc)
+{
+    PDELTA_REQUEST request = NULL;
+    unsigned long long ullBlockSize = 0;
+    unsigned long long ullBlocks = 0;
+    unsigned short usStatus = 200;
+
+    // Like PUT, without sane numbers there's no telling where the signatures end
+    if (argc < 4 || !parse_offset(argv[2], &ullBlockSize) || !parse_offset(argv[3], &ullBlocks) ||
+        ullBlockSize < HYPER_SYNC_MIN_BLOCK_SIZE || ullBlockSize > HYPER_SYNC_MAX_BLOCK_SIZE ||
+        ullBlocks > HYPER_SYNC_MAX_BLOCKS)
+    {
+        conn_send_status(conn, 400);
+        conn->bClosing = 1;
+        return;
+    }
+
+    if (HyperMemAlloc((void**)&request, sizeof(DELTA_REQUEST)) != HYPER_SUCCESS)
+    {
+        conn_send_status(conn, 500);
+        conn->bClosing = 1;
+        return;
+    }
+    memset(request, 0, sizeof(DELTA_REQUEST));
+    request->stBlockSize = (size_t)ullBlockSize;
+
+    // Any error is only reported after the signatures have been drained
+    if (realpath(argv[1], request->cpPath) == NULL || !path_in_root(request->cpPath))
+        usStatus = 404;
+
+    if (upload_start_buffer(conn, ullBlocks * HYPER_SYNC_SIGNATURE_SIZE, usStatus,
+            delta_complete, request) != HYPER_SUCCESS)
+    {
+        HyperMemFree(request);
+        conn_send_status(conn, 500);
+        conn->bClosing = 1;
+    }
+}
+
+// One "<id> <length>" line per chunk of manifest
+static void
+chunks_reply(
+    PCONNECTION         conn,
+    PSTORE_MANIFEST     manifest)
+{
+    const char *cpData = NULL;
+    char *cpText = NULL;
+    size_t stLength = 0;
+    uint32_t uiLength = 0;
+
+    // 64 hex digits, a space, at most 10 digits of length and a newline each
+    if (HyperMemAlloc((void**)&cpText, (size_t)manifest->uiChunks * 76 + 1) != HYPER_SUCCESS)
+    {
+        conn_send_status(conn, 500);
+        return;
+    }
+
+    for (uint32_t i = 0; i < manifest->uiChunks; i++)
+    {
+        if (chunk_store_locate(manifest->ucIds + (size_t)i * SHA256_DIGEST_SIZE, &cpData, &uiLength) != HYPER_SUCCESS)
+        {
+            HyperMemFree(cpText);
+            conn_send_status(conn, 500);
+            return;
+        }
+
+        for (unsigned int j = 0; j < SHA256_DIGEST_SIZE; j++)
+            stLength += snprintf(cpText + stLength, 3, "%02x", manifest->ucIds[(size_t)i * SHA256_DIGEST_SIZE + j]);
+        stLength += snprintf(cpText + stLength, 13, " %u\n", uiLength);
+    }
+
+    conn_begin_response(conn, 200, stLength);
+    if (conn_write_mapped(conn, cpText, stLength, chunk_store_free, cpText) != HYPER_SUCCESS)
+    {
+        chunk_store_free(cpText);
+        conn->bClosing = 1;
+    }
+}
+
+// Background thread, reads the whole file
+static void
+chunks_job_run(
+    PBACKGROUND_JOB     job)
+{
+    PCHUNKS_JOB chunks = (PCHUNKS_JOB)job;
+
+    if (chunk_store_manifest(chunks->fd, chunks->cpPath, &chunks->st, 1, &chunks->manifest) != HYPER_SUCCESS)
+        chunks->manifest = NULL;
+}
+
+static void
+chunks_job_complete(
+    PBACKGROUND_JOB     job)
+{
+    PCHUNKS_JOB chunks = (PCHUNKS_JOB)job;
+
+    if (chunks->manifest)
+        chunks_reply(job->conn, chunks->manifest);
+    else
+        conn_send_status(job->conn, 500);
+}
+
+static void
+chunks_job_release(
+    PBACKGROUND_JOB     job)
+{
+    PCHUNKS_JOB chunks = (PCHUNKS_JOB)job;
+
+    if (chunks->manifest)
+        HyperMemFree(chunks->manifest);
+    close(chunks->fd);
+    HyperMemFree(chunks);
+}
+
+// CHUNKS <path>, "<id> <length>" for every chunk of a file in the store
+void
+list_chunks(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc)
+{
+    PSTORE_MANIFEST manifest = NULL;
+    PCHUNKS_JOB chunks = NULL;
+    struct stat st = {0};
+    int fd = -1;
+    char cpFilePath[SERVER_MAX_PATH];
+
+    if (!chunkStore.bEnabled)
+    {
+        conn_send_status(conn, 501);
+        return;
+    }
+
+    if (argc < 2)
+    {
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    if (realpath(argv[1], cpFilePath) == NULL || !path_in_root(cpFilePath))
+    {
+        conn_send_status(conn, 404);
+        return;
+    }
+
+    fd = open(cpFilePath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        if (fd != -1)
+            close(fd);
+        conn_send_status(conn, 400);
+        return;
+    }
+
+    // Already in the store, only the manifest is read
+    if (chunk_store_manifest(fd, cpFilePath, &st, 0, &manifest) == HYPER_SUCCESS)
+    {
+        close(fd);
+        chunks_reply(conn, manifest);
+        HyperMemFree(manifest);
+        return;
+    }
+
+    // Otherwise the answer waits for the ingest, and so do the commands after it
+    if (HyperMemAlloc((void**)&chunks, sizeof(CHUNKS_JOB)) != HYPER_SUCCESS)
+    {
+        close(fd);
+        conn_send_status(conn, 500);
+        return;
+    }
+
+    memset(chunks, 0, sizeof(CHUNKS_JOB));
+    chunks->job.inbox = &conn->worker->jobs;
+    chunks->job.conn = conn;
+    chunks->job.run = chunks_job_run;
+    chunks->job.complete = chunks_job_complete;
+    chunks->job.release = chunks_job_release;
+    chunks->fd = fd;
+    chunks->st = st;
+    strcpy(chunks->cpPath, cpFilePath);
 
+    if (background_submit(&chunks->job) != HYPER_SUCCESS)
+    {
+        chunks_job_release(&chunks->job);
+        conn_send_status(conn, 500);
+    }
+}
+
+// The requested ids are in, answer with their chunks back to back
+static void
+fetch_complete(
+    PCONNECTION         conn,
+    PUPLOAD             upload)
+{
+    const unsigned char *ucIds = (const unsigned char*)upload->cpBuffer;
+    size_t stChunks = (size_t)(upload->ullSize / HYPER_CHUNK_ID_SIZE);
+    PSTORE_EXTENT extents = NULL;
+    unsigned long long ullTotal = 0;
+    uint32_t uiLength = 0;
+
+    if (stChunks && HyperMemAlloc((void**)&extents, sizeof(STORE_EXTENT) * stChunks) != HYPER_SUCCESS)
+    {
+        conn_send_status(conn, 500);
+        return;
+    }
+
+    // Every id has to be known before anything is queued
+    for (size_t i = 0; i < stChunks; i++)
+    {
+        if (chunk_store_locate(ucIds + i * HYPER_CHUNK_ID_SIZE, &extents[i].cpData, &uiLength) != HYPER_SUCCESS)
+        {
+            HyperMemFree(extents);
+            conn_send_status(conn, 404);
+            return;
+        }
+
+        extents[i].stLength = uiLength;
+        ullTotal += uiLength;
+    }
+
+    conn_begin_response(conn, 200, ullTotal);
+    for (size_t i = 0; i < stChunks; i++)
+    {
+        if (conn_write_mapped(conn, extents[i].cpData, extents[i].stLength, NULL, NULL) != HYPER_SUCCESS)
+        {
+            conn->bClosing = 1;
+            break;
+        }
+    }
+
+    if (extents)
+        HyperMemFree(extents);
+}
+
+// FETCH <count>, followed by count raw chunk ids
+void
+fetch_chunks(
+    PCONNECTION         conn,
+    const char          **argv,
+    const size_t        argc)
+{
+    unsigned long long ullCount = 0;
+
+    // Like PUT, without a count there's no telling where the ids end
+    if (argc < 2 || !parse_offset(argv[1], &ullCount) || ullCount > HYPER_FETCH_MAX_CHUNKS)
+    {
+        conn_send_status(conn, 400);
+        conn->bClosing = 1;
+        return;
+    }
+
+    if (upload_start_buffer(conn, ullCount * HYPER_CHUNK_ID_SIZE, chunkStore.bEnabled ? 200 : 501,
+            fetch_complete, NULL) != HYPER_SUCCESS)
+    {
+        conn_send_status(conn, 500);
+        conn->bClosing = 1;
+    }
+}
@@ -0,0 +1,1008 @@
+#include "connection.h"
+#include "upload.h"
+
+PCONNECTION
+conn_create(
+    PWORKER             worker,
+    SOCKET              sock)
+{
+    PCONNECTION conn = NULL;
+
+    if (HyperMemAlloc((void**)&conn, sizeof(CONNECTION)) != HYPER_SUCCESS)
+        return NULL;
+
+    memset(conn, 0, sizeof(CONNECTION));
+
+    if (ring_init(&conn->input, INPUT_RING_SIZE) != HYPER_SUCCESS)
+    {
+        HyperMemFree(conn);
+        return NULL;
+    }
+
+    conn->eType = EVENT_CONNECTION;
+    conn->worker = worker;
+    conn->sock = sock;
+    conn->pipeFds[0] = -1;
+    conn->pipeFds[1] = -1;
+    conn->iFixedSlot = -1;
+    conn->ullLastRead = worker->timers.ullClock;
+    conn->ullLastWrite = worker->timers.ullClock;
+    arena_init(&conn->arena);
+
+    // Responses are gathered into as few sends as possible already, Nagle
+    // would only hold back the tail of each one waiting for an ACK
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+
+    STAT_ADD(worker->stats.ullAccepted, 1);
+
+    return conn;
+}
+
+// Wraparound-safe, has zerocopy send uiId completed
+static int
+conn_zerocopy_done(
+    PCONNECTION         conn,
+    uint32_t            uiId)
+{
+    return (int32_t)(conn->uiZerocopyDone - uiId) > 0;
+}
+
+// Hold a release back until the kernel stops reading the memory
+static HYPERSTATUS
+conn_defer_release(
+    PCONNECTION         conn,
+    PSEGMENT            psSegment)
+{
+    PZEROCOPY_PENDING psPending = NULL;
+
+    if (HyperMemAlloc((void**)&psPending, sizeof(ZEROCOPY_PENDING)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    psPending->next = NULL;
+    psPending->uiId = psSegment->uiZerocopyId;
+    psPending->release = psSegment->release;
+    psPending->lpContext = psSegment->lpContext;
+
+    if (conn->psZerocopyTail)
+        conn->psZerocopyTail->next = psPending;
+    else
+        conn->psZerocopyHead = psPending;
+    conn->psZerocopyTail = psPending;
+
+    return HYPER_SUCCESS;
+}
+
+// Run deferred releases, oldest first, up to the first unfinished send
+static void
+conn_release_zerocopy(
+    PCONNECTION         conn,
+    int                 bAll)
+{
+    PZEROCOPY_PENDING psPending = NULL;
+
+    while ((psPending = conn->psZerocopyHead) != NULL &&
+           (bAll || conn_zerocopy_done(conn, psPending->uiId)))
+    {
+        conn->psZerocopyHead = psPending->next;
+        if (conn->psZerocopyHead == NULL)
+            conn->psZerocopyTail = NULL;
+
+        psPending->release(psPending->lpContext);
+        HyperMemFree(psPending);
+    }
+}
+
+static void
+conn_pop_segment(
+    PCONNECTION         conn)
+{
+    PSEGMENT psSegment = conn->psHead;
+
+    conn->psHead = psSegment->next;
+    if (conn->psHead == NULL)
+        conn->psTail = NULL;
+
+    // The segment and any buffer it owns live in the arena
+    if (psSegment->eType == SEGMENT_FILE)
+        close(psSegment->fd);
+    else if (psSegment->release)
+    {
+        if (psSegment->bZerocopy && !conn_zerocopy_done(conn, psSegment->uiZerocopyId) &&
+            conn_defer_release(conn, psSegment) == HYPER_SUCCESS)
+            return;
+
+        psSegment->release(psSegment->lpContext);
+    }
+}
+
+void
+conn_destroy(
+    PCONNECTION         conn)
+{
+    if (conn == NULL)
+        return;
+
+    STAT_ADD(conn->worker->stats.ullClosed, 1);
+    timer_wheel_remove(&conn->worker->timers, &conn->timer);
+    scheduler_remove(&conn->worker->sched, &conn->sched);
+
+    while (conn->psHead)
+        conn_pop_segment(conn);
+
+    // Whatever the kernel still holds goes nowhere once the socket is gone
+    conn_release_zerocopy(conn, 1);
+
+    if (conn->upload)
+        upload_abort(conn->upload);
+
+    // Still runs, but nobody is left to answer
+    if (conn->job)
+        conn->job->conn = NULL;
+
+    if (conn->pipeFds[0] != -1)
+    {
+        close(conn->pipeFds[0]);
+        close(conn->pipeFds[1]);
+    }
+
+    arena_destroy(&conn->arena);
+    ring_free(&conn->input);
+    HyperCloseSocket(conn->sock);
+    HyperMemFree(conn);
+}
+
+void*
+conn_alloc(
+    PCONNECTION         conn,
+    size_t              stSize)
+{
+    return arena_alloc(&conn->arena, stSize);
+}
+
+static PSEGMENT
+conn_new_segment(
+    PCONNECTION         conn,
+    SEGMENT_TYPE        eType,
+    size_t              stLength)
+{
+    PSEGMENT psSegment = arena_alloc(&conn->arena, sizeof(SEGMENT));
+
+    if (psSegment == NULL)
+        return NULL;
+
+    memset(psSegment, 0, sizeof(SEGMENT));
+    psSegment->eType = eType;
+    psSegment->stLength = stLength;
+    psSegment->fd = -1;
+
+    return psSegment;
+}
+
+static void
+conn_link_segment(
+    PCONNECTION         conn,
+    PSEGMENT            psSegment)
+{
+    if (conn->psTail)
+        conn->psTail->next = psSegment;
+    else
+        conn->psHead = psSegment;
+    conn->psTail = psSegment;
+
+    conn->stQueued += psSegment->stLength;
+}
+
+static HYPERSTATUS
+conn_append_segment(
+    PCONNECTION         conn,
+    char                *cpData,
+    size_t              stLength,
+    size_t              stCapacity)
+{
+    PSEGMENT psSegment = conn_new_segment(conn, SEGMENT_BUFFER, stLength);
+    if (psSegment == NULL)
+        return HYPER_FAILED;
+
+    psSegment->cpData = cpData;
+    psSegment->stCapacity = stCapacity;
+    conn_link_segment(conn, psSegment);
+
+    return HYPER_SUCCESS;
+}
+
+HYPERSTATUS
+conn_write(
+    PCONNECTION         conn,
+    const void          *data,
+    size_t              stLength)
+{
+    PSEGMENT psTail = conn->psTail;
+    char *cpData = NULL;
+    size_t stCapacity = 0;
+
+    if (stLength == 0)
+        return HYPER_SUCCESS;
+
+    // Coalesce small writes into the tail buffer so they leave in one send
+    if (psTail && psTail->eType == SEGMENT_BUFFER &&
+        psTail->stCapacity - psTail->stLength >= stLength)
+    {
+        memcpy(psTail->cpData + psTail->stLength, data, stLength);
+        psTail->stLength += stLength;
+        conn->stQueued += stLength;
+        return HYPER_SUCCESS;
+    }
+
+    stCapacity = stLength > OUTPUT_BUFFER_SIZE ? stLength : OUTPUT_BUFFER_SIZE;
+    cpData = arena_alloc(&conn->arena, stCapacity);
+    if (cpData == NULL)
+        return HYPER_FAILED;
+
+    memcpy(cpData, data, stLength);
+
+    return conn_append_segment(conn, cpData, stLength, stCapacity);
+}
+
+HYPERSTATUS
+conn_write_mapped(
+    PCONNECTION         conn,
+    const void          *data,
+    size_t              stLength,
+    void                (*release)(void *lpContext),
+    void                *lpContext)
+{
+    PSEGMENT psSegment = conn_new_segment(conn, SEGMENT_MAPPED, stLength);
+    if (psSegment == NULL)
+        return HYPER_FAILED;
+
+    // release(lpContext), if set, runs once the last byte has left or on disconnect
+    psSegment->cpData = (char*)data;
+    psSegment->release = release;
+    psSegment->lpContext = lpContext;
+    conn_link_segment(conn, psSegment);
+
+    return HYPER_SUCCESS;
+}
+
+static HYPERSTATUS
+conn_link_producer(
+    PCONNECTION         conn,
+    PRODUCER            produce,
+    void                (*release)(void *lpContext),
+    void                *lpContext,
+    int                 bFramed)
+{
+    PSEGMENT psSegment = conn_new_segment(conn, SEGMENT_PRODUCER, 0);
+    if (psSegment == NULL)
+        return HYPER_FAILED;
+
+    psSegment->cpData = arena_alloc(&conn->arena, PRODUCER_BUFFER_SIZE);
+    if (psSegment->cpData == NULL)
+        return HYPER_FAILED;
+
+    psSegment->stCapacity = PRODUCER_BUFFER_SIZE;
+    psSegment->produce = produce;
+    psSegment->release = release;
+    psSegment->lpContext = lpContext;
+    psSegment->bFramed = bFramed;
+    conn_link_segment(conn, psSegment);
+
+    return HYPER_SUCCESS;
+}
+
+HYPERSTATUS
+conn_write_producer(
+    PCONNECTION         conn,
+    PRODUCER            produce,
+    void                (*release)(void *lpContext),
+    void                *lpContext)
+{
+    return conn_link_producer(conn, produce, release, lpContext, conn->bFramed);
+}
+
+// Generated body of a response whose length went out with its status, never framed
+HYPERSTATUS
+conn_write_body_producer(
+    PCONNECTION         conn,
+    PRODUCER            produce,
+    void                (*release)(void *lpContext),
+    void                *lpContext)
+{
+    return conn_link_producer(conn, produce, release, lpContext, 0);
+}
+
+HYPERSTATUS
+conn_send_fd(
+    PCONNECTION         conn,
+    int                 fd,
+    off_t               offStart,
+    size_t              stLength)
+{
+    PSEGMENT psSegment = NULL;
+
+    if (stLength == 0)
+    {
+        close(fd);
+        return HYPER_SUCCESS;
+    }
+
+    psSegment = conn_new_segment(conn, SEGMENT_FILE, stLength);
+    if (psSegment == NULL)
+        return HYPER_FAILED;
+
+    // The segment owns fd from here on and closes it once sent
+    psSegment->fd = fd;
+    psSegment->offStart = offStart;
+    clock_gettime(CLOCK_MONOTONIC, &psSegment->tsStart);
+    conn_link_segment(conn, psSegment);
+
+    return HYPER_SUCCESS;
+}
+
+static HYPERSTATUS
+conn_write_frame_header(
+    PCONNECTION         conn,
+    const unsigned char ucType,
+    const unsigned short status,
+    const unsigned long long ullLength)
+{
+    HYPER_FRAME frame = {0};
+    unsigned char header[HYPER_FRAME_HEADER_SIZE];
+
+    frame.ucVersion = HYPER_FRAME_VERSION;
+    frame.ucType = ucType;
+    frame.usStatus = status;
+    frame.ullLength = ullLength;
+    HyperEncodeFrame(&frame, header);
+
+    return conn_write(conn, header, sizeof(header));
+}
+
+static HYPERSTATUS
+conn_write_legacy_status(
+    PCONNECTION         conn,
+    const unsigned short status)
+{
+    char buffer[STATUS_BUFFER_SIZE];
+    memset(buffer, 0, sizeof(buffer));
+
+    snprintf(buffer, sizeof(buffer), "%u", status);
+
+    return conn_write(conn, buffer, sizeof(buffer));
+}
+
+HYPERSTATUS
+conn_send_status(
+    PCONNECTION         conn,
+    const unsigned short status)
+{
+    stats_record_status(&conn->worker->stats, status);
+
+    if (conn->bFramed)
+        return conn_write_frame_header(conn, HYPER_FRAME_RESPONSE, status, 0);
+
+    return conn_write_legacy_status(conn, status);
+}
+
+// Status and body size, the body itself is queued by the caller
+HYPERSTATUS
+conn_begin_response(
+    PCONNECTION         conn,
+    const unsigned short status,
+    const unsigned long long ullLength)
+{
+    char fileSizeBuffer[FILESIZE_BUFFER_SIZE];
+
+    stats_record_status(&conn->worker->stats, status);
+
+    if (conn->bFramed)
+        return conn_write_frame_header(conn, HYPER_FRAME_RESPONSE, status, ullLength);
+
+    if (conn_write_legacy_status(conn, status) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    memset(fileSizeBuffer, 0, FILESIZE_BUFFER_SIZE);
+    snprintf(fileSizeBuffer, FILESIZE_BUFFER_SIZE, "%llu", ullLength);
+
+    return conn_write(conn, fileSizeBuffer, FILESIZE_BUFFER_SIZE);
+}
+
+// Status for a body of unknown length, followed by conn_write_producer
+HYPERSTATUS
+conn_begin_stream(
+    PCONNECTION         conn,
+    const unsigned short status)
+{
+    HYPER_FRAME frame = {0};
+    unsigned char header[HYPER_FRAME_HEADER_SIZE];
+
+    stats_record_status(&conn->worker->stats, status);
+
+    if (!conn->bFramed)
+        return conn_write_legacy_status(conn, status);
+
+    frame.ucVersion = HYPER_FRAME_VERSION;
+    frame.ucType = HYPER_FRAME_RESPONSE;
+    frame.ucFlags = HYPER_FRAME_FLAG_CHUNKED;
+    frame.usStatus = status;
+    HyperEncodeFrame(&frame, header);
+
+    return conn_write(conn, header, sizeof(header));
+}
+
+// Same, but text mode clients get no size and read the body as-is
+HYPERSTATUS
+conn_begin_text(
+    PCONNECTION         conn,
+    const unsigned short status,
+    const unsigned long long ullLength)
+{
+    stats_record_status(&conn->worker->stats, status);
+
+    if (conn->bFramed)
+        return conn_write_frame_header(conn, HYPER_FRAME_RESPONSE, status, ullLength);
+
+    return conn_write_legacy_status(conn, status);
+}
+
+// CHECKSUM frame for uiCrc, for producers that end their body with it
+size_t
+conn_format_checksum(
+    const uint32_t      uiCrc,
+    unsigned char       *ucFrame)
+{
+    HYPER_FRAME frame = {0};
+    unsigned char *payload = ucFrame + HYPER_FRAME_HEADER_SIZE;
+
+    frame.ucVersion = HYPER_FRAME_VERSION;
+    frame.ucType = HYPER_FRAME_CHECKSUM;
+    frame.usStatus = 200;
+    frame.ullLength = HYPER_CHECKSUM_SIZE;
+    HyperEncodeFrame(&frame, ucFrame);
+
+    payload[0] = (unsigned char)(uiCrc >> 24);
+    payload[1] = (unsigned char)(uiCrc >> 16);
+    payload[2] = (unsigned char)(uiCrc >> 8);
+    payload[3] = (unsigned char)uiCrc;
+
+    return CHECKSUM_FRAME_SIZE;
+}
+
+// CRC32C of the body just queued, for clients that asked for it in HELLO
+HYPERSTATUS
+conn_write_checksum(
+    PCONNECTION         conn,
+    const uint32_t      uiCrc)
+{
+    unsigned char ucFrame[CHECKSUM_FRAME_SIZE];
+
+    return conn_write(conn, ucFrame, conn_format_checksum(uiCrc, ucFrame));
+}
+
+static void
+conn_log_transfer(
+    PSEGMENT            psSegment)
+{
+    struct timespec tsEnd = {0};
+    double dSeconds = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    dSeconds = (tsEnd.tv_sec - psSegment->tsStart.tv_sec) +
+               (tsEnd.tv_nsec - psSegment->tsStart.tv_nsec) / 1e9;
+    if (dSeconds <= 0)
+        dSeconds = 1e-9;
+
+    printf("[+] Sent %zu bytes in %.3fs (%.2f MB/s)\n",
+            psSegment->stLength, dSeconds, psSegment->stLength / dSeconds / 1e6);
+}
+
+/* Move file bytes through a pipe when sendfile() can't handle the file. The
+   pipe may still hold a refill from a bigger turn, so the drain is capped too */
+static ssize_t
+conn_splice_file(
+    PCONNECTION         conn,
+    PSEGMENT            psSegment,
+    size_t              stChunk,
+    size_t              stBudget)
+{
+    loff_t offRead = 0;
+    ssize_t sBytes = 0;
+    size_t stDrain = 0;
+    unsigned int uiFlags = 0;
+
+    if (conn->pipeFds[0] == -1 && pipe2(conn->pipeFds, O_NONBLOCK | O_CLOEXEC) == -1)
+        return -1;
+
+    // Refill the pipe only once the previous contents made it to the socket
+    if (conn->stPipeBytes == 0)
+    {
+        offRead = psSegment->offStart + psSegment->stOffset;
+        sBytes = splice(psSegment->fd, &offRead, conn->pipeFds[1], NULL, stChunk,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (sBytes <= 0)
+        {
+            if (sBytes == 0)
+                errno = EIO;    /* File shrank underneath us */
+            return -1;
+        }
+
+        conn->stPipeBytes = sBytes;
+    }
+
+    stDrain = conn->stPipeBytes < stBudget ? conn->stPipeBytes : stBudget;
+
+    // Hint the kernel to hold a partial packet only if more is on its way
+    uiFlags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    if (psSegment->next || psSegment->stOffset + stDrain < psSegment->stLength)
+        uiFlags |= SPLICE_F_MORE;
+
+    STAT_ADD(conn->worker->stats.ullSendCalls, 1);
+    sBytes = splice(conn->pipeFds[0], NULL, conn->sock, NULL, stDrain, uiFlags);
+    if (sBytes > 0)
+        conn->stPipeBytes -= sBytes;
+
+    return sBytes;
+}
+
+static ssize_t
+conn_send_file(
+    PCONNECTION         conn,
+    PSEGMENT            psSegment,
+    size_t              stBudget)
+{
+    size_t stRemaining = psSegment->stLength - psSegment->stOffset;
+    off_t offFile = 0;
+    ssize_t sBytesSent = 0;
+
+    // Sized when the file starts and again each time the socket fills up
+    if (psSegment->stChunk == 0)
+    {
+        psSegment->stChunk = HyperTransferBlockSize(conn->sock, stRemaining, 0);
+        if (psSegment->stChunk < TRANSFER_MIN_CHUNK)
+            psSegment->stChunk = TRANSFER_MIN_CHUNK;
+    }
+
+    if (stRemaining > psSegment->stChunk)
+        stRemaining = psSegment->stChunk;
+    if (stRemaining > stBudget)
+        stRemaining = stBudget;
+
+    // It won't change its mind about the rest of the file, don't ask again
+    if (!psSegment->bSplice)
+    {
+        offFile = psSegment->offStart + psSegment->stOffset;
+        STAT_ADD(conn->worker->stats.ullSendCalls, 1);
+        sBytesSent = sendfile(conn->sock, psSegment->fd, &offFile, stRemaining);
+        if (sBytesSent != -1 || (errno != EINVAL && errno != ENOSYS))
+        {
+            if (sBytesSent == 0)
+            {
+                errno = EIO;    /* File shrank underneath us */
+                return -1;
+            }
+            return sBytesSent;
+        }
+
+        psSegment->bSplice = 1;
+    }
+
+    return conn_splice_file(conn, psSegment, stRemaining, stBudget);
+}
+
+// Generate the next piece of a producer segment into its staging buffer
+static HYPERSTATUS
+conn_produce(
+    PCONNECTION         conn,
+    PSEGMENT            psSegment)
+{
+    HYPER_FRAME frame = {0};
+    size_t stHeader = psSegment->bFramed ? HYPER_FRAME_HEADER_SIZE : 0;
+    ssize_t sProduced = 0;
+
+    // Framed pieces need room for their own DATA header and the closing one
+    sProduced = psSegment->produce(psSegment->lpContext, psSegment->cpData + stHeader,
+            psSegment->stCapacity - 2 * stHeader, &psSegment->bDone);
+    if (sProduced < 0)
+        return HYPER_FAILED;
+
+    psSegment->stOffset = 0;
+    psSegment->stLength = 0;
+
+    if (psSegment->bFramed)
+    {
+        frame.ucVersion = HYPER_FRAME_VERSION;
+        frame.ucType = HYPER_FRAME_DATA;
+
+        if (sProduced > 0)
+        {
+            frame.ullLength = sProduced;
+            HyperEncodeFrame(&frame, (unsigned char*)psSegment->cpData);
+            psSegment->stLength = HYPER_FRAME_HEADER_SIZE + sProduced;
+        }
+
+        if (psSegment->bDone)
+        {
+            frame.ullLength = 0;
+            HyperEncodeFrame(&frame, (unsigned char*)psSegment->cpData + psSegment->stLength);
+            psSegment->stLength += HYPER_FRAME_HEADER_SIZE;
+        }
+    }
+    else
+        psSegment->stLength = sProduced;
+
+    conn->stQueued += psSegment->stLength;
+
+    return HYPER_SUCCESS;
+}
+
+// Turn on SO_ZEROCOPY the first time a connection has something worth it
+static int
+conn_zerocopy_enable(
+    PCONNECTION         conn)
+{
+    if (conn->bZerocopy)
+        return 1;
+
+    if (conn->bZerocopyOff)
+        return 0;
+
+    if (setsockopt(conn->sock, SOL_SOCKET, SO_ZEROCOPY, &(int){1}, sizeof(int)) == -1)
+    {
+        conn->bZerocopyOff = 1;
+        return 0;
+    }
+
+    conn->bZerocopy = 1;
+    return 1;
+}
+
+// Send a large borrowed segment straight from its pages, released later
+static ssize_t
+conn_send_zerocopy(
+    PCONNECTION         conn,
+    PSEGMENT            psSegment,
+    size_t              stBudget)
+{
+    struct iovec iov = {0};
+    struct msghdr msg = {0};
+    int iFlags = MSG_NOSIGNAL | MSG_ZEROCOPY;
+    ssize_t sBytesSent = 0;
+
+    iov.iov_base = psSegment->cpData + psSegment->stOffset;
+    iov.iov_len = psSegment->stLength - psSegment->stOffset;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (psSegment->next || iov.iov_len > stBudget)
+        iFlags |= MSG_MORE;
+    if (iov.iov_len > stBudget)
+        iov.iov_len = stBudget;
+
+    STAT_ADD(conn->worker->stats.ullSendCalls, 1);
+    sBytesSent = sendmsg(conn->sock, &msg, iFlags);
+    if (sBytesSent > 0)
+    {
+        psSegment->bZerocopy = 1;
+        psSegment->uiZerocopyId = conn->uiZerocopyNext++;
+        STAT_ADD(conn->worker->stats.ullZerocopySends, 1);
+    }
+
+    return sBytesSent;
+}
+
+// Gather queued in-memory segments up to the next file, or the budget, into one sendmsg
+static ssize_t
+conn_send_buffers(
+    PCONNECTION         conn,
+    size_t              stBudget)
+{
+    struct iovec iov[FLUSH_MAX_IOV];
+    struct msghdr msg = {0};
+    PSEGMENT psSegment = conn->psHead;
+    int iFlags = MSG_NOSIGNAL;
+    int iCount = 0;
+    ssize_t sBytesSent = 0;
+
+    if (serverConfig.stZerocopyMin && psSegment->eType == SEGMENT_MAPPED &&
+        psSegment->stLength - psSegment->stOffset >= serverConfig.stZerocopyMin &&
+        conn_zerocopy_enable(conn))
+    {
+        sBytesSent = conn_send_zerocopy(conn, psSegment, stBudget);
+
+        // Out of option memory for notifications, copy from now on
+        if (sBytesSent != SOCKET_ERROR || errno != ENOBUFS)
+            return sBytesSent;
+        conn->bZerocopyOff = 1;
+    }
+
+    for (; psSegment && iCount < FLUSH_MAX_IOV; psSegment = psSegment->next)
+    {
+        if (psSegment->eType == SEGMENT_FILE)
+            break;
+
+        if (stBudget == 0)
+            break;
+
+        if (psSegment->stOffset != psSegment->stLength)
+        {
+            iov[iCount].iov_base = psSegment->cpData + psSegment->stOffset;
+            iov[iCount].iov_len = psSegment->stLength - psSegment->stOffset;
+            if (iov[iCount].iov_len > stBudget)
+                iov[iCount].iov_len = stBudget;
+            stBudget -= iov[iCount].iov_len;
+            iCount++;
+        }
+
+        // Anything behind a producer has to wait until it's finished
+        if (psSegment->eType == SEGMENT_PRODUCER)
+        {
+            psSegment = NULL;
+            break;
+        }
+    }
+
+    // A file body or more buffers go out right after, so let the status and
+    // header share their first packet instead of leaving on their own
+    if (psSegment)
+        iFlags |= MSG_MORE;
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iCount;
+
+    STAT_ADD(conn->worker->stats.ullSendCalls, 1);
+    return sendmsg(conn->sock, &msg, iFlags);
+}
+
+// Account sent bytes against the queue, front to back
+static void
+conn_advance(
+    PCONNECTION         conn,
+    size_t              stBytes)
+{
+    PSEGMENT psSegment = conn->psHead;
+    size_t stStep = 0;
+
+    conn->stQueued -= stBytes;
+    conn->ullLastWrite = conn->worker->timers.ullClock;
+    STAT_ADD(conn->worker->stats.ullBytesSent, stBytes);
+
+    while (stBytes && psSegment)
+    {
+        stStep = psSegment->stLength - psSegment->stOffset;
+        if (stStep > stBytes)
+            stStep = stBytes;
+
+        psSegment->stOffset += stStep;
+        stBytes -= stStep;
+        psSegment = psSegment->next;
+    }
+}
+
+// Read finished zerocopy ranges off the error queue and run their releases
+HYPERSTATUS
+conn_reap_zerocopy(
+    PCONNECTION         conn)
+{
+    char control[ZEROCOPY_MAX_NOTIFY * CMSG_SPACE(sizeof(struct sock_extended_err))];
+    struct msghdr msg = {0};
+    struct cmsghdr *cmsg = NULL;
+    struct sock_extended_err *error = NULL;
+
+    while (1)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(conn->sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return HYPER_FAILED;
+            break;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if ((cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) &&
+                (cmsg->cmsg_level != SOL_IPV6 || cmsg->cmsg_type != IPV6_RECVERR))
+                continue;
+
+            error = (struct sock_extended_err*)CMSG_DATA(cmsg);
+            if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            // Ids ee_info..ee_data are done, TCP reports them in order
+            if (!conn_zerocopy_done(conn, error->ee_info) && conn->uiZerocopyDone == error->ee_info)
+                conn->uiZerocopyDone = error->ee_data + 1;
+
+            // Loopback and some NICs copy anyway, then pinning is pure overhead
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                STAT_ADD(conn->worker->stats.ullZerocopyCopied, 1);
+                conn->bZerocopyOff = 1;
+            }
+        }
+    }
+
+    conn_release_zerocopy(conn, 0);
+
+    return HYPER_SUCCESS;
+}
+
+// Nothing left to send and no memory still lent to the kernel
+int
+conn_drained(
+    PCONNECTION         conn)
+{
+    return conn->psHead == NULL && conn->psZerocopyHead == NULL;
+}
+
+// Tick the connection times out on given what it's waiting for, 0 if never
+static unsigned long long
+conn_deadline(
+    PCONNECTION         conn,
+    CONN_TIMEOUT        *eKind)
+{
+    unsigned long long ullBase = conn->ullLastRead > conn->ullLastWrite ? conn->ullLastRead : conn->ullLastWrite;
+    unsigned int uiSeconds = 0;
+
+    // The client waits on us, not the other way round
+    if (conn->job)
+        return 0;
+
+    if (!conn_drained(conn))
+    {
+        *eKind = TIMEOUT_WRITE;
+        uiSeconds = serverConfig.uiWriteTimeout;
+    }
+    else if (conn->upload || ring_used(&conn->input))
+    {
+        *eKind = TIMEOUT_READ;
+        uiSeconds = serverConfig.uiReadTimeout;
+        ullBase = conn->ullLastRead;
+    }
+    else
+    {
+        *eKind = TIMEOUT_IDLE;
+        uiSeconds = serverConfig.uiIdleTimeout;
+    }
+
+    if (uiSeconds == 0)
+        return 0;
+
+    return ullBase + TIMER_MS_TO_TICKS(uiSeconds * 1000ULL);
+}
+
+// Called after every round of activity, cheap when nothing moved the deadline closer
+void
+conn_update_timer(
+    PCONNECTION         conn)
+{
+    PTIMER_WHEEL wheel = &conn->worker->timers;
+    CONN_TIMEOUT eKind = TIMEOUT_NONE;
+    unsigned long long ullDeadline = conn_deadline(conn, &eKind);
+
+    if (ullDeadline == 0)
+    {
+        timer_wheel_remove(wheel, &conn->timer);
+        return;
+    }
+
+    // A later deadline is found when the timer fires, that keeps the common
+    // case of steady traffic from touching the wheel at all
+    if (!timer_pending(&conn->timer) || ullDeadline < conn->timer.ullExpires)
+        timer_wheel_add(wheel, &conn->timer, ullDeadline);
+}
+
+// Timer fired, either the deadline really passed or activity pushed it back
+CONN_TIMEOUT
+conn_check_deadline(
+    PCONNECTION         conn)
+{
+    CONN_TIMEOUT eKind = TIMEOUT_NONE;
+    unsigned long long ullDeadline = conn_deadline(conn, &eKind);
+
+    if (ullDeadline == 0 || ullDeadline > conn->worker->timers.ullNow)
+    {
+        conn_update_timer(conn);
+        return TIMEOUT_NONE;
+    }
+
+    switch (eKind)
+    {
+    case TIMEOUT_IDLE:
+        printf("[!] Client idle for %us, closing\n", serverConfig.uiIdleTimeout);
+        STAT_ADD(conn->worker->stats.ullIdleTimeouts, 1);
+        break;
+    case TIMEOUT_READ:
+        printf("[!] Client request stalled for %us, closing\n", serverConfig.uiReadTimeout);
+        STAT_ADD(conn->worker->stats.ullReadTimeouts, 1);
+        break;
+    default:
+        printf("[!] Client stopped reading for %us, closing\n", serverConfig.uiWriteTimeout);
+        STAT_ADD(conn->worker->stats.ullWriteTimeouts, 1);
+        break;
+    }
+
+    return eKind;
+}
+
+HYPERSTATUS
+conn_flush(
+    PCONNECTION         conn)
+{
+    PSCHEDULER sched = &conn->worker->sched;
+    PSEGMENT psSegment = NULL;
+    ssize_t sBytesSent = 0;
+    size_t stBudget = 0;
+
+    if (conn->psZerocopyHead && conn_reap_zerocopy(conn) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    stBudget = scheduler_budget(sched, &conn->sched);
+
+    while ((psSegment = conn->psHead) != NULL)
+    {
+        if (psSegment->stOffset == psSegment->stLength)
+        {
+            if (psSegment->eType == SEGMENT_PRODUCER && !psSegment->bDone)
+            {
+                if (conn_produce(conn, psSegment) != HYPER_SUCCESS)
+                    return HYPER_FAILED;
+                continue;
+            }
+
+            if (psSegment->eType == SEGMENT_FILE)
+                conn_log_transfer(psSegment);
+
+            conn_pop_segment(conn);
+            continue;
+        }
+
+        // Turn used up or out of tokens, the scheduler resumes us later
+        if (stBudget == 0)
+        {
+            if (!scheduler_waiting(&conn->sched))
+            {
+                if (scheduler_yield(sched, &conn->sched))
+                    STAT_ADD(conn->worker->stats.ullThrottled, 1);
+                else
+                    STAT_ADD(conn->worker->stats.ullSchedYields, 1);
+            }
+            return HYPER_SUCCESS;
+        }
+
+        if (psSegment->eType == SEGMENT_FILE)
+            sBytesSent = conn_send_file(conn, psSegment, stBudget);
+        else
+            sBytesSent = conn_send_buffers(conn, stBudget);
+
+        if (sBytesSent == SOCKET_ERROR)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Socket buffer is full, resume once epoll reports EPOLLOUT
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                psSegment->stChunk = 0;
+                return HYPER_SUCCESS;
+            }
+
+            return HYPER_FAILED;
+        }
+
+        conn_advance(conn, sBytesSent);
+        scheduler_charge(sched, &conn->sched, sBytesSent);
+        stBudget = (size_t)sBytesSent < stBudget ? stBudget - sBytesSent : 0;
+    }
+
+    scheduler_idle(&conn->sched);
+
+    // Every queued response is out, so nothing references the arena any more
+    arena_reset(&conn->arena);
+
+    return HYPER_SUCCESS;
+}
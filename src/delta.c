@@ -0,0 +1,412 @@
+#include "delta.h"
+
+#define DELTA_NO_MATCH          UINT32_MAX
+
+static void
+delta_put32(
+    unsigned char       *ucOut,
+    uint32_t            uiValue)
+{
+    ucOut[0] = (unsigned char)(uiValue >> 24);
+    ucOut[1] = (unsigned char)(uiValue >> 16);
+    ucOut[2] = (unsigned char)(uiValue >> 8);
+    ucOut[3] = (unsigned char)uiValue;
+}
+
+static uint32_t
+delta_bucket(
+    PDELTA_STATE        state,
+    uint32_t            uiWeak)
+{
+    return (uiWeak * 0x9e3779b1u) >> state->uiBucketShift;
+}
+
+// Chain every block onto the bucket of its rolling checksum
+static HYPERSTATUS
+delta_index(
+    PDELTA_STATE        state)
+{
+    unsigned int uiBits = 4;
+    uint32_t uiSlot = 0;
+
+    if (state->uiBlocks == 0)
+        return HYPER_SUCCESS;
+
+    for (uint32_t i = 0; i < state->uiBlocks * 2; i++)
+        state->uiSignatures[i] = ntohl(state->uiSignatures[i]);
+
+    // Mostly empty buckets, so a miss rarely has to look at a signature
+    while ((1u << uiBits) < state->uiBlocks * 2)
+        uiBits++;
+    state->uiBucketShift = 32 - uiBits;
+
+    if (HyperMemAlloc((void**)&state->uiBuckets, sizeof(uint32_t) << uiBits) != HYPER_SUCCESS ||
+        HyperMemAlloc((void**)&state->uiChain, sizeof(uint32_t) * state->uiBlocks) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    memset(state->uiBuckets, 0, sizeof(uint32_t) << uiBits);
+
+    // Backwards, so each chain lists its blocks in file order
+    for (uint32_t i = state->uiBlocks; i-- > 0;)
+    {
+        uiSlot = delta_bucket(state, state->uiSignatures[i * 2]);
+        state->uiChain[i] = state->uiBuckets[uiSlot];
+        state->uiBuckets[uiSlot] = i + 1;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// Client block that ucBlock matches, CRC32C only for blocks the rolling checksum picks out
+static uint32_t
+delta_find(
+    PDELTA_STATE        state,
+    uint32_t            uiWeak,
+    const unsigned char *ucBlock)
+{
+    uint32_t uiNext = state->uiCopyFirst + state->uiCopyCount;
+    uint32_t uiEntry = 0;
+    uint32_t uiCrc = 0;
+    int bCrc = 0;
+    int iCandidates = 0;
+
+    if (state->uiBlocks == 0)
+        return DELTA_NO_MATCH;
+
+    // Unchanged runs continue with the next block, try that first
+    if (state->uiCopyCount && uiNext < state->uiBlocks && state->uiSignatures[uiNext * 2] == uiWeak)
+    {
+        uiCrc = checksum_crc32c(0, ucBlock, state->stBlockSize);
+        bCrc = 1;
+        if (state->uiSignatures[uiNext * 2 + 1] == uiCrc)
+            return uiNext;
+    }
+
+    for (uiEntry = state->uiBuckets[delta_bucket(state, uiWeak)];
+         uiEntry && iCandidates < DELTA_MAX_CANDIDATES;
+         uiEntry = state->uiChain[uiEntry - 1])
+    {
+        if (state->uiSignatures[(uiEntry - 1) * 2] != uiWeak)
+            continue;
+
+        if (!bCrc)
+        {
+            uiCrc = checksum_crc32c(0, ucBlock, state->stBlockSize);
+            bCrc = 1;
+        }
+
+        if (state->uiSignatures[(uiEntry - 1) * 2 + 1] == uiCrc)
+            return uiEntry - 1;
+
+        iCandidates++;
+    }
+
+    return DELTA_NO_MATCH;
+}
+
+// Make sure the window holds the file from the pending literal through ullEnd
+static HYPERSTATUS
+delta_fill(
+    PDELTA_STATE        state,
+    unsigned long long  ullEnd)
+{
+    ssize_t sBytesRead = 0;
+    size_t stKeep = 0;
+
+    if (ullEnd <= state->ullWindowStart + state->stWindowLength)
+        return HYPER_SUCCESS;
+
+    // Nothing before the literal is needed again
+    stKeep = state->ullWindowStart + state->stWindowLength - state->ullLiteral;
+    memmove(state->ucWindow, state->ucWindow + (state->ullLiteral - state->ullWindowStart), stKeep);
+    state->ullWindowStart = state->ullLiteral;
+    state->stWindowLength = stKeep;
+
+    while (state->ullWindowStart + state->stWindowLength < ullEnd)
+    {
+        sBytesRead = pread(state->fd, state->ucWindow + state->stWindowLength,
+                state->stWindowSize - state->stWindowLength,
+                (off_t)(state->ullWindowStart + state->stWindowLength));
+        if (sBytesRead == -1 && errno == EINTR)
+            continue;
+
+        // The file shrank under us, the delta can't be finished
+        if (sBytesRead <= 0)
+            return HYPER_FAILED;
+
+        state->stWindowLength += sBytesRead;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+static void
+delta_emit_copy(
+    PDELTA_STATE        state)
+{
+    unsigned char *ucOut = state->ucOutput + state->stOutputLength;
+
+    if (state->uiCopyCount == 0)
+        return;
+
+    ucOut[0] = HYPER_SYNC_COPY;
+    delta_put32(ucOut + 1, state->uiCopyFirst);
+    delta_put32(ucOut + 5, state->uiCopyCount);
+    state->stOutputLength += 9;
+
+    state->ullCopied += (unsigned long long)state->uiCopyCount * state->stBlockSize;
+    state->uiCopyCount = 0;
+}
+
+// Unmatched bytes from the pending literal up to ullEnd, all in the window
+static void
+delta_emit_literal(
+    PDELTA_STATE        state,
+    unsigned long long  ullEnd)
+{
+    unsigned char *ucOut = state->ucOutput + state->stOutputLength;
+    const unsigned char *ucData = state->ucWindow + (state->ullLiteral - state->ullWindowStart);
+    size_t stLength = (size_t)(ullEnd - state->ullLiteral);
+
+    if (stLength == 0)
+        return;
+
+    ucOut[0] = HYPER_SYNC_LITERAL;
+    delta_put32(ucOut + 1, (uint32_t)stLength);
+    memcpy(ucOut + 5, ucData, stLength);
+    state->stOutputLength += 5 + stLength;
+
+    state->uiCrc = checksum_crc32c(state->uiCrc, ucData, stLength);
+    state->ullLiteralBytes += stLength;
+    state->ullLiteral = ullEnd;
+}
+
+static void
+delta_emit_end(
+    PDELTA_STATE        state)
+{
+    unsigned char *ucOut = state->ucOutput + state->stOutputLength;
+
+    ucOut[0] = HYPER_SYNC_END;
+    delta_put32(ucOut + 1, (uint32_t)(state->ullFileSize >> 32));
+    delta_put32(ucOut + 5, (uint32_t)state->ullFileSize);
+    delta_put32(ucOut + 9, state->uiCrc);
+    state->stOutputLength += 13;
+    state->bFinished = 1;
+
+    printf("[+] Delta sent, %llu bytes copied and %llu literal\n",
+            state->ullCopied, state->ullLiteralBytes);
+}
+
+// What's left is too short for a block, send it as literals and finish
+static HYPERSTATUS
+delta_scan_tail(
+    PDELTA_STATE        state)
+{
+    unsigned long long ullEnd = state->ullLiteral + DELTA_MAX_LITERAL;
+
+    delta_emit_copy(state);
+
+    if (state->ullLiteral == state->ullFileSize)
+    {
+        delta_emit_end(state);
+        return HYPER_SUCCESS;
+    }
+
+    if (ullEnd > state->ullFileSize)
+        ullEnd = state->ullFileSize;
+
+    if (delta_fill(state, ullEnd) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    delta_emit_literal(state, ullEnd);
+    return HYPER_SUCCESS;
+}
+
+// Slide along the file until there is an instruction to send
+static HYPERSTATUS
+delta_scan(
+    PDELTA_STATE        state)
+{
+    const size_t stBlockSize = state->stBlockSize;
+    const unsigned char *ucBlock = NULL;
+    unsigned long long ullNeeded = 0;
+    uint32_t uiMatch = 0;
+    uint32_t uiOut = 0;
+
+    while (state->stOutputLength == 0 && !state->bFinished)
+    {
+        if (state->uiBlocks == 0 || state->ullPosition + stBlockSize > state->ullFileSize)
+        {
+            if (delta_scan_tail(state) != HYPER_SUCCESS)
+                return HYPER_FAILED;
+            continue;
+        }
+
+        // The block, plus the byte that rolls in if it doesn't match
+        ullNeeded = state->ullPosition + stBlockSize;
+        if (ullNeeded < state->ullFileSize)
+            ullNeeded++;
+        if (delta_fill(state, ullNeeded) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+
+        ucBlock = state->ucWindow + (state->ullPosition - state->ullWindowStart);
+        if (!state->bRolling)
+        {
+            state->uiRollA = 0;
+            state->uiRollB = 0;
+            for (size_t i = 0; i < stBlockSize; i++)
+            {
+                state->uiRollA += ucBlock[i];
+                state->uiRollB += state->uiRollA;
+            }
+            state->bRolling = 1;
+        }
+
+        uiMatch = delta_find(state, (state->uiRollA & 0xffff) | (state->uiRollB << 16), ucBlock);
+        if (uiMatch != DELTA_NO_MATCH)
+        {
+            delta_emit_literal(state, state->ullPosition);
+            state->uiCrc = checksum_crc32c(state->uiCrc, ucBlock, stBlockSize);
+
+            if (state->uiCopyCount && uiMatch == state->uiCopyFirst + state->uiCopyCount &&
+                (unsigned long long)(state->uiCopyCount + 1) * stBlockSize <= DELTA_MAX_COPY_BYTES)
+                state->uiCopyCount++;
+            else
+            {
+                delta_emit_copy(state);
+                state->uiCopyFirst = uiMatch;
+                state->uiCopyCount = 1;
+            }
+
+            state->ullPosition += stBlockSize;
+            state->ullLiteral = state->ullPosition;
+            state->bRolling = 0;
+            continue;
+        }
+
+        // A literal starts here, so any run of copies before it is over
+        delta_emit_copy(state);
+
+        if (state->ullPosition + stBlockSize < state->ullFileSize)
+        {
+            uiOut = ucBlock[0];
+            state->uiRollA += ucBlock[stBlockSize] - uiOut;
+            state->uiRollB += state->uiRollA - (uint32_t)stBlockSize * uiOut;
+        }
+        else
+            state->bRolling = 0;
+        state->ullPosition++;
+
+        if (state->ullPosition - state->ullLiteral >= DELTA_MAX_LITERAL)
+            delta_emit_literal(state, state->ullPosition);
+    }
+
+    return HYPER_SUCCESS;
+}
+
+// Hand out the encoded instructions, scanning further whenever they run out
+static ssize_t
+delta_produce(
+    void                *lpContext,
+    char                *cpBuffer,
+    size_t              stCapacity,
+    int                 *bDone)
+{
+    PDELTA_STATE state = (PDELTA_STATE)lpContext;
+    size_t stLength = 0;
+
+    if (state->stOutputOffset == state->stOutputLength)
+    {
+        state->stOutputOffset = 0;
+        state->stOutputLength = 0;
+
+        // A truncated delta must not look complete, drop the connection
+        if (delta_scan(state) != HYPER_SUCCESS)
+            return -1;
+    }
+
+    stLength = state->stOutputLength - state->stOutputOffset;
+    if (stLength > stCapacity)
+        stLength = stCapacity;
+
+    memcpy(cpBuffer, state->ucOutput + state->stOutputOffset, stLength);
+    state->stOutputOffset += stLength;
+
+    if (state->bFinished && state->stOutputOffset == state->stOutputLength)
+        *bDone = 1;
+
+    return stLength;
+}
+
+static void
+delta_release(
+    void                *lpContext)
+{
+    PDELTA_STATE state = (PDELTA_STATE)lpContext;
+
+    if (state->fd != -1)
+        close(state->fd);
+
+    HyperMemFree(state->uiSignatures);
+    HyperMemFree(state->uiBuckets);
+    HyperMemFree(state->uiChain);
+    HyperMemFree(state->ucWindow);
+    HyperMemFree(state);
+}
+
+// Signatures for a SYNC are in, stream the delta against them
+void
+delta_complete(
+    PCONNECTION         conn,
+    PUPLOAD             upload)
+{
+    PDELTA_REQUEST request = (PDELTA_REQUEST)upload->lpContext;
+    PDELTA_STATE state = NULL;
+    struct stat st = {0};
+
+    if (HyperMemAlloc((void**)&state, sizeof(DELTA_STATE)) != HYPER_SUCCESS)
+    {
+        conn_send_status(conn, 500);
+        return;
+    }
+    memset(state, 0, sizeof(DELTA_STATE));
+
+    // The signatures are ours from here on
+    state->uiSignatures = (uint32_t*)upload->cpBuffer;
+    state->uiBlocks = (uint32_t)(upload->ullSize / HYPER_SYNC_SIGNATURE_SIZE);
+    state->stBlockSize = request->stBlockSize;
+    upload->cpBuffer = NULL;
+
+    state->fd = open(request->cpPath, O_RDONLY | O_CLOEXEC);
+    if (state->fd == -1)
+    {
+        delta_release(state);
+        conn_send_status(conn, 404);
+        return;
+    }
+
+    if (fstat(state->fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        delta_release(state);
+        conn_send_status(conn, 400);
+        return;
+    }
+    state->ullFileSize = st.st_size;
+
+    // Room for the longest literal behind the block being tried, and a read ahead of it
+    state->stWindowSize = DELTA_MAX_LITERAL + state->stBlockSize + DELTA_READ_SIZE;
+    if (delta_index(state) != HYPER_SUCCESS ||
+        HyperMemAlloc((void**)&state->ucWindow, state->stWindowSize) != HYPER_SUCCESS)
+    {
+        delta_release(state);
+        conn_send_status(conn, 500);
+        return;
+    }
+
+    conn_begin_stream(conn, 200);
+    if (conn_write_producer(conn, delta_produce, delta_release, state) != HYPER_SUCCESS)
+    {
+        delta_release(state);
+        conn->bClosing = 1;
+    }
+}
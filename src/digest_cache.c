@@ -0,0 +1,67 @@
+#include "digest_cache.h"
+
+static PDIGEST_ENTRY
+digest_cache_slot(
+    PDIGEST_CACHE       cache,
+    const struct stat   *st)
+{
+    uint64_t ullKey = ((uint64_t)st->st_ino ^ ((uint64_t)st->st_dev << 32)) * 0x9e3779b97f4a7c15ULL;
+
+    return &cache->entries[ullKey >> (64 - DIGEST_CACHE_BITS)];
+}
+
+void
+digest_cache_init(
+    PDIGEST_CACHE       cache)
+{
+    memset(cache, 0, sizeof(DIGEST_CACHE));
+}
+
+// Digest of the file st describes, NULL if it has to be computed
+PDIGEST
+digest_cache_lookup(
+    PDIGEST_CACHE       cache,
+    const struct stat   *st,
+    int                 bSha256)
+{
+    PDIGEST_ENTRY entry = digest_cache_slot(cache, st);
+
+    if (!entry->bValid || entry->device != st->st_dev || entry->inode != st->st_ino ||
+        entry->offSize != st->st_size ||
+        entry->tsModified.tv_sec != st->st_mtim.tv_sec ||
+        entry->tsModified.tv_nsec != st->st_mtim.tv_nsec ||
+        (bSha256 && !entry->digest.bSha256))
+    {
+        STAT_ADD(cache->stats.ullMisses, 1);
+        return NULL;
+    }
+
+    STAT_ADD(cache->stats.ullHits, 1);
+    return &entry->digest;
+}
+
+void
+digest_cache_store(
+    PDIGEST_CACHE       cache,
+    const struct stat   *st,
+    const DIGEST        *digest)
+{
+    PDIGEST_ENTRY entry = digest_cache_slot(cache, st);
+
+    entry->device = st->st_dev;
+    entry->inode = st->st_ino;
+    entry->offSize = st->st_size;
+    entry->tsModified = st->st_mtim;
+    entry->digest = *digest;
+    entry->bValid = 1;
+}
+
+void
+digest_cache_get_stats(
+    PDIGEST_CACHE       cache,
+    PDIGEST_CACHE_STATS stats)
+{
+    // Called from other workers too, see STAT_READ
+    stats->ullHits = STAT_READ(cache->stats.ullHits);
+    stats->ullMisses = STAT_READ(cache->stats.ullMisses);
+}
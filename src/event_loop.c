@@ -0,0 +1,417 @@
+#include "event_loop.h"
+
+/* The listening socket is tagged by this sentinel in epoll_event.data.ptr,
+   every other registration points at a struct starting with an EVENT_TYPE */
+static EVENT_TYPE eListener = EVENT_LISTENER;
+
+static HYPERSTATUS
+set_nonblocking(
+    SOCKET              sock)
+{
+    int iFlags = fcntl(sock, F_GETFL, 0);
+    if (iFlags == -1)
+        return HYPER_FAILED;
+
+    if (fcntl(sock, F_SETFL, iFlags | O_NONBLOCK) == -1)
+        return HYPER_FAILED;
+
+    return HYPER_SUCCESS;
+}
+
+static void
+event_loop_close(
+    PCONNECTION         conn)
+{
+    // Closing the socket removes it from the epoll set
+    puts("[!] Client disconnected");
+    conn_destroy(conn);
+}
+
+static void
+event_loop_expire(
+    PTIMER              timer)
+{
+    PCONNECTION conn = (PCONNECTION)timer->lpContext;
+
+    if (conn_check_deadline(conn) != TIMEOUT_NONE)
+        event_loop_close(conn);
+}
+
+void
+event_loop_dispatch(
+    PCONNECTION         conn,
+    size_t              stLength,
+    size_t              stConsumed)
+{
+    ring_peek(&conn->input, conn->cpCommand, stLength);
+    ring_consume(&conn->input, stConsumed);
+
+    // Tolerate CRLF line endings
+    if (stLength && conn->cpCommand[stLength - 1] == '\r')
+        stLength--;
+    conn->cpCommand[stLength] = 0;
+
+    // A blank line is just a keypress, an empty frame is still a command to answer
+    if (stLength == 0 && !conn->bFramed)
+        return;
+
+    printf("[+] Command recieved. %s\n", conn->cpCommand);
+
+    command_handler(conn, conn->cpCommand);
+}
+
+// Run the next complete command in the input ring, returns 0 if there is none
+int
+event_loop_next_command(
+    PCONNECTION         conn)
+{
+    HYPER_FRAME frame = {0};
+    unsigned char header[HYPER_FRAME_HEADER_SIZE];
+    size_t stUsed = ring_used(&conn->input);
+    size_t stLength = 0;
+
+    if (stUsed == 0)
+        return 0;
+
+    if (conn->bFramed)
+    {
+        if (stUsed < HYPER_FRAME_HEADER_SIZE)
+            return 0;
+
+        ring_peek(&conn->input, header, sizeof(header));
+        if (HyperDecodeFrame(header, &frame) != HYPER_SUCCESS ||
+            frame.ucType != HYPER_FRAME_COMMAND || frame.ullLength >= MAX_INPUT_BUFFER)
+            return -1;
+
+        if (stUsed < HYPER_FRAME_HEADER_SIZE + frame.ullLength)
+            return 0;
+
+        ring_consume(&conn->input, HYPER_FRAME_HEADER_SIZE);
+        event_loop_dispatch(conn, (size_t)frame.ullLength, (size_t)frame.ullLength);
+        return 1;
+    }
+
+    if (ring_find(&conn->input, '\n', &stLength))
+    {
+        if (stLength >= MAX_INPUT_BUFFER)
+            return -1;
+
+        conn->bLineMode = 1;
+        event_loop_dispatch(conn, stLength, stLength + 1);
+        return 1;
+    }
+
+    // Nothing delimited yet and a full command's worth buffered, give up on it
+    if (stUsed >= MAX_INPUT_BUFFER)
+        return -1;
+
+    return 0;
+}
+
+/* Run buffered commands until output backs up or the ring runs dry. bDrained
+   says the socket has nothing more for now. Returns 1 when more input is
+   wanted, 0 when reading should pause and -1 on a protocol error */
+int
+event_loop_process_input(
+    PCONNECTION         conn,
+    int                 bDrained)
+{
+    int iResult = 0;
+
+    while (!conn->bClosing)
+    {
+        // Leave the rest in the socket until the client reads its responses
+        if (conn->stQueued >= OUTPUT_HIGH_WATERMARK)
+        {
+            conn->bInputPending = 1;
+            return 0;
+        }
+
+        // The answer to the last command is still being worked out
+        if (conn->job)
+        {
+            conn->bInputPending = 1;
+            return 0;
+        }
+
+        // A PUT body is data, not commands
+        if (conn->upload)
+        {
+            if (upload_drain_ring(conn) != HYPER_SUCCESS)
+                return -1;
+            if (conn->upload)
+                return 1;
+            continue;
+        }
+
+        // Pipelined commands run in order before we read any more
+        iResult = event_loop_next_command(conn);
+        if (iResult < 0)
+            return -1;
+        if (iResult > 0)
+            continue;
+
+        // Old clients send one undelimited command per write and wait. Once a
+        // client has used '\n' a drained ring may hold half a line, so this only
+        // applies to clients that never delimit; HyperSendCommand always does
+        if (bDrained && !conn->bFramed && !conn->bLineMode && ring_used(&conn->input))
+        {
+            event_loop_dispatch(conn, ring_used(&conn->input), ring_used(&conn->input));
+            continue;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static HYPERSTATUS
+event_loop_read(
+    PCONNECTION         conn)
+{
+    struct iovec iov[2];
+    ssize_t sBytesRead = 0;
+    int bDrained = 0;
+    int bUpload = 0;
+    int iResult = 0;
+
+    conn->bInputPending = 0;
+
+    while (1)
+    {
+        iResult = event_loop_process_input(conn, bDrained);
+        if (iResult < 0)
+            return HYPER_FAILED;
+        if (iResult == 0 || bDrained)
+            return HYPER_SUCCESS;
+
+        // Upload bodies skip the ring and go straight to disk
+        bUpload = conn->upload != NULL;
+        if (bUpload)
+            sBytesRead = upload_receive(conn);
+        else
+            sBytesRead = readv(conn->sock, iov, ring_write_vectors(&conn->input, iov));
+        if (sBytesRead == SOCKET_ERROR)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return HYPER_FAILED;
+
+            bDrained = 1;
+            continue;
+        }
+        if (sBytesRead == CONNECTION_CLOSED)
+            return HYPER_FAILED;
+
+        STAT_ADD(conn->worker->stats.ullBytesReceived, sBytesRead);
+        conn->ullLastRead = conn->worker->timers.ullClock;
+        if (!bUpload)
+            ring_commit(&conn->input, sBytesRead);
+    }
+}
+
+static void
+event_loop_service(
+    PCONNECTION         conn,
+    uint32_t            uiEvents)
+{
+    int iError = 0;
+    socklen_t slLength = sizeof(iError);
+
+    // Zerocopy completions raise EPOLLERR as well, only a socket error is fatal
+    if ((uiEvents & EPOLLERR) && !(uiEvents & EPOLLHUP) && conn->bZerocopy)
+    {
+        if (conn_reap_zerocopy(conn) != HYPER_SUCCESS ||
+            getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, &iError, &slLength) == -1 || iError)
+        {
+            event_loop_close(conn);
+            return;
+        }
+        uiEvents &= ~EPOLLERR;
+    }
+
+    if (uiEvents & (EPOLLERR | EPOLLHUP))
+    {
+        event_loop_close(conn);
+        return;
+    }
+
+    if (uiEvents & EPOLLIN)
+        conn->bInputPending = 1;
+
+    do
+    {
+        if (conn->bInputPending && event_loop_read(conn) != HYPER_SUCCESS)
+        {
+            event_loop_close(conn);
+            return;
+        }
+
+        if (conn_flush(conn) != HYPER_SUCCESS)
+        {
+            event_loop_close(conn);
+            return;
+        }
+    } while (conn->bInputPending && !conn->job && conn->stQueued < OUTPUT_HIGH_WATERMARK);
+
+    if (conn->bClosing && conn_drained(conn))
+    {
+        event_loop_close(conn);
+        return;
+    }
+
+    conn_update_timer(conn);
+}
+
+// Scheduler turn or tokens came in, carry on as if the socket had drained
+static void
+event_loop_resume(
+    void                *lpContext)
+{
+    event_loop_service((PCONNECTION)lpContext, 0);
+}
+
+static void
+event_loop_accept(
+    PWORKER             worker)
+{
+    struct epoll_event event = {0};
+    PCONNECTION conn = NULL;
+    SOCKET sockClient = 0;
+
+    while (1)
+    {
+        sockClient = accept4(worker->sockServer, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sockClient == INVALID_SOCKET)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                printf("[-] accept failed: %s\n", strerror(errno));
+
+            return;
+        }
+
+        conn = conn_create(worker, sockClient);
+        if (conn == NULL)
+        {
+            HyperCloseSocket(sockClient);
+            continue;
+        }
+
+        // Edge-triggered, so EPOLLOUT only fires when a full socket drains
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = conn;
+        if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, sockClient, &event) == -1)
+        {
+            conn_destroy(conn);
+            continue;
+        }
+
+        timer_init(&conn->timer, event_loop_expire, conn);
+        scheduler_entry_init(&worker->sched, &conn->sched, serverConfig.ullClientRate, event_loop_resume, conn);
+        conn_update_timer(conn);
+
+        printf("[*] Client connected\n");
+    }
+}
+
+HYPERSTATUS
+event_loop_run(
+    PWORKER             worker)
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct epoll_event event = {0};
+    SOCKET sockServer = worker->sockServer;
+    int epfd = 0;
+    int iReady = 0;
+    int bJobsDone = 0;
+
+    if (set_nonblocking(sockServer) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (listen(sockServer, SOMAXCONN) == SOCKET_ERROR)
+        return HYPER_FAILED;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        return HYPER_FAILED;
+    worker->epfd = epfd;
+
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = &eListener;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockServer, &event) == -1)
+    {
+        close(epfd);
+        return HYPER_FAILED;
+    }
+
+    if (worker->listCache.inotifyFd != -1)
+    {
+        worker->eInotify = EVENT_INOTIFY;
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = &worker->eInotify;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, worker->listCache.inotifyFd, &event) == -1)
+        {
+            close(epfd);
+            return HYPER_FAILED;
+        }
+    }
+
+    worker->eJobs = EVENT_JOBS;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = &worker->eJobs;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, worker->jobs.fd, &event) == -1)
+    {
+        close(epfd);
+        return HYPER_FAILED;
+    }
+
+    while (1)
+    {
+        // Sleeps no longer than the next connection deadline, and not at all
+        // while connections wait for their turn to send
+        iReady = epoll_wait(epfd, events, MAX_EVENTS,
+                worker->sched.stReady ? 0 : timer_wheel_timeout(&worker->timers));
+        if (iReady == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            close(epfd);
+            return HYPER_FAILED;
+        }
+
+        timer_wheel_update(&worker->timers);
+
+        for (int i = 0; i < iReady; i++)
+        {
+            if (*(EVENT_TYPE*)events[i].data.ptr == EVENT_LISTENER)
+                event_loop_accept(worker);
+            else if (*(EVENT_TYPE*)events[i].data.ptr == EVENT_INOTIFY)
+                list_cache_handle_events(&worker->listCache);
+            else if (*(EVENT_TYPE*)events[i].data.ptr == EVENT_JOBS)
+                bJobsDone = 1;
+            else
+                event_loop_service((PCONNECTION)events[i].data.ptr, events[i].events);
+        }
+
+        // After the batch, so no event above can point at a timed out connection
+        timer_wheel_advance(&worker->timers);
+        scheduler_run(&worker->sched);
+
+        // Same for one a finished job resumed and that then closed
+        if (bJobsDone)
+        {
+            bJobsDone = 0;
+            background_finish(&worker->jobs, event_loop_resume);
+        }
+    }
+
+    close(epfd);
+    return HYPER_SUCCESS;
+}
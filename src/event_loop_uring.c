@@ -0,0 +1,459 @@
+#include "event_loop_uring.h"
+
+/* Completions carry a pointer in user_data, like epoll_event.data.ptr: either
+   one of these tags or a connection with the operation in its low bits.
+   Timeouts are the exception, see URING_TIMEOUT_TAG */
+static EVENT_TYPE eListener = EVENT_LISTENER;
+
+HYPERSTATUS
+event_loop_uring_init(
+    PWORKER             worker)
+{
+    static const int requiredOps[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECVMSG, IORING_OP_POLL_ADD, IORING_OP_TIMEOUT,
+        IORING_OP_TIMEOUT_REMOVE
+    };
+
+    if (uring_init(&worker->ring, URING_ENTRIES) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (!uring_supports(&worker->ring, requiredOps, sizeof(requiredOps) / sizeof(requiredOps[0])))
+    {
+        uring_destroy(&worker->ring);
+        return HYPER_FAILED;
+    }
+
+    // Without registered files every operation just looks the socket up itself
+    uring_register_files(&worker->ring, URING_FIXED_FILES);
+    worker->bAcceptMultishot = 1;
+
+    return HYPER_SUCCESS;
+}
+
+void
+event_loop_uring_destroy(
+    PWORKER             worker)
+{
+    uring_destroy(&worker->ring);
+}
+
+static void
+uring_prep_fd(
+    struct io_uring_sqe *sqe,
+    PCONNECTION         conn)
+{
+    if (conn->iFixedSlot >= 0)
+    {
+        sqe->fd = conn->iFixedSlot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    else
+        sqe->fd = conn->sock;
+}
+
+static HYPERSTATUS
+uring_arm_accept(
+    PWORKER             worker)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&worker->ring);
+    if (sqe == NULL)
+        return HYPER_FAILED;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = worker->sockServer;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = worker->bAcceptMultishot ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = (uint64_t)(uintptr_t)&eListener;
+
+    return HYPER_SUCCESS;
+}
+
+// Readability of one of the worker's own descriptors, tagged like an epoll registration
+static HYPERSTATUS
+uring_arm_watch(
+    PWORKER             worker,
+    int                 fd,
+    EVENT_TYPE          *eTag)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&worker->ring);
+    if (sqe == NULL)
+        return HYPER_FAILED;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uint64_t)(uintptr_t)eTag;
+
+    return HYPER_SUCCESS;
+}
+
+/* Wake the ring for the wheel's next deadline, unless an earlier wakeup is
+   armed. Only one timeout is ever pending, a later one is cancelled first */
+static HYPERSTATUS
+uring_arm_timer(
+    PWORKER             worker)
+{
+    struct io_uring_sqe *sqe = NULL;
+    unsigned long long ullTick = timer_wheel_next(&worker->timers);
+    int iTimeout = 0;
+
+    if (ullTick == 0 || (worker->ullTimeoutTick && worker->ullTimeoutTick <= ullTick))
+        return HYPER_SUCCESS;
+
+    if (worker->ullTimeoutTick)
+    {
+        sqe = uring_get_sqe(&worker->ring);
+        if (sqe == NULL)
+            return HYPER_FAILED;
+
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = URING_TIMEOUT_TAG | worker->ullTimeoutTick;
+        sqe->user_data = (uint64_t)(uintptr_t)&worker->eTimer;
+    }
+
+    sqe = uring_get_sqe(&worker->ring);
+    if (sqe == NULL)
+        return HYPER_FAILED;
+
+    iTimeout = timer_wheel_timeout(&worker->timers);
+    worker->tsTimeout.tv_sec = iTimeout / 1000;
+    worker->tsTimeout.tv_nsec = (iTimeout % 1000) * 1000000LL;
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&worker->tsTimeout;
+    sqe->len = 1;
+    sqe->user_data = URING_TIMEOUT_TAG | ullTick;
+
+    worker->ullTimeoutTick = ullTick;
+
+    return HYPER_SUCCESS;
+}
+
+// Receive straight into the free space of the input ring
+static HYPERSTATUS
+uring_arm_read(
+    PCONNECTION         conn)
+{
+    struct io_uring_sqe *sqe = NULL;
+    size_t stVectors = 0;
+
+    if (conn->bReadArmed)
+        return HYPER_SUCCESS;
+
+    stVectors = ring_write_vectors(&conn->input, conn->readIov);
+    if (stVectors == 0)
+        return HYPER_SUCCESS;
+
+    sqe = uring_get_sqe(&conn->worker->ring);
+    if (sqe == NULL)
+        return HYPER_FAILED;
+
+    memset(&conn->readMsg, 0, sizeof(conn->readMsg));
+    conn->readMsg.msg_iov = conn->readIov;
+    conn->readMsg.msg_iovlen = stVectors;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    uring_prep_fd(sqe, conn);
+    sqe->addr = (uint64_t)(uintptr_t)&conn->readMsg;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_READ;
+
+    conn->bReadArmed = 1;
+    conn->uiInflight++;
+
+    return HYPER_SUCCESS;
+}
+
+static HYPERSTATUS
+uring_arm_poll(
+    PCONNECTION         conn,
+    unsigned int        uiEvents,
+    unsigned int        uiOp)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&conn->worker->ring);
+    if (sqe == NULL)
+        return HYPER_FAILED;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    uring_prep_fd(sqe, conn);
+    sqe->poll32_events = uiEvents;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | uiOp;
+
+    conn->uiInflight++;
+
+    return HYPER_SUCCESS;
+}
+
+// Shut the socket down so in-flight operations complete, then free it
+static void
+uring_close(
+    PCONNECTION         conn)
+{
+    if (!conn->bDead)
+    {
+        puts("[!] Client disconnected");
+        conn->bDead = 1;
+        timer_wheel_remove(&conn->worker->timers, &conn->timer);
+        scheduler_remove(&conn->worker->sched, &conn->sched);
+        shutdown(conn->sock, SHUT_RDWR);
+    }
+
+    if (conn->uiInflight)
+        return;
+
+    uring_fixed_remove(&conn->worker->ring, conn->iFixedSlot);
+    conn_destroy(conn);
+}
+
+// Same loop as event_loop_service, but input already sits in the ring
+static void
+uring_service(
+    PCONNECTION         conn)
+{
+    do
+    {
+        if (conn->bInputPending)
+        {
+            conn->bInputPending = 0;
+            if (event_loop_process_input(conn, 1) < 0)
+            {
+                uring_close(conn);
+                return;
+            }
+        }
+
+        if (conn_flush(conn) != HYPER_SUCCESS)
+        {
+            uring_close(conn);
+            return;
+        }
+    } while (conn->bInputPending && !conn->job && conn->stQueued < OUTPUT_HIGH_WATERMARK);
+
+    if (conn->bClosing && conn_drained(conn))
+    {
+        uring_close(conn);
+        return;
+    }
+
+    // Output stuck behind a full socket buffer, or zerocopy completions still
+    // to come, which only show up as POLLERR. Output the scheduler is holding
+    // back waits for it instead, a writable socket would just spin
+    if (!conn_drained(conn) && !conn->bWriteArmed &&
+        !(conn->psHead && scheduler_waiting(&conn->sched)))
+    {
+        if (uring_arm_poll(conn, conn->psHead ? POLLOUT : POLLERR, URING_OP_POLLOUT) != HYPER_SUCCESS)
+        {
+            uring_close(conn);
+            return;
+        }
+        conn->bWriteArmed = 1;
+    }
+
+    if (!conn->bInputPending && !conn->bClosing && uring_arm_read(conn) != HYPER_SUCCESS)
+    {
+        uring_close(conn);
+        return;
+    }
+
+    conn_update_timer(conn);
+}
+
+static void
+uring_resume(
+    void                *lpContext)
+{
+    uring_service((PCONNECTION)lpContext);
+}
+
+static void
+uring_expire(
+    PTIMER              timer)
+{
+    PCONNECTION conn = (PCONNECTION)timer->lpContext;
+
+    if (conn_check_deadline(conn) != TIMEOUT_NONE)
+        uring_close(conn);
+}
+
+static void
+uring_accept(
+    PWORKER             worker,
+    int                 iResult,
+    unsigned int        uiFlags)
+{
+    PCONNECTION conn = NULL;
+
+    // Multishot accept ended, or the kernel predates it
+    if (!(uiFlags & IORING_CQE_F_MORE))
+    {
+        if (iResult == -EINVAL && worker->bAcceptMultishot)
+            worker->bAcceptMultishot = 0;
+        uring_arm_accept(worker);
+    }
+
+    if (iResult < 0)
+    {
+        if (iResult != -EINVAL && iResult != -ECONNABORTED && iResult != -EINTR)
+            printf("[-] accept failed: %s\n", strerror(-iResult));
+        return;
+    }
+
+    conn = conn_create(worker, iResult);
+    if (conn == NULL)
+    {
+        HyperCloseSocket(iResult);
+        return;
+    }
+
+    conn->iFixedSlot = uring_fixed_add(&worker->ring, conn->sock);
+    timer_init(&conn->timer, uring_expire, conn);
+    scheduler_entry_init(&worker->sched, &conn->sched, serverConfig.ullClientRate, uring_resume, conn);
+    conn_update_timer(conn);
+
+    printf("[*] Client connected\n");
+
+    if (uring_arm_read(conn) != HYPER_SUCCESS)
+        uring_close(conn);
+}
+
+static void
+uring_complete(
+    PCONNECTION         conn,
+    unsigned int        uiOp,
+    int                 iResult)
+{
+    conn->uiInflight--;
+
+    if (uiOp == URING_OP_READ)
+        conn->bReadArmed = 0;
+    else if (uiOp == URING_OP_POLLOUT)
+        conn->bWriteArmed = 0;
+
+    if (conn->bDead)
+    {
+        uring_close(conn);
+        return;
+    }
+
+    switch (uiOp)
+    {
+    case URING_OP_READ:
+        // Nothing there after all, wait for readability and try again
+        if (iResult == -EAGAIN || iResult == -EINTR)
+        {
+            if (uring_arm_poll(conn, POLLIN, URING_OP_POLLIN) != HYPER_SUCCESS)
+                uring_close(conn);
+            return;
+        }
+
+        if (iResult <= 0)
+        {
+            uring_close(conn);
+            return;
+        }
+
+        STAT_ADD(conn->worker->stats.ullBytesReceived, iResult);
+        conn->ullLastRead = conn->worker->timers.ullClock;
+        ring_commit(&conn->input, iResult);
+        conn->bInputPending = 1;
+        uring_service(conn);
+        break;
+
+    case URING_OP_POLLIN:
+        if (iResult < 0 || uring_arm_read(conn) != HYPER_SUCCESS)
+            uring_close(conn);
+        break;
+
+    case URING_OP_POLLOUT:
+        if (iResult < 0)
+        {
+            uring_close(conn);
+            return;
+        }
+        uring_service(conn);
+        break;
+    }
+}
+
+HYPERSTATUS
+event_loop_uring_run(
+    PWORKER             worker)
+{
+    struct io_uring_cqe *cqe = NULL;
+    uint64_t ullData = 0;
+    unsigned int uiFlags = 0;
+    int iResult = 0;
+
+    if (listen(worker->sockServer, SOMAXCONN) == SOCKET_ERROR)
+        return HYPER_FAILED;
+
+    if (uring_arm_accept(worker) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    if (worker->listCache.inotifyFd != -1)
+    {
+        worker->eInotify = EVENT_INOTIFY;
+        if (uring_arm_watch(worker, worker->listCache.inotifyFd, &worker->eInotify) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+    }
+
+    worker->eJobs = EVENT_JOBS;
+    if (uring_arm_watch(worker, worker->jobs.fd, &worker->eJobs) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    worker->eTimer = EVENT_TIMER;
+
+    while (1)
+    {
+        if (uring_arm_timer(worker) != HYPER_SUCCESS)
+            return HYPER_FAILED;
+
+        // One syscall submits everything queued last round and waits for more
+        if (uring_submit(&worker->ring, worker->sched.stReady ? 0 : 1) < 0)
+            return HYPER_FAILED;
+
+        timer_wheel_update(&worker->timers);
+
+        while ((cqe = uring_peek_cqe(&worker->ring)) != NULL)
+        {
+            ullData = cqe->user_data;
+            iResult = cqe->res;
+            uiFlags = cqe->flags;
+            uring_cqe_seen(&worker->ring);
+
+            // A replaced timeout still completes, cancelled or having fired just before
+            if (ullData & URING_TIMEOUT_TAG)
+            {
+                if ((ullData & ~URING_TIMEOUT_TAG) == worker->ullTimeoutTick)
+                    worker->ullTimeoutTick = 0;
+            }
+            else if (ullData == (uint64_t)(uintptr_t)&eListener)
+                uring_accept(worker, iResult, uiFlags);
+            else if (ullData == (uint64_t)(uintptr_t)&worker->eInotify)
+            {
+                list_cache_handle_events(&worker->listCache);
+                if (!(uiFlags & IORING_CQE_F_MORE))
+                    uring_arm_watch(worker, worker->listCache.inotifyFd, &worker->eInotify);
+            }
+            else if (ullData == (uint64_t)(uintptr_t)&worker->eJobs)
+            {
+                background_finish(&worker->jobs, uring_resume);
+                if (!(uiFlags & IORING_CQE_F_MORE))
+                    uring_arm_watch(worker, worker->jobs.fd, &worker->eJobs);
+            }
+            else if (ullData == (uint64_t)(uintptr_t)&worker->eTimer)
+                continue;   /* TIMEOUT_REMOVE, the replacement is armed either way */
+            else
+                uring_complete((PCONNECTION)(uintptr_t)(ullData & ~(uint64_t)URING_OP_MASK),
+                        (unsigned int)(ullData & URING_OP_MASK), iResult);
+        }
+
+        timer_wheel_advance(&worker->timers);
+        scheduler_run(&worker->sched);
+    }
+
+    return HYPER_SUCCESS;
+}
@@ -0,0 +1,237 @@
+#include "file_cache.h"
+
+HYPERSTATUS
+file_cache_init(
+    PFILE_CACHE         cache,
+    size_t              stBudget)
+{
+    memset(cache, 0, sizeof(FILE_CACHE));
+    cache->stBudget = stBudget;
+
+    if (stBudget == 0)
+        return HYPER_SUCCESS;
+
+    if (HyperMemAlloc((void**)&cache->buckets, sizeof(PCACHE_ENTRY) * CACHE_INITIAL_BUCKETS) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    memset(cache->buckets, 0, sizeof(PCACHE_ENTRY) * CACHE_INITIAL_BUCKETS);
+    cache->stBuckets = CACHE_INITIAL_BUCKETS;
+
+    return HYPER_SUCCESS;
+}
+
+static void
+file_cache_free_entry(
+    PCACHE_ENTRY        entry)
+{
+    HyperMemFree(entry->cpData);
+    HyperMemFree(entry->cpPath);
+    HyperMemFree(entry);
+}
+
+// Drop an entry from the cache; its memory lives on until the last send finishes
+static void
+file_cache_remove(
+    PFILE_CACHE         cache,
+    PCACHE_ENTRY        entry)
+{
+    PCACHE_ENTRY *lpLink = &cache->buckets[entry->ullHash & (cache->stBuckets - 1)];
+
+    while (*lpLink != entry)
+        lpLink = &(*lpLink)->hashNext;
+    *lpLink = entry->hashNext;
+
+    lru_unlink(&cache->lru, &entry->lru);
+
+    STAT_SUB(cache->stats.stEntries, 1);
+    STAT_SUB(cache->stats.stBytes, entry->stDataLength);
+    entry->bLinked = 0;
+
+    if (entry->uiRefs == 0)
+        file_cache_free_entry(entry);
+}
+
+void
+file_cache_destroy(
+    PFILE_CACHE         cache)
+{
+    while (cache->lru.head)
+        file_cache_remove(cache, (PCACHE_ENTRY)cache->lru.head);
+
+    HyperMemFree(cache->buckets);
+    cache->buckets = NULL;
+    cache->stBuckets = 0;
+}
+
+static void
+file_cache_grow(
+    PFILE_CACHE         cache)
+{
+    PCACHE_ENTRY *buckets = NULL;
+    PCACHE_ENTRY entry = NULL;
+    size_t stBuckets = cache->stBuckets * 2;
+
+    // Keep the old table if we're out of memory, chains just get longer
+    if (HyperMemAlloc((void**)&buckets, sizeof(PCACHE_ENTRY) * stBuckets) != HYPER_SUCCESS)
+        return;
+    memset(buckets, 0, sizeof(PCACHE_ENTRY) * stBuckets);
+
+    for (entry = (PCACHE_ENTRY)cache->lru.head; entry; entry = (PCACHE_ENTRY)entry->lru.next)
+    {
+        entry->hashNext = buckets[entry->ullHash & (stBuckets - 1)];
+        buckets[entry->ullHash & (stBuckets - 1)] = entry;
+    }
+
+    HyperMemFree(cache->buckets);
+    cache->buckets = buckets;
+    cache->stBuckets = stBuckets;
+}
+
+PCACHE_ENTRY
+file_cache_lookup(
+    PFILE_CACHE         cache,
+    const char          *cpPath,
+    const struct stat   *st)
+{
+    PCACHE_ENTRY entry = NULL;
+    uint64_t ullHash = 0;
+
+    if (cache->stBuckets == 0)
+        return NULL;
+
+    ullHash = lru_key_hash(cpPath);
+
+    for (entry = cache->buckets[ullHash & (cache->stBuckets - 1)]; entry; entry = entry->hashNext)
+    {
+        if (entry->ullHash == ullHash && strcmp(entry->cpPath, cpPath) == 0)
+            break;
+    }
+
+    if (entry == NULL)
+    {
+        STAT_ADD(cache->stats.ullMisses, 1);
+        return NULL;
+    }
+
+    // The file changed on disk since we cached it
+    if (entry->device != st->st_dev || entry->inode != st->st_ino ||
+        entry->offSize != st->st_size ||
+        entry->tsModified.tv_sec != st->st_mtim.tv_sec ||
+        entry->tsModified.tv_nsec != st->st_mtim.tv_nsec)
+    {
+        file_cache_remove(cache, entry);
+        STAT_ADD(cache->stats.ullMisses, 1);
+        return NULL;
+    }
+
+    lru_unlink(&cache->lru, &entry->lru);
+    lru_push(&cache->lru, &entry->lru);
+    STAT_ADD(cache->stats.ullHits, 1);
+
+    return entry;
+}
+
+PCACHE_ENTRY
+file_cache_insert(
+    PFILE_CACHE         cache,
+    const char          *cpPath,
+    int                 fd,
+    const struct stat   *st)
+{
+    PCACHE_ENTRY entry = NULL;
+    size_t stDataLength = CACHE_HEADER_SIZE + st->st_size;
+    size_t stRead = 0;
+    ssize_t sBytesRead = 0;
+
+    if (cache->stBuckets == 0 || st->st_size <= 0 ||
+        (size_t)st->st_size > cache->stBudget / CACHE_MAX_ENTRY_SHARE)
+        return NULL;
+
+    if (HyperMemAlloc((void**)&entry, sizeof(CACHE_ENTRY)) != HYPER_SUCCESS)
+        return NULL;
+    memset(entry, 0, sizeof(CACHE_ENTRY));
+
+    entry->cpPath = strdup(cpPath);
+    if (entry->cpPath == NULL || HyperMemAlloc((void**)&entry->cpData, stDataLength) != HYPER_SUCCESS)
+    {
+        file_cache_free_entry(entry);
+        return NULL;
+    }
+
+    // Pre-format the status and size buffers so a hit is a single send
+    memset(entry->cpData, 0, CACHE_HEADER_SIZE);
+    snprintf(entry->cpData, STATUS_BUFFER_SIZE, "%u", 200);
+    snprintf(entry->cpData + STATUS_BUFFER_SIZE, FILESIZE_BUFFER_SIZE, "%lu", (unsigned long)st->st_size);
+
+    while (stRead < (size_t)st->st_size)
+    {
+        sBytesRead = pread(fd, entry->cpData + CACHE_HEADER_SIZE + stRead, st->st_size - stRead, stRead);
+        if (sBytesRead == -1 && errno == EINTR)
+            continue;
+
+        if (sBytesRead <= 0)
+        {
+            file_cache_free_entry(entry);
+            return NULL;
+        }
+
+        stRead += sBytesRead;
+    }
+
+    entry->ullHash = lru_key_hash(cpPath);
+    entry->device = st->st_dev;
+    entry->inode = st->st_ino;
+    entry->offSize = st->st_size;
+    entry->tsModified = st->st_mtim;
+    entry->stDataLength = stDataLength;
+    entry->bLinked = 1;
+
+    while (cache->lru.tail && cache->stats.stBytes + stDataLength > cache->stBudget)
+    {
+        file_cache_remove(cache, (PCACHE_ENTRY)cache->lru.tail);
+        STAT_ADD(cache->stats.ullEvictions, 1);
+    }
+
+    if (cache->stats.stEntries >= cache->stBuckets)
+        file_cache_grow(cache);
+
+    entry->hashNext = cache->buckets[entry->ullHash & (cache->stBuckets - 1)];
+    cache->buckets[entry->ullHash & (cache->stBuckets - 1)] = entry;
+    lru_push(&cache->lru, &entry->lru);
+
+    STAT_ADD(cache->stats.stEntries, 1);
+    STAT_ADD(cache->stats.stBytes, stDataLength);
+
+    return entry;
+}
+
+void
+file_cache_retain(
+    PCACHE_ENTRY        entry)
+{
+    entry->uiRefs++;
+}
+
+void
+file_cache_release(
+    void                *lpEntry)
+{
+    PCACHE_ENTRY entry = (PCACHE_ENTRY)lpEntry;
+
+    entry->uiRefs--;
+    if (entry->uiRefs == 0 && !entry->bLinked)
+        file_cache_free_entry(entry);
+}
+
+void
+file_cache_get_stats(
+    PFILE_CACHE         cache,
+    PFILE_CACHE_STATS   stats)
+{
+    // Called from other workers too, see STAT_READ
+    stats->ullHits = STAT_READ(cache->stats.ullHits);
+    stats->ullMisses = STAT_READ(cache->stats.ullMisses);
+    stats->ullEvictions = STAT_READ(cache->stats.ullEvictions);
+    stats->stEntries = STAT_READ(cache->stats.stEntries);
+    stats->stBytes = STAT_READ(cache->stats.stBytes);
+}
@@ -1,7 +1,5 @@
 #include "hyper_server.h"
 
-int isConnected = 0;
-
 void print_ascii(void)
 {
     puts( 
@@ -18,59 +16,106 @@ void print_ascii(void)
 void usage(void)
 {
     print_ascii();
-    puts("Usage: hyper-server <PORT>");
+    puts("Usage: hyper-server [OPTIONS] <PORT>\n"
+         "\n"
+         "  -w, --workers N      Serve from N threads, each pinned to a core\n"
+         "                       with its own SO_REUSEPORT listener (default 1)\n"
+         "  -c, --cache-size N   Hot-file cache budget in bytes, K/M/G suffixes\n"
+         "                       allowed, 0 disables it (default 64M)\n"
+         "  -l, --list-cache-size N\n"
+         "                       Directory listing cache budget, invalidated\n"
+         "                       through inotify, 0 disables it (default 16M)\n"
+         "  -b, --backend NAME   I/O backend, epoll or uring; uring falls back\n"
+         "                       to epoll when the kernel lacks support\n"
+         "  -s, --stats-file PATH\n"
+         "                       Rewrite PATH with the STATS counters in\n"
+         "                       Prometheus text format every 10 seconds\n"
+         "  -S, --store DIR      Keep served files deduplicated as content-defined\n"
+         "                       chunks in DIR and stream SEND from there\n"
+         "  -z, --zerocopy N     Send cached payloads of at least N bytes with\n"
+         "                       MSG_ZEROCOPY, 0 disables it (default 0)\n"
+         "      --sndbuf N, --rcvbuf N\n"
+         "                       Fix client socket buffers for links with a\n"
+         "                       large bandwidth-delay product; turns off the\n"
+         "                       kernel's autotuning (default 0, autotune)\n"
+         "  -i, --idle-timeout S Close connections idle between requests for S\n"
+         "                       seconds, 0 never does (default 120)\n"
+         "      --read-timeout S Close clients that stall mid-command or\n"
+         "                       mid-upload for S seconds (default 30)\n"
+         "      --write-timeout S\n"
+         "                       Close clients that read none of their pending\n"
+         "                       response for S seconds (default 60)\n"
+         "      --quantum N      Bytes a connection sends per turn before the\n"
+         "                       others on its worker get theirs, so bulk\n"
+         "                       downloads can't hold up small ones; 0 lets\n"
+         "                       each send until its socket is full (default 256K)\n"
+         "      --rate N         Cap all output at N bytes per second, split\n"
+         "                       evenly between workers (default 0, unlimited)\n"
+         "      --client-rate N  Cap each connection at N bytes per second\n"
+         "                       (default 0, unlimited)");
 }
 
-// Get arguments from input, separated by delimiter
-char** 
-GetArgs(
-    char                *a_str, 
-    char                a_delim, 
-    size_t              *count
-)
+// Parse a number of at most ullMax, nothing may follow it
+HYPERSTATUS
+parse_count(
+    const char          *cpValue,
+    unsigned long long  ullMax,
+    unsigned long long  *ullValue)
 {
-	char** result = 0;
-	char* tmp = a_str;
-	char* last_comma = 0;
-	char delim[2] = {a_delim, 0};
-
-	// Count how many elements will be extracted.
-	while (*tmp)
-	{
-		if (a_delim == *tmp)
-		{
-			(*count)++;
-			last_comma = tmp;
-		}
-		tmp++;
-	}
-
-	// Add space for trailing token.
-	*count += last_comma < (a_str + strlen(a_str) - 1);
-
-	// Add space for terminating null string so caller
-	// knows where the list of returned strings ends. 
-	(*count)++;
-
-	result = realloc(result, sizeof(char*) * (*count));
-
-	if (result)
-	{
-		size_t idx = 0;
-		char* token = strtok(a_str, delim);
-
-		while (token)
-		{
-			*(result + idx++) = strdup(token);
-			token = strtok(0, delim);
-		}
-		*(result + idx) = 0;
-        
-        // Decrement count so count is accurate to array size
-	    (*count)--;
-	}
-	
-    return result;
+    char *cpEnd = NULL;
+
+    // strtoull would take a sign or leading blanks
+    if (*cpValue < '0' || *cpValue > '9')
+        return HYPER_FAILED;
+
+    errno = 0;
+    *ullValue = strtoull(cpValue, &cpEnd, 0);
+    if (errno != 0 || *cpEnd != 0 || *ullValue > ullMax)
+        return HYPER_FAILED;
+
+    return HYPER_SUCCESS;
+}
+
+// Parse a byte count with an optional K/M/G suffix, it has to fit a size_t
+HYPERSTATUS
+parse_size(
+    const char          *cpSize,
+    unsigned long long  *ullSize)
+{
+    char *cpEnd = NULL;
+    unsigned int uiShift = 0;
+
+    if (*cpSize < '0' || *cpSize > '9')
+        return HYPER_FAILED;
+
+    errno = 0;
+    *ullSize = strtoull(cpSize, &cpEnd, 0);
+    if (errno != 0)
+        return HYPER_FAILED;
+
+    switch (*cpEnd)
+    {
+    case 0: break;
+    case 'K': case 'k': uiShift = 10; cpEnd++; break;
+    case 'M': case 'm': uiShift = 20; cpEnd++; break;
+    case 'G': case 'g': uiShift = 30; cpEnd++; break;
+    default: return HYPER_FAILED;
+    }
+
+    if (*cpEnd != 0 || *ullSize > (SIZE_MAX >> uiShift))
+        return HYPER_FAILED;
+
+    *ullSize <<= uiShift;
+    return HYPER_SUCCESS;
+}
+
+static int
+option_error(
+    const char          *cpOption,
+    const char          *cpValue)
+{
+    printf("[-] Bad value %s for %s\n", cpValue, cpOption);
+    return HYPER_FAILED;
 }
 
 void server_init(void)
@@ -78,7 +123,10 @@ void server_init(void)
     char hostedDir[] = "hosted";
 
     if (mkdir(hostedDir, 0700) == 0 || errno == EEXIST)
+    {
         chdir(hostedDir);
+        getcwd(serverConfig.cpRoot, SERVER_MAX_PATH);
+    }
     else
     {
         puts("[-] Couldn't make hosted directory");
@@ -91,77 +139,193 @@ void server_init(void)
 int main(int argc, char **argv)
 {
     HYPERSTATUS iResult = 0;
-    
-    SOCKET sockServer = 0;
-    SOCKET sockClient = 0;
-    unsigned short usPort = 0;
-    
-    char command[MAX_INPUT_BUFFER];
-    
-    if (argc < 2)
+    int iOption = 0;
+    unsigned long long ullValue = 0;
+    char cpCwd[SERVER_MAX_PATH];
+
+    static const struct option longOptions[] = {
+        {"workers", required_argument, NULL, 'w'},
+        {"cache-size", required_argument, NULL, 'c'},
+        {"list-cache-size", required_argument, NULL, 'l'},
+        {"backend", required_argument, NULL, 'b'},
+        {"stats-file", required_argument, NULL, 's'},
+        {"store",   required_argument, NULL, 'S'},
+        {"zerocopy", required_argument, NULL, 'z'},
+        {"sndbuf",  required_argument, NULL, OPTION_SNDBUF},
+        {"rcvbuf",  required_argument, NULL, OPTION_RCVBUF},
+        {"idle-timeout", required_argument, NULL, 'i'},
+        {"read-timeout", required_argument, NULL, OPTION_READ_TIMEOUT},
+        {"write-timeout", required_argument, NULL, OPTION_WRITE_TIMEOUT},
+        {"quantum", required_argument, NULL, OPTION_QUANTUM},
+        {"rate",    required_argument, NULL, OPTION_RATE},
+        {"client-rate", required_argument, NULL, OPTION_CLIENT_RATE},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL,      0,                 NULL, 0}
+    };
+
+    while ((iOption = getopt_long(argc, argv, "w:c:l:b:s:S:z:i:h", longOptions, NULL)) != -1)
+    {
+        switch (iOption)
+        {
+        case 'w':
+            if (parse_count(optarg, MAX_WORKERS, &ullValue) != HYPER_SUCCESS || ullValue == 0)
+            {
+                printf("[-] Worker count must be between 1 and %d\n", MAX_WORKERS);
+                return HYPER_FAILED;
+            }
+            serverConfig.uiWorkers = (unsigned int)ullValue;
+            break;
+        case 'c':
+            if (parse_size(optarg, &ullValue) != HYPER_SUCCESS)
+                return option_error("--cache-size", optarg);
+            serverConfig.stCacheSize = (size_t)ullValue;
+            break;
+        case 'l':
+            if (parse_size(optarg, &ullValue) != HYPER_SUCCESS)
+                return option_error("--list-cache-size", optarg);
+            serverConfig.stListCacheSize = (size_t)ullValue;
+            break;
+        case 'b':
+            if (strcmp(optarg, "epoll") == 0)
+                serverConfig.eBackend = BACKEND_EPOLL;
+            else if (strcmp(optarg, "uring") == 0)
+                serverConfig.eBackend = BACKEND_URING;
+            else
+            {
+                printf("[-] Unknown backend %s, expected epoll or uring\n", optarg);
+                return HYPER_FAILED;
+            }
+            break;
+        case 's':
+            // Relative to where we started, not the hosted directory
+            cpCwd[0] = 0;
+            if ((optarg[0] != '/' && getcwd(cpCwd, sizeof(cpCwd)) == NULL) ||
+                snprintf(serverConfig.cpStatsFile, SERVER_MAX_PATH, "%s%s%s",
+                        cpCwd, cpCwd[0] ? "/" : "", optarg) >= SERVER_MAX_PATH)
+            {
+                printf("[-] Bad stats file path %s\n", optarg);
+                return HYPER_FAILED;
+            }
+            break;
+        case 'S':
+            cpCwd[0] = 0;
+            if ((optarg[0] != '/' && getcwd(cpCwd, sizeof(cpCwd)) == NULL) ||
+                snprintf(serverConfig.cpStoreDir, SERVER_MAX_PATH, "%s%s%s",
+                        cpCwd, cpCwd[0] ? "/" : "", optarg) >= SERVER_MAX_PATH)
+            {
+                printf("[-] Bad store path %s\n", optarg);
+                return HYPER_FAILED;
+            }
+            break;
+        case 'z':
+            if (parse_size(optarg, &ullValue) != HYPER_SUCCESS)
+                return option_error("--zerocopy", optarg);
+            serverConfig.stZerocopyMin = (size_t)ullValue;
+            break;
+        case OPTION_SNDBUF:
+            if (parse_size(optarg, &ullValue) != HYPER_SUCCESS)
+                return option_error("--sndbuf", optarg);
+            serverConfig.stSendBuffer = (size_t)ullValue;
+            break;
+        case OPTION_RCVBUF:
+            if (parse_size(optarg, &ullValue) != HYPER_SUCCESS)
+                return option_error("--rcvbuf", optarg);
+            serverConfig.stReceiveBuffer = (size_t)ullValue;
+            break;
+        case 'i':
+            if (parse_count(optarg, UINT_MAX, &ullValue) != HYPER_SUCCESS)
+                return option_error("--idle-timeout", optarg);
+            serverConfig.uiIdleTimeout = (unsigned int)ullValue;
+            break;
+        case OPTION_READ_TIMEOUT:
+            if (parse_count(optarg, UINT_MAX, &ullValue) != HYPER_SUCCESS)
+                return option_error("--read-timeout", optarg);
+            serverConfig.uiReadTimeout = (unsigned int)ullValue;
+            break;
+        case OPTION_WRITE_TIMEOUT:
+            if (parse_count(optarg, UINT_MAX, &ullValue) != HYPER_SUCCESS)
+                return option_error("--write-timeout", optarg);
+            serverConfig.uiWriteTimeout = (unsigned int)ullValue;
+            break;
+        case OPTION_QUANTUM:
+            if (parse_size(optarg, &ullValue) != HYPER_SUCCESS)
+                return option_error("--quantum", optarg);
+            serverConfig.stQuantum = (size_t)ullValue;
+            break;
+        case OPTION_RATE:
+            if (parse_size(optarg, &ullValue) != HYPER_SUCCESS)
+                return option_error("--rate", optarg);
+            serverConfig.ullRate = ullValue;
+            break;
+        case OPTION_CLIENT_RATE:
+            if (parse_size(optarg, &ullValue) != HYPER_SUCCESS)
+                return option_error("--client-rate", optarg);
+            serverConfig.ullClientRate = ullValue;
+            break;
+        default:
+            usage();
+            return HYPER_FAILED;
+        }
+    }
+
+    if (optind >= argc)
     {
         usage();
         return HYPER_FAILED;
     }
-    else
+    else if (parse_count(argv[optind], USHRT_MAX, &ullValue) != HYPER_SUCCESS || ullValue == 0)
     {
-        usPort = (unsigned short)strtoul(argv[1], NULL, 0);
+        printf("[-] Port must be between 1 and %d\n", USHRT_MAX);
+        return HYPER_FAILED;
     }
+    else
+        serverConfig.usPort = (unsigned short)ullValue;
     
+    // Keep the log readable when stdout is redirected to a file
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
     print_ascii();
 
     server_init();
 
-    iResult = HyperNetworkInit();
-    if (iResult != HYPER_SUCCESS)
+    if (command_table_init() != HYPER_SUCCESS)
     {
-        printf("[-] HyperNetworkInit failed\n");
+        printf("[-] Couldn't build the command table\n");
         return HYPER_FAILED;
     }
-    else
-        printf("[+] Hyper NetAPI Initialized\n");
 
-    iResult = HyperStartServer(&sockServer, usPort);
-    if (iResult != HYPER_SUCCESS)
-    {
-        printf("[-] HyperStartServer failed\n");
-        return HYPER_FAILED;
-    }
-    else
-        printf("[+] Hyper Server has been started\n");
+    // Once, before any worker can hash a file
+    checksum_init();
+    printf("[+] Checksums: %s\n", checksum_describe());
 
-    while (1)
+    // Chunk ids are SHA-256, so this comes after checksum_init
+    if (serverConfig.cpStoreDir[0])
     {
-        isConnected = 0;
-        iResult = HyperServerListen(sockServer, &sockClient);
-        if (iResult != HYPER_SUCCESS)
+        if (chunk_store_open(serverConfig.cpStoreDir) != HYPER_SUCCESS)
         {
-            printf("[-] HyperServerListen failed\n");
+            printf("[-] Couldn't open the chunk store in %s\n", serverConfig.cpStoreDir);
             return HYPER_FAILED;
         }
-        else
-            printf("[*] Client connected\n");
 
-        isConnected = 1;
-        while (isConnected == 1)
-        {
-            memset(command, 0, MAX_INPUT_BUFFER);
+        printf("[+] Chunk store: %u chunks in %u packs\n", chunkStore.uiChunks, chunkStore.uiPacks);
+    }
 
-            iResult = HyperReceiveCommand(sockClient, command, MAX_INPUT_BUFFER);
-            if (iResult != HYPER_SUCCESS)
-            {
-                printf("[-] HyperRecieveCommand failed\n");
-                return HYPER_FAILED;
-            }
-            else
-                printf("[+] Command recieved. %s\n", command);
+    // Peers that vanish mid-transfer must not kill the whole server
+    signal(SIGPIPE, SIG_IGN);
 
-            command_handler(sockClient, command);
-        }
+    iResult = HyperNetworkInit();
+    if (iResult != HYPER_SUCCESS)
+    {
+        printf("[-] HyperNetworkInit failed\n");
+        return HYPER_FAILED;
     }
-        
-    HyperCloseSocket(sockServer);
-    HyperCloseSocket(sockClient);
+    else
+        printf("[+] Hyper NetAPI Initialized\n");
+
+    iResult = worker_pool_run(serverConfig.usPort, serverConfig.uiWorkers);
+    if (iResult != HYPER_SUCCESS)
+        printf("[-] Hyper Server stopped with errors\n");
+
     HyperSocketCleanup();
-    return HYPER_SUCCESS;
+    return iResult;
 }
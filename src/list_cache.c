@@ -0,0 +1,339 @@
+#include "list_cache.h"
+
+HYPERSTATUS
+list_cache_init(
+    PLIST_CACHE         cache,
+    size_t              stBudget)
+{
+    memset(cache, 0, sizeof(LIST_CACHE));
+    cache->inotifyFd = -1;
+    cache->stBudget = stBudget;
+
+    if (stBudget == 0)
+        return HYPER_SUCCESS;
+
+    cache->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->inotifyFd == -1)
+        return HYPER_FAILED;
+
+    return HYPER_SUCCESS;
+}
+
+static void
+list_cache_free_entry(
+    PLIST_ENTRY         entry)
+{
+    HyperMemFree(entry->cpData);
+    HyperMemFree(entry->cpPath);
+    HyperMemFree(entry);
+}
+
+static PLIST_ENTRY
+list_cache_find_watch(
+    PLIST_CACHE         cache,
+    int                 wd)
+{
+    PLIST_ENTRY entry = cache->watchBuckets[wd & (LIST_CACHE_BUCKETS - 1)];
+
+    while (entry && entry->wd != wd)
+        entry = entry->watchNext;
+
+    return entry;
+}
+
+// Unhook an entry and drop its watch, the data lives on until the last send
+static void
+list_cache_remove(
+    PLIST_CACHE         cache,
+    PLIST_ENTRY         entry)
+{
+    PLIST_ENTRY *lpLink = &cache->pathBuckets[entry->ullHash & (LIST_CACHE_BUCKETS - 1)];
+
+    while (*lpLink != entry)
+        lpLink = &(*lpLink)->pathNext;
+    *lpLink = entry->pathNext;
+
+    lpLink = &cache->watchBuckets[entry->wd & (LIST_CACHE_BUCKETS - 1)];
+    while (*lpLink != entry)
+        lpLink = &(*lpLink)->watchNext;
+    *lpLink = entry->watchNext;
+
+    lru_unlink(&cache->lru, &entry->lru);
+    inotify_rm_watch(cache->inotifyFd, entry->wd);
+
+    STAT_SUB(cache->stats.stEntries, 1);
+    STAT_SUB(cache->stats.stBytes, entry->stCapacity);
+    entry->bLinked = 0;
+
+    if (entry->uiRefs == 0)
+        list_cache_free_entry(entry);
+}
+
+void
+list_cache_destroy(
+    PLIST_CACHE         cache)
+{
+    while (cache->lru.head)
+        list_cache_remove(cache, (PLIST_ENTRY)cache->lru.head);
+
+    if (cache->inotifyFd != -1)
+        close(cache->inotifyFd);
+    cache->inotifyFd = -1;
+}
+
+PLIST_ENTRY
+list_cache_lookup(
+    PLIST_CACHE         cache,
+    const char          *cpPath)
+{
+    PLIST_ENTRY entry = NULL;
+    uint64_t ullHash = 0;
+
+    if (cache->inotifyFd == -1)
+        return NULL;
+
+    ullHash = lru_key_hash(cpPath);
+    for (entry = cache->pathBuckets[ullHash & (LIST_CACHE_BUCKETS - 1)]; entry; entry = entry->pathNext)
+    {
+        if (entry->ullHash == ullHash && strcmp(entry->cpPath, cpPath) == 0)
+            break;
+    }
+
+    // Still being captured by another LIST counts as a miss
+    if (entry == NULL || !entry->bComplete)
+    {
+        STAT_ADD(cache->stats.ullMisses, 1);
+        return NULL;
+    }
+
+    lru_unlink(&cache->lru, &entry->lru);
+    lru_push(&cache->lru, &entry->lru);
+    STAT_ADD(cache->stats.ullHits, 1);
+
+    return entry;
+}
+
+// Start capturing a listing of cpPath, the watch goes in before the directory is read
+PLIST_ENTRY
+list_cache_begin(
+    PLIST_CACHE         cache,
+    const char          *cpPath)
+{
+    PLIST_ENTRY entry = NULL;
+    uint64_t ullHash = 0;
+    int wd = -1;
+
+    if (cache->inotifyFd == -1)
+        return NULL;
+
+    ullHash = lru_key_hash(cpPath);
+    for (entry = cache->pathBuckets[ullHash & (LIST_CACHE_BUCKETS - 1)]; entry; entry = entry->pathNext)
+    {
+        if (entry->ullHash == ullHash && strcmp(entry->cpPath, cpPath) == 0)
+            return NULL;
+    }
+
+    wd = inotify_add_watch(cache->inotifyFd, cpPath, LIST_CACHE_WATCH_MASK);
+    if (wd == -1)
+        return NULL;
+
+    // Another path to the same directory already owns this watch
+    if (list_cache_find_watch(cache, wd))
+        return NULL;
+
+    if (HyperMemAlloc((void**)&entry, sizeof(LIST_ENTRY)) != HYPER_SUCCESS)
+    {
+        inotify_rm_watch(cache->inotifyFd, wd);
+        return NULL;
+    }
+    memset(entry, 0, sizeof(LIST_ENTRY));
+
+    entry->cpPath = strdup(cpPath);
+    if (entry->cpPath == NULL)
+    {
+        inotify_rm_watch(cache->inotifyFd, wd);
+        HyperMemFree(entry);
+        return NULL;
+    }
+
+    entry->ullHash = ullHash;
+    entry->wd = wd;
+    entry->bLinked = 1;
+    entry->uiRefs = 1;              /* Held by the capturing LIST until list_cache_finish */
+
+    entry->pathNext = cache->pathBuckets[ullHash & (LIST_CACHE_BUCKETS - 1)];
+    cache->pathBuckets[ullHash & (LIST_CACHE_BUCKETS - 1)] = entry;
+    entry->watchNext = cache->watchBuckets[wd & (LIST_CACHE_BUCKETS - 1)];
+    cache->watchBuckets[wd & (LIST_CACHE_BUCKETS - 1)] = entry;
+    lru_push(&cache->lru, &entry->lru);
+    STAT_ADD(cache->stats.stEntries, 1);
+
+    return entry;
+}
+
+void
+list_cache_append(
+    PLIST_CACHE         cache,
+    PLIST_ENTRY         entry,
+    const char          *cpData,
+    size_t              stLength)
+{
+    size_t stCapacity = entry->stCapacity;
+
+    if (entry->bStale || !entry->bLinked || stLength == 0)
+        return;
+
+    // Too big to be worth keeping, let the LIST finish uncached
+    if (entry->stLength + stLength > cache->stBudget / LIST_CACHE_MAX_ENTRY_SHARE)
+    {
+        entry->bStale = 1;
+        return;
+    }
+
+    if (entry->stLength + stLength > stCapacity)
+    {
+        stCapacity = stCapacity ? stCapacity * 2 : 4096;
+        while (stCapacity < entry->stLength + stLength)
+            stCapacity *= 2;
+
+        if (HyperMemRealloc((void**)&entry->cpData, stCapacity) != HYPER_SUCCESS)
+        {
+            entry->bStale = 1;
+            return;
+        }
+
+        STAT_ADD(cache->stats.stBytes, stCapacity - entry->stCapacity);
+        entry->stCapacity = stCapacity;
+    }
+
+    memcpy(entry->cpData + entry->stLength, cpData, stLength);
+    entry->stLength += stLength;
+}
+
+void
+list_cache_finish(
+    PLIST_CACHE         cache,
+    PLIST_ENTRY         entry,
+    int                 bComplete)
+{
+    // Evicted while we were still capturing it
+    if (!entry->bLinked)
+    {
+        list_cache_release(entry);
+        return;
+    }
+
+    if (!bComplete || entry->bStale)
+    {
+        list_cache_remove(cache, entry);
+        list_cache_release(entry);
+        return;
+    }
+
+    entry->bComplete = 1;
+    list_cache_release(entry);
+
+    while (cache->stats.stBytes > cache->stBudget && cache->lru.tail && cache->lru.tail != &entry->lru)
+    {
+        list_cache_remove(cache, (PLIST_ENTRY)cache->lru.tail);
+        STAT_ADD(cache->stats.ullEvictions, 1);
+    }
+}
+
+static void
+list_cache_invalidate(
+    PLIST_CACHE         cache,
+    int                 wd)
+{
+    PLIST_ENTRY entry = list_cache_find_watch(cache, wd);
+
+    if (entry == NULL)
+        return;
+
+    STAT_ADD(cache->stats.ullInvalidations, 1);
+
+    // A capture in flight can't be trusted any more, but it still owns its state
+    if (!entry->bComplete)
+    {
+        entry->bStale = 1;
+        return;
+    }
+
+    list_cache_remove(cache, entry);
+}
+
+void
+list_cache_handle_events(
+    PLIST_CACHE         cache)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event = NULL;
+    ssize_t sBytesRead = 0;
+    PLIST_ENTRY entry = NULL;
+    PLIST_ENTRY next = NULL;
+
+    while (1)
+    {
+        sBytesRead = read(cache->inotifyFd, buffer, sizeof(buffer));
+        if (sBytesRead <= 0)
+        {
+            if (sBytesRead == -1 && errno == EINTR)
+                continue;
+            return;
+        }
+
+        for (char *cpEvent = buffer; cpEvent < buffer + sBytesRead;
+             cpEvent += sizeof(struct inotify_event) + event->len)
+        {
+            event = (const struct inotify_event*)cpEvent;
+
+            // Lost events, so nothing cached can be trusted
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                for (entry = (PLIST_ENTRY)cache->lru.head; entry; entry = next)
+                {
+                    next = (PLIST_ENTRY)entry->lru.next;
+                    list_cache_invalidate(cache, entry->wd);
+                }
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED)
+                continue;
+
+            list_cache_invalidate(cache, event->wd);
+        }
+    }
+}
+
+void
+list_cache_retain(
+    PLIST_ENTRY         entry)
+{
+    entry->uiRefs++;
+}
+
+void
+list_cache_release(
+    void                *lpEntry)
+{
+    PLIST_ENTRY entry = (PLIST_ENTRY)lpEntry;
+
+    entry->uiRefs--;
+    if (entry->uiRefs == 0 && !entry->bLinked)
+        list_cache_free_entry(entry);
+}
+
+void
+list_cache_get_stats(
+    PLIST_CACHE         cache,
+    PLIST_CACHE_STATS   stats)
+{
+    // Called from other workers too, see STAT_READ
+    stats->ullHits = STAT_READ(cache->stats.ullHits);
+    stats->ullMisses = STAT_READ(cache->stats.ullMisses);
+    stats->ullInvalidations = STAT_READ(cache->stats.ullInvalidations);
+    stats->ullEvictions = STAT_READ(cache->stats.ullEvictions);
+    stats->stEntries = STAT_READ(cache->stats.stEntries);
+    stats->stBytes = STAT_READ(cache->stats.stBytes);
+}
@@ -0,0 +1,53 @@
+#include "lru.h"
+
+// FNV-1a, keys are short paths and this is far cheaper than the stat() we do anyway
+uint64_t
+lru_key_hash(
+    const char          *cpKey)
+{
+    uint64_t ullHash = 0xcbf29ce484222325ULL;
+
+    while (*cpKey)
+    {
+        ullHash ^= (unsigned char)*cpKey++;
+        ullHash *= 0x100000001b3ULL;
+    }
+
+    return ullHash;
+}
+
+void
+lru_unlink(
+    PLRU_LIST           list,
+    PLRU_NODE           node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        list->head = node->next;
+
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        list->tail = node->prev;
+
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+// Make node the most recently used
+void
+lru_push(
+    PLRU_LIST           list,
+    PLRU_NODE           node)
+{
+    node->prev = NULL;
+    node->next = list->head;
+
+    if (list->head)
+        list->head->prev = node;
+    else
+        list->tail = node;
+
+    list->head = node;
+}
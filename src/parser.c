@@ -0,0 +1,85 @@
+#include "parser.h"
+
+// Split cpInput on spaces in place, argv gets stMaxArgs slots plus a NULL
+size_t
+parse_args(
+    char                *cpInput,
+    char                **argv,
+    size_t              stMaxArgs)
+{
+    size_t argc = 0;
+    char *cpCursor = cpInput;
+
+    while (*cpCursor && argc < stMaxArgs)
+    {
+        while (*cpCursor == ' ')
+            cpCursor++;
+
+        if (*cpCursor == 0)
+            break;
+
+        argv[argc++] = cpCursor;
+
+        while (*cpCursor && *cpCursor != ' ')
+            cpCursor++;
+
+        if (*cpCursor)
+            *cpCursor++ = 0;
+    }
+
+    argv[argc] = NULL;
+    return argc;
+}
+
+// Get arguments from input, separated by delimiter
+char** 
+GetArgs(
+    char                *a_str, 
+    char                a_delim, 
+    size_t              *count
+)
+{
+	char** result = 0;
+	char* tmp = a_str;
+	char* last_comma = 0;
+	char delim[2] = {a_delim, 0};
+
+	// Count how many elements will be extracted.
+	while (*tmp)
+	{
+		if (a_delim == *tmp)
+		{
+			(*count)++;
+			last_comma = tmp;
+		}
+		tmp++;
+	}
+
+	// Add space for trailing token.
+	*count += last_comma < (a_str + strlen(a_str) - 1);
+
+	// Add space for terminating null string so caller
+	// knows where the list of returned strings ends. 
+	(*count)++;
+
+	result = realloc(result, sizeof(char*) * (*count));
+
+	if (result)
+	{
+		size_t idx = 0;
+		char* token = strtok(a_str, delim);
+
+		while (token)
+		{
+			*(result + idx++) = strdup(token);
+			token = strtok(0, delim);
+		}
+		*(result + idx) = 0;
+        
+        // Decrement count so count is accurate to array size
+	    (*count)--;
+	}
+	
+    return result;
+}
+
@@ -0,0 +1,171 @@
+#include "ring_buffer.h"
+
+HYPERSTATUS
+ring_init(
+    PRING_BUFFER        ring,
+    size_t              stCapacity)
+{
+    memset(ring, 0, sizeof(RING_BUFFER));
+
+    // Indices are masked, so the capacity has to be a power of two
+    if (stCapacity == 0 || (stCapacity & (stCapacity - 1)) != 0)
+        return HYPER_BAD_PARAMETER;
+
+    if (HyperMemAlloc((void**)&ring->cpData, stCapacity) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    ring->stCapacity = stCapacity;
+
+    return HYPER_SUCCESS;
+}
+
+void
+ring_free(
+    PRING_BUFFER        ring)
+{
+    HyperMemFree(ring->cpData);
+    memset(ring, 0, sizeof(RING_BUFFER));
+}
+
+size_t
+ring_used(
+    const RING_BUFFER   *ring)
+{
+    return ring->stTail - ring->stHead;
+}
+
+size_t
+ring_space(
+    const RING_BUFFER   *ring)
+{
+    return ring->stCapacity - ring_used(ring);
+}
+
+// Describe the free space as at most two iovecs, for a single readv()
+int
+ring_write_vectors(
+    PRING_BUFFER        ring,
+    struct iovec        *iov)
+{
+    size_t stSpace = ring_space(ring);
+    size_t stStart = ring->stTail & (ring->stCapacity - 1);
+    size_t stFirst = ring->stCapacity - stStart;
+
+    if (stSpace == 0)
+        return 0;
+
+    if (stFirst >= stSpace)
+    {
+        iov[0].iov_base = ring->cpData + stStart;
+        iov[0].iov_len = stSpace;
+        return 1;
+    }
+
+    iov[0].iov_base = ring->cpData + stStart;
+    iov[0].iov_len = stFirst;
+    iov[1].iov_base = ring->cpData;
+    iov[1].iov_len = stSpace - stFirst;
+    return 2;
+}
+
+void
+ring_commit(
+    PRING_BUFFER        ring,
+    size_t              stLength)
+{
+    ring->stTail += stLength;
+}
+
+// Describe the first stLength buffered bytes in place, for writev-style consumers
+int
+ring_read_vectors(
+    const RING_BUFFER   *ring,
+    struct iovec        *iov,
+    size_t              stLength)
+{
+    size_t stStart = ring->stHead & (ring->stCapacity - 1);
+    size_t stFirst = ring->stCapacity - stStart;
+
+    if (stLength == 0)
+        return 0;
+
+    iov[0].iov_base = ring->cpData + stStart;
+
+    if (stFirst >= stLength)
+    {
+        iov[0].iov_len = stLength;
+        return 1;
+    }
+
+    iov[0].iov_len = stFirst;
+    iov[1].iov_base = ring->cpData;
+    iov[1].iov_len = stLength - stFirst;
+    return 2;
+}
+
+// Copy the first stLength unread bytes out without consuming them
+void
+ring_peek(
+    const RING_BUFFER   *ring,
+    void                *lpBuffer,
+    size_t              stLength)
+{
+    size_t stStart = ring->stHead & (ring->stCapacity - 1);
+    size_t stFirst = ring->stCapacity - stStart;
+
+    if (stFirst >= stLength)
+    {
+        memcpy(lpBuffer, ring->cpData + stStart, stLength);
+        return;
+    }
+
+    memcpy(lpBuffer, ring->cpData + stStart, stFirst);
+    memcpy((char*)lpBuffer + stFirst, ring->cpData, stLength - stFirst);
+}
+
+void
+ring_consume(
+    PRING_BUFFER        ring,
+    size_t              stLength)
+{
+    ring->stHead += stLength;
+
+    // Restart at the front when empty so short commands rarely wrap
+    if (ring->stHead == ring->stTail)
+    {
+        ring->stHead = 0;
+        ring->stTail = 0;
+    }
+}
+
+// Find the first cDelimiter among the unread bytes, as an offset from the head
+int
+ring_find(
+    const RING_BUFFER   *ring,
+    char                cDelimiter,
+    size_t              *stIndex)
+{
+    size_t stUsed = ring_used(ring);
+    size_t stStart = ring->stHead & (ring->stCapacity - 1);
+    size_t stFirst = ring->stCapacity - stStart;
+    char *cpFound = NULL;
+
+    if (stFirst > stUsed)
+        stFirst = stUsed;
+
+    cpFound = memchr(ring->cpData + stStart, cDelimiter, stFirst);
+    if (cpFound)
+    {
+        *stIndex = cpFound - (ring->cpData + stStart);
+        return 1;
+    }
+
+    cpFound = memchr(ring->cpData, cDelimiter, stUsed - stFirst);
+    if (cpFound)
+    {
+        *stIndex = stFirst + (cpFound - ring->cpData);
+        return 1;
+    }
+
+    return 0;
+}
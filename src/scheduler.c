@@ -0,0 +1,259 @@
+#include "scheduler.h"
+
+static void
+bucket_init(
+    PTOKEN_BUCKET       bucket,
+    unsigned long long  ullRate,
+    unsigned long long  ullNow)
+{
+    bucket->ullRate = ullRate;
+    bucket->ullBurst = ullRate / 8;
+    if (bucket->ullBurst < SCHED_MIN_BURST)
+        bucket->ullBurst = SCHED_MIN_BURST;
+
+    // Start full, so the first response of a client is never held back
+    bucket->llTokens = (long long)bucket->ullBurst;
+    bucket->ullUpdated = ullNow;
+}
+
+static void
+bucket_refill(
+    PTOKEN_BUCKET       bucket,
+    unsigned long long  ullNow)
+{
+    unsigned long long ullTicks = ullNow - bucket->ullUpdated;
+    unsigned long long ullAdd = 0;
+
+    if (bucket->ullRate == 0 || ullNow <= bucket->ullUpdated)
+        return;
+
+    // Long idle just means full, and keeps the product below from overflowing
+    if (ullTicks > SCHED_TICKS_PER_SECOND * 60)
+        ullTicks = SCHED_TICKS_PER_SECOND * 60;
+
+    // Slow rates gain nothing in a tick, keep the time for the next refill
+    ullAdd = bucket->ullRate * ullTicks / SCHED_TICKS_PER_SECOND;
+    if (ullAdd == 0)
+        return;
+    if (ullAdd > bucket->ullBurst * 2)
+        ullAdd = bucket->ullBurst * 2;
+
+    bucket->llTokens += (long long)ullAdd;
+    if (bucket->llTokens > (long long)bucket->ullBurst)
+        bucket->llTokens = (long long)bucket->ullBurst;
+    bucket->ullUpdated = ullNow;
+}
+
+static size_t
+bucket_available(
+    const TOKEN_BUCKET  *bucket)
+{
+    if (bucket->ullRate == 0)
+        return SIZE_MAX;
+
+    return bucket->llTokens > 0 ? (size_t)bucket->llTokens : 0;
+}
+
+// Ticks until the bucket holds enough for a worthwhile send, or a tenth of a
+// second's worth at slow rates, which would otherwise stall past --write-timeout
+static unsigned long long
+bucket_wait(
+    const TOKEN_BUCKET  *bucket)
+{
+    long long llWant = SCHED_MIN_SEND;
+    unsigned long long ullShort = 0;
+
+    if (bucket->ullRate == 0)
+        return 0;
+
+    if (llWant > (long long)(bucket->ullRate / 10))
+        llWant = (long long)(bucket->ullRate / 10);
+    if (llWant < 1)
+        llWant = 1;
+
+    if (bucket->llTokens >= llWant)
+        return 0;
+
+    ullShort = (unsigned long long)(llWant - bucket->llTokens);
+
+    return (ullShort * SCHED_TICKS_PER_SECOND + bucket->ullRate - 1) / bucket->ullRate;
+}
+
+static void
+scheduler_throttle_expire(
+    PTIMER              timer)
+{
+    PSCHED_ENTRY entry = (PSCHED_ENTRY)timer->lpContext;
+
+    entry->resume(entry->lpContext);
+}
+
+void
+scheduler_init(
+    PSCHEDULER          sched,
+    PTIMER_WHEEL        wheel,
+    size_t              stQuantum,
+    unsigned long long  ullRate)
+{
+    memset(sched, 0, sizeof(SCHEDULER));
+    sched->wheel = wheel;
+    sched->stQuantum = stQuantum;
+    sched->ready.next = &sched->ready;
+    sched->ready.prev = &sched->ready;
+    bucket_init(&sched->bucket, ullRate, wheel->ullClock);
+}
+
+void
+scheduler_entry_init(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry,
+    unsigned long long  ullRate,
+    void                (*resume)(void *lpContext),
+    void                *lpContext)
+{
+    memset(entry, 0, sizeof(SCHED_ENTRY));
+    entry->resume = resume;
+    entry->lpContext = lpContext;
+    bucket_init(&entry->bucket, ullRate, sched->wheel->ullClock);
+    timer_init(&entry->throttle, scheduler_throttle_expire, entry);
+}
+
+// Queued for a turn or throttled, either way something else will resume it
+int
+scheduler_waiting(
+    const SCHED_ENTRY   *entry)
+{
+    return entry->bQueued || timer_pending(&entry->throttle);
+}
+
+/* Bytes the connection may send right now: what's left of its turn, capped by
+   its own tokens and its worker's. A connection that starts sending outside
+   its turn, because the socket drained or a request came in, starts a turn */
+size_t
+scheduler_budget(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry)
+{
+    size_t stBudget = SIZE_MAX;
+    size_t stTokens = 0;
+
+    if (scheduler_waiting(entry))
+        return 0;
+
+    if (sched->stQuantum)
+    {
+        if (entry->stDeficit == 0)
+            entry->stDeficit = sched->stQuantum;
+        stBudget = entry->stDeficit;
+    }
+
+    bucket_refill(&entry->bucket, sched->wheel->ullClock);
+    bucket_refill(&sched->bucket, sched->wheel->ullClock);
+
+    stTokens = bucket_available(&entry->bucket);
+    if (stTokens < stBudget)
+        stBudget = stTokens;
+
+    stTokens = bucket_available(&sched->bucket);
+    if (stTokens < stBudget)
+        stBudget = stTokens;
+
+    return stBudget;
+}
+
+void
+scheduler_charge(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry,
+    size_t              stBytes)
+{
+    if (sched->stQuantum)
+        entry->stDeficit = stBytes < entry->stDeficit ? entry->stDeficit - stBytes : 0;
+
+    if (entry->bucket.ullRate)
+        entry->bucket.llTokens -= (long long)stBytes;
+    if (sched->bucket.ullRate)
+        sched->bucket.llTokens -= (long long)stBytes;
+}
+
+/* Out of budget with output left. Out of turn goes to the back of the ready
+   queue, out of tokens sleeps on the wheel. Returns 1 for the latter */
+int
+scheduler_yield(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry)
+{
+    unsigned long long ullWait = 0;
+    unsigned long long ullGlobal = 0;
+
+    if (scheduler_waiting(entry))
+        return 0;
+
+    if (sched->stQuantum == 0 || entry->stDeficit)
+    {
+        ullWait = bucket_wait(&entry->bucket);
+        ullGlobal = bucket_wait(&sched->bucket);
+        if (ullGlobal > ullWait)
+            ullWait = ullGlobal;
+
+        if (ullWait)
+        {
+            timer_wheel_add(sched->wheel, &entry->throttle, sched->wheel->ullNow + ullWait);
+            return 1;
+        }
+    }
+
+    entry->prev = sched->ready.prev;
+    entry->next = &sched->ready;
+    sched->ready.prev->next = entry;
+    sched->ready.prev = entry;
+    entry->bQueued = 1;
+    sched->stReady++;
+
+    return 0;
+}
+
+// Nothing left to send, classic DRR forfeits the rest of the turn
+void
+scheduler_idle(
+    PSCHED_ENTRY        entry)
+{
+    entry->stDeficit = 0;
+}
+
+void
+scheduler_remove(
+    PSCHEDULER          sched,
+    PSCHED_ENTRY        entry)
+{
+    timer_wheel_remove(sched->wheel, &entry->throttle);
+
+    if (!entry->bQueued)
+        return;
+
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->bQueued = 0;
+    sched->stReady--;
+}
+
+/* One round: every connection queued when it starts gets one more quantum.
+   Those still not done queue up again behind anything that came in meanwhile */
+void
+scheduler_run(
+    PSCHEDULER          sched)
+{
+    PSCHED_ENTRY entry = NULL;
+    size_t stTurns = sched->stReady;
+
+    while (stTurns-- && sched->stReady)
+    {
+        entry = sched->ready.next;
+        scheduler_remove(sched, entry);
+
+        entry->stDeficit += sched->stQuantum;
+        entry->resume(entry->lpContext);
+    }
+}
@@ -0,0 +1,21 @@
+#include "server_config.h"
+
+SERVER_CONFIG serverConfig = {
+    .usPort = 0,
+    .uiWorkers = 1,
+    .stCacheSize = DEFAULT_CACHE_SIZE,
+    .stListCacheSize = DEFAULT_LIST_CACHE_SIZE,
+    .eBackend = BACKEND_EPOLL,
+    .stZerocopyMin = 0,
+    .stSendBuffer = 0,
+    .stReceiveBuffer = 0,
+    .uiIdleTimeout = DEFAULT_IDLE_TIMEOUT,
+    .uiReadTimeout = DEFAULT_READ_TIMEOUT,
+    .uiWriteTimeout = DEFAULT_WRITE_TIMEOUT,
+    .stQuantum = DEFAULT_SCHED_QUANTUM,
+    .ullRate = 0,
+    .ullClientRate = 0,
+    .cpRoot = {0},
+    .cpStatsFile = {0},
+    .cpStoreDir = {0}
+};
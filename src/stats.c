@@ -0,0 +1,435 @@
+#include "stats.h"
+#include "worker.h"
+#include "commands.h"
+
+/* Growable buffer the exposition text is formatted into */
+typedef struct _STATS_TEXT
+{
+    char                *cpData;
+    size_t              stLength;
+    size_t              stCapacity;
+    int                 bFailed;
+} STATS_TEXT, * PSTATS_TEXT;
+
+/* Background writer for --stats-file */
+static pthread_t dumpThread;
+static pthread_mutex_t dumpLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dumpWake = PTHREAD_COND_INITIALIZER;
+static int bDumpRunning = 0;
+static int bDumpStop = 0;
+static char cpDumpPath[SERVER_MAX_PATH];
+
+unsigned long long
+stats_now(void)
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Smallest bucket whose bound, 2^i microseconds, covers the latency
+static unsigned int
+stats_bucket(
+    unsigned long long  ullNanoseconds)
+{
+    unsigned long long ullMicroseconds = (ullNanoseconds + 999) / 1000;
+    unsigned int uiBucket = 0;
+
+    if (ullMicroseconds > 1)
+        uiBucket = 64 - __builtin_clzll(ullMicroseconds - 1);
+
+    return uiBucket < STATS_LATENCY_BUCKETS ? uiBucket : STATS_LATENCY_BUCKETS;
+}
+
+void
+stats_record_command(
+    PWORKER_STATS       stats,
+    unsigned int        uiCommand,
+    unsigned long long  ullNanoseconds)
+{
+    PCOMMAND_STATS command = &stats->commands[uiCommand];
+
+    STAT_ADD(command->ullCount, 1);
+    STAT_ADD(command->ullNanoseconds, ullNanoseconds);
+    STAT_ADD(command->ullBuckets[stats_bucket(ullNanoseconds)], 1);
+}
+
+void
+stats_record_status(
+    PWORKER_STATS       stats,
+    unsigned short      usStatus)
+{
+    if (usStatus < STATS_MAX_STATUS)
+        STAT_ADD(stats->ullStatus[usStatus], 1);
+}
+
+static void
+stats_printf(
+    PSTATS_TEXT         text,
+    const char          *cpFormat,
+    ...)
+{
+    va_list args;
+    int iLength = 0;
+    size_t stCapacity = 0;
+
+    if (text->bFailed)
+        return;
+
+    while (1)
+    {
+        va_start(args, cpFormat);
+        iLength = vsnprintf(text->cpData + text->stLength, text->stCapacity - text->stLength, cpFormat, args);
+        va_end(args);
+
+        if (iLength < 0)
+        {
+            text->bFailed = 1;
+            return;
+        }
+
+        if ((size_t)iLength < text->stCapacity - text->stLength)
+            break;
+
+        stCapacity = text->stCapacity * 2;
+        if (HyperMemRealloc((void**)&text->cpData, stCapacity) != HYPER_SUCCESS)
+        {
+            text->bFailed = 1;
+            return;
+        }
+        text->stCapacity = stCapacity;
+    }
+
+    text->stLength += iLength;
+}
+
+static void
+stats_counter(
+    PSTATS_TEXT         text,
+    const char          *cpName,
+    const char          *cpType,
+    const char          *cpHelp,
+    unsigned long long  ullValue)
+{
+    stats_printf(text, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+            cpName, cpHelp, cpName, cpType, cpName, ullValue);
+}
+
+// Sum every worker into one set of counters
+static void
+stats_collect(
+    PWORKER_STATS       total,
+    PFILE_CACHE_STATS   fileTotal,
+    PLIST_CACHE_STATS   listTotal,
+    PDIGEST_CACHE_STATS digestTotal,
+    unsigned int        *uiWorkers)
+{
+    PWORKER workers = worker_pool_get(uiWorkers);
+    PWORKER_STATS stats = NULL;
+    FILE_CACHE_STATS fileStats = {0};
+    LIST_CACHE_STATS listStats = {0};
+    DIGEST_CACHE_STATS digestStats = {0};
+
+    for (unsigned int i = 0; i < *uiWorkers; i++)
+    {
+        stats = &workers[i].stats;
+
+        total->ullAccepted += STAT_READ(stats->ullAccepted);
+        total->ullClosed += STAT_READ(stats->ullClosed);
+        total->ullBytesReceived += STAT_READ(stats->ullBytesReceived);
+        total->ullBytesSent += STAT_READ(stats->ullBytesSent);
+        total->ullSendCalls += STAT_READ(stats->ullSendCalls);
+        total->ullZerocopySends += STAT_READ(stats->ullZerocopySends);
+        total->ullZerocopyCopied += STAT_READ(stats->ullZerocopyCopied);
+        total->ullIdleTimeouts += STAT_READ(stats->ullIdleTimeouts);
+        total->ullReadTimeouts += STAT_READ(stats->ullReadTimeouts);
+        total->ullWriteTimeouts += STAT_READ(stats->ullWriteTimeouts);
+        total->ullSchedYields += STAT_READ(stats->ullSchedYields);
+        total->ullThrottled += STAT_READ(stats->ullThrottled);
+        total->ullUnknownCommands += STAT_READ(stats->ullUnknownCommands);
+
+        for (unsigned int uiStatus = 0; uiStatus < STATS_MAX_STATUS; uiStatus++)
+            total->ullStatus[uiStatus] += STAT_READ(stats->ullStatus[uiStatus]);
+
+        for (unsigned int uiCommand = 0; uiCommand < numCommands; uiCommand++)
+        {
+            total->commands[uiCommand].ullCount += STAT_READ(stats->commands[uiCommand].ullCount);
+            total->commands[uiCommand].ullNanoseconds += STAT_READ(stats->commands[uiCommand].ullNanoseconds);
+            for (unsigned int uiBucket = 0; uiBucket <= STATS_LATENCY_BUCKETS; uiBucket++)
+                total->commands[uiCommand].ullBuckets[uiBucket] += STAT_READ(stats->commands[uiCommand].ullBuckets[uiBucket]);
+        }
+
+        file_cache_get_stats(&workers[i].fileCache, &fileStats);
+        fileTotal->ullHits += fileStats.ullHits;
+        fileTotal->ullMisses += fileStats.ullMisses;
+        fileTotal->ullEvictions += fileStats.ullEvictions;
+        fileTotal->stEntries += fileStats.stEntries;
+        fileTotal->stBytes += fileStats.stBytes;
+
+        list_cache_get_stats(&workers[i].listCache, &listStats);
+        listTotal->ullHits += listStats.ullHits;
+        listTotal->ullMisses += listStats.ullMisses;
+        listTotal->ullInvalidations += listStats.ullInvalidations;
+        listTotal->ullEvictions += listStats.ullEvictions;
+        listTotal->stEntries += listStats.stEntries;
+        listTotal->stBytes += listStats.stBytes;
+
+        digest_cache_get_stats(&workers[i].digestCache, &digestStats);
+        digestTotal->ullHits += digestStats.ullHits;
+        digestTotal->ullMisses += digestStats.ullMisses;
+    }
+}
+
+static void
+stats_format_commands(
+    PSTATS_TEXT         text,
+    PWORKER_STATS       total)
+{
+    PCOMMAND_STATS command = NULL;
+    unsigned long long ullCumulative = 0;
+
+    stats_printf(text, "# HELP hyper_command_duration_seconds Time spent in each command handler.\n"
+                       "# TYPE hyper_command_duration_seconds histogram\n");
+
+    for (unsigned int uiCommand = 0; uiCommand < numCommands; uiCommand++)
+    {
+        command = &total->commands[uiCommand];
+        ullCumulative = 0;
+
+        // Prometheus buckets are cumulative, ours are not
+        for (unsigned int uiBucket = 0; uiBucket < STATS_LATENCY_BUCKETS; uiBucket++)
+        {
+            ullCumulative += command->ullBuckets[uiBucket];
+            stats_printf(text, "hyper_command_duration_seconds_bucket{command=\"%s\",le=\"%g\"} %llu\n",
+                    command_list[uiCommand].command, (double)(1ULL << uiBucket) / 1e6, ullCumulative);
+        }
+
+        stats_printf(text, "hyper_command_duration_seconds_bucket{command=\"%s\",le=\"+Inf\"} %llu\n"
+                           "hyper_command_duration_seconds_sum{command=\"%s\"} %.9f\n"
+                           "hyper_command_duration_seconds_count{command=\"%s\"} %llu\n",
+                command_list[uiCommand].command, command->ullCount,
+                command_list[uiCommand].command, command->ullNanoseconds / 1e9,
+                command_list[uiCommand].command, command->ullCount);
+    }
+}
+
+// Prometheus text exposition of every worker's counters added together
+HYPERSTATUS
+stats_format(
+    char                **cpText,
+    size_t              *stLength)
+{
+    STATS_TEXT text = {0};
+    FILE_CACHE_STATS fileTotal = {0};
+    LIST_CACHE_STATS listTotal = {0};
+    DIGEST_CACHE_STATS digestTotal = {0};
+    CHUNK_STORE_STATS storeStats = {0};
+    PWORKER_STATS total = NULL;
+    unsigned int uiWorkers = 0;
+
+    // Too big to want on a worker's stack
+    if (HyperMemAlloc((void**)&total, sizeof(WORKER_STATS)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    memset(total, 0, sizeof(WORKER_STATS));
+
+    text.stCapacity = 16384;
+    if (HyperMemAlloc((void**)&text.cpData, text.stCapacity) != HYPER_SUCCESS)
+    {
+        HyperMemFree(total);
+        return HYPER_FAILED;
+    }
+
+    stats_collect(total, &fileTotal, &listTotal, &digestTotal, &uiWorkers);
+
+    stats_counter(&text, "hyper_workers", "gauge", "Worker threads serving connections.", uiWorkers);
+    stats_counter(&text, "hyper_connections_accepted_total", "counter", "Connections accepted.", total->ullAccepted);
+    stats_counter(&text, "hyper_connections_open", "gauge", "Connections currently open.",
+            total->ullAccepted - total->ullClosed);
+    stats_printf(&text, "# HELP hyper_connection_timeouts_total Connections closed by a deadline, by kind.\n"
+                        "# TYPE hyper_connection_timeouts_total counter\n"
+                        "hyper_connection_timeouts_total{kind=\"idle\"} %llu\n"
+                        "hyper_connection_timeouts_total{kind=\"read\"} %llu\n"
+                        "hyper_connection_timeouts_total{kind=\"write\"} %llu\n",
+            total->ullIdleTimeouts, total->ullReadTimeouts, total->ullWriteTimeouts);
+    stats_counter(&text, "hyper_sched_yields_total", "counter",
+            "Times a connection used up its turn and let others send first.", total->ullSchedYields);
+    stats_counter(&text, "hyper_throttled_total", "counter",
+            "Times a connection waited for rate limit tokens.", total->ullThrottled);
+    stats_counter(&text, "hyper_received_bytes_total", "counter", "Bytes read from clients.", total->ullBytesReceived);
+    stats_counter(&text, "hyper_sent_bytes_total", "counter", "Bytes written to clients.", total->ullBytesSent);
+    stats_counter(&text, "hyper_send_calls_total", "counter", "System calls that wrote to a client socket.",
+            total->ullSendCalls);
+    stats_counter(&text, "hyper_zerocopy_sends_total", "counter", "Sends made with MSG_ZEROCOPY.",
+            total->ullZerocopySends);
+    stats_counter(&text, "hyper_zerocopy_copied_total", "counter", "Zerocopy sends the kernel copied anyway.",
+            total->ullZerocopyCopied);
+    stats_counter(&text, "hyper_unknown_commands_total", "counter", "Commands that matched no handler.",
+            total->ullUnknownCommands);
+
+    stats_printf(&text, "# HELP hyper_responses_total Responses sent, by status code.\n"
+                        "# TYPE hyper_responses_total counter\n");
+    for (unsigned int uiStatus = 0; uiStatus < STATS_MAX_STATUS; uiStatus++)
+    {
+        if (total->ullStatus[uiStatus])
+            stats_printf(&text, "hyper_responses_total{status=\"%u\"} %llu\n", uiStatus, total->ullStatus[uiStatus]);
+    }
+
+    stats_format_commands(&text, total);
+
+    stats_counter(&text, "hyper_file_cache_hits_total", "counter", "SEND requests served from the file cache.",
+            fileTotal.ullHits);
+    stats_counter(&text, "hyper_file_cache_misses_total", "counter", "SEND requests that missed the file cache.",
+            fileTotal.ullMisses);
+    stats_counter(&text, "hyper_file_cache_evictions_total", "counter", "Files evicted from the file cache.",
+            fileTotal.ullEvictions);
+    stats_counter(&text, "hyper_file_cache_entries", "gauge", "Files in the file cache.", fileTotal.stEntries);
+    stats_counter(&text, "hyper_file_cache_bytes", "gauge", "Bytes held by the file cache.", fileTotal.stBytes);
+
+    stats_counter(&text, "hyper_list_cache_hits_total", "counter", "LIST requests served from the listing cache.",
+            listTotal.ullHits);
+    stats_counter(&text, "hyper_list_cache_misses_total", "counter", "LIST requests that missed the listing cache.",
+            listTotal.ullMisses);
+    stats_counter(&text, "hyper_list_cache_invalidations_total", "counter", "Listings dropped after a directory changed.",
+            listTotal.ullInvalidations);
+    stats_counter(&text, "hyper_list_cache_evictions_total", "counter", "Listings evicted from the listing cache.",
+            listTotal.ullEvictions);
+    stats_counter(&text, "hyper_list_cache_entries", "gauge", "Listings in the listing cache.", listTotal.stEntries);
+    stats_counter(&text, "hyper_list_cache_bytes", "gauge", "Bytes held by the listing cache.", listTotal.stBytes);
+
+    stats_counter(&text, "hyper_digest_cache_hits_total", "counter", "Checksums served without reading the file.",
+            digestTotal.ullHits);
+    stats_counter(&text, "hyper_digest_cache_misses_total", "counter", "Checksums that had to read the file.",
+            digestTotal.ullMisses);
+
+    if (chunkStore.bEnabled)
+    {
+        chunk_store_get_stats(&storeStats);
+        stats_counter(&text, "hyper_store_chunks", "gauge", "Unique chunks in the chunk store.", storeStats.ullChunks);
+        stats_counter(&text, "hyper_store_bytes", "gauge", "Bytes of unique chunk data in the packs.",
+                storeStats.ullStoredBytes);
+        stats_counter(&text, "hyper_store_ingested_bytes_total", "counter",
+                "File bytes split into chunks, duplicates included.", storeStats.ullIngestedBytes);
+    }
+
+    HyperMemFree(total);
+
+    if (text.bFailed)
+    {
+        HyperMemFree(text.cpData);
+        return HYPER_FAILED;
+    }
+
+    *cpText = text.cpData;
+    *stLength = text.stLength;
+
+    return HYPER_SUCCESS;
+}
+
+void
+stats_free(
+    void                *lpText)
+{
+    HyperMemFree(lpText);
+}
+
+// Write to a temp file and rename it, so scrapers never see half a dump
+static HYPERSTATUS
+stats_dump(
+    const char          *cpPath)
+{
+    char cpTempPath[SERVER_MAX_PATH + 8];
+    char *cpText = NULL;
+    size_t stLength = 0;
+    FILE *file = NULL;
+    int bWritten = 0;
+
+    if (stats_format(&cpText, &stLength) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    snprintf(cpTempPath, sizeof(cpTempPath), "%s.tmp", cpPath);
+
+    file = fopen(cpTempPath, "w");
+    if (file)
+    {
+        bWritten = fwrite(cpText, 1, stLength, file) == stLength;
+        bWritten = (fclose(file) == 0) && bWritten;
+    }
+
+    stats_free(cpText);
+
+    if (!bWritten || rename(cpTempPath, cpPath) == -1)
+    {
+        unlink(cpTempPath);
+        return HYPER_FAILED;
+    }
+
+    return HYPER_SUCCESS;
+}
+
+static void*
+stats_dump_main(
+    void                *lpParam)
+{
+    struct timespec tsWake = {0};
+    int bFailing = 0;
+
+    pthread_mutex_lock(&dumpLock);
+    while (!bDumpStop)
+    {
+        pthread_mutex_unlock(&dumpLock);
+
+        // Complain once, not every interval
+        if (stats_dump(cpDumpPath) != HYPER_SUCCESS)
+        {
+            if (!bFailing)
+                printf("[-] Couldn't write stats to %s: %s\n", cpDumpPath, strerror(errno));
+            bFailing = 1;
+        }
+        else
+            bFailing = 0;
+
+        clock_gettime(CLOCK_REALTIME, &tsWake);
+        tsWake.tv_sec += STATS_DUMP_INTERVAL;
+
+        pthread_mutex_lock(&dumpLock);
+        while (!bDumpStop && pthread_cond_timedwait(&dumpWake, &dumpLock, &tsWake) == 0)
+            ;
+    }
+    pthread_mutex_unlock(&dumpLock);
+
+    // One last dump so the file reflects the final counters
+    stats_dump(cpDumpPath);
+
+    return NULL;
+}
+
+// Rewrite cpPath every STATS_DUMP_INTERVAL seconds until stats_dump_stop
+HYPERSTATUS
+stats_dump_start(
+    const char          *cpPath)
+{
+    strncpy(cpDumpPath, cpPath, sizeof(cpDumpPath) - 1);
+    bDumpStop = 0;
+
+    if (pthread_create(&dumpThread, NULL, stats_dump_main, NULL) != 0)
+        return HYPER_FAILED;
+
+    bDumpRunning = 1;
+    return HYPER_SUCCESS;
+}
+
+void
+stats_dump_stop(void)
+{
+    if (!bDumpRunning)
+        return;
+
+    pthread_mutex_lock(&dumpLock);
+    bDumpStop = 1;
+    pthread_cond_signal(&dumpWake);
+    pthread_mutex_unlock(&dumpLock);
+
+    pthread_join(dumpThread, NULL);
+    bDumpRunning = 0;
+}
@@ -0,0 +1,246 @@
+#include "timer_wheel.h"
+
+static unsigned long long
+timer_now_ms(void)
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void
+timer_list_init(
+    PTIMER              head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void
+timer_list_append(
+    PTIMER              head,
+    PTIMER              timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+// Move every timer of src onto the end of dst, leaving src empty
+static void
+timer_list_splice(
+    PTIMER              dst,
+    PTIMER              src)
+{
+    if (src->next == src)
+        return;
+
+    src->next->prev = dst->prev;
+    src->prev->next = dst;
+    dst->prev->next = src->next;
+    dst->prev = src->prev;
+    timer_list_init(src);
+}
+
+void
+timer_wheel_init(
+    PTIMER_WHEEL        wheel)
+{
+    memset(wheel, 0, sizeof(TIMER_WHEEL));
+    wheel->ullStartMs = timer_now_ms();
+
+    for (unsigned int uiLevel = 0; uiLevel < TIMER_LEVELS; uiLevel++)
+    {
+        for (unsigned int uiSlot = 0; uiSlot < TIMER_LEVEL_SLOTS; uiSlot++)
+            timer_list_init(&wheel->slots[uiLevel][uiSlot]);
+    }
+}
+
+void
+timer_init(
+    PTIMER              timer,
+    void                (*expire)(PTIMER timer),
+    void                *lpContext)
+{
+    memset(timer, 0, sizeof(TIMER));
+    timer->expire = expire;
+    timer->lpContext = lpContext;
+}
+
+int
+timer_pending(
+    const TIMER         *timer)
+{
+    return timer->next != NULL;
+}
+
+// File a timer by how far away it is, the lowest level whose span covers it
+static void
+timer_wheel_link(
+    PTIMER_WHEEL        wheel,
+    PTIMER              timer)
+{
+    unsigned long long ullDelta = timer->ullExpires - wheel->ullNow;
+    unsigned int uiLevel = 0;
+    unsigned int uiSlot = 0;
+
+    while (uiLevel < TIMER_LEVELS - 1 && ullDelta >= (1ULL << (TIMER_LEVEL_BITS * (uiLevel + 1))))
+        uiLevel++;
+
+    uiSlot = (unsigned int)(timer->ullExpires >> (TIMER_LEVEL_BITS * uiLevel)) & (TIMER_LEVEL_SLOTS - 1);
+    timer_list_append(&wheel->slots[uiLevel][uiSlot], timer);
+}
+
+void
+timer_wheel_add(
+    PTIMER_WHEEL        wheel,
+    PTIMER              timer,
+    unsigned long long  ullExpires)
+{
+    if (timer_pending(timer))
+        timer_wheel_remove(wheel, timer);
+
+    // The current tick's slot has already fired, so overdue means next tick
+    if (ullExpires <= wheel->ullNow)
+        ullExpires = wheel->ullNow + 1;
+    else if (ullExpires - wheel->ullNow > TIMER_MAX_TICKS)
+        ullExpires = wheel->ullNow + TIMER_MAX_TICKS;
+
+    timer->ullExpires = ullExpires;
+    timer_wheel_link(wheel, timer);
+    wheel->stTimers++;
+}
+
+void
+timer_wheel_remove(
+    PTIMER_WHEEL        wheel,
+    PTIMER              timer)
+{
+    if (!timer_pending(timer))
+        return;
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    wheel->stTimers--;
+}
+
+// Levels whose slot boundary is this tick hand their timers down, top first
+static void
+timer_wheel_cascade(
+    PTIMER_WHEEL        wheel)
+{
+    TIMER list;
+    PTIMER timer = NULL;
+    unsigned int uiLevel = 1;
+    unsigned int uiSlot = 0;
+
+    while (uiLevel < TIMER_LEVELS &&
+           (wheel->ullNow & ((1ULL << (TIMER_LEVEL_BITS * uiLevel)) - 1)) == 0)
+        uiLevel++;
+
+    while (--uiLevel > 0)
+    {
+        uiSlot = (unsigned int)(wheel->ullNow >> (TIMER_LEVEL_BITS * uiLevel)) & (TIMER_LEVEL_SLOTS - 1);
+
+        timer_list_init(&list);
+        timer_list_splice(&list, &wheel->slots[uiLevel][uiSlot]);
+
+        while ((timer = list.next) != &list)
+        {
+            list.next = timer->next;
+            timer->next->prev = &list;
+            timer_wheel_link(wheel, timer);
+        }
+    }
+}
+
+// Read the clock once per wakeup, a loop may have slept for a long while
+void
+timer_wheel_update(
+    PTIMER_WHEEL        wheel)
+{
+    wheel->ullClock = (timer_now_ms() - wheel->ullStartMs) / TIMER_TICK_MS;
+}
+
+// Catch up with the clock and run every timer that came due on the way
+void
+timer_wheel_advance(
+    PTIMER_WHEEL        wheel)
+{
+    TIMER expired;
+    PTIMER timer = NULL;
+
+    timer_wheel_update(wheel);
+
+    if (wheel->stTimers == 0)
+    {
+        wheel->ullNow = wheel->ullClock;
+        return;
+    }
+
+    timer_list_init(&expired);
+
+    while (wheel->ullNow < wheel->ullClock)
+    {
+        wheel->ullNow++;
+        timer_wheel_cascade(wheel);
+        timer_list_splice(&expired, &wheel->slots[0][wheel->ullNow & (TIMER_LEVEL_SLOTS - 1)]);
+    }
+
+    // Detached before the callback, which may well schedule it again
+    while ((timer = expired.next) != &expired)
+    {
+        expired.next = timer->next;
+        timer->next->prev = &expired;
+        timer->next = NULL;
+        timer->prev = NULL;
+        wheel->stTimers--;
+
+        timer->expire(timer);
+    }
+}
+
+// Next tick the wheel has work on, 0 with nothing scheduled
+unsigned long long
+timer_wheel_next(
+    const TIMER_WHEEL   *wheel)
+{
+    unsigned long long ullTick = wheel->ullNow + 1;
+    const TIMER *head = NULL;
+
+    if (wheel->stTimers == 0)
+        return 0;
+
+    // First busy slot this rotation, otherwise the next cascade
+    while ((ullTick & (TIMER_LEVEL_SLOTS - 1)) != 0)
+    {
+        head = &wheel->slots[0][ullTick & (TIMER_LEVEL_SLOTS - 1)];
+        if (head->next != head)
+            break;
+        ullTick++;
+    }
+
+    return ullTick;
+}
+
+// Milliseconds until the wheel next needs to advance, -1 with nothing scheduled
+int
+timer_wheel_timeout(
+    const TIMER_WHEEL   *wheel)
+{
+    unsigned long long ullTick = timer_wheel_next(wheel);
+    unsigned long long ullNowMs = 0;
+    unsigned long long ullWakeMs = 0;
+
+    if (ullTick == 0)
+        return -1;
+
+    ullNowMs = timer_now_ms();
+    ullWakeMs = wheel->ullStartMs + ullTick * TIMER_TICK_MS;
+
+    return ullWakeMs > ullNowMs ? (int)(ullWakeMs - ullNowMs) : 0;
+}
@@ -0,0 +1,368 @@
+#include "upload.h"
+
+static unsigned short
+upload_error_status(
+    int                 iError)
+{
+    return (iError == ENOSPC || iError == EDQUOT) ? 507 : 500;
+}
+
+// Stop writing but keep reading, the body still has to be drained to stay in sync
+static void
+upload_fail(
+    PUPLOAD             upload,
+    unsigned short      usStatus)
+{
+    if (upload->fd != -1)
+    {
+        close(upload->fd);
+        unlink(upload->cpTempPath);
+        upload->fd = -1;
+    }
+
+    if (upload->usStatus == 200)
+        upload->usStatus = usStatus;
+}
+
+static void
+upload_free(
+    PUPLOAD             upload)
+{
+    if (upload->pipeFds[0] != -1)
+    {
+        close(upload->pipeFds[0]);
+        close(upload->pipeFds[1]);
+    }
+
+    if (upload->cpBuffer)
+        HyperMemFree(upload->cpBuffer);
+    if (upload->lpContext)
+        HyperMemFree(upload->lpContext);
+
+    HyperMemFree(upload);
+}
+
+static void
+upload_write(
+    PUPLOAD             upload,
+    const char          *cpData,
+    size_t              stLength,
+    off_t               offPosition)
+{
+    ssize_t sWritten = 0;
+
+    if (upload->cpBuffer)
+    {
+        memcpy(upload->cpBuffer + offPosition, cpData, stLength);
+        return;
+    }
+
+    while (stLength && upload->fd != -1)
+    {
+        sWritten = pwrite(upload->fd, cpData, stLength, offPosition);
+        if (sWritten == -1 && errno == EINTR)
+            continue;
+
+        if (sWritten <= 0)
+        {
+            upload_fail(upload, upload_error_status(errno));
+            return;
+        }
+
+        cpData += sWritten;
+        stLength -= sWritten;
+        offPosition += sWritten;
+    }
+}
+
+// Whole body is in, put the file in place and answer the PUT
+static HYPERSTATUS
+upload_complete(
+    PCONNECTION         conn)
+{
+    PUPLOAD upload = conn->upload;
+    struct timespec tsEnd = {0};
+    double dSeconds = 0;
+
+    // In-memory bodies are answered by whoever asked for them
+    if (upload->complete)
+    {
+        conn->upload = NULL;
+        if (upload->usStatus == 200)
+            upload->complete(conn, upload);
+        else
+            conn_send_status(conn, upload->usStatus);
+        upload_free(upload);
+
+        return HYPER_SUCCESS;
+    }
+
+    if (upload->fd != -1)
+    {
+        close(upload->fd);
+        upload->fd = -1;
+
+        if (rename(upload->cpTempPath, upload->cpFinalPath) == -1)
+        {
+            unlink(upload->cpTempPath);
+            upload->usStatus = 500;
+        }
+        else
+        {
+            clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+            dSeconds = (tsEnd.tv_sec - upload->tsStart.tv_sec) +
+                       (tsEnd.tv_nsec - upload->tsStart.tv_nsec) / 1e9;
+            if (dSeconds <= 0)
+                dSeconds = 1e-9;
+
+            printf("[+] Received %llu bytes in %.3fs (%.2f MB/s)\n",
+                    upload->ullSize, dSeconds, upload->ullSize / dSeconds / 1e6);
+        }
+    }
+
+    conn->upload = NULL;
+    conn_send_status(conn, upload->usStatus);
+    upload_free(upload);
+
+    return HYPER_SUCCESS;
+}
+
+// Take over the input stream for ullSize bytes; fd is -1 to just discard them
+HYPERSTATUS
+upload_start(
+    PCONNECTION         conn,
+    int                 fd,
+    const char          *cpTempPath,
+    const char          *cpFinalPath,
+    unsigned long long  ullSize,
+    unsigned short      usStatus)
+{
+    PUPLOAD upload = NULL;
+
+    if (HyperMemAlloc((void**)&upload, sizeof(UPLOAD)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    memset(upload, 0, sizeof(UPLOAD));
+
+    upload->fd = fd;
+    upload->pipeFds[0] = -1;
+    upload->pipeFds[1] = -1;
+    upload->ullSize = ullSize;
+    upload->usStatus = usStatus;
+    strncpy(upload->cpTempPath, cpTempPath, SERVER_MAX_PATH - 1);
+    strncpy(upload->cpFinalPath, cpFinalPath, SERVER_MAX_PATH - 1);
+    clock_gettime(CLOCK_MONOTONIC, &upload->tsStart);
+
+    conn->upload = upload;
+
+    // Reserve the space now so a full disk fails before we read the body
+    if (fd != -1 && ullSize && fallocate(fd, 0, 0, (off_t)ullSize) == -1 &&
+        errno != EOPNOTSUPP && errno != ENOSYS)
+        upload_fail(upload, upload_error_status(errno));
+
+    if (ullSize == 0)
+        return upload_complete(conn);
+
+    return HYPER_SUCCESS;
+}
+
+// Collect ullSize bytes in memory and hand them to complete, usStatus other
+// than 200 discards them and answers with it instead
+HYPERSTATUS
+upload_start_buffer(
+    PCONNECTION         conn,
+    unsigned long long  ullSize,
+    unsigned short      usStatus,
+    UPLOAD_COMPLETE     complete,
+    void                *lpContext)
+{
+    PUPLOAD upload = NULL;
+
+    if (HyperMemAlloc((void**)&upload, sizeof(UPLOAD)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    memset(upload, 0, sizeof(UPLOAD));
+
+    if (usStatus == 200 && ullSize &&
+        HyperMemAlloc((void**)&upload->cpBuffer, (size_t)ullSize) != HYPER_SUCCESS)
+    {
+        HyperMemFree(upload);
+        return HYPER_FAILED;
+    }
+
+    upload->fd = -1;
+    upload->pipeFds[0] = -1;
+    upload->pipeFds[1] = -1;
+    upload->ullSize = ullSize;
+    upload->usStatus = usStatus;
+    upload->complete = complete;
+    upload->lpContext = lpContext;
+    clock_gettime(CLOCK_MONOTONIC, &upload->tsStart);
+
+    conn->upload = upload;
+
+    if (ullSize == 0)
+        return upload_complete(conn);
+
+    return HYPER_SUCCESS;
+}
+
+// Body bytes that arrived along with the command are already in the ring
+HYPERSTATUS
+upload_drain_ring(
+    PCONNECTION         conn)
+{
+    PUPLOAD upload = conn->upload;
+    struct iovec iov[2];
+    size_t stLength = ring_used(&conn->input);
+    off_t offPosition = (off_t)upload->ullReceived;
+    int iVectors = 0;
+
+    if (stLength > upload->ullSize - upload->ullReceived)
+        stLength = upload->ullSize - upload->ullReceived;
+
+    if (stLength == 0)
+        return HYPER_SUCCESS;
+
+    iVectors = ring_read_vectors(&conn->input, iov, stLength);
+    for (int i = 0; i < iVectors; i++)
+    {
+        upload_write(upload, iov[i].iov_base, iov[i].iov_len, offPosition);
+        offPosition += iov[i].iov_len;
+    }
+
+    ring_consume(&conn->input, stLength);
+    upload->ullReceived += stLength;
+
+    if (upload->ullReceived == upload->ullSize)
+        return upload_complete(conn);
+
+    return HYPER_SUCCESS;
+}
+
+// Bytes left in the pipe after the file stopped taking them
+static void
+upload_discard_pipe(
+    PUPLOAD             upload,
+    size_t              stLength)
+{
+    char bounce[UPLOAD_BOUNCE_SIZE];
+    ssize_t sBytesRead = 0;
+
+    while (stLength)
+    {
+        sBytesRead = read(upload->pipeFds[0], bounce,
+                stLength < sizeof(bounce) ? stLength : sizeof(bounce));
+        if (sBytesRead == -1 && errno == EINTR)
+            continue;
+        if (sBytesRead <= 0)
+            return;
+
+        stLength -= sBytesRead;
+    }
+}
+
+// socket -> pipe -> file, the body never enters user space
+static ssize_t
+upload_splice(
+    PUPLOAD             upload,
+    SOCKET              sock,
+    size_t              stWant)
+{
+    ssize_t sIn = 0;
+    ssize_t sOut = 0;
+    size_t stMoved = 0;
+    loff_t offPosition = 0;
+
+    if (upload->pipeFds[0] == -1)
+    {
+        if (pipe2(upload->pipeFds, O_CLOEXEC) == -1)
+        {
+            upload->pipeFds[0] = -1;
+            upload->pipeFds[1] = -1;
+            errno = EINVAL;
+            return -1;
+        }
+
+        fcntl(upload->pipeFds[1], F_SETPIPE_SZ, UPLOAD_PIPE_SIZE);
+    }
+
+    sIn = splice(sock, NULL, upload->pipeFds[1], NULL, stWant, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (sIn <= 0)
+        return sIn;
+
+    while (stMoved < (size_t)sIn)
+    {
+        offPosition = (loff_t)(upload->ullReceived + stMoved);
+        sOut = splice(upload->pipeFds[0], NULL, upload->fd, &offPosition, sIn - stMoved, SPLICE_F_MOVE);
+        if (sOut == -1 && errno == EINTR)
+            continue;
+
+        if (sOut <= 0)
+        {
+            upload_fail(upload, sOut == 0 ? 500 : upload_error_status(errno));
+            upload_discard_pipe(upload, sIn - stMoved);
+            break;
+        }
+
+        stMoved += sOut;
+    }
+
+    return sIn;
+}
+
+// Read the rest of the body straight off the socket, same contract as recv()
+ssize_t
+upload_receive(
+    PCONNECTION         conn)
+{
+    PUPLOAD upload = conn->upload;
+    char bounce[UPLOAD_BOUNCE_SIZE];
+    unsigned long long ullWant = upload->ullSize - upload->ullReceived;
+    ssize_t sBytesRead = -1;
+    int bSpliced = 0;
+
+    if (ullWant > UPLOAD_PIPE_SIZE)
+        ullWant = UPLOAD_PIPE_SIZE;
+
+    // In-memory bodies are received in place
+    if (upload->cpBuffer)
+        sBytesRead = recv(conn->sock, upload->cpBuffer + upload->ullReceived, (size_t)ullWant, 0);
+    else if (upload->fd != -1 && !upload->bNoSplice)
+    {
+        sBytesRead = upload_splice(upload, conn->sock, (size_t)ullWant);
+        if (sBytesRead == -1 && errno == EINVAL)
+            upload->bNoSplice = 1;
+        else
+            bSpliced = 1;
+    }
+
+    // Bounded copy through the stack when splicing isn't an option
+    if (!bSpliced && !upload->cpBuffer)
+    {
+        sBytesRead = recv(conn->sock, bounce, ullWant < sizeof(bounce) ? ullWant : sizeof(bounce), 0);
+        if (sBytesRead > 0)
+            upload_write(upload, bounce, sBytesRead, (off_t)upload->ullReceived);
+    }
+
+    if (sBytesRead <= 0)
+        return sBytesRead;
+
+    upload->ullReceived += sBytesRead;
+    if (upload->ullReceived == upload->ullSize)
+        upload_complete(conn);
+
+    return sBytesRead;
+}
+
+// The connection went away mid-upload
+void
+upload_abort(
+    PUPLOAD             upload)
+{
+    if (upload->fd != -1)
+    {
+        close(upload->fd);
+        unlink(upload->cpTempPath);
+    }
+
+    upload_free(upload);
+}
@@ -0,0 +1,287 @@
+#include "uring.h"
+
+static int
+uring_setup(
+    unsigned int        uiEntries,
+    struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, uiEntries, params);
+}
+
+static int
+uring_enter(
+    int                 fd,
+    unsigned int        uiSubmit,
+    unsigned int        uiWait,
+    unsigned int        uiFlags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, uiSubmit, uiWait, uiFlags, NULL, 0);
+}
+
+static int
+uring_register(
+    int                 fd,
+    unsigned int        uiOpcode,
+    void                *lpArg,
+    unsigned int        uiArgs)
+{
+    return (int)syscall(__NR_io_uring_register, fd, uiOpcode, lpArg, uiArgs);
+}
+
+HYPERSTATUS
+uring_init(
+    PURING              ring,
+    unsigned int        uiEntries)
+{
+    struct io_uring_params params;
+    size_t stSqSize = 0;
+    size_t stCqSize = 0;
+    char *cpRing = NULL;
+
+    memset(ring, 0, sizeof(URING));
+    ring->fd = -1;
+
+    // Each ring is only ever touched by the worker that owns it
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    ring->fd = uring_setup(uiEntries, &params);
+    if (ring->fd == -1 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        ring->fd = uring_setup(uiEntries, &params);
+    }
+    if (ring->fd == -1)
+        return HYPER_FAILED;
+
+    // Every kernel new enough for the ops we use maps both rings at once
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        uring_destroy(ring);
+        return HYPER_FAILED;
+    }
+
+    stSqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    stCqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->stRingSize = stSqSize > stCqSize ? stSqSize : stCqSize;
+    ring->stSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->lpRing = mmap(NULL, ring->stRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->lpRing == MAP_FAILED)
+    {
+        ring->lpRing = NULL;
+        uring_destroy(ring);
+        return HYPER_FAILED;
+    }
+
+    ring->sqes = mmap(NULL, ring->stSqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        uring_destroy(ring);
+        return HYPER_FAILED;
+    }
+
+    cpRing = (char*)ring->lpRing;
+    ring->sqHead = (unsigned int*)(cpRing + params.sq_off.head);
+    ring->sqTail = (unsigned int*)(cpRing + params.sq_off.tail);
+    ring->sqMask = (unsigned int*)(cpRing + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned int*)(cpRing + params.sq_off.array);
+    ring->uiSqEntries = params.sq_entries;
+    ring->uiSqTail = *ring->sqTail;
+
+    ring->cqHead = (unsigned int*)(cpRing + params.cq_off.head);
+    ring->cqTail = (unsigned int*)(cpRing + params.cq_off.tail);
+    ring->cqMask = (unsigned int*)(cpRing + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cpRing + params.cq_off.cqes);
+
+    // SQE slots map to themselves, so the index array is written once
+    for (unsigned int i = 0; i < params.sq_entries; i++)
+        ring->sqArray[i] = i;
+
+    ring->uiFeatures = params.features;
+
+    return HYPER_SUCCESS;
+}
+
+void
+uring_destroy(
+    PURING              ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->stSqesSize);
+    if (ring->lpRing)
+        munmap(ring->lpRing, ring->stRingSize);
+    if (ring->fd != -1)
+        close(ring->fd);
+
+    HyperMemFree(ring->fixedFiles);
+    memset(ring, 0, sizeof(URING));
+    ring->fd = -1;
+}
+
+// Non-zero if the kernel implements every opcode in ops
+int
+uring_supports(
+    PURING              ring,
+    const int           *ops,
+    size_t              stOps)
+{
+    struct io_uring_probe *probe = NULL;
+    size_t stProbeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    int bSupported = 1;
+
+    if (HyperMemAlloc((void**)&probe, stProbeSize) != HYPER_SUCCESS)
+        return 0;
+    memset(probe, 0, stProbeSize);
+
+    if (uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) == -1)
+    {
+        HyperMemFree(probe);
+        return 0;
+    }
+
+    for (size_t i = 0; i < stOps; i++)
+    {
+        if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+            bSupported = 0;
+    }
+
+    HyperMemFree(probe);
+    return bSupported;
+}
+
+// Next free SQE, zeroed; a full queue is flushed to the kernel first
+struct io_uring_sqe*
+uring_get_sqe(
+    PURING              ring)
+{
+    struct io_uring_sqe *sqe = NULL;
+
+    if (ring->uiSqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->uiSqEntries)
+    {
+        uring_submit(ring, 0);
+        if (ring->uiSqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->uiSqEntries)
+            return NULL;
+    }
+
+    sqe = &ring->sqes[ring->uiSqTail & *ring->sqMask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->uiSqTail++;
+
+    return sqe;
+}
+
+// Hand every queued SQE to the kernel and optionally wait for completions
+int
+uring_submit(
+    PURING              ring,
+    unsigned int        uiWait)
+{
+    unsigned int uiSubmit = 0;
+    int iResult = 0;
+
+    __atomic_store_n(ring->sqTail, ring->uiSqTail, __ATOMIC_RELEASE);
+    uiSubmit = ring->uiSqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+    if (uiSubmit == 0 && uiWait == 0)
+        return 0;
+
+    iResult = uring_enter(ring->fd, uiSubmit, uiWait, uiWait ? IORING_ENTER_GETEVENTS : 0);
+    if (iResult == -1 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        return 0;
+
+    return iResult;
+}
+
+struct io_uring_cqe*
+uring_peek_cqe(
+    PURING              ring)
+{
+    unsigned int uiHead = *ring->cqHead;
+
+    if (uiHead == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[uiHead & *ring->cqMask];
+}
+
+void
+uring_cqe_seen(
+    PURING              ring)
+{
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+HYPERSTATUS
+uring_register_files(
+    PURING              ring,
+    unsigned int        uiFiles)
+{
+    if (HyperMemAlloc((void**)&ring->fixedFiles, uiFiles * sizeof(int)) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+
+    // A table of -1 registers empty slots to be filled in per connection
+    memset(ring->fixedFiles, 0xff, uiFiles * sizeof(int));
+
+    if (uring_register(ring->fd, IORING_REGISTER_FILES, ring->fixedFiles, uiFiles) == -1)
+    {
+        HyperMemFree(ring->fixedFiles);
+        ring->fixedFiles = NULL;
+        return HYPER_FAILED;
+    }
+
+    ring->uiFixedFiles = uiFiles;
+    ring->uiFixedNext = 0;
+
+    return HYPER_SUCCESS;
+}
+
+// Register fd in a free slot, -1 if the table is full or missing
+int
+uring_fixed_add(
+    PURING              ring,
+    int                 fd)
+{
+    struct io_uring_files_update update;
+    unsigned int uiSlot = 0;
+
+    for (unsigned int i = 0; i < ring->uiFixedFiles; i++)
+    {
+        uiSlot = (ring->uiFixedNext + i) % ring->uiFixedFiles;
+        if (ring->fixedFiles[uiSlot] != -1)
+            continue;
+
+        memset(&update, 0, sizeof(update));
+        update.offset = uiSlot;
+        update.fds = (uint64_t)(uintptr_t)&fd;
+        if (uring_register(ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1)
+            return -1;
+
+        ring->fixedFiles[uiSlot] = fd;
+        ring->uiFixedNext = uiSlot + 1;
+        return (int)uiSlot;
+    }
+
+    return -1;
+}
+
+void
+uring_fixed_remove(
+    PURING              ring,
+    int                 iSlot)
+{
+    struct io_uring_files_update update;
+    int fd = -1;
+
+    if (iSlot < 0 || (unsigned int)iSlot >= ring->uiFixedFiles)
+        return;
+
+    memset(&update, 0, sizeof(update));
+    update.offset = iSlot;
+    update.fds = (uint64_t)(uintptr_t)&fd;
+    uring_register(ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+
+    ring->fixedFiles[iSlot] = -1;
+}
@@ -0,0 +1,172 @@
+#include "worker.h"
+#include "event_loop.h"
+#include "event_loop_uring.h"
+
+/* Running pool, for readers of every worker's counters */
+static PWORKER workerPool = NULL;
+static unsigned int uiPoolSize = 0;
+
+static void*
+worker_main(
+    void                *lpParam)
+{
+    PWORKER worker = (PWORKER)lpParam;
+    unsigned long long ullRate = 0;
+    cpu_set_t cpuSet;
+
+    if (worker->iCpu >= 0)
+    {
+        CPU_ZERO(&cpuSet);
+        CPU_SET(worker->iCpu, &cpuSet);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0)
+            printf("[-] Worker %u couldn't be pinned to CPU %d\n", worker->uiId, worker->iCpu);
+    }
+
+    // Each worker caches on its own, so the budget is split between them
+    if (file_cache_init(&worker->fileCache, serverConfig.stCacheSize / serverConfig.uiWorkers) != HYPER_SUCCESS)
+    {
+        worker->hsResult = HYPER_FAILED;
+        return NULL;
+    }
+
+    // Listings still work uncached if we're out of inotify instances
+    if (list_cache_init(&worker->listCache, serverConfig.stListCacheSize / serverConfig.uiWorkers) != HYPER_SUCCESS)
+        printf("[-] Worker %u couldn't watch directories, listing cache disabled\n", worker->uiId);
+
+    digest_cache_init(&worker->digestCache);
+    timer_wheel_init(&worker->timers);
+
+    // Like the caches, --rate is split evenly, so workers never share a bucket
+    ullRate = serverConfig.ullRate / serverConfig.uiWorkers;
+    if (ullRate == 0 && serverConfig.ullRate)
+        ullRate = 1;
+    scheduler_init(&worker->sched, &worker->timers, serverConfig.stQuantum, ullRate);
+
+    worker->eBackend = BACKEND_EPOLL;
+    if (serverConfig.eBackend == BACKEND_URING)
+    {
+        if (event_loop_uring_init(worker) == HYPER_SUCCESS)
+            worker->eBackend = BACKEND_URING;
+        else
+            printf("[-] Worker %u can't use io_uring, falling back to epoll\n", worker->uiId);
+    }
+
+    if (worker->eBackend == BACKEND_URING)
+        worker->hsResult = event_loop_uring_run(worker);
+    else
+        worker->hsResult = event_loop_run(worker);
+    if (worker->hsResult != HYPER_SUCCESS)
+        printf("[-] Worker %u event loop failed: %s\n", worker->uiId, strerror(errno));
+
+    if (worker->eBackend == BACKEND_URING)
+        event_loop_uring_destroy(worker);
+
+    list_cache_destroy(&worker->listCache);
+    file_cache_destroy(&worker->fileCache);
+
+    return NULL;
+}
+
+HYPERSTATUS
+worker_pool_run(
+    const unsigned short usPort,
+    const unsigned int  uiWorkers)
+{
+    HYPERSTATUS hsResult = HYPER_SUCCESS;
+    PWORKER workers = NULL;
+    unsigned int uiStarted = 0;
+    long lCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (uiWorkers == 0 || uiWorkers > MAX_WORKERS)
+        return HYPER_BAD_PARAMETER;
+
+    if (HyperMemAlloc((void**)&workers, sizeof(WORKER) * uiWorkers) != HYPER_SUCCESS)
+        return HYPER_FAILED;
+    memset(workers, 0, sizeof(WORKER) * uiWorkers);
+
+    // Every worker owns a listener, the kernel spreads connections between them
+    for (unsigned int i = 0; i < uiWorkers; i++)
+    {
+        workers[i].uiId = i;
+        workers[i].iCpu = (uiWorkers > 1 && lCpus > 0) ? (int)(i % lCpus) : -1;
+
+        hsResult = background_inbox_init(&workers[i].jobs);
+        if (hsResult != HYPER_SUCCESS)
+        {
+            printf("[-] Couldn't create the job inbox for worker %u\n", i);
+            break;
+        }
+
+        hsResult = HyperStartServerEx(&workers[i].sockServer, usPort, HYPER_SERVER_REUSEPORT);
+        if (hsResult != HYPER_SUCCESS)
+        {
+            printf("[-] HyperStartServerEx failed for worker %u\n", i);
+            break;
+        }
+
+        // Before listen(), so accepted sockets inherit it and the window
+        // scale offered in the handshake can cover the whole buffer
+        if (HyperSetSocketBuffers(workers[i].sockServer, serverConfig.stSendBuffer,
+                    serverConfig.stReceiveBuffer) != HYPER_SUCCESS)
+            printf("[-] Couldn't set socket buffers for worker %u\n", i);
+    }
+
+    // Before any worker can hand it a file to hash or chunk
+    if (hsResult == HYPER_SUCCESS && background_start() != HYPER_SUCCESS)
+    {
+        printf("[-] Couldn't start the background threads\n");
+        hsResult = HYPER_FAILED;
+    }
+
+    if (hsResult == HYPER_SUCCESS)
+    {
+        // Published before any worker can answer STATS
+        workerPool = workers;
+        uiPoolSize = uiWorkers;
+
+        for (uiStarted = 0; uiStarted < uiWorkers; uiStarted++)
+        {
+            if (pthread_create(&workers[uiStarted].thread, NULL, worker_main, &workers[uiStarted]) != 0)
+            {
+                hsResult = HYPER_FAILED;
+                break;
+            }
+        }
+
+        printf("[+] Started %u worker(s)\n", uiStarted);
+
+        if (serverConfig.cpStatsFile[0] && stats_dump_start(serverConfig.cpStatsFile) != HYPER_SUCCESS)
+            printf("[-] Couldn't start writing stats to %s\n", serverConfig.cpStatsFile);
+    }
+
+    for (unsigned int i = 0; i < uiStarted; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].hsResult != HYPER_SUCCESS)
+            hsResult = HYPER_FAILED;
+    }
+
+    stats_dump_stop();
+    background_stop();
+    workerPool = NULL;
+    uiPoolSize = 0;
+
+    for (unsigned int i = 0; i < uiWorkers; i++)
+    {
+        if (workers[i].sockServer > 0)
+            HyperCloseSocket(workers[i].sockServer);
+        if (workers[i].jobs.fd > 0)
+            background_inbox_destroy(&workers[i].jobs);
+    }
+
+    HyperMemFree(workers);
+    return hsResult;
+}
+
+PWORKER
+worker_pool_get(
+    unsigned int        *uiCount)
+{
+    *uiCount = uiPoolSize;
+    return workerPool;
+}